@@ -55,9 +55,16 @@ class BlockchainTest(BitcoinTestFramework):
         assert_equal(res['transactions'], 200)
         assert_equal(res['height'], 200)
         assert_equal(res['txouts'], 200)
-        assert_equal(res['bytes_serialized'], 13924),
+        assert_equal(res['bytes_serialized'], 13788),
         assert_equal(len(res['bestblock']), 64)
-        assert_equal(len(res['hash_serialized']), 64)
+        assert_equal(len(res['muhash']), 64)
+        assert('hash_serialized' not in res)
+
+        # The full pass agrees with the statistics kept block by block
+        res_full = node.gettxoutsetinfo(True)
+        assert_equal(len(res_full['hash_serialized']), 64)
+        del res_full['hash_serialized']
+        assert_equal(res_full, res)
 
     def _test_getblockheader(self):
         node = self.nodes[0]
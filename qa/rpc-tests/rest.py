@@ -324,6 +324,41 @@ class RESTTest (BitcoinTestFramework):
         for tx in txs:
             assert_equal(tx in json_obj['tx'], True)
 
+        ##########################
+        # TXCOMMENTS: the stream #
+        ##########################
+        # with nothing to report, the stream ends empty after its duration
+        response = http_get_call(url.hostname, url.port, '/rest/txcomments/stream/1'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 200)
+        assert_equal(response.read().decode('utf-8'), '')
+
+        # the comment of a transaction accepted while the stream is open is sent as a JSON line
+        conn = http.client.HTTPConnection(url.hostname, url.port)
+        conn.request('GET', '/rest/txcomments/stream/3'+self.FORMAT_SEPARATOR+'json')
+        response = conn.getresponse()
+        assert_equal(response.status, 200)
+        txid = self.nodes[0].sendtoaddress(self.nodes[1].getnewaddress(), 0.1, "", "", False, "rest stream")
+        lines = response.read().decode('utf-8').splitlines()
+        assert_equal(len(lines), 1)
+        json_obj = json.loads(lines[0])
+        assert_equal(json_obj['txid'], txid)
+        assert_equal(json_obj['height'], -1)
+        assert_equal(json_obj['comment'], "rest stream")
+
+        # streams may take all but one of the -rpcthreads (default 4) HTTP workers
+        responses = []
+        for i in range(3):
+            conn = http.client.HTTPConnection(url.hostname, url.port)
+            conn.request('GET', '/rest/txcomments/stream/3'+self.FORMAT_SEPARATOR+'json')
+            responses.append(conn.getresponse())
+            assert_equal(responses[-1].status, 200)
+        response = http_get_call(url.hostname, url.port, '/rest/txcomments/stream/3'+self.FORMAT_SEPARATOR+'json', True)
+        assert_equal(response.status, 503)
+        # while the last worker still serves RPC
+        assert_equal(self.nodes[0].getbestblockhash(), newblockhash[0])
+        for response in responses:
+            response.read()
+
         #test rest bestblock
         bb_hash = self.nodes[0].getbestblockhash()
 
@@ -348,6 +348,10 @@ class WalletTest (BitcoinTestFramework):
         assert_equal(coinbase_tx_1["transactions"][0]["blockhash"], blocks[1])
         assert_equal(len(self.nodes[0].listsinceblock(blocks[1])["transactions"]), 0)
 
+        # A page of nothing would hand back the cursor it started from
+        assert_raises_message(JSONRPCException, "Count must be positive", self.nodes[0].listsinceblock, blocks[0], 1, False, 0)
+        assert_raises_message(JSONRPCException, "Count must be positive with a cursor", self.nodes[0].listtransactions, "*", 0, 0, False, "")
+
         # ==Check that wallet prefers to use coins that don't exceed mempool limits =====
 
         # Get all non-zero utxos together
@@ -0,0 +1,155 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "checkqueue.h"
+#include "coins.h"
+#include "key.h"
+#include "main.h"
+#include "policy/policy.h"
+#include "pubkey.h"
+#include "script/interpreter.h"
+#include "script/sigcache.h"
+#include "script/standard.h"
+
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/thread.hpp>
+
+/* Shape of the simulated block: transactions of P2PKH inputs, queued per transaction like ConnectBlock does */
+static const int BLOCK_TXS = 100;
+static const int INPUTS_PER_TX = 10;
+
+/** Signed transactions and the coins they spend */
+struct ScriptCheckBlock
+{
+    CCoins coins;
+    std::vector<CTransaction> vtx;
+    std::vector<PrecomputedTransactionData> vtxdata;
+
+    ScriptCheckBlock()
+    {
+        CKey key;
+        key.MakeNewKey(true);
+        CScript scriptPubKey = GetScriptForDestination(key.GetPubKey().GetID());
+
+        CMutableTransaction txFund;
+        txFund.vin.resize(1);
+        txFund.vout.resize(BLOCK_TXS * INPUTS_PER_TX, CTxOut(1 * COIN, scriptPubKey));
+        CTransaction txFundFinal(txFund);
+        coins = CCoins(txFundFinal, 1);
+
+        for (int i = 0; i < BLOCK_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vout.resize(1, CTxOut(INPUTS_PER_TX * COIN, scriptPubKey));
+            for (int j = 0; j < INPUTS_PER_TX; j++)
+                tx.vin.push_back(CTxIn(COutPoint(txFundFinal.GetHash(), i * INPUTS_PER_TX + j)));
+            for (int j = 0; j < INPUTS_PER_TX; j++) {
+                uint256 hash = SignatureHash(scriptPubKey, tx, j, SIGHASH_ALL, 1 * COIN, SIGVERSION_BASE);
+                std::vector<unsigned char> vchSig;
+                key.Sign(hash, vchSig);
+                vchSig.push_back((unsigned char)SIGHASH_ALL);
+                tx.vin[j].scriptSig << vchSig << ToByteVector(key.GetPubKey());
+            }
+            vtx.push_back(CTransaction(tx));
+        }
+        for (int i = 0; i < BLOCK_TXS; i++)
+            vtxdata.push_back(PrecomputedTransactionData(vtx[i]));
+    }
+};
+
+static void ScriptChecks(benchmark::State& state, int nThreads)
+{
+    ECCVerifyHandle verifyHandle;
+    static ScriptCheckBlock block;
+    CCheckQueue<CScriptCheck> queue(128);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CScriptCheck>::Thread, boost::ref(queue)));
+
+    while (state.KeepRunning()) {
+        CCheckQueueControl<CScriptCheck> control(nThreads > 1 ? &queue : NULL);
+        for (int i = 0; i < BLOCK_TXS; i++) {
+            std::vector<CScriptCheck> vChecks;
+            for (int j = 0; j < INPUTS_PER_TX; j++) {
+                CScriptCheck check(block.coins, block.vtx[i], j, STANDARD_SCRIPT_VERIFY_FLAGS, false, &block.vtxdata[i]);
+                if (nThreads > 1) {
+                    vChecks.push_back(CScriptCheck());
+                    check.swap(vChecks.back());
+                } else {
+                    bool fOk = check();
+                    assert(fOk);
+                }
+            }
+            control.Add(vChecks);
+        }
+        bool fOk = control.Wait();
+        assert(fOk);
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+static void ScriptChecks_1thread(benchmark::State& state) { ScriptChecks(state, 1); }
+static void ScriptChecks_2threads(benchmark::State& state) { ScriptChecks(state, 2); }
+static void ScriptChecks_4threads(benchmark::State& state) { ScriptChecks(state, 4); }
+static void ScriptChecks_8threads(benchmark::State& state) { ScriptChecks(state, 8); }
+static void ScriptChecks_16threads(benchmark::State& state) { ScriptChecks(state, 16); }
+
+BENCHMARK(ScriptChecks_1thread);
+BENCHMARK(ScriptChecks_2threads);
+BENCHMARK(ScriptChecks_4threads);
+BENCHMARK(ScriptChecks_8threads);
+BENCHMARK(ScriptChecks_16threads);
+
+/**
+ * A block's worth of script checks whose signatures are all in the signature
+ * cache: what each extra CheckInputs pass in AcceptToMemoryPool costs, and
+ * what ConnectBlock paid for a transaction from the mempool before the script
+ * execution cache.
+ */
+static void RunCachingScriptChecks(ScriptCheckBlock& block)
+{
+    for (int i = 0; i < BLOCK_TXS; i++) {
+        for (int j = 0; j < INPUTS_PER_TX; j++) {
+            CScriptCheck check(block.coins, block.vtx[i], j, STANDARD_SCRIPT_VERIFY_FLAGS, true, &block.vtxdata[i]);
+            bool fOk = check();
+            assert(fOk);
+        }
+    }
+}
+
+static void ScriptChecks_SigCacheHit(benchmark::State& state)
+{
+    ECCVerifyHandle verifyHandle;
+    static ScriptCheckBlock block;
+    RunCachingScriptChecks(block);
+    while (state.KeepRunning())
+        RunCachingScriptChecks(block);
+}
+
+/** The same block's transactions looked up in the script execution cache, what ConnectBlock pays now */
+static void ScriptChecks_ExecutionCacheHit(benchmark::State& state)
+{
+    static ScriptCheckBlock block;
+    CScriptExecutionCache cache(1 << 20);
+    for (int i = 0; i < BLOCK_TXS; i++) {
+        uint256 entry;
+        cache.ComputeEntry(entry, block.vtx[i], STANDARD_SCRIPT_VERIFY_FLAGS);
+        cache.Insert(entry);
+    }
+    while (state.KeepRunning()) {
+        for (int i = 0; i < BLOCK_TXS; i++) {
+            uint256 entry;
+            cache.ComputeEntry(entry, block.vtx[i], STANDARD_SCRIPT_VERIFY_FLAGS);
+            bool fFound = cache.Contains(entry, false);
+            assert(fFound);
+        }
+    }
+}
+
+BENCHMARK(ScriptChecks_SigCacheHit);
+BENCHMARK(ScriptChecks_ExecutionCacheHit);
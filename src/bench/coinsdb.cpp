@@ -0,0 +1,98 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chainparamsbase.h"
+#include "coins.h"
+#include "random.h"
+#include "txdb.h"
+
+#include <vector>
+
+/* Transactions in the simulated chainstate, and point lookups per iteration */
+static const int CHAINSTATE_TXS = 50000;
+static const int LOOKUPS = 1000;
+
+/**
+ * In-memory chainstate holding every transaction both as per-output records,
+ * read by GetCoins, and as a legacy per-transaction record read by a plain
+ * db.Read, the way GetCoins did before.
+ */
+class CoinsDBBench : public CCoinsViewDB
+{
+public:
+    std::vector<uint256> vTxids;
+
+    CoinsDBBench() : CCoinsViewDB(8 << 20, true)
+    {
+        CCoinsMap mapCoins;
+        for (int i = 0; i < CHAINSTATE_TXS; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout.hash = GetRandHash();
+            tx.vout.resize(2, CTxOut(1 * COIN, CScript() << OP_DUP << OP_HASH160 << ToByteVector(GetRandHash()) << OP_EQUALVERIFY << OP_CHECKSIG));
+            CCoins coins(tx, 100000 + i);
+            vTxids.push_back(tx.GetHash());
+            db.Write(std::make_pair('c', tx.GetHash()), coins);
+            CCoinsCacheEntry& entry = mapCoins[tx.GetHash()];
+            entry.coins = coins;
+            entry.flags = CCoinsCacheEntry::DIRTY | CCoinsCacheEntry::FRESH;
+        }
+        BatchWrite(mapCoins, uint256());
+    }
+
+    bool GetLegacyCoins(const uint256& txid, CCoins& coins) const
+    {
+        return db.Read(std::make_pair('c', txid), coins);
+    }
+
+    bool HaveLegacyCoins(const uint256& txid) const
+    {
+        return db.Exists(std::make_pair('c', txid));
+    }
+};
+
+static CoinsDBBench& Chainstate()
+{
+    // CCoinsViewDB names its directory after the network, even in memory
+    SelectBaseParams(CBaseChainParams::MAIN);
+    static CoinsDBBench chainstate;
+    return chainstate;
+}
+
+static void CoinsDB_GetCoins(benchmark::State& state, bool fLegacy)
+{
+    const CoinsDBBench& chainstate = Chainstate();
+    while (state.KeepRunning()) {
+        for (int i = 0; i < LOOKUPS; i++) {
+            CCoins coins;
+            const uint256& txid = chainstate.vTxids[insecure_rand() % chainstate.vTxids.size()];
+            bool fOk = fLegacy ? chainstate.GetLegacyCoins(txid, coins) : chainstate.GetCoins(txid, coins);
+            assert(fOk);
+        }
+    }
+}
+
+static void CoinsDB_HaveCoinsMissing(benchmark::State& state, bool fLegacy)
+{
+    const CoinsDBBench& chainstate = Chainstate();
+    while (state.KeepRunning()) {
+        for (int i = 0; i < LOOKUPS; i++) {
+            uint256 txid = chainstate.vTxids[insecure_rand() % chainstate.vTxids.size()];
+            *txid.begin() ^= 1;
+            bool fFound = fLegacy ? chainstate.HaveLegacyCoins(txid) : chainstate.HaveCoins(txid);
+            assert(!fFound);
+        }
+    }
+}
+
+static void CoinsDB_GetCoins_Legacy(benchmark::State& state) { CoinsDB_GetCoins(state, true); }
+static void CoinsDB_GetCoins_PerOutput(benchmark::State& state) { CoinsDB_GetCoins(state, false); }
+static void CoinsDB_HaveCoinsMissing_Legacy(benchmark::State& state) { CoinsDB_HaveCoinsMissing(state, true); }
+static void CoinsDB_HaveCoinsMissing_PerOutput(benchmark::State& state) { CoinsDB_HaveCoinsMissing(state, false); }
+
+BENCHMARK(CoinsDB_GetCoins_Legacy);
+BENCHMARK(CoinsDB_GetCoins_PerOutput);
+BENCHMARK(CoinsDB_HaveCoinsMissing_Legacy);
+BENCHMARK(CoinsDB_HaveCoinsMissing_PerOutput);
@@ -0,0 +1,89 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "key.h"
+#include "main.h"
+#include "pubkey.h"
+#include "random.h"
+#include "util.h"
+#include "wallet/crypter.h"
+#include "wallet/db.h"
+#include "wallet/wallet.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/thread.hpp>
+
+/* Keys each top-up adds to the pool, as for a service handing out deposit addresses */
+static const unsigned int TOPUP_KEYS = 1000;
+
+/**
+ * An HD wallet in a wallet file of the database environment. Encrypt()
+ * encrypts it in place with a random master key and unlocks it, skipping the
+ * passphrase derivation and the file rewrite of EncryptWallet.
+ */
+class CBenchWallet : public CWallet
+{
+public:
+    CBenchWallet() : CWallet("bench_keypool.dat")
+    {
+        bool fFirstRun;
+        LoadWallet(fFirstRun);
+        LOCK(cs_wallet);
+        SetHDMasterKey(GenerateNewHDMasterKey());
+    }
+
+    void Encrypt()
+    {
+        CKeyingMaterial vMasterKey(WALLET_CRYPTO_KEY_SIZE);
+        GetStrongRandBytes(&vMasterKey[0], WALLET_CRYPTO_KEY_SIZE);
+        LOCK(cs_wallet);
+        bool fOk = EncryptKeys(vMasterKey) && CCryptoKeyStore::Unlock(vMasterKey);
+        assert(fOk);
+    }
+};
+
+static void KeypoolTopUp(benchmark::State& state, bool fEncrypted, int nThreads)
+{
+    ECCVerifyHandle verifyHandle;
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = nThreads > 1 ? nThreads : 0;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nThreads - 1; i++)
+        threadGroup.create_thread(&ThreadWalletCheck);
+
+    // A real wallet file, so that the synced commit of each top-up counts
+    boost::filesystem::path pathTemp = GetTempPath() / strprintf("bench_keypool_%lu_%i", (unsigned long)GetTime(), (int)GetRand(100000));
+    boost::filesystem::create_directories(pathTemp);
+    bool fOpened = bitdb.Open(pathTemp);
+    assert(fOpened);
+    {
+        CBenchWallet wallet;
+        if (fEncrypted)
+            wallet.Encrypt();
+        unsigned int nSize = wallet.GetKeyPoolSize();
+        while (state.KeepRunning()) {
+            nSize += TOPUP_KEYS;
+            bool fOk = wallet.TopUpKeyPool(nSize);
+            assert(fOk);
+        }
+    }
+    bitdb.Flush(true);
+    bitdb.Reset();
+    boost::filesystem::remove_all(pathTemp);
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+}
+
+static void KeypoolTopUp_1thread(benchmark::State& state) { KeypoolTopUp(state, false, 1); }
+static void KeypoolTopUp_4threads(benchmark::State& state) { KeypoolTopUp(state, false, 4); }
+static void KeypoolTopUpEncrypted_1thread(benchmark::State& state) { KeypoolTopUp(state, true, 1); }
+static void KeypoolTopUpEncrypted_4threads(benchmark::State& state) { KeypoolTopUp(state, true, 4); }
+
+BENCHMARK(KeypoolTopUp_1thread);
+BENCHMARK(KeypoolTopUp_4threads);
+BENCHMARK(KeypoolTopUpEncrypted_1thread);
+BENCHMARK(KeypoolTopUpEncrypted_4threads);
@@ -0,0 +1,92 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "chain.h"
+#include "chainparams.h"
+#include "pow.h"
+
+#include <vector>
+
+/* Headers validated per iteration, taken from the middle of each retarget era */
+static const int HEADERS_PER_ERA = 10000;
+
+/** Synthetic main network header chain from genesis up to past the Version3 fork, with valid nBits */
+struct RetargetChain
+{
+    std::vector<CBlockIndex> vIndex;
+
+    RetargetChain(const Consensus::Params& params)
+    {
+        vIndex.resize(params.nHeight_Version3 + HEADERS_PER_ERA);
+        int64_t nTime = 1371488396;
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            CBlockIndex& index = vIndex[i];
+            index.pprev = i ? &vIndex[i - 1] : NULL;
+            index.nHeight = i;
+            // Alternate fast and slow blocks so the difficulty keeps moving
+            nTime += (i % 3 == 0) ? 100 : 10;
+            index.nTime = nTime;
+            CBlockHeader header;
+            header.nTime = nTime;
+            index.nBits = GetNextWorkRequired(index.pprev, &header, params);
+            index.BuildSkip();
+        }
+    }
+};
+
+/**
+ * Main network parameters. Some of the per-era intervals are derived from
+ * CChainParams members that are never set, which makes retargeting divide by
+ * zero; fill them in from the target timespans so the chain can cross all eras.
+ */
+static const Consensus::Params& RetargetParams()
+{
+    static Consensus::Params params;
+    if (params.nInterval_Version1 == 0) {
+        params = Params(CBaseChainParams::MAIN).GetConsensus();
+        if (params.nInterval_Version2 == 0)
+            params.nInterval_Version2 = params.nPowTargetTimespan_Version2 / params.nPowTargetSpacing;
+        if (params.nInterval_Version3 == 0)
+            params.nInterval_Version3 = params.nPowTargetTimespan_Version3 / params.nPowTargetSpacing;
+        if (params.nAveragingInterval_Version1 == 0)
+            params.nAveragingInterval_Version1 = params.nInterval_Version1;
+        params.nAveragingTargetTimespan_Version1 = params.nAveragingInterval_Version1 * params.nPowTargetSpacing;
+    }
+    return params;
+}
+
+static void ValidateHeaders(benchmark::State& state, int nEraStart)
+{
+    const Consensus::Params& params = RetargetParams();
+    static RetargetChain chain(params);
+    while (state.KeepRunning()) {
+        for (int i = nEraStart; i < nEraStart + HEADERS_PER_ERA; i++) {
+            const CBlockIndex& index = chain.vIndex[i];
+            CBlockHeader header;
+            header.nTime = index.nTime;
+            bool fOk = GetNextWorkRequired(index.pprev, &header, params) == index.nBits;
+            assert(fOk);
+        }
+    }
+}
+
+static void Retarget_Version1(benchmark::State& state)
+{
+    ValidateHeaders(state, RetargetParams().nHeight_Version2 - 2 * HEADERS_PER_ERA);
+}
+
+static void Retarget_Version2(benchmark::State& state)
+{
+    ValidateHeaders(state, RetargetParams().nHeight_Version3 - 2 * HEADERS_PER_ERA);
+}
+
+static void Retarget_Version3(benchmark::State& state)
+{
+    ValidateHeaders(state, RetargetParams().nHeight_Version3);
+}
+
+BENCHMARK(Retarget_Version1);
+BENCHMARK(Retarget_Version2);
+BENCHMARK(Retarget_Version3);
@@ -0,0 +1,58 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "crypto/scrypt.h"
+
+#include <vector>
+
+/* Number of 80-byte headers to hash per iteration; a multiple of every lane count */
+static const int HEADER_COUNT = 16;
+
+static void ScryptHeaders(benchmark::State& state, int nLanes)
+{
+    scrypt_detect_multibuffer();
+    std::vector<char> in(80 * HEADER_COUNT);
+    std::vector<char> out(32 * HEADER_COUNT);
+    std::vector<char> scratchpad(scrypt_multi_scratchpad_size(nLanes));
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = (char)i;
+
+    scrypt_multi_func func = NULL;
+    if (nLanes > 1) {
+        func = scrypt_multi_impl(nLanes);
+        if (func == NULL)
+            return; // not built in or not supported by this CPU
+    }
+    while (state.KeepRunning()) {
+        for (int i = 0; i < HEADER_COUNT; i += nLanes) {
+            if (func)
+                func(&in[80 * i], &out[32 * i], &scratchpad[0]);
+            else
+                scrypt_1024_1_1_256_sp_generic(&in[80 * i], &out[32 * i], &scratchpad[0]);
+        }
+    }
+}
+
+static void Scrypt_1way(benchmark::State& state) { ScryptHeaders(state, 1); }
+static void Scrypt_4way(benchmark::State& state) { ScryptHeaders(state, 4); }
+static void Scrypt_8way(benchmark::State& state) { ScryptHeaders(state, 8); }
+static void Scrypt_16way(benchmark::State& state) { ScryptHeaders(state, 16); }
+
+static void Scrypt_Batch(benchmark::State& state)
+{
+    scrypt_detect_multibuffer();
+    std::vector<char> in(80 * HEADER_COUNT);
+    std::vector<char> out(32 * HEADER_COUNT);
+    for (size_t i = 0; i < in.size(); i++)
+        in[i] = (char)i;
+    while (state.KeepRunning())
+        scrypt_1024_1_1_256_multi(&in[0], &out[0], HEADER_COUNT);
+}
+
+BENCHMARK(Scrypt_1way);
+BENCHMARK(Scrypt_4way);
+BENCHMARK(Scrypt_8way);
+BENCHMARK(Scrypt_16way);
+BENCHMARK(Scrypt_Batch);
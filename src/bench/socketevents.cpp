@@ -0,0 +1,135 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "bench.h"
+#include "netbase.h"
+#include "netpoll.h"
+#include "random.h"
+#include "util.h"
+
+#include <cassert>
+#include <memory>
+#include <vector>
+
+#ifndef WIN32
+
+/** TCP connections over loopback; the accepted ends are polled, the connecting ends send */
+struct LoopbackConnections
+{
+    std::vector<SOCKET> vServer;
+    std::vector<SOCKET> vClient;
+
+    LoopbackConnections(int nConnections)
+    {
+        RaiseFileDescriptorLimit(2 * nConnections + 64);
+
+        struct sockaddr_in addr;
+        memset(&addr, 0, sizeof(addr));
+        addr.sin_family = AF_INET;
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        addr.sin_port = 0;
+        socklen_t nAddrLen = sizeof(addr);
+        SOCKET hListen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        bool fOk = hListen != INVALID_SOCKET &&
+                   bind(hListen, (struct sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR &&
+                   listen(hListen, SOMAXCONN) != SOCKET_ERROR &&
+                   getsockname(hListen, (struct sockaddr*)&addr, &nAddrLen) != SOCKET_ERROR;
+        assert(fOk);
+
+        for (int i = 0; i < nConnections; i++) {
+            SOCKET hClient = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+            fOk = hClient != INVALID_SOCKET && connect(hClient, (struct sockaddr*)&addr, sizeof(addr)) != SOCKET_ERROR;
+            assert(fOk);
+            SOCKET hServer = accept(hListen, NULL, NULL);
+            assert(hServer != INVALID_SOCKET);
+            SetSocketNonBlocking(hServer, true);
+            vClient.push_back(hClient);
+            vServer.push_back(hServer);
+        }
+        CloseSocket(hListen);
+    }
+
+    ~LoopbackConnections()
+    {
+        for (size_t i = 0; i < vServer.size(); i++) {
+            CloseSocket(vServer[i]);
+            CloseSocket(vClient[i]);
+        }
+    }
+};
+
+/**
+ * One iteration sends nBytes on nActive random connections, then runs socket
+ * handler style rounds (wait, drain the ready connections) until all of it has been received. The per-iteration min/max/average are
+ * the latency of getting that traffic through with nConnections peers.
+ */
+static void PollLoopback(benchmark::State& state, SocketEventsMode mode, int nConnections, int nActive, size_t nBytes)
+{
+    LoopbackConnections conns(nConnections);
+    std::unique_ptr<CSocketPoller> poller(CSocketPoller::Create(mode));
+    assert(poller);
+    for (int i = 0; i < nConnections; i++) {
+        bool fAdded = poller->Add(conns.vServer[i], CSocketPoller::EVENT_RECV, i);
+        assert(fAdded);
+    }
+
+    std::vector<char> vSend(nBytes, 'x');
+    std::vector<char> vRecv(0x10000);
+    std::map<SOCKET, int> mapReady;
+    while (state.KeepRunning()) {
+        for (int i = 0; i < nActive; i++) {
+            ssize_t nSent = send(conns.vClient[insecure_rand() % nConnections], &vSend[0], nBytes, MSG_NOSIGNAL);
+            assert(nSent == (ssize_t)nBytes);
+        }
+
+        size_t nPending = nActive * nBytes;
+        while (nPending > 0) {
+            poller->Wait(1000, mapReady);
+            for (std::map<SOCKET, int>::const_iterator it = mapReady.begin(); it != mapReady.end(); it++) {
+                ssize_t nRecv;
+                while ((nRecv = recv(it->first, &vRecv[0], vRecv.size(), MSG_DONTWAIT)) > 0)
+                    nPending -= nRecv;
+            }
+        }
+    }
+}
+
+// A few chatty peers among many idle ones
+static void SocketEvents_Select_Sparse(benchmark::State& state)
+{
+    PollLoopback(state, SOCKETEVENTS_SELECT, 400, 4, 1);
+}
+
+// Every peer sending at once
+static void SocketEvents_Select_Busy(benchmark::State& state)
+{
+    PollLoopback(state, SOCKETEVENTS_SELECT, 400, 400, 4096);
+}
+
+BENCHMARK(SocketEvents_Select_Sparse);
+BENCHMARK(SocketEvents_Select_Busy);
+
+#ifdef HAVE_SYS_EPOLL_H
+static void SocketEvents_Epoll_Sparse(benchmark::State& state)
+{
+    PollLoopback(state, SOCKETEVENTS_EPOLL, 400, 4, 1);
+}
+
+static void SocketEvents_Epoll_Busy(benchmark::State& state)
+{
+    PollLoopback(state, SOCKETEVENTS_EPOLL, 400, 400, 4096);
+}
+
+// Beyond what select() can handle at all
+static void SocketEvents_Epoll_Sparse_4000(benchmark::State& state)
+{
+    PollLoopback(state, SOCKETEVENTS_EPOLL, 4000, 4, 1);
+}
+
+BENCHMARK(SocketEvents_Epoll_Sparse);
+BENCHMARK(SocketEvents_Epoll_Busy);
+BENCHMARK(SocketEvents_Epoll_Sparse_4000);
+#endif // HAVE_SYS_EPOLL_H
+
+#endif // WIN32
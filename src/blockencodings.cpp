@@ -178,3 +178,53 @@ ReadStatus PartiallyDownloadedBlock::FillBlock(CBlock& block, const std::vector<
 
     return READ_STATUS_OK;
 }
+
+CRecentBlockCache::Entry* CRecentBlockCache::Find(const uint256& hash) {
+    for (Entry& entry : entries) {
+        if (entry.hash == hash)
+            return &entry;
+    }
+    return nullptr;
+}
+
+void CRecentBlockCache::Add(const std::shared_ptr<const CBlock>& block) {
+    LOCK(cs);
+    uint256 hash = block->GetHash();
+    if (Find(hash))
+        return;
+    Entry entry;
+    entry.hash = hash;
+    entry.block = block;
+    entries.push_back(entry);
+    while (entries.size() > max_blocks)
+        entries.pop_front();
+}
+
+std::shared_ptr<const CBlock> CRecentBlockCache::GetBlock(const uint256& hash) {
+    LOCK(cs);
+    Entry* entry = Find(hash);
+    return entry ? entry->block : nullptr;
+}
+
+CRecentBlockCache::SerializedPtr CRecentBlockCache::GetSerialized(const uint256& hash, bool compact, bool witness) {
+    LOCK(cs);
+    Entry* entry = Find(hash);
+    if (!entry)
+        return nullptr;
+
+    SerializedPtr& serialized = compact ? entry->serialized_compact[witness] : entry->serialized_block[witness];
+    if (!serialized) {
+        CDataStream stream(SER_NETWORK, PROTOCOL_VERSION | (witness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS));
+        if (compact)
+            stream << CBlockHeaderAndShortTxIDs(*entry->block, witness);
+        else
+            stream << *entry->block;
+        serialized = std::make_shared<const std::vector<unsigned char> >(stream.begin(), stream.end());
+    }
+    return serialized;
+}
+
+size_t CRecentBlockCache::size() const {
+    LOCK(cs);
+    return entries.size();
+}
@@ -6,7 +6,9 @@
 #define BITCOIN_BLOCK_ENCODINGS_H
 
 #include "primitives/block.h"
+#include "sync.h"
 
+#include <deque>
 #include <memory>
 
 class CTxMemPool;
@@ -205,4 +207,40 @@ public:
     ReadStatus FillBlock(CBlock& block, const std::vector<CTransaction>& vtx_missing) const;
 };
 
+/**
+ * The last few connected blocks, kept in the forms peers ask for them: the
+ * block message payload and the compact block payload, each with and without
+ * witness data. A form is serialized the first time it is asked for, so
+ * announcing a new tip to many peers and answering their getdata costs one
+ * serialization and then a copy per peer.
+ */
+class CRecentBlockCache {
+public:
+    typedef std::shared_ptr<const std::vector<unsigned char> > SerializedPtr;
+
+private:
+    struct Entry {
+        uint256 hash;
+        std::shared_ptr<const CBlock> block;
+        //! Indexed by whether witness data is included; null until first asked for
+        SerializedPtr serialized_block[2];
+        SerializedPtr serialized_compact[2];
+    };
+
+    mutable CCriticalSection cs;
+    const size_t max_blocks;
+    std::deque<Entry> entries;
+
+    Entry* Find(const uint256& hash);
+
+public:
+    CRecentBlockCache(size_t max_blocks_in) : max_blocks(max_blocks_in) {}
+
+    void Add(const std::shared_ptr<const CBlock>& block);
+    std::shared_ptr<const CBlock> GetBlock(const uint256& hash);
+    //! Payload of a block or cmpctblock message for hash, or null if it is not cached
+    SerializedPtr GetSerialized(const uint256& hash, bool compact, bool witness);
+    size_t size() const;
+};
+
 #endif
@@ -6,10 +6,15 @@
 #define BITCOIN_CHECKQUEUE_H
 
 #include <algorithm>
+#include <atomic>
 #include <vector>
 
+#include <assert.h>
+#include <stdint.h>
+
 #include <boost/foreach.hpp>
 #include <boost/thread/condition_variable.hpp>
+#include <boost/thread/exceptions.hpp>
 #include <boost/thread/locks.hpp>
 #include <boost/thread/mutex.hpp>
 
@@ -25,146 +30,270 @@ class CCheckQueueControl;
   * onto the queue, where they are processed by N-1 worker threads. When
   * the master is done adding work, it temporarily joins the worker pool
   * as an N'th worker, until all jobs are done.
+  *
+  * Verifications are moved into chunked storage that never relocates, so
+  * threads hand them around as plain indices. Published indices form a
+  * shared range, and every thread owns a range of its own. A thread takes
+  * work from the front of its own range and refills it from the shared
+  * range, or else by stealing the back half of another thread's range.
+  * Each range is a single packed word updated by compare-and-swap, so
+  * no lock is taken while there is work. The mutex and condition
+  * variables are only used to put idle threads to sleep.
   */
 template <typename T>
 class CCheckQueue
 {
 private:
-    //! Mutex to protect the inner state
-    boost::mutex mutex;
+    enum {
+        //! log2 of the number of verifications per storage chunk
+        CHUNK_BITS = 10,
+        CHUNK_SIZE = 1 << CHUNK_BITS,
+        //! Upper bound on the number of storage chunks
+        MAX_CHUNKS = 4096,
+        //! Upper bound on the number of workers (including the master)
+        MAX_THREADS = 64
+    };
 
-    //! Worker threads block on this when out of work
-    boost::condition_variable condWorker;
+    /** Half-open range [begin, end) of verification indices, packed into one word */
+    static uint64_t PackRange(uint32_t nBegin, uint32_t nEnd) { return ((uint64_t)nBegin << 32) | nEnd; }
+    static uint32_t RangeBegin(uint64_t range) { return range >> 32; }
+    static uint32_t RangeEnd(uint64_t range) { return (uint32_t)range; }
 
-    //! Master thread blocks on this when out of work
-    boost::condition_variable condMaster;
+    /** The range owned by one worker, padded to a cache line of its own */
+    struct WorkerRange {
+        std::atomic<uint64_t> range;
+        //! Whether a thread owns this entry; threads that exit give theirs back
+        std::atomic<bool> fInUse;
+        char padding[64 - sizeof(std::atomic<uint64_t>) - sizeof(std::atomic<bool>)];
 
-    //! The queue of elements to be processed.
-    //! As the order of booleans doesn't matter, it is used as a LIFO (stack)
-    std::vector<T> queue;
+        WorkerRange() : range(0), fInUse(false) {}
+    };
 
-    //! The number of workers (including the master) that are idle.
-    int nIdle;
+    //! Storage for the verifications, allocated by the master as needed
+    T* chunks[MAX_CHUNKS];
+    unsigned int nChunks;
+
+    //! Number of verifications added in the current round (master only)
+    uint32_t nAdded;
 
-    //! The total number of workers (including the master).
-    int nTotal;
+    //! Added verifications that no worker has taken yet
+    std::atomic<uint64_t> shared;
+
+    //! Per-worker ranges; index 0 belongs to the master
+    WorkerRange workers[MAX_THREADS];
+
+    //! The number of entries in workers that were ever in use
+    std::atomic<int> nWorkers;
 
     //! The temporary evaluation result.
-    bool fAllOk;
+    std::atomic<bool> fAllOk;
 
     /**
      * Number of verifications that haven't completed yet.
      * This includes elements that are no longer queued, but still in the
-     * worker's own batches.
+     * worker's own ranges.
      */
-    unsigned int nTodo;
+    std::atomic<unsigned int> nTodo;
 
-    //! Whether we're shutting down.
-    bool fQuit;
-
-    //! The maximum number of elements to be processed in one batch
+    //! The maximum number of elements taken from the shared range at once
     unsigned int nBatchSize;
 
-    /** Internal function that does bulk of the verification work. */
-    bool Loop(bool fMaster = false)
+    //! Mutex to protect the sleeping state
+    boost::mutex mutex;
+
+    //! Worker threads block on this when out of work
+    boost::condition_variable condWorker;
+
+    //! Master thread blocks on this when out of work
+    boost::condition_variable condMaster;
+
+    //! The number of workers blocked on condWorker.
+    int nIdle;
+
+    T& At(uint32_t nIndex)
     {
-        boost::condition_variable& cond = fMaster ? condMaster : condWorker;
-        std::vector<T> vChecks;
-        vChecks.reserve(nBatchSize);
-        unsigned int nNow = 0;
-        bool fOk = true;
-        do {
-            {
-                boost::unique_lock<boost::mutex> lock(mutex);
-                // first do the clean-up of the previous loop run (allowing us to do it in the same critsect)
-                if (nNow) {
-                    fAllOk &= fOk;
-                    nTodo -= nNow;
-                    if (nTodo == 0 && !fMaster)
-                        // We processed the last element; inform the master it can exit and return the result
-                        condMaster.notify_one();
-                } else {
-                    // first iteration
-                    nTotal++;
-                }
-                // logically, the do loop starts here
-                while (queue.empty()) {
-                    if ((fMaster || fQuit) && nTodo == 0) {
-                        nTotal--;
-                        bool fRet = fAllOk;
-                        // reset the status for new work later
-                        if (fMaster)
-                            fAllOk = true;
-                        // return the current status
-                        return fRet;
-                    }
-                    nIdle++;
-                    cond.wait(lock); // wait
-                    nIdle--;
-                }
-                // Decide how many work units to process now.
-                // * Do not try to do everything at once, but aim for increasingly smaller batches so
-                //   all workers finish approximately simultaneously.
-                // * Try to account for idle jobs which will instantly start helping.
-                // * Don't do batches smaller than 1 (duh), or larger than nBatchSize.
-                nNow = std::max(1U, std::min(nBatchSize, (unsigned int)queue.size() / (nTotal + nIdle + 1)));
-                vChecks.resize(nNow);
-                for (unsigned int i = 0; i < nNow; i++) {
-                    // We want the lock on the mutex to be as short as possible, so swap jobs from the global
-                    // queue to the local batch vector instead of copying.
-                    vChecks[i].swap(queue.back());
-                    queue.pop_back();
+        return chunks[nIndex >> CHUNK_BITS][nIndex & (CHUNK_SIZE - 1)];
+    }
+
+    /** Whether any range still holds verifications that can be taken. */
+    bool HaveWork()
+    {
+        uint64_t range = shared.load();
+        if (RangeBegin(range) < RangeEnd(range))
+            return true;
+        int n = nWorkers.load();
+        for (int i = 0; i < n; i++) {
+            range = workers[i].range.load();
+            if (RangeBegin(range) < RangeEnd(range))
+                return true;
+        }
+        return false;
+    }
+
+    /** Refill the (empty) range of worker nWorker. Returns false if there was nothing left to take. */
+    bool Refill(int nWorker)
+    {
+        // Take a batch from the shared range first.
+        // * Do not try to take everything at once, but aim for increasingly smaller batches so
+        //   all workers finish approximately simultaneously.
+        // * Don't take batches smaller than 1 (duh), or larger than nBatchSize.
+        uint64_t range = shared.load();
+        while (RangeBegin(range) < RangeEnd(range)) {
+            uint32_t nBegin = RangeBegin(range), nEnd = RangeEnd(range);
+            uint32_t nNow = std::max(1U, std::min(nBatchSize, (nEnd - nBegin) / (nWorkers.load() + 1)));
+            if (shared.compare_exchange_weak(range, PackRange(nBegin + nNow, nEnd))) {
+                // Nobody else modifies an empty range, so a plain store suffices
+                workers[nWorker].range.store(PackRange(nBegin, nBegin + nNow));
+                return true;
+            }
+        }
+        // Otherwise steal the back half of another worker's range
+        int n = nWorkers.load();
+        for (int i = 1; i < n; i++) {
+            std::atomic<uint64_t>& victim = workers[(nWorker + i) % n].range;
+            range = victim.load();
+            while (RangeBegin(range) < RangeEnd(range)) {
+                uint32_t nBegin = RangeBegin(range), nEnd = RangeEnd(range);
+                uint32_t nMid = nBegin + (nEnd - nBegin) / 2;
+                if (victim.compare_exchange_weak(range, PackRange(nBegin, nMid))) {
+                    workers[nWorker].range.store(PackRange(nMid, nEnd));
+                    return true;
                 }
-                // Check whether we need to do work at all
-                fOk = fAllOk;
             }
-            // execute work
-            BOOST_FOREACH (T& check, vChecks)
-                if (fOk)
-                    fOk = check();
-            vChecks.clear();
-        } while (true);
+        }
+        return false;
+    }
+
+    /** Claim a free entry in workers for a new thread. */
+    int AcquireWorker()
+    {
+        int nWorker = 1;
+        for (; nWorker < MAX_THREADS; nWorker++) {
+            bool fInUse = false;
+            if (workers[nWorker].fInUse.compare_exchange_strong(fInUse, true))
+                break;
+        }
+        assert(nWorker < MAX_THREADS);
+        // An entry that is not in use has an empty range, so the others may
+        // look at it before this thread does anything with it
+        int n = nWorkers.load();
+        while (n <= nWorker && !nWorkers.compare_exchange_weak(n, nWorker + 1));
+        return nWorker;
+    }
+
+    /** Run verifications until no range has any left. */
+    void Work(int nWorker)
+    {
+        std::atomic<uint64_t>& own = workers[nWorker].range;
+        while (true) {
+            uint64_t range = own.load();
+            uint32_t nBegin = RangeBegin(range), nEnd = RangeEnd(range);
+            if (nBegin == nEnd) {
+                if (!Refill(nWorker))
+                    return;
+                continue;
+            }
+            if (!own.compare_exchange_weak(range, PackRange(nBegin + 1, nEnd)))
+                continue;
+            T& check = At(nBegin);
+            // Once something failed the remaining verifications are skipped, but still accounted for
+            if (fAllOk.load() && !check())
+                fAllOk.store(false);
+            T().swap(check);
+            if (--nTodo == 0) {
+                // We processed the last element; inform the master it can exit and return the result
+                boost::unique_lock<boost::mutex> lock(mutex);
+                condMaster.notify_one();
+            }
+        }
     }
 
 public:
     //! Create a new check queue
-    CCheckQueue(unsigned int nBatchSizeIn) : nIdle(0), nTotal(0), fAllOk(true), nTodo(0), fQuit(false), nBatchSize(nBatchSizeIn) {}
+    CCheckQueue(unsigned int nBatchSizeIn) : nChunks(0), nAdded(0), shared(0), nWorkers(1), fAllOk(true), nTodo(0), nBatchSize(nBatchSizeIn), nIdle(0)
+    {
+        workers[0].fInUse.store(true);
+    }
 
     //! Worker thread
     void Thread()
     {
-        Loop();
+        int nWorker = AcquireWorker();
+        try {
+            while (true) {
+                Work(nWorker);
+                boost::unique_lock<boost::mutex> lock(mutex);
+                while (!HaveWork()) {
+                    nIdle++;
+                    condWorker.wait(lock); // wait
+                    nIdle--;
+                }
+            }
+        } catch (const boost::thread_interrupted&) {
+            // Interrupted while idle, so the range is empty and the entry can
+            // go to a later thread
+            {
+                boost::unique_lock<boost::mutex> lock(mutex);
+                nIdle--;
+            }
+            workers[nWorker].fInUse.store(false);
+            throw;
+        }
     }
 
     //! Wait until execution finishes, and return whether all evaluations were successful.
     bool Wait()
     {
-        return Loop(true);
+        Work(0);
+        {
+            boost::unique_lock<boost::mutex> lock(mutex);
+            while (nTodo.load() != 0)
+                condMaster.wait(lock);
+        }
+        bool fRet = fAllOk.load();
+        // reset the status for new work later; every range is empty at this point
+        nAdded = 0;
+        shared.store(0);
+        fAllOk.store(true);
+        return fRet;
     }
 
     //! Add a batch of checks to the queue
     void Add(std::vector<T>& vChecks)
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
+        if (vChecks.empty())
+            return;
         BOOST_FOREACH (T& check, vChecks) {
-            queue.push_back(T());
-            check.swap(queue.back());
+            if ((nAdded >> CHUNK_BITS) == nChunks) {
+                assert(nChunks < MAX_CHUNKS);
+                chunks[nChunks++] = new T[CHUNK_SIZE];
+            }
+            check.swap(At(nAdded++));
         }
         nTodo += vChecks.size();
+        // Publish the new end; workers only ever move the begin of the shared range
+        uint64_t range = shared.load();
+        while (!shared.compare_exchange_weak(range, PackRange(RangeBegin(range), nAdded)));
+
+        boost::unique_lock<boost::mutex> lock(mutex);
+        if (nIdle == 0)
+            return;
         if (vChecks.size() == 1)
             condWorker.notify_one();
-        else if (vChecks.size() > 1)
+        else
             condWorker.notify_all();
     }
 
     ~CCheckQueue()
     {
+        for (unsigned int i = 0; i < nChunks; i++)
+            delete[] chunks[i];
     }
 
     bool IsIdle()
     {
-        boost::unique_lock<boost::mutex> lock(mutex);
-        return (nTotal == nIdle && nTodo == 0 && fAllOk == true);
+        uint64_t range = shared.load();
+        return (nTodo.load() == 0 && RangeBegin(range) == RangeEnd(range) && fAllOk.load() == true);
     }
 
 };
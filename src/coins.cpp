@@ -41,6 +41,34 @@ bool CCoins::Spend(uint32_t nPos)
     return true;
 }
 
+void CCoinsCacheEntry::MarkChanged(uint32_t n)
+{
+    if (n >= vChanged.size())
+        vChanged.resize(n + 1);
+    vChanged[n] = true;
+}
+
+void CCoinsCacheEntry::MergeChanges(const CCoinsCacheEntry& child)
+{
+    if (!fChangesKnown)
+        return;
+    if (child.flags & FRESH) {
+        // The child started from our pruned version, so all it has is new.
+        for (uint32_t n = 0; n < child.coins.vout.size(); n++) {
+            if (child.coins.IsAvailable(n))
+                MarkChanged(n);
+        }
+    } else if (!child.fChangesKnown) {
+        vChanged.clear();
+        fChangesKnown = false;
+    } else {
+        for (uint32_t n = 0; n < child.vChanged.size(); n++) {
+            if (child.vChanged[n])
+                MarkChanged(n);
+        }
+    }
+}
+
 bool CCoinsView::GetCoins(const uint256 &txid, CCoins &coins) const { return false; }
 bool CCoinsView::HaveCoins(const uint256 &txid) const { return false; }
 uint256 CCoinsView::GetBestBlock() const { return uint256(); }
@@ -58,7 +86,9 @@ CCoinsViewCursor *CCoinsViewBacked::Cursor() const { return base->Cursor(); }
 
 SaltedTxidHasher::SaltedTxidHasher() : k0(GetRand(std::numeric_limits<uint64_t>::max())), k1(GetRand(std::numeric_limits<uint64_t>::max())) {}
 
-CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn) : CCoinsViewBacked(baseIn), hasModifier(false), cachedCoinsUsage(0) { }
+CCoinsViewCache::CCoinsViewCache(CCoinsView *baseIn, size_t nPoolChunkSize) :
+    CCoinsViewBacked(baseIn), hasModifier(false), cacheCoinsResource(nPoolChunkSize),
+    cacheCoins(0, SaltedTxidHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(&cacheCoinsResource)), cachedCoinsUsage(0) { }
 
 CCoinsViewCache::~CCoinsViewCache()
 {
@@ -112,6 +142,11 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
     } else {
         cachedCoinUsage = ret.first->second.coins.DynamicMemoryUsage();
     }
+    if (!(ret.first->second.flags & CCoinsCacheEntry::DIRTY)) {
+        // Still identical to the parent; start tracking what changes.
+        ret.first->second.vChanged.clear();
+        ret.first->second.fChangesKnown = true;
+    }
     // Assume that whenever ModifyCoins is called, the entry will be modified.
     ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, cachedCoinUsage);
@@ -124,11 +159,24 @@ CCoinsModifier CCoinsViewCache::ModifyCoins(const uint256 &txid) {
 CCoinsModifier CCoinsViewCache::ModifyNewCoins(const uint256 &txid, bool coinbase) {
     assert(!hasModifier);
     std::pair<CCoinsMap::iterator, bool> ret = cacheCoins.insert(std::make_pair(txid, CCoinsCacheEntry()));
-    ret.first->second.coins.Clear();
+    CCoinsCacheEntry& entry = ret.first->second;
     if (!coinbase) {
-        ret.first->second.flags = CCoinsCacheEntry::FRESH;
+        entry.flags = CCoinsCacheEntry::FRESH;
+    } else if (!(entry.flags & CCoinsCacheEntry::FRESH)) {
+        if (!(entry.flags & CCoinsCacheEntry::DIRTY)) {
+            entry.vChanged.clear();
+            entry.fChangesKnown = true;
+        }
+        // Outputs of a duplicate coinbase that are overwritten change as well.
+        if (entry.fChangesKnown) {
+            for (uint32_t n = 0; n < entry.coins.vout.size(); n++) {
+                if (entry.coins.IsAvailable(n))
+                    entry.MarkChanged(n);
+            }
+        }
     }
-    ret.first->second.flags |= CCoinsCacheEntry::DIRTY;
+    entry.coins.Clear();
+    entry.flags |= CCoinsCacheEntry::DIRTY;
     return CCoinsModifier(*this, ret.first, 0);
 }
 
@@ -178,6 +226,8 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     // and move the data up and mark it as dirty
                     CCoinsCacheEntry& entry = cacheCoins[it->first];
                     entry.coins.swap(it->second.coins);
+                    entry.vChanged.swap(it->second.vChanged);
+                    entry.fChangesKnown = it->second.fChangesKnown;
                     cachedCoinsUsage += entry.coins.DynamicMemoryUsage();
                     entry.flags = CCoinsCacheEntry::DIRTY;
                     // We can mark it FRESH in the parent if it was FRESH in the child
@@ -196,6 +246,11 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
                     cacheCoins.erase(itUs);
                 } else {
                     // A normal modification.
+                    if (!(itUs->second.flags & CCoinsCacheEntry::DIRTY)) {
+                        itUs->second.vChanged.clear();
+                        itUs->second.fChangesKnown = true;
+                    }
+                    itUs->second.MergeChanges(it->second);
                     cachedCoinsUsage -= itUs->second.coins.DynamicMemoryUsage();
                     itUs->second.coins.swap(it->second.coins);
                     cachedCoinsUsage += itUs->second.coins.DynamicMemoryUsage();
@@ -212,11 +267,22 @@ bool CCoinsViewCache::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlockIn
 
 bool CCoinsViewCache::Flush() {
     bool fOk = base->BatchWrite(cacheCoins, hashBlock);
-    cacheCoins.clear();
-    cachedCoinsUsage = 0;
+    ReallocateCache();
     return fOk;
 }
 
+void CCoinsViewCache::ReallocateCache()
+{
+    // Free lists would keep the pool at its high-water mark, so rebuild both
+    // the map and its pool instead of clearing the map.
+    size_t nPoolChunkSize = cacheCoinsResource.ChunkSizeBytes();
+    cacheCoins.~CCoinsMap();
+    cacheCoinsResource.~CCoinsMapResource();
+    ::new (&cacheCoinsResource) CCoinsMapResource(nPoolChunkSize);
+    ::new (&cacheCoins) CCoinsMap(0, SaltedTxidHasher(), std::equal_to<uint256>(), CCoinsMapAllocator(&cacheCoinsResource));
+    cachedCoinsUsage = 0;
+}
+
 void CCoinsViewCache::Uncache(const uint256& hash)
 {
     CCoinsMap::iterator it = cacheCoins.find(hash);
@@ -285,6 +351,16 @@ double CCoinsViewCache::GetPriority(const CTransaction &tx, int nHeight, CAmount
 CCoinsModifier::CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage) : cache(cache_), it(it_), cachedCoinUsage(usage) {
     assert(!cache.hasModifier);
     cache.hasModifier = true;
+    const CCoins& coins = it->second.coins;
+    fTrackChanges = !(it->second.flags & CCoinsCacheEntry::FRESH) && it->second.fChangesKnown;
+    if (fTrackChanges) {
+        vAvailableBefore.resize(coins.vout.size());
+        for (uint32_t n = 0; n < coins.vout.size(); n++)
+            vAvailableBefore[n] = coins.IsAvailable(n);
+        nHeightBefore = coins.nHeight;
+        nVersionBefore = coins.nVersion;
+        fCoinBaseBefore = coins.fCoinBase;
+    }
 }
 
 CCoinsModifier::~CCoinsModifier()
@@ -292,6 +368,17 @@ CCoinsModifier::~CCoinsModifier()
     assert(cache.hasModifier);
     cache.hasModifier = false;
     it->second.coins.Cleanup();
+    if (fTrackChanges) {
+        const CCoins& coins = it->second.coins;
+        // Every output is stored along with the metadata, so if that changed
+        // all available outputs have to be rewritten.
+        bool fSameMeta = coins.nHeight == nHeightBefore && coins.nVersion == nVersionBefore && coins.fCoinBase == fCoinBaseBefore;
+        for (uint32_t n = 0; n < std::max(coins.vout.size(), vAvailableBefore.size()); n++) {
+            bool fBefore = n < vAvailableBefore.size() && vAvailableBefore[n];
+            if (fBefore != coins.IsAvailable(n) || (!fSameMeta && fBefore))
+                it->second.MarkChanged(n);
+        }
+    }
     cache.cachedCoinsUsage -= cachedCoinUsage; // Subtract the old usage
     if ((it->second.flags & CCoinsCacheEntry::FRESH) && it->second.coins.IsPruned()) {
         cache.cacheCoins.erase(it);
@@ -11,6 +11,7 @@
 #include "hash.h"
 #include "memusage.h"
 #include "serialize.h"
+#include "support/allocators/pool.h"
 #include "uint256.h"
 
 #include <assert.h>
@@ -288,16 +289,41 @@ struct CCoinsCacheEntry
 {
     CCoins coins; // The actual cached data.
     unsigned char flags;
+    /**
+     * For a DIRTY entry that is not FRESH: the outputs that may differ from the
+     * parent view, so that flushing to the coin database need not read the old
+     * version back. Only valid if fChangesKnown; entries built outside of
+     * CCoinsViewCache leave it unset and get compared against the parent.
+     */
+    std::vector<bool> vChanged;
+    bool fChangesKnown;
 
     enum Flags {
         DIRTY = (1 << 0), // This cache entry is potentially different from the version in the parent view.
         FRESH = (1 << 1), // The parent view does not have this entry (or it is pruned).
     };
 
-    CCoinsCacheEntry() : coins(), flags(0) {}
+    CCoinsCacheEntry() : coins(), flags(0), fChangesKnown(false) {}
+
+    //! Record that output n may differ from the parent view
+    void MarkChanged(uint32_t n);
+
+    //! Take over the changes of child, a DIRTY entry of a cache on top of this one
+    void MergeChanges(const CCoinsCacheEntry& child);
 };
 
-typedef boost::unordered_map<uint256, CCoinsCacheEntry, SaltedTxidHasher> CCoinsMap;
+/**
+ * Nodes of the coins map are allocated from a pool. The largest pooled block
+ * leaves room for the per-node bookkeeping of boost::unordered_map.
+ */
+typedef PoolAllocator<std::pair<const uint256, CCoinsCacheEntry>,
+                      sizeof(std::pair<const uint256, CCoinsCacheEntry>) + sizeof(void*) * 4,
+                      alignof(void*)> CCoinsMapAllocator;
+typedef CCoinsMapAllocator::ResourceType CCoinsMapResource;
+typedef boost::unordered_map<uint256, CCoinsCacheEntry, SaltedTxidHasher, std::equal_to<uint256>, CCoinsMapAllocator> CCoinsMap;
+
+//! Default size of the chunks the coins map pool allocates
+static const size_t DEFAULT_COINS_POOL_CHUNK_SIZE = 256 * 1024;
 
 /** Cursor for iterating over CoinsView state */
 class CCoinsViewCursor
@@ -376,6 +402,11 @@ private:
     CCoinsViewCache& cache;
     CCoinsMap::iterator it;
     size_t cachedCoinUsage; // Cached memory usage of the CCoins object before modification
+    bool fTrackChanges; // Whether the entry records which outputs this modification changes
+    std::vector<bool> vAvailableBefore; // Outputs available before modification
+    int nHeightBefore; // Metadata before modification; outputs are stored alongside it
+    int nVersionBefore;
+    bool fCoinBaseBefore;
     CCoinsModifier(CCoinsViewCache& cache_, CCoinsMap::iterator it_, size_t usage);
 
 public:
@@ -398,13 +429,19 @@ protected:
      * declared as "const".  
      */
     mutable uint256 hashBlock;
+    /* Pool backing the nodes of cacheCoins; must outlive it. */
+    mutable CCoinsMapResource cacheCoinsResource;
     mutable CCoinsMap cacheCoins;
 
     /* Cached dynamic memory usage for the inner CCoins objects. */
     mutable size_t cachedCoinsUsage;
 
+    /* Drop all entries and return the pool's memory to the system at once. */
+    void ReallocateCache();
+
 public:
-    CCoinsViewCache(CCoinsView *baseIn);
+    /** nPoolChunkSize is the granularity in which the memory of the cache grows */
+    CCoinsViewCache(CCoinsView *baseIn, size_t nPoolChunkSize = DEFAULT_COINS_POOL_CHUNK_SIZE);
     ~CCoinsViewCache();
 
     // Standard CCoinsView methods
@@ -462,7 +499,7 @@ public:
     //! Calculate the size of the cache (in number of transactions)
     unsigned int GetCacheSize() const;
 
-    //! Calculate the size of the cache (in bytes)
+    //! Calculate the size of the cache (in bytes), counting the whole pool the entries are allocated from
     size_t DynamicMemoryUsage() const;
 
     /** 
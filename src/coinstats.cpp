@@ -0,0 +1,102 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coinstats.h"
+
+#include "chain.h"
+#include "coins.h"
+#include "hash.h"
+#include "main.h"
+#include "streams.h"
+#include "sync.h"
+#include "txdb.h"
+#include "util.h"
+#include "utxosnapshot.h"
+
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+static void ApplyOutput(CCoinsStats& stats, const uint256& txid, uint32_t n, const CCoins& coins, bool fInsert)
+{
+    const CTxOut& out = coins.vout[n];
+    CDataStream ss(SER_DISK, PROTOCOL_VERSION);
+    ss << COutPoint(txid, n) << VARINT(coins.nHeight * 2 + (coins.fCoinBase ? 1 : 0)) << out;
+    unsigned int nRecordSize = CCoinsViewDB::GetRecordSize(coins, n);
+    if (fInsert) {
+        stats.muhash.Insert((const unsigned char*)&ss[0], ss.size());
+        stats.nTransactionOutputs++;
+        stats.nTotalAmount += out.nValue;
+        stats.nSerializedSize += nRecordSize;
+    } else {
+        stats.muhash.Remove((const unsigned char*)&ss[0], ss.size());
+        stats.nTransactionOutputs--;
+        stats.nTotalAmount -= out.nValue;
+        stats.nSerializedSize -= nRecordSize;
+    }
+}
+
+void CCoinsStats::UpdateCoins(const uint256& txid, const CCoins& coinsOld, const CCoins& coinsNew)
+{
+    bool fSameMeta = coinsOld.fCoinBase == coinsNew.fCoinBase && coinsOld.nHeight == coinsNew.nHeight && coinsOld.nVersion == coinsNew.nVersion;
+    for (uint32_t n = 0; n < std::max(coinsOld.vout.size(), coinsNew.vout.size()); n++) {
+        bool fOld = coinsOld.IsAvailable(n);
+        bool fNew = coinsNew.IsAvailable(n);
+        if (fOld && fNew && fSameMeta && coinsOld.vout[n] == coinsNew.vout[n])
+            continue;
+        if (fOld)
+            ApplyOutput(*this, txid, n, coinsOld, false);
+        if (fNew)
+            ApplyOutput(*this, txid, n, coinsNew, true);
+    }
+
+    // Each transaction in the set also costs its 32-byte txid
+    bool fWasPresent = !coinsOld.IsPruned();
+    bool fIsPresent = !coinsNew.IsPruned();
+    if (fWasPresent && !fIsPresent) {
+        nTransactions--;
+        nSerializedSize -= 32;
+    } else if (!fWasPresent && fIsPresent) {
+        nTransactions++;
+        nSerializedSize += 32;
+    }
+}
+
+uint256 CCoinsStats::GetMuHash() const
+{
+    MuHash3072 muhashCopy(muhash);
+    uint256 hash;
+    muhashCopy.Finalize(hash.begin());
+    return hash;
+}
+
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats)
+{
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    stats = CCoinsStats();
+    stats.hashBlock = pcursor->GetBestBlock();
+    {
+        LOCK(cs_main);
+        BlockMap::const_iterator mi = mapBlockIndex.find(stats.hashBlock);
+        if (mi != mapBlockIndex.end())
+            stats.nHeight = mi->second->nHeight;
+    }
+    ss << stats.hashBlock;
+    CCoins coinsNone;
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        uint256 key;
+        CCoins coins;
+        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
+            UpdateUTXOSetHash(ss, key, coins);
+            stats.UpdateCoins(key, coinsNone, coins);
+        } else {
+            return error("%s: unable to read value", __func__);
+        }
+        pcursor->Next();
+    }
+    stats.hashSerialized = ss.GetHash();
+    return true;
+}
@@ -0,0 +1,68 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_COINSTATS_H
+#define BITCOIN_COINSTATS_H
+
+#include "amount.h"
+#include "crypto/muhash.h"
+#include "serialize.h"
+#include "uint256.h"
+
+class CCoins;
+class CCoinsView;
+
+/**
+ * Statistics about the unspent transaction output set at hashBlock, as
+ * gettxoutsetinfo reports them. Everything but hashSerialized can be kept up
+ * to date block by block with UpdateCoins. hashSerialized depends on the
+ * order of the whole set, so only GetUTXOStats fills it in.
+ */
+class CCoinsStats
+{
+public:
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint64_t nSerializedSize;
+    CAmount nTotalAmount;
+    //! Rolling hash of the unspent outputs, see GetMuHash
+    MuHash3072 muhash;
+    uint256 hashSerialized;
+
+    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
+
+    /**
+     * Account for the unspent outputs of txid going from coinsOld to coinsNew
+     * (either may be pruned). Only the outputs that differ are touched.
+     */
+    void UpdateCoins(const uint256& txid, const CCoins& coinsOld, const CCoins& coinsNew);
+
+    /** Hash of the set of unspent outputs, each one being its outpoint, height and coinbase flag, and the output */
+    uint256 GetMuHash() const;
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nTransactions);
+        READWRITE(nTransactionOutputs);
+        READWRITE(nSerializedSize);
+        READWRITE(nTotalAmount);
+        unsigned char state[MuHash3072::STATE_SIZE];
+        if (!ser_action.ForRead())
+            muhash.ToBytes(state);
+        READWRITE(FLATDATA(state));
+        if (ser_action.ForRead())
+            muhash.FromBytes(state);
+    }
+};
+
+/** Calculate the statistics of the set in view, hashSerialized included, by iterating over all of it */
+bool GetUTXOStats(CCoinsView* view, CCoinsStats& stats);
+
+#endif // BITCOIN_COINSTATS_H
@@ -0,0 +1,191 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "crypto/muhash.h"
+
+#include "crypto/common.h"
+#include "crypto/sha256.h"
+
+#include <string.h>
+
+namespace
+{
+/** The prime is 2^3072 - MAX_PRIME_DIFF, so 2^3072 is congruent to MAX_PRIME_DIFF */
+const uint32_t MAX_PRIME_DIFF = 1103717;
+
+/** Map a byte string to a group element */
+Num3072 ToNum3072(const unsigned char* data, size_t len)
+{
+    unsigned char seed[CSHA256::OUTPUT_SIZE];
+    CSHA256().Write(data, len).Finalize(seed);
+    unsigned char buf[Num3072::BYTE_SIZE];
+    for (uint32_t i = 0; i < Num3072::BYTE_SIZE / CSHA256::OUTPUT_SIZE; i++) {
+        unsigned char counter[4];
+        WriteLE32(counter, i);
+        CSHA256().Write(seed, sizeof(seed)).Write(counter, sizeof(counter)).Finalize(buf + i * CSHA256::OUTPUT_SIZE);
+    }
+    return Num3072(buf);
+}
+
+} // anon namespace
+
+Num3072::Num3072()
+{
+    limbs[0] = 1;
+    memset(limbs + 1, 0, sizeof(limbs) - sizeof(limbs[0]));
+}
+
+Num3072::Num3072(const unsigned char data[BYTE_SIZE])
+{
+    for (int i = 0; i < LIMBS; i++)
+        limbs[i] = ReadLE32(data + 4 * i);
+    if (IsOverflow())
+        FullReduce();
+}
+
+void Num3072::ToBytes(unsigned char out[BYTE_SIZE]) const
+{
+    for (int i = 0; i < LIMBS; i++)
+        WriteLE32(out + 4 * i, limbs[i]);
+}
+
+bool Num3072::IsOverflow() const
+{
+    if (limbs[0] < 0xFFFFFFFF - MAX_PRIME_DIFF + 1)
+        return false;
+    for (int i = 1; i < LIMBS; i++) {
+        if (limbs[i] != 0xFFFFFFFF)
+            return false;
+    }
+    return true;
+}
+
+void Num3072::FullReduce()
+{
+    // Subtract the prime: add MAX_PRIME_DIFF and drop the carry out of 2^3072
+    uint64_t carry = MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && carry; i++) {
+        uint64_t t = (uint64_t)limbs[i] + carry;
+        limbs[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+}
+
+void Num3072::Multiply(const Num3072& a)
+{
+    // Schoolbook product; a may be this very number
+    uint32_t r[2 * LIMBS];
+    memset(r, 0, sizeof(r));
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t carry = 0;
+        for (int j = 0; j < LIMBS; j++) {
+            uint64_t t = (uint64_t)limbs[i] * a.limbs[j] + r[i + j] + carry;
+            r[i + j] = (uint32_t)t;
+            carry = t >> 32;
+        }
+        r[i + LIMBS] = (uint32_t)carry;
+    }
+
+    // Fold the high half onto the low half, then what overflowed from that
+    uint64_t carry = 0;
+    for (int i = 0; i < LIMBS; i++) {
+        uint64_t t = (uint64_t)r[i + LIMBS] * MAX_PRIME_DIFF + r[i] + carry;
+        limbs[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    carry *= MAX_PRIME_DIFF;
+    for (int i = 0; i < LIMBS && carry; i++) {
+        uint64_t t = (uint64_t)limbs[i] + carry;
+        limbs[i] = (uint32_t)t;
+        carry = t >> 32;
+    }
+    if (carry) {
+        // Wrapped past 2^3072, leaving a small number: add the 2^3072 back as MAX_PRIME_DIFF
+        carry = MAX_PRIME_DIFF;
+        for (int i = 0; i < LIMBS && carry; i++) {
+            uint64_t t = (uint64_t)limbs[i] + carry;
+            limbs[i] = (uint32_t)t;
+            carry = t >> 32;
+        }
+    }
+    if (IsOverflow())
+        FullReduce();
+}
+
+void Num3072::Invert()
+{
+    // Fermat: raise to the power p - 2. All limbs of that exponent but the
+    // lowest are 0xFFFFFFFF, so build x^(2^32 - 1) once and reuse it.
+    const Num3072 x(*this);
+    Num3072 ones(x); // x^(2^k - 1), for k doubling up to 32
+    for (int k = 1; k < 32; k *= 2) {
+        Num3072 t(ones);
+        for (int i = 0; i < k; i++)
+            t.Multiply(t);
+        t.Multiply(ones);
+        ones = t;
+    }
+
+    *this = ones;
+    for (int i = LIMBS - 2; i > 0; i--) {
+        for (int j = 0; j < 32; j++)
+            Multiply(*this);
+        Multiply(ones);
+    }
+    const uint32_t nLowest = 0xFFFFFFFF - MAX_PRIME_DIFF - 1;
+    for (int j = 31; j >= 0; j--) {
+        Multiply(*this);
+        if ((nLowest >> j) & 1)
+            Multiply(x);
+    }
+}
+
+MuHash3072& MuHash3072::Insert(const unsigned char* data, size_t len)
+{
+    numerator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::Remove(const unsigned char* data, size_t len)
+{
+    denominator.Multiply(ToNum3072(data, len));
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator*=(const MuHash3072& other)
+{
+    numerator.Multiply(other.numerator);
+    denominator.Multiply(other.denominator);
+    return *this;
+}
+
+MuHash3072& MuHash3072::operator/=(const MuHash3072& other)
+{
+    numerator.Multiply(other.denominator);
+    denominator.Multiply(other.numerator);
+    return *this;
+}
+
+void MuHash3072::Finalize(unsigned char hash[OUTPUT_SIZE])
+{
+    denominator.Invert();
+    numerator.Multiply(denominator);
+    denominator = Num3072();
+
+    unsigned char data[Num3072::BYTE_SIZE];
+    numerator.ToBytes(data);
+    CSHA256().Write(data, sizeof(data)).Finalize(hash);
+}
+
+void MuHash3072::ToBytes(unsigned char out[STATE_SIZE]) const
+{
+    numerator.ToBytes(out);
+    denominator.ToBytes(out + Num3072::BYTE_SIZE);
+}
+
+void MuHash3072::FromBytes(const unsigned char in[STATE_SIZE])
+{
+    numerator = Num3072(in);
+    denominator = Num3072(in + Num3072::BYTE_SIZE);
+}
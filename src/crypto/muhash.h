@@ -0,0 +1,72 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_CRYPTO_MUHASH_H
+#define BITCOIN_CRYPTO_MUHASH_H
+
+#include <stdint.h>
+#include <stdlib.h>
+
+/** A number modulo the prime 2^3072 - 1103717, in 32-bit little-endian limbs. */
+class Num3072
+{
+public:
+    static const int LIMBS = 96;
+    static const size_t BYTE_SIZE = 384;
+
+    uint32_t limbs[LIMBS];
+
+    //! The number 1
+    Num3072();
+    //! Reads a 384-byte little-endian number, reducing it if it is not below the prime
+    explicit Num3072(const unsigned char data[BYTE_SIZE]);
+
+    void Multiply(const Num3072& a);
+    //! Replace this number by its multiplicative inverse (not defined for 0)
+    void Invert();
+    void ToBytes(unsigned char out[BYTE_SIZE]) const;
+
+private:
+    bool IsOverflow() const;
+    void FullReduce();
+};
+
+/**
+ * A hash of a set of byte strings that can be updated one element at a time,
+ * in any order: MuHash, the product of the elements' hashes in the
+ * multiplicative group modulo a 3072-bit prime. Each element is mapped into
+ * the group by expanding its SHA256 hash with SHA256 in counter mode.
+ *
+ * Removed elements go into a separate denominator, so Insert and Remove both
+ * cost a single multiplication; the one modular inversion is left to
+ * Finalize. Two MuHash3072 over disjoint sets combine with *= and /=.
+ */
+class MuHash3072
+{
+private:
+    Num3072 numerator;
+    Num3072 denominator;
+
+public:
+    static const size_t OUTPUT_SIZE = 32;
+    //! Size of the state as written by ToBytes
+    static const size_t STATE_SIZE = 2 * Num3072::BYTE_SIZE;
+
+    //! The hash of the empty set
+    MuHash3072() {}
+
+    MuHash3072& Insert(const unsigned char* data, size_t len);
+    MuHash3072& Remove(const unsigned char* data, size_t len);
+
+    MuHash3072& operator*=(const MuHash3072& other);
+    MuHash3072& operator/=(const MuHash3072& other);
+
+    //! Hash the set down to 32 bytes. Also folds the denominator into the numerator.
+    void Finalize(unsigned char hash[OUTPUT_SIZE]);
+
+    void ToBytes(unsigned char out[STATE_SIZE]) const;
+    void FromBytes(const unsigned char in[STATE_SIZE]);
+};
+
+#endif // BITCOIN_CRYPTO_MUHASH_H
@@ -0,0 +1,126 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * Copyright (c) 2017 The Florincoin Core developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * 16-way interleaved scrypt for AVX-512F: word k of lane l lives in element l
+ * of vector k. The second ROMix loop uses gathers so that each lane can read
+ * its own, data-dependent V entry.
+ */
+
+#include "crypto/scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(ENABLE_AVX512)
+#include <immintrin.h>
+
+#define LANES 16
+#define ROTL(a, b) _mm512_rol_epi32((a), (b))
+#define QR(a, b, c, r) x[a] = _mm512_xor_si512(x[a], ROTL(_mm512_add_epi32(x[b], x[c]), r))
+
+static inline void xor_salsa8_16way(__m512i B[16], const __m512i Bx[16])
+{
+	__m512i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm512_xor_si512(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		QR( 4,  0, 12,  7);  QR( 9,  5,  1,  7);
+		QR(14, 10,  6,  7);  QR( 3, 15, 11,  7);
+
+		QR( 8,  4,  0,  9);  QR(13,  9,  5,  9);
+		QR( 2, 14, 10,  9);  QR( 7,  3, 15,  9);
+
+		QR(12,  8,  4, 13);  QR( 1, 13,  9, 13);
+		QR( 6,  2, 14, 13);  QR(11,  7,  3, 13);
+
+		QR( 0, 12,  8, 18);  QR( 5,  1, 13, 18);
+		QR(10,  6,  2, 18);  QR(15, 11,  7, 18);
+
+		/* Operate on rows. */
+		QR( 1,  0,  3,  7);  QR( 6,  5,  4,  7);
+		QR(11, 10,  9,  7);  QR(12, 15, 14,  7);
+
+		QR( 2,  1,  0,  9);  QR( 7,  6,  5,  9);
+		QR( 8, 11, 10,  9);  QR(13, 12, 15,  9);
+
+		QR( 3,  2,  1, 13);  QR( 4,  7,  6, 13);
+		QR( 9,  8, 11, 13);  QR(14, 13, 12, 13);
+
+		QR( 0,  3,  2, 18);  QR( 5,  4,  7, 18);
+		QR(10,  9,  8, 18);  QR(15, 14, 13, 18);
+	}
+	for (i = 0; i < 16; i++)
+		B[i] = _mm512_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_avx512_16way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[LANES][128];
+	union {
+		__m512i i512[32];
+		uint32_t u32[32 * LANES];
+	} X;
+	uint32_t *V;
+	uint32_t i, k, l;
+	const __m512i vMask = _mm512_set1_epi32(1023);
+	const __m512i vStep = _mm512_set1_epi32(LANES);
+	const __m512i vLane = _mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7, 8, 9, 10, 11, 12, 13, 14, 15);
+	__m512i vIdx;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (l = 0; l < LANES; l++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B[l], 128);
+		for (k = 0; k < 32; k++)
+			X.u32[k * LANES + l] = le32dec(&B[l][4 * k]);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		memcpy(&V[i * 32 * LANES], X.u32, sizeof(X));
+		xor_salsa8_16way(&X.i512[0], &X.i512[16]);
+		xor_salsa8_16way(&X.i512[16], &X.i512[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Element l of vIdx is the word offset of lane l's V entry. */
+		vIdx = _mm512_add_epi32(_mm512_slli_epi32(_mm512_and_si512(X.i512[16], vMask), 9), vLane);
+		for (k = 0; k < 32; k++) {
+			X.i512[k] = _mm512_xor_si512(X.i512[k], _mm512_i32gather_epi32(vIdx, (const void *)V, 4));
+			vIdx = _mm512_add_epi32(vIdx, vStep);
+		}
+		xor_salsa8_16way(&X.i512[0], &X.i512[16]);
+		xor_salsa8_16way(&X.i512[16], &X.i512[0]);
+	}
+
+	for (l = 0; l < LANES; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[l][4 * k], X.u32[k * LANES + l]);
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B[l], 128, 1, (uint8_t *)output + 32 * l, 32);
+	}
+}
+#endif // ENABLE_AVX512
@@ -0,0 +1,121 @@
+/*
+ * Copyright 2009 Colin Percival, 2011 ArtForz, 2012-2013 pooler
+ * Copyright (c) 2017 The Florincoin Core developers
+ * All rights reserved.
+ *
+ * Redistribution and use in source and binary forms, with or without
+ * modification, are permitted provided that the following conditions
+ * are met:
+ * 1. Redistributions of source code must retain the above copyright
+ *    notice, this list of conditions and the following disclaimer.
+ * 2. Redistributions in binary form must reproduce the above copyright
+ *    notice, this list of conditions and the following disclaimer in the
+ *    documentation and/or other materials provided with the distribution.
+ *
+ * THIS SOFTWARE IS PROVIDED BY THE AUTHOR AND CONTRIBUTORS ``AS IS'' AND
+ * ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ * IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ * ARE DISCLAIMED.  IN NO EVENT SHALL THE AUTHOR OR CONTRIBUTORS BE LIABLE
+ * FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+ * DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS
+ * OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION)
+ * HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT
+ * LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY
+ * OUT OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF
+ * SUCH DAMAGE.
+ *
+ * 4-way interleaved scrypt: word k of lane l lives in element l of vector k,
+ * so one SSE2 instruction advances the same salsa20/8 step of four hashes.
+ */
+
+#include "crypto/scrypt.h"
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+
+#define LANES 4
+#define ROTL(a, b) _mm_or_si128(_mm_slli_epi32((a), (b)), _mm_srli_epi32((a), 32 - (b)))
+#define QR(a, b, c, r) x[a] = _mm_xor_si128(x[a], ROTL(_mm_add_epi32(x[b], x[c]), r))
+
+static inline void xor_salsa8_4way(__m128i B[16], const __m128i Bx[16])
+{
+	__m128i x[16];
+	int i;
+
+	for (i = 0; i < 16; i++)
+		x[i] = B[i] = _mm_xor_si128(B[i], Bx[i]);
+	for (i = 0; i < 8; i += 2) {
+		/* Operate on columns. */
+		QR( 4,  0, 12,  7);  QR( 9,  5,  1,  7);
+		QR(14, 10,  6,  7);  QR( 3, 15, 11,  7);
+
+		QR( 8,  4,  0,  9);  QR(13,  9,  5,  9);
+		QR( 2, 14, 10,  9);  QR( 7,  3, 15,  9);
+
+		QR(12,  8,  4, 13);  QR( 1, 13,  9, 13);
+		QR( 6,  2, 14, 13);  QR(11,  7,  3, 13);
+
+		QR( 0, 12,  8, 18);  QR( 5,  1, 13, 18);
+		QR(10,  6,  2, 18);  QR(15, 11,  7, 18);
+
+		/* Operate on rows. */
+		QR( 1,  0,  3,  7);  QR( 6,  5,  4,  7);
+		QR(11, 10,  9,  7);  QR(12, 15, 14,  7);
+
+		QR( 2,  1,  0,  9);  QR( 7,  6,  5,  9);
+		QR( 8, 11, 10,  9);  QR(13, 12, 15,  9);
+
+		QR( 3,  2,  1, 13);  QR( 4,  7,  6, 13);
+		QR( 9,  8, 11, 13);  QR(14, 13, 12, 13);
+
+		QR( 0,  3,  2, 18);  QR( 5,  4,  7, 18);
+		QR(10,  9,  8, 18);  QR(15, 14, 13, 18);
+	}
+	for (i = 0; i < 16; i++)
+		B[i] = _mm_add_epi32(B[i], x[i]);
+}
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad)
+{
+	uint8_t B[LANES][128];
+	union {
+		__m128i i128[32];
+		uint32_t u32[32 * LANES];
+	} X;
+	uint32_t *V;
+	uint32_t i, j, k, l;
+
+	V = (uint32_t *)(((uintptr_t)(scratchpad) + 63) & ~ (uintptr_t)(63));
+
+	for (l = 0; l < LANES; l++) {
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, (const uint8_t *)input + 80 * l, 80, 1, B[l], 128);
+		for (k = 0; k < 32; k++)
+			X.u32[k * LANES + l] = le32dec(&B[l][4 * k]);
+	}
+
+	for (i = 0; i < 1024; i++) {
+		memcpy(&V[i * 32 * LANES], X.u32, sizeof(X));
+		xor_salsa8_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_4way(&X.i128[16], &X.i128[0]);
+	}
+	for (i = 0; i < 1024; i++) {
+		/* Each lane picks its own V entry; SSE2 has no gather, so xor lane by lane. */
+		for (l = 0; l < LANES; l++) {
+			j = 32 * LANES * (X.u32[16 * LANES + l] & 1023) + l;
+			for (k = 0; k < 32; k++)
+				X.u32[k * LANES + l] ^= V[j + k * LANES];
+		}
+		xor_salsa8_4way(&X.i128[0], &X.i128[16]);
+		xor_salsa8_4way(&X.i128[16], &X.i128[0]);
+	}
+
+	for (l = 0; l < LANES; l++) {
+		for (k = 0; k < 32; k++)
+			le32enc(&B[l][4 * k], X.u32[k * LANES + l]);
+		PBKDF2_SHA256((const uint8_t *)input + 80 * l, 80, B[l], 128, 1, (uint8_t *)output + 32 * l, 32);
+	}
+}
+#endif // __SSE2__
@@ -34,6 +34,11 @@
 #include <string.h>
 #include <openssl/sha.h>
 
+#if (defined(ENABLE_AVX2) || defined(ENABLE_AVX512)) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define USE_MULTI_CPUID 1
+#include <cpuid.h>
+#endif
+
 #if defined(USE_SSE2) && !defined(USE_SSE2_ALWAYS)
 #ifdef _MSC_VER
 // MSVC 64bit is unable to use inline asm
@@ -327,3 +332,95 @@ void scrypt_1024_1_1_256(const char *input, char *output)
 	char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
     scrypt_1024_1_1_256_sp(input, output, scratchpad);
 }
+
+// Only the SSE2 4-way path is usable until scrypt_detect_multibuffer() has probed the CPU
+static bool fScryptHaveAVX2 = false;
+static bool fScryptHaveAVX512 = false;
+
+#if defined(USE_MULTI_CPUID)
+static uint64_t scrypt_xgetbv()
+{
+	uint32_t a, d;
+	__asm__ ("xgetbv" : "=a"(a), "=d"(d) : "c"(0));
+	return ((uint64_t)d << 32) | a;
+}
+#endif
+
+const char *scrypt_detect_multibuffer()
+{
+#if defined(USE_MULTI_CPUID)
+	uint32_t eax, ebx, ecx, edx;
+	bool fOSXSave = false;
+	uint64_t xcr0 = 0;
+	if (__get_cpuid(1, &eax, &ebx, &ecx, &edx) && (ecx & bit_OSXSAVE)) {
+		fOSXSave = true;
+		xcr0 = scrypt_xgetbv();
+	}
+	ebx = 0;
+	if (__get_cpuid_max(0, NULL) >= 7)
+		__cpuid_count(7, 0, eax, ebx, ecx, edx);
+	// The OS must save YMM (and for AVX-512 also opmask/ZMM) state on context switches
+	fScryptHaveAVX2 = fOSXSave && (xcr0 & 0x6) == 0x6 && (ebx & (1 << 5));
+	fScryptHaveAVX512 = fOSXSave && (xcr0 & 0xe6) == 0xe6 && (ebx & (1 << 16));
+#endif
+#if !defined(ENABLE_AVX2)
+	fScryptHaveAVX2 = false;
+#endif
+#if !defined(ENABLE_AVX512)
+	fScryptHaveAVX512 = false;
+#endif
+	if (fScryptHaveAVX512)
+		return "avx512 (16-way)";
+	if (fScryptHaveAVX2)
+		return "avx2 (8-way)";
+#if defined(__SSE2__)
+	return "sse2 (4-way)";
+#else
+	return "generic (1-way)";
+#endif
+}
+
+scrypt_multi_func scrypt_multi_impl(int nLanes)
+{
+	switch (nLanes) {
+#if defined(__SSE2__)
+	case 4:
+		return &scrypt_1024_1_1_256_sp_sse2_4way;
+#endif
+#if defined(ENABLE_AVX2)
+	case 8:
+		return fScryptHaveAVX2 ? &scrypt_1024_1_1_256_sp_avx2_8way : NULL;
+#endif
+#if defined(ENABLE_AVX512)
+	case 16:
+		return fScryptHaveAVX512 ? &scrypt_1024_1_1_256_sp_avx512_16way : NULL;
+#endif
+	default:
+		return NULL;
+	}
+}
+
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t nCount)
+{
+	static const int lanes[] = { 16, 8, 4 };
+	char *scratchpad = NULL;
+	size_t n = 0;
+
+	for (unsigned int i = 0; i < sizeof(lanes) / sizeof(lanes[0]); i++) {
+		scrypt_multi_func func = scrypt_multi_impl(lanes[i]);
+		if (func == NULL || nCount - n < (size_t)lanes[i])
+			continue;
+		if (scratchpad == NULL) {
+			scratchpad = (char *)malloc(scrypt_multi_scratchpad_size(lanes[i]));
+			if (scratchpad == NULL)
+				break;
+		}
+		for (; nCount - n >= (size_t)lanes[i]; n += lanes[i])
+			func(input + 80 * n, output + 32 * n, scratchpad);
+	}
+	free(scratchpad);
+
+	// Whatever does not fill a whole batch is hashed one at a time
+	for (; n < nCount; n++)
+		scrypt_1024_1_1_256(input + 80 * n, output + 32 * n);
+}
@@ -23,6 +23,32 @@ extern void (*scrypt_1024_1_1_256_sp_detected)(const char *input, char *output,
 #define scrypt_1024_1_1_256_sp(input, output, scratchpad) scrypt_1024_1_1_256_sp_generic((input), (output), (scratchpad))
 #endif
 
+/**
+ * Multi-buffer scrypt: hash several independent 80-byte inputs at once by
+ * interleaving them across SIMD lanes. Inputs are packed back to back (80
+ * bytes each) and the 32-byte outputs are written back to back in the same
+ * order. Each lane needs its own 128 KiB scratchpad.
+ */
+typedef void (*scrypt_multi_func)(const char *input, char *output, char *scratchpad);
+
+static const int SCRYPT_MULTI_MAX_LANES = 16;
+
+static inline size_t scrypt_multi_scratchpad_size(int nLanes)
+{
+    return (size_t)131072 * nLanes + 63;
+}
+
+void scrypt_1024_1_1_256_sp_sse2_4way(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_avx2_8way(const char *input, char *output, char *scratchpad);
+void scrypt_1024_1_1_256_sp_avx512_16way(const char *input, char *output, char *scratchpad);
+
+/** Hash nCount packed headers, using the widest lane count the CPU supports. */
+void scrypt_1024_1_1_256_multi(const char *input, char *output, size_t nCount);
+/** Return the nLanes-way implementation, or NULL if it is not built or not supported by this CPU. */
+scrypt_multi_func scrypt_multi_impl(int nLanes);
+/** Probe the CPU for AVX2/AVX-512 support; returns a description of the widest implementation selected. */
+const char *scrypt_detect_multibuffer();
+
 void
 PBKDF2_SHA256(const uint8_t *passwd, size_t passwdlen, const uint8_t *salt,
     size_t saltlen, uint64_t c, uint8_t *buf, size_t dkLen);
@@ -535,12 +535,15 @@ void HTTPEvent::trigger(struct timeval* tv)
         evtimer_add(ev, tv); // trigger after timeval passed
 }
 HTTPRequest::HTTPRequest(struct evhttp_request* req) : req(req),
-                                                       replySent(false)
+                                                       replySent(false),
+                                                       chunkedReply(false)
 {
 }
 HTTPRequest::~HTTPRequest()
 {
-    if (!replySent) {
+    if (chunkedReply && !replySent) {
+        EndChunkedReply();
+    } else if (!replySent) {
         // Keep track of whether reply was sent to avoid request leaks
         LogPrintf("%s: Unhandled request\n", __func__);
         WriteReply(HTTP_INTERNAL, "Unhandled request");
@@ -605,6 +608,81 @@ void HTTPRequest::WriteReply(int nStatus, const std::string& strReply)
     req = 0; // transferred back to main thread
 }
 
+/**
+ * Close callback of a connection with a chunked reply in progress, run when
+ * the client goes away or a chunk could not be written. evhttp detaches the
+ * unfinished request from the connection, and leaves it to
+ * evhttp_send_reply_end to free.
+ */
+static void http_reply_connection_closed(struct evhttp_connection* evcon, void* arg)
+{
+    *(std::atomic<bool>*)arg = true;
+}
+
+/** Start a chunked reply from the main http thread */
+static void http_reply_start(struct evhttp_request* req, int nStatus, std::shared_ptr<std::atomic<bool> > closed)
+{
+    evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (!evcon) {
+        *closed = true;
+        return;
+    }
+    // The flag outlives the callback: every reply event holds it, and the
+    // last one, http_reply_end, unregisters the callback
+    evhttp_connection_set_closecb(evcon, http_reply_connection_closed, closed.get());
+    evhttp_send_reply_start(req, nStatus, NULL);
+}
+
+/** Send a chunk from the main http thread; the buffer is owned by the event */
+static void http_reply_chunk(struct evhttp_request* req, struct evbuffer* evb, std::shared_ptr<std::atomic<bool> > closed)
+{
+    if (!*closed)
+        evhttp_send_reply_chunk(req, evb);
+    evbuffer_free(evb);
+}
+
+/** Finish a chunked reply from the main http thread */
+static void http_reply_end(struct evhttp_request* req, std::shared_ptr<std::atomic<bool> > closed)
+{
+    evhttp_connection* evcon = evhttp_request_get_connection(req);
+    if (evcon && !*closed)
+        evhttp_connection_set_closecb(evcon, NULL, NULL);
+    evhttp_send_reply_end(req);
+}
+
+void HTTPRequest::StartChunkedReply(int nStatus)
+{
+    assert(!replySent && !chunkedReply && req);
+    connectionClosed.reset(new std::atomic<bool>(false));
+    HTTPEvent* ev = new HTTPEvent(eventBase, true,
+        boost::bind(http_reply_start, req, nStatus, connectionClosed));
+    ev->trigger(0);
+    chunkedReply = true;
+}
+
+bool HTTPRequest::WriteReplyChunk(const std::string& strChunk)
+{
+    assert(chunkedReply && !replySent && req);
+    if (*connectionClosed)
+        return false;
+    struct evbuffer* evb = evbuffer_new();
+    assert(evb);
+    evbuffer_add(evb, strChunk.data(), strChunk.size());
+    // Events triggered from this thread run in order, so chunks stay ordered
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(http_reply_chunk, req, evb, connectionClosed));
+    ev->trigger(0);
+    return true;
+}
+
+void HTTPRequest::EndChunkedReply()
+{
+    assert(chunkedReply && !replySent && req);
+    HTTPEvent* ev = new HTTPEvent(eventBase, true, boost::bind(http_reply_end, req, connectionClosed));
+    ev->trigger(0);
+    replySent = true;
+    req = 0; // transferred back to main thread
+}
+
 CService HTTPRequest::GetPeer()
 {
     evhttp_connection* con = evhttp_request_get_connection(req);
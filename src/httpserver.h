@@ -5,6 +5,8 @@
 #ifndef BITCOIN_HTTPSERVER_H
 #define BITCOIN_HTTPSERVER_H
 
+#include <atomic>
+#include <memory>
 #include <string>
 #include <stdint.h>
 #include <boost/thread.hpp>
@@ -57,6 +59,9 @@ class HTTPRequest
 private:
     struct evhttp_request* req;
     bool replySent;
+    bool chunkedReply;
+    /** Set from the main http thread once the connection of a chunked reply is closed */
+    std::shared_ptr<std::atomic<bool> > connectionClosed;
 
 public:
     HTTPRequest(struct evhttp_request* req);
@@ -112,6 +117,29 @@ public:
      * main thread, do not call any other HTTPRequest methods after calling this.
      */
     void WriteReply(int nStatus, const std::string& strReply = "");
+
+    /**
+     * Start a chunked HTTP reply, for bodies that are produced over time.
+     * Follow with any number of WriteReplyChunk calls and one EndChunkedReply,
+     * instead of calling WriteReply.
+     */
+    void StartChunkedReply(int nStatus);
+
+    /**
+     * Send one chunk of a reply started with StartChunkedReply.
+     * Returns false, without sending anything, once the client has gone away
+     * or an earlier chunk could not be written. Stop producing the body then
+     * and call EndChunkedReply.
+     */
+    bool WriteReplyChunk(const std::string& strChunk);
+
+    /**
+     * Finish a chunked reply.
+     *
+     * @note Like WriteReply this gives the request back to the main thread,
+     * do not call any other HTTPRequest methods after calling this.
+     */
+    void EndChunkedReply();
 };
 
 /** Event handler closure.
@@ -11,9 +11,11 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "checkqueue.h"
+#include "coinstats.h"
 #include "consensus/consensus.h"
 #include "consensus/merkle.h"
 #include "consensus/validation.h"
+#include "crypto/scrypt.h"
 #include "hash.h"
 #include "init.h"
 #include "merkleblock.h"
@@ -70,7 +72,10 @@ int nScriptCheckThreads = 0;
 bool fImporting = false;
 bool fReindex = false;
 bool fTxIndex = false;
+bool fCommentIndex = false;
+bool fPoWCache = DEFAULT_POWCACHE;
 bool fHavePruned = false;
+bool fLoadedUTXOSnapshot = false;
 bool fPruneMode = false;
 bool fIsBareMultisigStd = DEFAULT_PERMIT_BAREMULTISIG;
 bool fRequireStandard = true;
@@ -112,6 +117,10 @@ void EraseOrphansFor(NodeId peer) EXCLUSIVE_LOCKS_REQUIRED(cs_main);
  */
 static bool IsSuperMajority(int minVersion, const CBlockIndex* pstart, unsigned nRequired, const Consensus::Params& consensusParams);
 static void CheckBlockIndex(const Consensus::Params& consensusParams);
+/** Script verification flags enforced for a block with the given version and time on top of pindexPrev */
+static unsigned int GetBlockScriptFlags(int nVersion, int64_t nTime, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams);
+/** GetBlockScriptFlags for the next block on the active chain, recomputed only when the tip changes. Requires cs_main. */
+static unsigned int GetNextBlockScriptFlags(const Consensus::Params& consensusParams);
 
 /** Constant stuff for coinbase transactions we create: */
 CScript COINBASE_FLAGS;
@@ -235,6 +244,9 @@ namespace {
     MapRelay mapRelay;
     /** Expiration-time ordered list of (expire time, relay map entry) pairs, protected by cs_main). */
     std::deque<std::pair<int64_t, MapRelay::iterator>> vRelayExpiration;
+
+    /** Blocks most recently connected to the tip, served to peers without touching disk. Has its own lock. */
+    CRecentBlockCache recentBlocks(MAX_RECENT_BLOCKS);
 } // anon namespace
 
 //////////////////////////////////////////////////////////////////////////////
@@ -696,6 +708,7 @@ CBlockIndex* FindForkInGlobalIndex(const CChain& chain, const CBlockLocator& loc
 }
 
 CCoinsViewCache *pcoinsTip = NULL;
+CCoinsStats coinsStatsTip;
 CBlockTreeDB *pblocktree = NULL;
 
 //////////////////////////////////////////////////////////////////////////////
@@ -1142,7 +1155,7 @@ std::string FormatStateMessage(const CValidationState &state)
 }
 
 bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const CTransaction& tx, bool fLimitFree,
-                              bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
+                              bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount& nAbsurdFee,
                               std::vector<uint256>& vHashTxnToUncache)
 {
     const uint256 hash = tx.GetHash();
@@ -1315,7 +1328,7 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
             }
         }
 
-        CTxMemPoolEntry entry(tx, nFees, GetTime(), dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
+        CTxMemPoolEntry entry(tx, nFees, nAcceptTime, dPriority, chainActive.Height(), pool.HasNoInputsOf(tx), inChainInputValue, fSpendsCoinbase, nSigOpsCost, lp);
         unsigned int nSize = entry.GetTxSize();
 
         // Check that the transaction doesn't have an excessive number of
@@ -1552,6 +1565,17 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
                 __func__, hash.ToString(), FormatStateMessage(state));
         }
 
+        // Check once more against the flags the next block will be validated
+        // with, so the script execution cache lets ConnectBlock skip this
+        // transaction. Its signatures are all in the signature cache by now.
+        unsigned int currentBlockScriptVerifyFlags = GetNextBlockScriptFlags(Params().GetConsensus());
+        if (currentBlockScriptVerifyFlags != scriptVerifyFlags && currentBlockScriptVerifyFlags != MANDATORY_SCRIPT_VERIFY_FLAGS &&
+            !CheckInputs(tx, state, view, true, currentBlockScriptVerifyFlags, true, txdata))
+        {
+            return error("%s: BUG! PLEASE REPORT THIS! ConnectInputs failed against block flags but not STANDARD flags %s, %s",
+                __func__, hash.ToString(), FormatStateMessage(state));
+        }
+
         // Remove conflicting transactions from the mempool
         BOOST_FOREACH(const CTxMemPool::txiter it, allConflicting)
         {
@@ -1579,11 +1603,11 @@ bool AcceptToMemoryPoolWorker(CTxMemPool& pool, CValidationState& state, const C
     return true;
 }
 
-bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
-                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
 {
     std::vector<uint256> vHashTxToUncache;
-    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
+    bool res = AcceptToMemoryPoolWorker(pool, state, tx, fLimitFree, pfMissingInputs, nAcceptTime, fOverrideMempoolLimit, nAbsurdFee, vHashTxToUncache);
     if (!res) {
         BOOST_FOREACH(const uint256& hashTx, vHashTxToUncache)
             pcoinsTip->Uncache(hashTx);
@@ -1591,6 +1615,12 @@ bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransa
     return res;
 }
 
+bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                        bool* pfMissingInputs, bool fOverrideMempoolLimit, const CAmount nAbsurdFee)
+{
+    return AcceptToMemoryPoolWithTime(pool, state, tx, fLimitFree, pfMissingInputs, GetTime(), fOverrideMempoolLimit, nAbsurdFee);
+}
+
 /** Return transaction in txOut, and if it was found inside a block, its hash is placed in hashBlock */
 bool GetTransaction(const uint256 &hash, CTransaction &txOut, const Consensus::Params& consensusParams, uint256 &hashBlock, bool fAllowSlow)
 {
@@ -1685,6 +1715,83 @@ bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHea
     return true;
 }
 
+namespace {
+
+/**
+ * PoW hashes found valid since the last block index flush. Headers get here
+ * before their contextual checks, so FlushStateToDisk only writes out those
+ * that made it into mapBlockIndex and drops the rest; the block tree DB thus
+ * holds at most one entry per block index entry. Bounded by
+ * MAX_POWCACHE_PENDING, beyond which hashes are simply not cached.
+ */
+CCriticalSection cs_powcache;
+std::map<uint256, uint256> mapPoWHashesPending;
+
+void AddPendingPoWHashes(const std::vector<std::pair<uint256, uint256> >& vPoWHashes)
+{
+    LOCK(cs_powcache);
+    for (size_t i = 0; i < vPoWHashes.size() && mapPoWHashesPending.size() < MAX_POWCACHE_PENDING; i++)
+        mapPoWHashesPending[vPoWHashes[i].first] = vPoWHashes[i].second;
+}
+
+bool ReadCachedPoWHash(const uint256& hash, uint256& powHash)
+{
+    {
+        LOCK(cs_powcache);
+        std::map<uint256, uint256>::const_iterator it = mapPoWHashesPending.find(hash);
+        if (it != mapPoWHashesPending.end()) {
+            powHash = it->second;
+            return true;
+        }
+    }
+    return pblocktree->ReadPoWHash(hash, powHash);
+}
+
+/** Write the pending PoW hashes of headers in mapBlockIndex to the block tree DB and forget all of them */
+bool FlushPoWHashes()
+{
+    AssertLockHeld(cs_main);
+    std::map<uint256, uint256> mapPending;
+    {
+        LOCK(cs_powcache);
+        mapPending.swap(mapPoWHashesPending);
+    }
+    std::vector<std::pair<uint256, uint256> > vPoWHashes;
+    for (std::map<uint256, uint256>::const_iterator it = mapPending.begin(); it != mapPending.end(); it++) {
+        BlockMap::const_iterator mi = mapBlockIndex.find(it->first);
+        if (mi != mapBlockIndex.end() && !(mi->second->nStatus & BLOCK_FAILED_MASK))
+            vPoWHashes.push_back(*it);
+    }
+    return vPoWHashes.empty() || pblocktree->WritePoWHashes(vPoWHashes);
+}
+
+}
+
+/**
+ * Check a header's proof of work. With -powcache, the scrypt hash of every
+ * header that passes is remembered by its block hash and, once the header is
+ * in the block index, stored in the block tree DB, so rereading an already
+ * validated block only costs a SHA256d. Only headers that passed are ever
+ * cached, so an entry that does not meet the header's target is stale and the
+ * hash is recomputed rather than the block rejected.
+ */
+static bool CheckBlockPoW(const CBlockHeader& block, const Consensus::Params& consensusParams)
+{
+    if (!fPoWCache || !pblocktree)
+        return CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams);
+
+    uint256 hash = block.GetHash();
+    uint256 powHash;
+    if (ReadCachedPoWHash(hash, powHash) && CheckProofOfWork(powHash, block.nBits, consensusParams))
+        return true;
+
+    powHash = block.GetPoWHash();
+    if (!CheckProofOfWork(powHash, block.nBits, consensusParams))
+        return false;
+    AddPendingPoWHashes(std::vector<std::pair<uint256, uint256> >(1, std::make_pair(hash, powHash)));
+    return true;
+}
+
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams)
 {
     block.SetNull();
@@ -1703,7 +1810,7 @@ bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus:
     }
 
     // Check the header
-    if (!CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (!CheckBlockPoW(block, consensusParams))
         return error("ReadBlockFromDisk: Errors in block header at %s", pos.ToString());
 
     return true;
@@ -1719,6 +1826,53 @@ bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus
     return true;
 }
 
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart)
+{
+    vchBlock.clear();
+
+    // Start at the magic and size written in front of the block
+    CDiskBlockPos posHeader = pos;
+    if (posHeader.nPos < MESSAGE_START_SIZE + sizeof(unsigned int))
+        return error("%s: invalid block position %s", __func__, pos.ToString());
+    posHeader.nPos -= MESSAGE_START_SIZE + sizeof(unsigned int);
+
+    CAutoFile filein(OpenBlockFile(posHeader, true), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull())
+        return error("%s: OpenBlockFile failed for %s", __func__, pos.ToString());
+
+    try {
+        CMessageHeader::MessageStartChars blockStart;
+        unsigned int nSize;
+        filein >> FLATDATA(blockStart) >> nSize;
+        if (memcmp(blockStart, messageStart, MESSAGE_START_SIZE) != 0)
+            return error("%s: block magic mismatch at %s", __func__, pos.ToString());
+        if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+            return error("%s: invalid block size %u at %s", __func__, nSize, pos.ToString());
+        vchBlock.resize(nSize);
+        filein.read((char*)&vchBlock[0], nSize);
+    }
+    catch (const std::exception& e) {
+        return error("%s: I/O error - %s at %s", __func__, e.what(), pos.ToString());
+    }
+
+    // The block hash covers the 80 byte header at the front
+    if (Hash(vchBlock.begin(), vchBlock.begin() + 80) != hashBlock)
+        return error("%s: block hash doesn't match %s at %s", __func__, hashBlock.ToString(), pos.ToString());
+
+    return true;
+}
+
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart)
+{
+    return ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), pindex->GetBlockHash(), messageStart);
+}
+
+bool IsBlockWitnessFree(const CBlockIndex* pindex, const Consensus::Params& params)
+{
+    // Blocks with witness data are invalid before activation and never stored
+    return !IsWitnessEnabled(pindex->pprev, params);
+}
+
 CAmount GetBlockSubsidy(int nHeight, const Consensus::Params& consensusParams)
 {
     int halvings = nHeight / consensusParams.nSubsidyHalvingInterval;
@@ -2024,6 +2178,14 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
         // the checkpoint is for a chain that's invalid due to false scriptSigs
         // this optimization would allow an invalid chain to be accepted.
         if (fScriptChecks) {
+            // Skip the scripts altogether if this transaction already passed
+            // them with these flags, e.g. when it was accepted to the mempool.
+            // Entries are only used once when not storing, like signatures.
+            uint256 hashCacheEntry;
+            GetScriptExecutionCache().ComputeEntry(hashCacheEntry, tx, flags);
+            if (GetScriptExecutionCache().Contains(hashCacheEntry, !cacheStore))
+                return true;
+
             for (unsigned int i = 0; i < tx.vin.size(); i++) {
                 const COutPoint &prevout = tx.vin[i].prevout;
                 const CCoins* coins = inputs.AccessCoins(prevout.hash);
@@ -2057,6 +2219,10 @@ bool CheckInputs(const CTransaction& tx, CValidationState &state, const CCoinsVi
                     return state.DoS(100,false, REJECT_INVALID, strprintf("mandatory-script-verify-flag-failed (%s)", ScriptErrorString(check.GetScriptError())));
                 }
             }
+
+            // All scripts ran inline and passed; deferred checks are not known to pass yet
+            if (cacheStore && !pvChecks)
+                GetScriptExecutionCache().Insert(hashCacheEntry);
         }
     }
 
@@ -2172,7 +2338,26 @@ static bool ApplyTxInUndo(const CTxInUndo& undo, CCoinsViewCache& view, const CO
     return fClean;
 }
 
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean)
+/** Keep a copy of the coins of txid as they were before the block being (dis)connected touched them */
+static void RememberCoins(std::map<uint256, CCoins>& mapCoinsBefore, const CCoinsViewCache& view, const uint256& txid)
+{
+    if (mapCoinsBefore.count(txid))
+        return;
+    const CCoins* coins = view.AccessCoins(txid);
+    mapCoinsBefore.insert(std::make_pair(txid, coins ? *coins : CCoins()));
+}
+
+/** Account in stats for every remembered transaction going from its old coins to what view has now */
+static void UpdateCoinsStats(CCoinsStats& stats, const std::map<uint256, CCoins>& mapCoinsBefore, const CCoinsViewCache& view)
+{
+    const CCoins coinsNone;
+    for (std::map<uint256, CCoins>::const_iterator it = mapCoinsBefore.begin(); it != mapCoinsBefore.end(); it++) {
+        const CCoins* coins = view.AccessCoins(it->first);
+        stats.UpdateCoins(it->first, it->second, coins ? *coins : coinsNone);
+    }
+}
+
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& view, bool* pfClean, CCoinsStats* pstats)
 {
     assert(pindex->GetBlockHash() == view.GetBestBlock());
 
@@ -2180,6 +2365,7 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         *pfClean = false;
 
     bool fClean = true;
+    std::map<uint256, CCoins> mapCoinsBefore;
 
     CBlockUndo blockUndo;
     CDiskBlockPos pos = pindex->GetUndoPos();
@@ -2196,6 +2382,9 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
         const CTransaction &tx = block.vtx[i];
         uint256 hash = tx.GetHash();
 
+        if (pstats)
+            RememberCoins(mapCoinsBefore, view, hash);
+
         // Check that all outputs are available and match the outputs in the block itself
         // exactly.
         {
@@ -2223,12 +2412,20 @@ bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockI
             for (unsigned int j = tx.vin.size(); j-- > 0;) {
                 const COutPoint &out = tx.vin[j].prevout;
                 const CTxInUndo &undo = txundo.vprevout[j];
+                if (pstats)
+                    RememberCoins(mapCoinsBefore, view, out.hash);
                 if (!ApplyTxInUndo(undo, view, out))
                     fClean = false;
             }
         }
     }
 
+    if (pstats && (fClean || pfClean)) {
+        UpdateCoinsStats(*pstats, mapCoinsBefore, view);
+        pstats->hashBlock = pindex->pprev->GetBlockHash();
+        pstats->nHeight = pindex->pprev->nHeight;
+    }
+
     // move best block pointer to prevout block
     view.SetBestBlock(pindex->pprev->GetBlockHash());
 
@@ -2272,6 +2469,95 @@ void ThreadScriptCheck() {
     scriptcheckqueue.Thread();
 }
 
+/**
+ * Closure representing the proof-of-work check of a group of headers from one
+ * headers message. The group is hashed in one go through the multi-buffer
+ * scrypt engine, and each header that passes gets its flag set in pfValid.
+ */
+class CHeaderPoWCheck
+{
+private:
+    const std::vector<CBlockHeader> *pheaders;
+    std::vector<unsigned int> vIndex;
+    char *pfValid;
+    const Consensus::Params *pparams;
+
+public:
+    CHeaderPoWCheck(): pheaders(NULL), pfValid(NULL), pparams(NULL) {}
+    CHeaderPoWCheck(const std::vector<CBlockHeader>& headersIn, const std::vector<unsigned int>& vIndexIn, char* pfValidIn, const Consensus::Params& paramsIn) :
+        pheaders(&headersIn), vIndex(vIndexIn), pfValid(pfValidIn), pparams(&paramsIn) { }
+
+    bool operator()() {
+        std::vector<CBlockHeader> vGroup;
+        vGroup.reserve(vIndex.size());
+        BOOST_FOREACH(unsigned int n, vIndex)
+            vGroup.push_back((*pheaders)[n]);
+        std::vector<uint256> vHashes;
+        GetPoWHashes(vGroup, vHashes);
+        bool fOk = true;
+        std::vector<std::pair<uint256, uint256> > vPoWHashes;
+        for (size_t i = 0; i < vIndex.size(); i++) {
+            if (CheckProofOfWork(vHashes[i], vGroup[i].nBits, *pparams)) {
+                pfValid[vIndex[i]] = 1;
+                vPoWHashes.push_back(std::make_pair(vGroup[i].GetHash(), vHashes[i]));
+            } else {
+                fOk = false;
+            }
+        }
+        if (fPoWCache && !vPoWHashes.empty())
+            AddPendingPoWHashes(vPoWHashes);
+        return fOk;
+    }
+
+    void swap(CHeaderPoWCheck &check) {
+        std::swap(pheaders, check.pheaders);
+        vIndex.swap(check.vIndex);
+        std::swap(pfValid, check.pfValid);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+static CCheckQueue<CHeaderPoWCheck> headerpowcheckqueue(4);
+
+void ThreadHeaderPoWCheck() {
+    RenameThread("florincoin-hdrpow");
+    headerpowcheckqueue.Thread();
+}
+
+/**
+ * Check the proof of work of a continuous batch of headers in parallel,
+ * without holding cs_main during the hashing. vPoWValid[i] is set for every
+ * header whose PoW was verified; headers that are already known, or that
+ * failed or were skipped after an earlier failure, are left for
+ * CheckBlockHeader. Nothing is hashed if the batch does not connect to a
+ * known block, as AcceptBlockHeader rejects it at the first header anyway.
+ */
+static void CheckHeadersPoW(const std::vector<CBlockHeader>& headers, std::vector<char>& vPoWValid, const Consensus::Params& consensusParams)
+{
+    vPoWValid.assign(headers.size(), 0);
+
+    std::vector<unsigned int> vUnknown;
+    {
+        LOCK(cs_main);
+        if (headers.empty() || !mapBlockIndex.count(headers[0].hashPrevBlock))
+            return;
+        for (unsigned int i = 0; i < headers.size(); i++)
+            if (!mapBlockIndex.count(headers[i].GetHash()))
+                vUnknown.push_back(i);
+    }
+
+    CCheckQueueControl<CHeaderPoWCheck> control(&headerpowcheckqueue);
+    std::vector<CHeaderPoWCheck> vChecks;
+    for (size_t i = 0; i < vUnknown.size(); i += SCRYPT_MULTI_MAX_LANES) {
+        std::vector<unsigned int> vGroup(vUnknown.begin() + i, vUnknown.begin() + std::min(vUnknown.size(), i + SCRYPT_MULTI_MAX_LANES));
+        vChecks.push_back(CHeaderPoWCheck());
+        CHeaderPoWCheck check(headers, vGroup, &vPoWValid[0], consensusParams);
+        check.swap(vChecks.back());
+    }
+    control.Add(vChecks);
+    control.Wait();
+}
+
 // Protected by cs_main
 VersionBitsCache versionbitscache;
 
@@ -2317,6 +2603,86 @@ public:
 // Protected by cs_main
 static ThresholdConditionCache warningcache[VERSIONBITS_NUM_BITS];
 
+/** Collect the -commentindex entries for the transactions of a block */
+static void GetCommentIndexEntries(const CBlock& block, int nHeight, std::vector<CCommentIndexEntry>& vEntries)
+{
+    BOOST_FOREACH(const CTransaction& tx, block.vtx) {
+        if (!tx.strTxComment.empty())
+            vEntries.push_back(CCommentIndexEntry(tx.GetHash(), nHeight, tx.strTxComment));
+    }
+}
+
+/**
+ * -commentindex entries of disconnected blocks. They are only erased once the
+ * chainstate without those blocks has been flushed, so that a crash in between
+ * cannot leave the index missing comments of a block still in the chainstate.
+ * Protected by cs_main.
+ */
+static std::vector<CCommentIndexEntry> vCommentsToErase;
+
+/** Forget pending erasures of entries that a block connected again */
+static void KeepCommentIndexEntries(const std::vector<CCommentIndexEntry>& vEntries)
+{
+    BOOST_FOREACH(const CCommentIndexEntry& entry, vEntries) {
+        for (std::vector<CCommentIndexEntry>::iterator it = vCommentsToErase.begin(); it != vCommentsToErase.end(); ) {
+            if (it->txid == entry.txid && it->nHeight == entry.nHeight)
+                it = vCommentsToErase.erase(it);
+            else
+                it++;
+        }
+    }
+}
+
+static unsigned int GetBlockScriptFlags(int nVersion, int64_t nTime, const CBlockIndex* pindexPrev, const Consensus::Params& consensusParams)
+{
+    // BIP16 didn't become active until Oct 1 2012
+    int64_t nBIP16SwitchTime = 1349049600;
+    bool fStrictPayToScriptHash = (nTime >= nBIP16SwitchTime);
+
+    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+
+    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
+    // when 75% of the network has upgraded:
+    if (nVersion >= 3 && IsSuperMajority(3, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_DERSIG;
+    }
+
+    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
+    // blocks, when 75% of the network has upgraded:
+    if (nVersion >= 4 && IsSuperMajority(4, pindexPrev, consensusParams.nMajorityEnforceBlockUpgrade, consensusParams)) {
+        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
+    }
+
+    // Start enforcing BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    if (VersionBitsState(pindexPrev, consensusParams, Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
+        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
+    }
+
+    // Start enforcing WITNESS rules using versionbits logic.
+    if (IsWitnessEnabled(pindexPrev, consensusParams)) {
+        flags |= SCRIPT_VERIFY_WITNESS;
+        flags |= SCRIPT_VERIFY_NULLDUMMY;
+    }
+
+    return flags;
+}
+
+static uint256 hashNextBlockFlagsTip;
+static unsigned int nNextBlockFlags = 0;
+
+static unsigned int GetNextBlockScriptFlags(const Consensus::Params& consensusParams)
+{
+    AssertLockHeld(cs_main);
+    // ComputeBlockVersion and the IsSuperMajority walks only depend on the
+    // tip, so don't repeat them for every transaction accepted on top of it
+    CBlockIndex* pindexTip = chainActive.Tip();
+    if (pindexTip->GetBlockHash() != hashNextBlockFlagsTip) {
+        nNextBlockFlags = GetBlockScriptFlags(ComputeBlockVersion(pindexTip, consensusParams), GetAdjustedTime(), pindexTip, consensusParams);
+        hashNextBlockFlagsTip = pindexTip->GetBlockHash();
+    }
+    return nNextBlockFlags;
+}
+
 static int64_t nTimeCheck = 0;
 static int64_t nTimeForks = 0;
 static int64_t nTimeVerify = 0;
@@ -2326,7 +2692,7 @@ static int64_t nTimeCallbacks = 0;
 static int64_t nTimeTotal = 0;
 
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex,
-                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck)
+                  CCoinsViewCache& view, const CChainParams& chainparams, bool fJustCheck, CCoinsStats* pstats)
 {
     AssertLockHeld(cs_main);
 
@@ -2343,8 +2709,13 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     // Special case for the genesis block, skipping connection of its transactions
     // (its coinbase is unspendable)
     if (block.GetHash() == chainparams.GetConsensus().hashGenesisBlock) {
-        if (!fJustCheck)
+        if (!fJustCheck) {
             view.SetBestBlock(pindex->GetBlockHash());
+            if (pstats) {
+                pstats->hashBlock = pindex->GetBlockHash();
+                pstats->nHeight = pindex->nHeight;
+            }
+        }
         return true;
     }
 
@@ -2396,37 +2767,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         }
     }
 
-    // BIP16 didn't become active until Oct 1 2012
-    int64_t nBIP16SwitchTime = 1349049600;
-    bool fStrictPayToScriptHash = (pindex->GetBlockTime() >= nBIP16SwitchTime);
-
-    unsigned int flags = fStrictPayToScriptHash ? SCRIPT_VERIFY_P2SH : SCRIPT_VERIFY_NONE;
+    unsigned int flags = GetBlockScriptFlags(block.nVersion, pindex->GetBlockTime(), pindex->pprev, chainparams.GetConsensus());
 
-    // Start enforcing the DERSIG (BIP66) rules, for block.nVersion=3 blocks,
-    // when 75% of the network has upgraded:
-    if (block.nVersion >= 3 && IsSuperMajority(3, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_DERSIG;
-    }
-
-    // Start enforcing CHECKLOCKTIMEVERIFY, (BIP65) for block.nVersion=4
-    // blocks, when 75% of the network has upgraded:
-    if (block.nVersion >= 4 && IsSuperMajority(4, pindex->pprev, chainparams.GetConsensus().nMajorityEnforceBlockUpgrade, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_CHECKLOCKTIMEVERIFY;
-    }
-
-    // Start enforcing BIP68 (sequence locks) and BIP112 (CHECKSEQUENCEVERIFY) using versionbits logic.
+    // Start enforcing BIP68 (sequence locks) using versionbits logic, along with BIP112 in the flags above.
     int nLockTimeFlags = 0;
     if (VersionBitsState(pindex->pprev, chainparams.GetConsensus(), Consensus::DEPLOYMENT_CSV, versionbitscache) == THRESHOLD_ACTIVE) {
-        flags |= SCRIPT_VERIFY_CHECKSEQUENCEVERIFY;
         nLockTimeFlags |= LOCKTIME_VERIFY_SEQUENCE;
     }
 
-    // Start enforcing WITNESS rules using versionbits logic.
-    if (IsWitnessEnabled(pindex->pprev, chainparams.GetConsensus())) {
-        flags |= SCRIPT_VERIFY_WITNESS;
-        flags |= SCRIPT_VERIFY_NULLDUMMY;
-    }
-
     int64_t nTime2 = GetTimeMicros(); nTimeForks += nTime2 - nTime1;
     LogPrint("bench", "    - Fork checks: %.2fms [%.2fs]\n", 0.001 * (nTime2 - nTime1), nTimeForks * 0.000001);
 
@@ -2435,6 +2783,7 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
     CCheckQueueControl<CScriptCheck> control(fScriptChecks && nScriptCheckThreads ? &scriptcheckqueue : NULL);
 
     std::vector<uint256> vOrphanErase;
+    std::map<uint256, CCoins> mapCoinsBefore;
     std::vector<int> prevheights;
     CAmount nFees = 0;
     int nInputs = 0;
@@ -2504,6 +2853,14 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
             control.Add(vChecks);
         }
 
+        if (pstats && !fJustCheck) {
+            if (!tx.IsCoinBase()) {
+                BOOST_FOREACH(const CTxIn& txin, tx.vin)
+                    RememberCoins(mapCoinsBefore, view, txin.prevout.hash);
+            }
+            RememberCoins(mapCoinsBefore, view, tx.GetHash());
+        }
+
         CTxUndo undoDummy;
         if (i > 0) {
             blockundo.vtxundo.push_back(CTxUndo());
@@ -2554,6 +2911,20 @@ bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pin
         if (!pblocktree->WriteTxIndex(vPos))
             return AbortNode(state, "Failed to write transaction index");
 
+    if (fCommentIndex) {
+        std::vector<CCommentIndexEntry> vComments;
+        GetCommentIndexEntries(block, pindex->nHeight, vComments);
+        KeepCommentIndexEntries(vComments);
+        if (!vComments.empty() && !pblocktree->WriteCommentIndex(vComments))
+            return AbortNode(state, "Failed to write comment index");
+    }
+
+    if (pstats) {
+        UpdateCoinsStats(*pstats, mapCoinsBefore, view);
+        pstats->hashBlock = pindex->GetBlockHash();
+        pstats->nHeight = pindex->nHeight;
+    }
+
     // add this block to the view's block chain
     view.SetBestBlock(pindex->GetBlockHash());
 
@@ -2659,6 +3030,9 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
             if (!pblocktree->WriteBatchSync(vFiles, nLastBlockFile, vBlocks)) {
                 return AbortNode(state, "Files to write to block index database");
             }
+            if (!FlushPoWHashes()) {
+                return AbortNode(state, "Failed to write PoW hashes to block index database");
+            }
         }
         // Finally remove any pruned files
         if (fFlushForPrune)
@@ -2677,6 +3051,17 @@ bool static FlushStateToDisk(CValidationState &state, FlushStateMode mode) {
         // Flush the chainstate (which may refer to block index entries).
         if (!pcoinsTip->Flush())
             return AbortNode(state, "Failed to write to coin database");
+        // The statistics go after the coins they describe; if they do not
+        // make it, LoadCoinsStats recomputes them on the next start
+        if (coinsStatsTip.hashBlock == pcoinsTip->GetBestBlock() && !pblocktree->WriteCoinsStats(coinsStatsTip))
+            return AbortNode(state, "Failed to write UTXO set statistics");
+        // Comments of disconnected blocks go only now that the chainstate
+        // no longer has those blocks either
+        if (!vCommentsToErase.empty()) {
+            if (!pblocktree->EraseCommentIndex(vCommentsToErase))
+                return AbortNode(state, "Failed to erase comment index");
+            vCommentsToErase.clear();
+        }
         nLastFlush = nNow;
     }
     if (fDoFullFlush || ((mode == FLUSH_STATE_ALWAYS || mode == FLUSH_STATE_PERIODIC) && nNow > nLastSetChain + (int64_t)DATABASE_WRITE_INTERVAL * 1000000)) {
@@ -2776,10 +3161,13 @@ bool static DisconnectTip(CValidationState& state, const CChainParams& chainpara
     int64_t nStart = GetTimeMicros();
     {
         CCoinsViewCache view(pcoinsTip);
-        if (!DisconnectBlock(block, state, pindexDelete, view))
+        CCoinsStats* pstats = coinsStatsTip.hashBlock == pcoinsTip->GetBestBlock() ? &coinsStatsTip : NULL;
+        if (!DisconnectBlock(block, state, pindexDelete, view, NULL, pstats))
             return error("DisconnectTip(): DisconnectBlock %s failed", pindexDelete->GetBlockHash().ToString());
         assert(view.Flush());
     }
+    if (fCommentIndex)
+        GetCommentIndexEntries(block, pindexDelete->nHeight, vCommentsToErase);
     LogPrint("bench", "- Disconnect block: %.2fms\n", (GetTimeMicros() - nStart) * 0.001);
     // Write the chain state to disk, if necessary.
     if (!FlushStateToDisk(state, FLUSH_STATE_IF_NEEDED))
@@ -2843,7 +3231,8 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     LogPrint("bench", "  - Load block from disk: %.2fms [%.2fs]\n", (nTime2 - nTime1) * 0.001, nTimeReadFromDisk * 0.000001);
     {
         CCoinsViewCache view(pcoinsTip);
-        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams);
+        CCoinsStats* pstats = coinsStatsTip.hashBlock == pcoinsTip->GetBestBlock() ? &coinsStatsTip : NULL;
+        bool rv = ConnectBlock(*pblock, state, pindexNew, view, chainparams, false, pstats);
         GetMainSignals().BlockChecked(*pblock, state);
         if (!rv) {
             if (state.IsInvalid())
@@ -2867,6 +3256,9 @@ bool static ConnectTip(CValidationState& state, const CChainParams& chainparams,
     mempool.removeForBlock(pblock->vtx, pindexNew->nHeight, txConflicted, !IsInitialBlockDownload());
     // Update chainActive & related variables.
     UpdateTip(pindexNew, chainparams);
+    // Peers are about to ask for it; during initial sync nobody will
+    if (!IsInitialBlockDownload())
+        recentBlocks.Add(std::make_shared<const CBlock>(*pblock));
     // Tell wallet about transactions that went from mempool
     // to conflicted:
     BOOST_FOREACH(const CTransaction &tx, txConflicted) {
@@ -3386,7 +3778,7 @@ bool FindUndoPos(CValidationState &state, int nFile, CDiskBlockPos &pos, unsigne
 bool CheckBlockHeader(const CBlockHeader& block, CValidationState& state, const Consensus::Params& consensusParams, bool fCheckPOW)
 {
     // Check proof of work matches claimed amount
-    if (fCheckPOW && !CheckProofOfWork(block.GetPoWHash(), block.nBits, consensusParams))
+    if (fCheckPOW && !CheckBlockPoW(block, consensusParams))
         return state.DoS(50, false, REJECT_INVALID, "high-hash", false, "proof of work failed");
 
     return true;
@@ -3677,7 +4069,7 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
     return true;
 }
 
-static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL)
+static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state, const CChainParams& chainparams, CBlockIndex** ppindex=NULL, bool fCheckPOW=true)
 {
     AssertLockHeld(cs_main);
     // Check for duplicate
@@ -3696,7 +4088,7 @@ static bool AcceptBlockHeader(const CBlockHeader& block, CValidationState& state
             return true;
         }
 
-        if (!CheckBlockHeader(block, state, chainparams.GetConsensus()))
+        if (!CheckBlockHeader(block, state, chainparams.GetConsensus(), fCheckPOW))
             return error("%s: Consensus::CheckBlockHeader: %s, %s", __func__, hash.ToString(), FormatStateMessage(state));
 
         // Get prev block index
@@ -3733,7 +4125,8 @@ static bool AcceptBlock(const CBlock& block, CValidationState& state, const CCha
     CBlockIndex *pindexDummy = NULL;
     CBlockIndex *&pindex = ppindex ? *ppindex : pindexDummy;
 
-    if (!AcceptBlockHeader(block, state, chainparams, &pindex))
+    // A block that passed CheckBlock already had its proof of work checked
+    if (!AcceptBlockHeader(block, state, chainparams, &pindex, !block.fChecked))
         return false;
 
     // Try to process all requested blocks that we don't have, but only
@@ -4115,6 +4508,13 @@ bool static LoadBlockIndexDB()
     if (fHavePruned)
         LogPrintf("LoadBlockIndexDB(): Block files have previously been pruned\n");
 
+    // Check whether the chain state was bootstrapped from a UTXO snapshot
+    if (pblocktree->ReadFlag("utxosnapshot", fLoadedUTXOSnapshot)) {
+        if (!fLoadedUTXOSnapshot)
+            return error("%s: loading a UTXO snapshot was interrupted", __func__);
+        LogPrintf("%s: chain state was loaded from a UTXO snapshot\n", __func__);
+    }
+
     // Check whether we need to continue reindexing
     bool fReindexing = false;
     pblocktree->ReadReindexing(fReindexing);
@@ -4124,6 +4524,10 @@ bool static LoadBlockIndexDB()
     pblocktree->ReadFlag("txindex", fTxIndex);
     LogPrintf("%s: transaction index %s\n", __func__, fTxIndex ? "enabled" : "disabled");
 
+    // Check whether we have a comment index
+    pblocktree->ReadFlag("commentindex", fCommentIndex);
+    LogPrintf("%s: comment index %s\n", __func__, fCommentIndex ? "enabled" : "disabled");
+
     // Load pointer to end of best chain
     BlockMap::iterator it = mapBlockIndex.find(pcoinsTip->GetBestBlock());
     if (it == mapBlockIndex.end())
@@ -4183,7 +4587,7 @@ bool CVerifyDB::VerifyDB(const CChainParams& chainparams, CCoinsView *coinsview,
         uiInterface.ShowProgress(_("Verifying blocks..."), percentageDone);
         if (pindex->nHeight < chainActive.Height()-nCheckDepth)
             break;
-        if (fPruneMode && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
+        if ((fPruneMode || fHavePruned) && !(pindex->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, only go back as far as we have data.
             LogPrintf("VerifyDB(): block verification stopping at height %d (pruning, no data)\n", pindex->nHeight);
             break;
@@ -4260,7 +4664,7 @@ bool RewindBlockIndex(const CChainParams& params)
     CValidationState state;
     CBlockIndex* pindex = chainActive.Tip();
     while (chainActive.Height() >= nHeight) {
-        if (fPruneMode && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
+        if ((fPruneMode || fHavePruned) && !(chainActive.Tip()->nStatus & BLOCK_HAVE_DATA)) {
             // If pruning, don't try rewinding past the HAVE_DATA point;
             // since older blocks can't be served anyway, there's
             // no need to walk further, and trying to DisconnectTip()
@@ -4360,6 +4764,8 @@ void UnloadBlockIndex()
     }
     mapBlockIndex.clear();
     fHavePruned = false;
+    fLoadedUTXOSnapshot = false;
+    coinsStatsTip = CCoinsStats();
 }
 
 bool LoadBlockIndex()
@@ -4370,6 +4776,32 @@ bool LoadBlockIndex()
     return true;
 }
 
+bool LoadCoinsStats()
+{
+    LOCK(cs_main);
+    uint256 hashBest = pcoinsTip->GetBestBlock();
+    if (coinsStatsTip.hashBlock == hashBest)
+        return true;
+    if (pblocktree->ReadCoinsStats(coinsStatsTip) && coinsStatsTip.hashBlock == hashBest)
+        return true;
+
+    // Missing (first start with them, or an unclean shutdown) or for another
+    // block than the coin database is at: walk the whole set once
+    LogPrintf("Computing UTXO set statistics at block %s...\n", hashBest.ToString());
+    int64_t nStart = GetTimeMillis();
+    coinsStatsTip = CCoinsStats();
+    FlushStateToDisk();
+    CCoinsStats stats;
+    if (!GetUTXOStats(pcoinsTip, stats))
+        return error("%s: unable to read the UTXO set", __func__);
+    coinsStatsTip = stats;
+    if (!pblocktree->WriteCoinsStats(coinsStatsTip))
+        return error("%s: failed to write UTXO set statistics", __func__);
+    LogPrintf("Computed UTXO set statistics: %u transactions, %u outputs in %dms\n",
+        coinsStatsTip.nTransactions, coinsStatsTip.nTransactionOutputs, (int)(GetTimeMillis() - nStart));
+    return true;
+}
+
 bool InitBlockIndex(const CChainParams& chainparams) 
 {
     LOCK(cs_main);
@@ -4384,6 +4816,9 @@ bool InitBlockIndex(const CChainParams& chainparams)
     // Use the provided setting for -txindex in the new database
     fTxIndex = GetBoolArg("-txindex", DEFAULT_TXINDEX);
     pblocktree->WriteFlag("txindex", fTxIndex);
+    // Likewise for -commentindex
+    fCommentIndex = GetBoolArg("-commentindex", DEFAULT_COMMENTINDEX);
+    pblocktree->WriteFlag("commentindex", fCommentIndex);
     LogPrintf("Initializing databases...\n");
 
     // Only add the genesis block if not reindexing (in which case we reuse the one already on disk)
@@ -4411,112 +4846,347 @@ bool InitBlockIndex(const CChainParams& chainparams)
     return true;
 }
 
+/** A block record found in a block file by LoadExternalBlockFile */
+struct CImportBlock
+{
+    //! Position of the block data on disk, for blocks in blk?????.dat files
+    CDiskBlockPos pos;
+    //! Offset of the block data in the file being read
+    uint64_t nFilePos;
+    //! Where to resume scanning if the record turns out not to hold a block
+    uint64_t nResyncPos;
+    //! The record as read from the file; empty if the block is to be read from pos
+    std::vector<char> vchData;
+    //! Hash and parent of the header at the front of the record
+    uint256 hash;
+    uint256 hashPrevBlock;
+    //! Whether to run CheckBlock on it, rather than only deserialize it
+    bool fCheck;
+    //! Whether the block deserialized, and the number of bytes of vchData that took
+    bool fRead;
+    uint64_t nReadSize;
+    std::string strError;
+    CBlock block;
+
+    CImportBlock() : nFilePos(0), nResyncPos(0), fCheck(false), fRead(false), nReadSize(0) {}
+};
+
+/**
+ * Closure representing the context-free part of importing one block during
+ * -reindex or -loadblock: deserializing it and running CheckBlock, which
+ * hashes the scrypt proof of work, the merkle root and every transaction.
+ * A block that passes has fChecked set, so AcceptBlock does not repeat any
+ * of that under cs_main. Failures are left for AcceptBlock to report.
+ */
+class CBlockImportCheck
+{
+private:
+    CImportBlock *pimport;
+    const Consensus::Params *pparams;
+
+public:
+    CBlockImportCheck(): pimport(NULL), pparams(NULL) {}
+    CBlockImportCheck(CImportBlock& importIn, const Consensus::Params& paramsIn) :
+        pimport(&importIn), pparams(&paramsIn) { }
+
+    bool operator()() {
+        CImportBlock& import = *pimport;
+        try {
+            if (import.vchData.empty()) {
+                CAutoFile filein(OpenBlockFile(import.pos, true), SER_DISK, CLIENT_VERSION);
+                if (filein.IsNull()) {
+                    import.strError = "OpenBlockFile failed for " + import.pos.ToString();
+                    return true;
+                }
+                filein >> import.block;
+                import.nReadSize = 0;
+            } else {
+                CDataStream ssBlock(import.vchData, SER_DISK, CLIENT_VERSION);
+                ssBlock >> import.block;
+                import.nReadSize = import.vchData.size() - ssBlock.size();
+            }
+        } catch (const std::exception& e) {
+            import.strError = e.what();
+            return true;
+        }
+        import.fRead = true;
+        if (import.fCheck) {
+            CValidationState state;
+            CheckBlock(import.block, state, *pparams);
+        }
+        return true;
+    }
+
+    void swap(CBlockImportCheck &check) {
+        std::swap(pimport, check.pimport);
+        std::swap(pparams, check.pparams);
+    }
+};
+
+static CCheckQueue<CBlockImportCheck> blockimportcheckqueue(1);
+
+void ThreadBlockImportCheck() {
+    RenameThread("florincoin-impchk");
+    blockimportcheckqueue.Thread();
+}
+
+/** Queue the import checks for vImport on control, or run them right away without check threads */
+static void StartImportChecks(CCheckQueueControl<CBlockImportCheck>& control, std::vector<CImportBlock>& vImport, const Consensus::Params& consensusParams)
+{
+    std::vector<CBlockImportCheck> vChecks;
+    vChecks.reserve(vImport.size());
+    BOOST_FOREACH(CImportBlock& import, vImport) {
+        CBlockImportCheck check(import, consensusParams);
+        if (!nScriptCheckThreads) {
+            check();
+            continue;
+        }
+        vChecks.push_back(CBlockImportCheck());
+        check.swap(vChecks.back());
+    }
+    control.Add(vChecks);
+}
+
+/**
+ * Scan blkdat from nRewind for the next batch of block records and read them
+ * in raw, leaving nRewind where scanning should continue. Returns whether
+ * more records may follow.
+ */
+static bool ReadImportBatch(CBufferedFile& blkdat, uint64_t& nRewind, const CDiskBlockPos* dbp, const CChainParams& chainparams, std::vector<CImportBlock>& vBatch)
+{
+    vBatch.clear();
+    uint64_t nBatchSize = 0;
+    while (!blkdat.eof()) {
+        if (vBatch.size() >= MAX_IMPORT_BATCH_BLOCKS || nBatchSize >= MAX_IMPORT_BATCH_SIZE)
+            return true;
+        boost::this_thread::interruption_point();
+
+        blkdat.SetPos(nRewind);
+        nRewind++; // start one byte further next time, in case of failure
+        blkdat.SetLimit(); // remove former limit
+        unsigned int nSize = 0;
+        try {
+            // locate a header
+            unsigned char buf[MESSAGE_START_SIZE];
+            blkdat.FindByte(chainparams.MessageStart()[0]);
+            nRewind = blkdat.GetPos()+1;
+            blkdat >> FLATDATA(buf);
+            if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
+                continue;
+            // read size
+            blkdat >> nSize;
+            if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
+                continue;
+        } catch (const std::exception&) {
+            // no valid block header found; don't complain
+            return false;
+        }
+        vBatch.push_back(CImportBlock());
+        CImportBlock& import = vBatch.back();
+        try {
+            // read the record; deserializing it is left to the import checks
+            uint64_t nBlockPos = blkdat.GetPos();
+            blkdat.SetLimit(nBlockPos + nSize);
+            import.nFilePos = nBlockPos;
+            import.nResyncPos = nRewind;
+            if (dbp)
+                import.pos = CDiskBlockPos(dbp->nFile, nBlockPos);
+            import.vchData.resize(nSize);
+            // in pieces, as the buffer cannot hand out a whole maximum size block at once
+            for (unsigned int nDone = 0; nDone < nSize; ) {
+                unsigned int nChunk = std::min(nSize - nDone, (unsigned int)MAX_BLOCK_SERIALIZED_SIZE / 4);
+                blkdat.read(&import.vchData[nDone], nChunk);
+                nDone += nChunk;
+            }
+            nRewind = blkdat.GetPos();
+
+            CBlockHeader header;
+            CDataStream ssHeader(&import.vchData[0], &import.vchData[0] + 80, SER_DISK, CLIENT_VERSION);
+            ssHeader >> header;
+            import.hash = header.GetHash();
+            import.hashPrevBlock = header.hashPrevBlock;
+            nBatchSize += nSize;
+        } catch (const std::exception& e) {
+            vBatch.pop_back();
+            LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
+        }
+    }
+    return false;
+}
+
+/**
+ * Accept the blocks stashed in mapBlocksUnknownParent that descend from hash,
+ * parents before children. They are read back from disk and checked in
+ * parallel a batch at a time. Returns the number of blocks accepted.
+ */
+static int LoadUnknownParentDescendants(const CChainParams& chainparams, const uint256& hash, std::multimap<uint256, std::pair<uint256, CDiskBlockPos> >& mapBlocksUnknownParent)
+{
+    int nLoaded = 0;
+    deque<uint256> queue;
+    queue.push_back(hash);
+    while (!queue.empty()) {
+        std::vector<std::pair<uint256, uint256> > vParents;
+        std::vector<CImportBlock> vChildren;
+        while (!queue.empty() && vChildren.size() < MAX_IMPORT_BATCH_BLOCKS) {
+            uint256 head = queue.front();
+            queue.pop_front();
+            std::pair<std::multimap<uint256, std::pair<uint256, CDiskBlockPos> >::iterator, std::multimap<uint256, std::pair<uint256, CDiskBlockPos> >::iterator> range = mapBlocksUnknownParent.equal_range(head);
+            while (range.first != range.second) {
+                std::multimap<uint256, std::pair<uint256, CDiskBlockPos> >::iterator it = range.first++;
+                vChildren.push_back(CImportBlock());
+                CImportBlock& child = vChildren.back();
+                child.hash = it->second.first;
+                child.hashPrevBlock = head;
+                child.pos = it->second.second;
+                child.fCheck = true;
+                queue.push_back(child.hash);
+                mapBlocksUnknownParent.erase(it);
+            }
+        }
+
+        {
+            CCheckQueueControl<CBlockImportCheck> control(nScriptCheckThreads ? &blockimportcheckqueue : NULL);
+            StartImportChecks(control, vChildren, chainparams.GetConsensus());
+            control.Wait();
+        }
+
+        BOOST_FOREACH(CImportBlock& child, vChildren) {
+            if (!child.fRead || child.block.GetHash() != child.hash) {
+                LogPrintf("%s: Could not read out of order block %s at %s: %s\n", __func__, child.hash.ToString(), child.pos.ToString(),
+                        child.fRead ? "hash mismatch" : child.strError);
+                continue;
+            }
+            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, child.hash.ToString(),
+                    child.hashPrevBlock.ToString());
+            {
+                LOCK(cs_main);
+                CValidationState dummy;
+                if (AcceptBlock(child.block, dummy, chainparams, NULL, true, &child.pos, NULL))
+                    nLoaded++;
+            }
+            NotifyHeaderTip();
+        }
+    }
+    return nLoaded;
+}
+
+/**
+ * Blocks are imported in a pipeline: records are read ahead a batch at a
+ * time, deserialized and put through CheckBlock on the import check threads
+ * while the next batch is read, and then accepted one by one in file order.
+ * Blocks whose parent is not known yet are only deserialized; they get
+ * checked once they are read back after their parent.
+ */
 bool LoadExternalBlockFile(const CChainParams& chainparams, FILE* fileIn, CDiskBlockPos *dbp)
 {
-    // Map of disk positions for blocks with unknown parent (only used for reindex)
-    static std::multimap<uint256, CDiskBlockPos> mapBlocksUnknownParent;
+    // Map of disk positions for blocks with unknown parent (only used for reindex),
+    // keyed by the parent's hash and with the hash of the block itself
+    static std::multimap<uint256, std::pair<uint256, CDiskBlockPos> > mapBlocksUnknownParent;
     int64_t nStart = GetTimeMillis();
+    const uint256& hashGenesisBlock = chainparams.GetConsensus().hashGenesisBlock;
 
     int nLoaded = 0;
     try {
         // This takes over fileIn and calls fclose() on it in the CBufferedFile destructor
         CBufferedFile blkdat(fileIn, 2*MAX_BLOCK_SERIALIZED_SIZE, MAX_BLOCK_SERIALIZED_SIZE+8, SER_DISK, CLIENT_VERSION);
         uint64_t nRewind = blkdat.GetPos();
-        while (!blkdat.eof()) {
+        std::vector<CImportBlock> vBatch, vNext;
+        bool fMore = ReadImportBatch(blkdat, nRewind, dbp, chainparams, vBatch);
+        bool fAbort = false;
+        while (!vBatch.empty() && !fAbort) {
             boost::this_thread::interruption_point();
 
-            blkdat.SetPos(nRewind);
-            nRewind++; // start one byte further next time, in case of failure
-            blkdat.SetLimit(); // remove former limit
-            unsigned int nSize = 0;
-            try {
-                // locate a header
-                unsigned char buf[MESSAGE_START_SIZE];
-                blkdat.FindByte(chainparams.MessageStart()[0]);
-                nRewind = blkdat.GetPos()+1;
-                blkdat >> FLATDATA(buf);
-                if (memcmp(buf, chainparams.MessageStart(), MESSAGE_START_SIZE))
-                    continue;
-                // read size
-                blkdat >> nSize;
-                if (nSize < 80 || nSize > MAX_BLOCK_SERIALIZED_SIZE)
-                    continue;
-            } catch (const std::exception&) {
-                // no valid block header found; don't complain
-                break;
-            }
-            try {
-                // read block
-                uint64_t nBlockPos = blkdat.GetPos();
-                if (dbp)
-                    dbp->nPos = nBlockPos;
-                blkdat.SetLimit(nBlockPos + nSize);
-                blkdat.SetPos(nBlockPos);
-                CBlock block;
-                blkdat >> block;
-                nRewind = blkdat.GetPos();
-
-                // detect out of order blocks, and store them for later
-                uint256 hash = block.GetHash();
-                if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
-                    LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
-                            block.hashPrevBlock.ToString());
-                    if (dbp)
-                        mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, *dbp));
-                    continue;
+            // Only blocks that will be accepted right away are worth checking now
+            {
+                LOCK(cs_main);
+                std::set<uint256> setBatch;
+                BOOST_FOREACH(CImportBlock& import, vBatch) {
+                    BlockMap::iterator mi = mapBlockIndex.find(import.hash);
+                    bool fHave = mi != mapBlockIndex.end() && (mi->second->nStatus & BLOCK_HAVE_DATA);
+                    bool fParent = import.hash == hashGenesisBlock || mapBlockIndex.count(import.hashPrevBlock) || setBatch.count(import.hashPrevBlock);
+                    import.fCheck = fParent && !fHave;
+                    if (fParent)
+                        setBatch.insert(import.hash);
                 }
+            }
 
-                // process in case the block isn't known yet
-                if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
-                    LOCK(cs_main);
-                    CValidationState state;
-                    if (AcceptBlock(block, state, chainparams, NULL, true, dbp, NULL))
-                        nLoaded++;
-                    if (state.IsError())
-                        break;
-                } else if (hash != chainparams.GetConsensus().hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
-                    LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
-                }
+            {
+                CCheckQueueControl<CBlockImportCheck> control(nScriptCheckThreads ? &blockimportcheckqueue : NULL);
+                StartImportChecks(control, vBatch, chainparams.GetConsensus());
+                if (fMore)
+                    fMore = ReadImportBatch(blkdat, nRewind, dbp, chainparams, vNext);
+                control.Wait();
+            }
 
-                // Activate the genesis block so normal node progress can continue
-                if (hash == chainparams.GetConsensus().hashGenesisBlock) {
-                    CValidationState state;
-                    if (!ActivateBestChain(state, chainparams)) {
+            for (size_t i = 0; i < vBatch.size() && !fAbort; i++) {
+                CImportBlock& import = vBatch[i];
+                if (!import.fRead || import.nReadSize != import.vchData.size()) {
+                    // Resume scanning right after the block, or just past the
+                    // start of the record if it held none, dropping what was
+                    // read ahead from there
+                    nRewind = import.fRead ? import.nFilePos + import.nReadSize : import.nResyncPos;
+                    blkdat.SetLimit();
+                    if (!blkdat.SetPos(nRewind) && !blkdat.Seek(nRewind)) {
+                        LogPrintf("%s: Cannot rewind to %u, skipping the rest of the file\n", __func__, nRewind);
+                        fMore = false;
+                        vNext.clear();
+                    } else {
+                        fMore = ReadImportBatch(blkdat, nRewind, dbp, chainparams, vNext);
+                    }
+                    vBatch.resize(i + 1);
+                    if (!import.fRead) {
+                        LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, import.strError);
                         break;
                     }
                 }
 
-                NotifyHeaderTip();
-
-                // Recursively process earlier encountered successors of this block
-                deque<uint256> queue;
-                queue.push_back(hash);
-                while (!queue.empty()) {
-                    uint256 head = queue.front();
-                    queue.pop_front();
-                    std::pair<std::multimap<uint256, CDiskBlockPos>::iterator, std::multimap<uint256, CDiskBlockPos>::iterator> range = mapBlocksUnknownParent.equal_range(head);
-                    while (range.first != range.second) {
-                        std::multimap<uint256, CDiskBlockPos>::iterator it = range.first;
-                        if (ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()))
-                        {
-                            LogPrint("reindex", "%s: Processing out of order child %s of %s\n", __func__, block.GetHash().ToString(),
-                                    head.ToString());
-                            LOCK(cs_main);
-                            CValidationState dummy;
-                            if (AcceptBlock(block, dummy, chainparams, NULL, true, &it->second, NULL))
-                            {
-                                nLoaded++;
-                                queue.push_back(block.GetHash());
-                            }
+                try {
+                    const CBlock& block = import.block;
+                    const uint256& hash = import.hash;
+                    CDiskBlockPos* dbpBlock = dbp ? &import.pos : NULL;
+
+                    // detect out of order blocks, and store them for later
+                    if (hash != hashGenesisBlock && mapBlockIndex.find(block.hashPrevBlock) == mapBlockIndex.end()) {
+                        LogPrint("reindex", "%s: Out of order block %s, parent %s not known\n", __func__, hash.ToString(),
+                                block.hashPrevBlock.ToString());
+                        if (dbp)
+                            mapBlocksUnknownParent.insert(std::make_pair(block.hashPrevBlock, std::make_pair(hash, import.pos)));
+                        continue;
+                    }
+
+                    // process in case the block isn't known yet
+                    if (mapBlockIndex.count(hash) == 0 || (mapBlockIndex[hash]->nStatus & BLOCK_HAVE_DATA) == 0) {
+                        LOCK(cs_main);
+                        CValidationState state;
+                        if (AcceptBlock(block, state, chainparams, NULL, true, dbpBlock, NULL))
+                            nLoaded++;
+                        if (state.IsError()) {
+                            fAbort = true;
+                            break;
                         }
-                        range.first++;
-                        mapBlocksUnknownParent.erase(it);
-                        NotifyHeaderTip();
+                    } else if (hash != hashGenesisBlock && mapBlockIndex[hash]->nHeight % 1000 == 0) {
+                        LogPrint("reindex", "Block Import: already had block %s at height %d\n", hash.ToString(), mapBlockIndex[hash]->nHeight);
                     }
+
+                    // Activate the genesis block so normal node progress can continue
+                    if (hash == hashGenesisBlock) {
+                        CValidationState state;
+                        if (!ActivateBestChain(state, chainparams)) {
+                            fAbort = true;
+                            break;
+                        }
+                    }
+
+                    NotifyHeaderTip();
+
+                    // Process earlier encountered successors of this block
+                    nLoaded += LoadUnknownParentDescendants(chainparams, hash, mapBlocksUnknownParent);
+                } catch (const std::exception& e) {
+                    LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
                 }
-            } catch (const std::exception& e) {
-                LogPrintf("%s: Deserialize or I/O error - %s\n", __func__, e.what());
             }
+            vBatch.swap(vNext);
+            vNext.clear();
         }
     } catch (const std::runtime_error& e) {
         AbortNode(std::string("System error: ") + e.what());
@@ -4804,11 +5474,27 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
 
     vector<CInv> vNotFound;
 
+    // What to send is decided under cs_main, but the block is read from disk
+    // and everything is serialized after releasing it, so that message handler
+    // threads serving other peers are not held up meanwhile.
+    vector<std::pair<int, std::shared_ptr<const CTransaction> > > vTxToSend;
+    size_t nTxBytes = 0;
+    CInv invBlock;
+    CDiskBlockPos posBlock;
+    bool fSendBlock = false;
+    bool fSendCompact = false;
+    bool fPeerWantsWitness = false;
+    bool fRawBlock = false;
+    bool fFullBlock = false;
+    bool fWitness = false;
+    uint256 hashContinueTip;
+
+    {
     LOCK(cs_main);
 
     while (it != pfrom->vRecvGetData.end()) {
         // Don't bother if send buffer is too full to respond anyway
-        if (pfrom->nSendSize >= SendBufferSize())
+        if (pfrom->nSendSize + nTxBytes >= SendBufferSize())
             break;
 
         const CInv &inv = *it;
@@ -4852,85 +5538,46 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 // it's available before trying to send.
                 if (send && (mi->second->nStatus & BLOCK_HAVE_DATA))
                 {
-                    // Send block from disk
-                    CBlock block;
-                    if (!ReadBlockFromDisk(block, (*mi).second, consensusParams))
-                        assert(!"cannot load block from disk");
-                    if (inv.type == MSG_BLOCK)
-                        pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_WITNESS_BLOCK)
-                        pfrom->PushMessage(NetMsgType::BLOCK, block);
-                    else if (inv.type == MSG_FILTERED_BLOCK)
-                    {
-                        bool send = false;
-                        CMerkleBlock merkleBlock;
-                        {
-                            LOCK(pfrom->cs_filter);
-                            if (pfrom->pfilter) {
-                                send = true;
-                                merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
-                            }
-                        }
-                        if (send) {
-                            pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
-                            // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
-                            // This avoids hurting performance by pointlessly requiring a round-trip
-                            // Note that there is currently no way for a node to request any single transactions we didn't send here -
-                            // they must either disconnect and retry or request the full block.
-                            // Thus, the protocol spec specified allows for us to provide duplicate txn here,
-                            // however we MUST always provide at least what the remote peer needs
-                            typedef std::pair<unsigned int, uint256> PairType;
-                            BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
-                                pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, block.vtx[pair.first]);
-                        }
-                        // else
-                            // no response
-                    }
-                    else if (inv.type == MSG_CMPCT_BLOCK)
-                    {
+                    fSendBlock = true;
+                    invBlock = inv;
+                    posBlock = mi->second->GetBlockPos();
+                    if (inv.type == MSG_CMPCT_BLOCK) {
                         // If a peer is asking for old blocks, we're almost guaranteed
                         // they wont have a useful mempool to match against a compact block,
                         // and we don't feel like constructing the object for them, so
                         // instead we respond with the full, non-compact block.
-                        bool fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
-                        if (CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH) {
-                            CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
-                            pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
-                        } else
-                            pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+                        fPeerWantsWitness = State(pfrom->GetId())->fWantsCmpctWitness;
+                        fSendCompact = CanDirectFetch(consensusParams) && mi->second->nHeight >= chainActive.Height() - MAX_CMPCTBLOCK_DEPTH;
                     }
-
+                    // Full blocks that need no witness stripping are copied
+                    // straight from the block file instead of being
+                    // deserialized, checked and serialized again.
+                    fFullBlock = inv.type == MSG_BLOCK || inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && !fSendCompact);
+                    fWitness = inv.type == MSG_WITNESS_BLOCK || (inv.type == MSG_CMPCT_BLOCK && fPeerWantsWitness);
+                    fRawBlock = fFullBlock && (fWitness || IsBlockWitnessFree(mi->second, consensusParams));
                     // Trigger the peer node to send a getblocks request for the next batch of inventory
                     if (inv.hash == pfrom->hashContinue)
-                    {
-                        // Bypass PushInventory, this must send even if redundant,
-                        // and we want it right after the last block so they don't
-                        // wait for other stuff first.
-                        vector<CInv> vInv;
-                        vInv.push_back(CInv(MSG_BLOCK, chainActive.Tip()->GetBlockHash()));
-                        pfrom->PushMessage(NetMsgType::INV, vInv);
-                        pfrom->hashContinue.SetNull();
-                    }
+                        hashContinueTip = chainActive.Tip()->GetBlockHash();
                 }
             }
             else if (inv.type == MSG_TX || inv.type == MSG_WITNESS_TX)
             {
                 // Send stream from relay memory
-                bool push = false;
+                std::shared_ptr<const CTransaction> tx;
                 auto mi = mapRelay.find(inv.hash);
                 if (mi != mapRelay.end()) {
-                    pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *mi->second);
-                    push = true;
+                    tx = mi->second;
                 } else if (pfrom->timeLastMempoolReq) {
                     auto txinfo = mempool.info(inv.hash);
                     // To protect privacy, do not answer getdata using the mempool when
                     // that TX couldn't have been INVed in reply to a MEMPOOL request.
-                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq) {
-                        pfrom->PushMessageWithFlag(inv.type == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *txinfo.tx);
-                        push = true;
-                    }
+                    if (txinfo.tx && txinfo.nTime <= pfrom->timeLastMempoolReq)
+                        tx = txinfo.tx;
                 }
-                if (!push) {
+                if (tx) {
+                    vTxToSend.push_back(std::make_pair(inv.type, tx));
+                    nTxBytes += ::GetSerializeSize(*tx, SER_NETWORK, PROTOCOL_VERSION);
+                } else {
                     vNotFound.push_back(inv);
                 }
             }
@@ -4942,9 +5589,86 @@ void static ProcessGetData(CNode* pfrom, const Consensus::Params& consensusParam
                 break;
         }
     }
+    } // cs_main
 
     pfrom->vRecvGetData.erase(pfrom->vRecvGetData.begin(), it);
 
+    // Transactions come first: the loop above stops at the first block
+    for (unsigned int i = 0; i < vTxToSend.size(); i++)
+        pfrom->PushMessageWithFlag(vTxToSend[i].first == MSG_TX ? SERIALIZE_TRANSACTION_NO_WITNESS : 0, NetMsgType::TX, *vTxToSend[i].second);
+
+    if (fSendBlock)
+    {
+        // Send recently connected blocks from memory, others from disk
+        CRecentBlockCache::SerializedPtr pvchRecent;
+        if (fFullBlock || fSendCompact)
+            pvchRecent = recentBlocks.GetSerialized(invBlock.hash, fSendCompact, fSendCompact ? fPeerWantsWitness : fWitness);
+        CBlock block;
+        std::vector<unsigned char> vchBlock;
+        bool fRead = pvchRecent ||
+                     (fRawBlock ? ReadRawBlockFromDisk(vchBlock, posBlock, invBlock.hash, Params().MessageStart())
+                                : ReadBlockFromDisk(block, posBlock, consensusParams) && block.GetHash() == invBlock.hash);
+        if (!fRead) {
+            // Without cs_main the block may have been pruned in the meantime
+            LogPrintf("%s: cannot load block %s from disk, disconnect peer=%d\n", __func__, invBlock.hash.ToString(), pfrom->GetId());
+            pfrom->fDisconnect = true;
+            return;
+        }
+        if (pvchRecent)
+            pfrom->PushMessage(fSendCompact ? NetMsgType::CMPCTBLOCK : NetMsgType::BLOCK, CFlatData((void*)&pvchRecent->front(), (void*)(&pvchRecent->front() + pvchRecent->size())));
+        else if (fRawBlock)
+            pfrom->PushMessage(NetMsgType::BLOCK, CFlatData(vchBlock));
+        else if (invBlock.type == MSG_BLOCK)
+            pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+        else if (invBlock.type == MSG_WITNESS_BLOCK)
+            pfrom->PushMessage(NetMsgType::BLOCK, block);
+        else if (invBlock.type == MSG_FILTERED_BLOCK)
+        {
+            bool send = false;
+            CMerkleBlock merkleBlock;
+            {
+                LOCK(pfrom->cs_filter);
+                if (pfrom->pfilter) {
+                    send = true;
+                    merkleBlock = CMerkleBlock(block, *pfrom->pfilter);
+                }
+            }
+            if (send) {
+                pfrom->PushMessage(NetMsgType::MERKLEBLOCK, merkleBlock);
+                // CMerkleBlock just contains hashes, so also push any transactions in the block the client did not see
+                // This avoids hurting performance by pointlessly requiring a round-trip
+                // Note that there is currently no way for a node to request any single transactions we didn't send here -
+                // they must either disconnect and retry or request the full block.
+                // Thus, the protocol spec specified allows for us to provide duplicate txn here,
+                // however we MUST always provide at least what the remote peer needs
+                typedef std::pair<unsigned int, uint256> PairType;
+                BOOST_FOREACH(PairType& pair, merkleBlock.vMatchedTxn)
+                    pfrom->PushMessageWithFlag(SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::TX, block.vtx[pair.first]);
+            }
+            // else
+                // no response
+        }
+        else if (invBlock.type == MSG_CMPCT_BLOCK)
+        {
+            if (fSendCompact) {
+                CBlockHeaderAndShortTxIDs cmpctblock(block, fPeerWantsWitness);
+                pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
+            } else
+                pfrom->PushMessageWithFlag(fPeerWantsWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::BLOCK, block);
+        }
+
+        if (!hashContinueTip.IsNull())
+        {
+            // Bypass PushInventory, this must send even if redundant,
+            // and we want it right after the last block so they don't
+            // wait for other stuff first.
+            vector<CInv> vInv;
+            vInv.push_back(CInv(MSG_BLOCK, hashContinueTip));
+            pfrom->PushMessage(NetMsgType::INV, vInv);
+            pfrom->hashContinue.SetNull();
+        }
+    }
+
     if (!vNotFound.empty()) {
         // Let the peer know that we didn't find what it asked for, so it doesn't
         // have to wait around forever. Currently only SPV clients actually care
@@ -5377,8 +6101,8 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         if ((fDebug && vInv.size() > 0) || (vInv.size() == 1))
             LogPrint("net", "received getdata for: %s peer=%d\n", vInv[0].ToString(), pfrom->id);
 
+        // Served by ProcessMessages on the next pass, outside cs_MessageHandling
         pfrom->vRecvGetData.insert(pfrom->vRecvGetData.end(), vInv.begin(), vInv.end());
-        ProcessGetData(pfrom, chainparams.GetConsensus());
     }
 
 
@@ -5452,12 +6176,16 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             inv.type = State(pfrom->GetId())->fWantsCmpctWitness ? MSG_WITNESS_BLOCK : MSG_BLOCK;
             inv.hash = req.blockhash;
             pfrom->vRecvGetData.push_back(inv);
-            ProcessGetData(pfrom, chainparams.GetConsensus());
             return true;
         }
 
-        CBlock block;
-        assert(ReadBlockFromDisk(block, it->second, chainparams.GetConsensus()));
+        std::shared_ptr<const CBlock> pblock = recentBlocks.GetBlock(req.blockhash);
+        if (!pblock) {
+            std::shared_ptr<CBlock> pblockRead = std::make_shared<CBlock>();
+            assert(ReadBlockFromDisk(*pblockRead, it->second, chainparams.GetConsensus()));
+            pblock = pblockRead;
+        }
+        const CBlock& block = *pblock;
 
         BlockTransactions resp(req);
         for (size_t i = 0; i < req.indexes.size(); i++) {
@@ -5953,6 +6681,23 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
             ReadCompactSize(vRecv); // ignore tx count; assume it is 0.
         }
 
+        // Each header has to build on the one before; that takes no lock and
+        // only SHA256, so do it before anything expensive.
+        for (unsigned int n = 1; n < nCount; n++) {
+            if (headers[n].hashPrevBlock != headers[n - 1].GetHash()) {
+                LOCK(cs_main);
+                Misbehaving(pfrom->GetId(), 20);
+                return error("non-continuous headers sequence");
+            }
+        }
+
+        // Scrypt dominates header validation, so check the PoW of a full batch
+        // on the worker pool before taking cs_main. Small announcements are not
+        // worth the round trip and may not even connect.
+        std::vector<char> vPoWValid;
+        if (nCount > MAX_BLOCKS_TO_ANNOUNCE)
+            CheckHeadersPoW(headers, vPoWValid, chainparams.GetConsensus());
+
         {
         LOCK(cs_main);
 
@@ -5991,13 +6736,11 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
         }
 
         CBlockIndex *pindexLast = NULL;
-        BOOST_FOREACH(const CBlockHeader& header, headers) {
+        for (unsigned int n = 0; n < nCount; n++) {
+            const CBlockHeader& header = headers[n];
             CValidationState state;
-            if (pindexLast != NULL && header.hashPrevBlock != pindexLast->GetBlockHash()) {
-                Misbehaving(pfrom->GetId(), 20);
-                return error("non-continuous headers sequence");
-            }
-            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast)) {
+            bool fCheckPOW = vPoWValid.empty() || !vPoWValid[n];
+            if (!AcceptBlockHeader(header, state, chainparams, &pindexLast, fCheckPOW)) {
                 int nDoS;
                 if (state.IsInvalid(nDoS)) {
                     if (nDoS > 0)
@@ -6346,6 +7089,14 @@ bool static ProcessMessage(CNode* pfrom, string strCommand, CDataStream& vRecv,
     return true;
 }
 
+/**
+ * Serializes ProcessMessage and SendMessages across message handler threads.
+ * They were written for a single thread and touch other peers' state without
+ * locks (e.g. the address relay queues), so only the message checks and
+ * getdata serving run in parallel. Taken before any CNode::cs_vSend.
+ */
+static CCriticalSection cs_MessageHandling;
+
 // requires LOCK(cs_vRecvMsg)
 bool ProcessMessages(CNode* pfrom)
 {
@@ -6424,6 +7175,7 @@ bool ProcessMessages(CNode* pfrom)
         bool fRet = false;
         try
         {
+            LOCK(cs_MessageHandling);
             fRet = ProcessMessage(pfrom, strCommand, vRecv, msg.nTime, chainparams);
             boost::this_thread::interruption_point();
         }
@@ -6492,6 +7244,9 @@ public:
 bool SendMessages(CNode* pto)
 {
     const Consensus::Params& consensusParams = Params().GetConsensus();
+    // Called without pto->cs_vSend: like ProcessMessage, this takes
+    // cs_MessageHandling first and then cs_vSend for every push
+    LOCK(cs_MessageHandling);
     {
         // Don't send anything until we get its version message
         if (pto->nVersion == 0)
@@ -6691,11 +7446,15 @@ bool SendMessages(CNode* pto)
                     // probably means we're doing an initial-ish-sync or they're slow
                     LogPrint("net", "%s sending header-and-ids %s to peer %d\n", __func__,
                             vHeaders.front().GetHash().ToString(), pto->id);
-                    //TODO: Shouldn't need to reload block from disk, but requires refactor
-                    CBlock block;
-                    assert(ReadBlockFromDisk(block, pBestIndex, consensusParams));
-                    CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
-                    pto->PushMessageWithFlag(state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
+                    CRecentBlockCache::SerializedPtr pvchCompact = recentBlocks.GetSerialized(pBestIndex->GetBlockHash(), true, state.fWantsCmpctWitness);
+                    if (pvchCompact) {
+                        pto->PushMessage(NetMsgType::CMPCTBLOCK, CFlatData((void*)&pvchCompact->front(), (void*)(&pvchCompact->front() + pvchCompact->size())));
+                    } else {
+                        CBlock block;
+                        assert(ReadBlockFromDisk(block, pBestIndex, consensusParams));
+                        CBlockHeaderAndShortTxIDs cmpctblock(block, state.fWantsCmpctWitness);
+                        pto->PushMessageWithFlag(state.fWantsCmpctWitness ? 0 : SERIALIZE_TRANSACTION_NO_WITNESS, NetMsgType::CMPCTBLOCK, cmpctblock);
+                    }
                     state.pindexBestHeaderSent = pBestIndex;
                 } else if (state.fPreferHeaders) {
                     if (vHeaders.size() > 1) {
@@ -6983,6 +7742,108 @@ ThresholdState VersionBitsTipState(const Consensus::Params& params, Consensus::D
     return VersionBitsState(chainActive.Tip(), params, pos, versionbitscache);
 }
 
+static const uint64_t MEMPOOL_DUMP_VERSION = 1;
+
+std::atomic<bool> fMempoolLoaded(false);
+
+bool LoadMempool()
+{
+    int64_t nExpiryTimeout = GetArg("-mempoolexpiry", DEFAULT_MEMPOOL_EXPIRY) * 60 * 60;
+    boost::filesystem::path path = GetDataDir() / "mempool.dat";
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        LogPrintf("Failed to open mempool file from disk. Continuing anyway.\n");
+        return false;
+    }
+
+    int64_t nStart = GetTimeMillis();
+    int64_t nNow = GetTime();
+    unsigned int nAccepted = 0, nFailed = 0, nExpired = 0;
+    try {
+        uint64_t nVersion;
+        filein >> nVersion;
+        if (nVersion != MEMPOOL_DUMP_VERSION) {
+            LogPrintf("Mempool file has unknown version %u. Continuing anyway.\n", nVersion);
+            return false;
+        }
+
+        // Deltas go first, as they can decide whether a transaction is accepted
+        std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+        filein >> mapDeltas;
+        for (std::map<uint256, std::pair<double, CAmount> >::const_iterator it = mapDeltas.begin(); it != mapDeltas.end(); it++)
+            mempool.PrioritiseTransaction(it->first, it->first.ToString(), it->second.first, it->second.second);
+
+        uint64_t nTransactions;
+        filein >> nTransactions;
+        while (nTransactions--) {
+            CTransaction tx;
+            int64_t nTime;
+            filein >> tx >> nTime;
+            if (nTime + nExpiryTimeout <= nNow) {
+                nExpired++;
+                continue;
+            }
+            CValidationState state;
+            {
+                LOCK(cs_main);
+                if (AcceptToMemoryPoolWithTime(mempool, state, tx, true, NULL, nTime))
+                    nAccepted++;
+                else
+                    nFailed++;
+            }
+            if (ShutdownRequested())
+                return false;
+        }
+    } catch (const std::exception& e) {
+        LogPrintf("Failed to deserialize mempool data on disk: %s. Continuing anyway.\n", e.what());
+        return false;
+    }
+
+    LogPrintf("Imported mempool transactions from disk: %u accepted, %u failed, %u expired in %dms\n",
+        nAccepted, nFailed, nExpired, (int)(GetTimeMillis() - nStart));
+    return true;
+}
+
+bool DumpMempool()
+{
+    // Only one dump at a time; they share the temporary file
+    static CCriticalSection cs_dump;
+    LOCK(cs_dump);
+
+    int64_t nStart = GetTimeMicros();
+    std::map<uint256, std::pair<double, CAmount> > mapDeltas;
+    std::vector<TxMempoolInfo> vInfo;
+    {
+        LOCK(mempool.cs);
+        mapDeltas = mempool.mapDeltas;
+        vInfo = mempool.infoAll();
+    }
+    int64_t nCopied = GetTimeMicros();
+
+    boost::filesystem::path pathTmp = GetDataDir() / "mempool.dat.new";
+    try {
+        CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        if (fileout.IsNull())
+            return error("%s: failed to open %s", __func__, pathTmp.string());
+
+        fileout << MEMPOOL_DUMP_VERSION;
+        fileout << mapDeltas;
+        // infoAll lists parents before their children, which is the order they can be accepted in again
+        fileout << (uint64_t)vInfo.size();
+        BOOST_FOREACH(const TxMempoolInfo& info, vInfo)
+            fileout << *info.tx << info.nTime;
+        FileCommit(fileout.Get());
+        fileout.fclose();
+        if (!RenameOver(pathTmp, GetDataDir() / "mempool.dat"))
+            return error("%s: failed to rename %s", __func__, pathTmp.string());
+    } catch (const std::exception& e) {
+        return error("%s: failed to dump mempool: %s", __func__, e.what());
+    }
+    LogPrintf("Dumped mempool: %u transactions, %gs to copy, %gs to dump\n",
+        vInfo.size(), (nCopied - nStart) * 0.000001, (GetTimeMicros() - nCopied) * 0.000001);
+    return true;
+}
+
 class CMainCleanup
 {
 public:
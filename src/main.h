@@ -19,6 +19,7 @@
 #include "versionbits.h"
 
 #include <algorithm>
+#include <atomic>
 #include <exception>
 #include <map>
 #include <set>
@@ -33,6 +34,7 @@ class CBlockIndex;
 class CBlockTreeDB;
 class CBloomFilter;
 class CChainParams;
+class CCoinsStats;
 class CInv;
 class CScriptCheck;
 class CTxMemPool;
@@ -71,6 +73,8 @@ static const unsigned int DEFAULT_DESCENDANT_LIMIT = 25;
 static const unsigned int DEFAULT_DESCENDANT_SIZE_LIMIT = 101;
 /** Default for -mempoolexpiry, expiration time for mempool transactions in hours */
 static const unsigned int DEFAULT_MEMPOOL_EXPIRY = 72;
+/** Default for -persistmempool */
+static const bool DEFAULT_PERSIST_MEMPOOL = true;
 /** The maximum size of a blk?????.dat file (since 0.8) */
 static const unsigned int MAX_BLOCKFILE_SIZE = 0x8000000; // 128 MiB
 /** The pre-allocation chunk size for blk?????.dat files (since 0.8) */
@@ -94,6 +98,12 @@ static const unsigned int MAX_HEADERS_RESULTS = 2000;
 static const int MAX_CMPCTBLOCK_DEPTH = 5;
 /** Maximum depth of blocks we're willing to respond to GETBLOCKTXN requests for. */
 static const int MAX_BLOCKTXN_DEPTH = 10;
+/** Number of most recently connected blocks kept in memory, ready serialized, for serving to peers. */
+static const unsigned int MAX_RECENT_BLOCKS = 6;
+/** Maximum number of block records read ahead from a block file by -reindex and -loadblock, to be checked in parallel */
+static const unsigned int MAX_IMPORT_BATCH_BLOCKS = 128;
+/** Maximum total size of the block records read ahead from a block file by -reindex and -loadblock */
+static const uint64_t MAX_IMPORT_BATCH_SIZE = 16 * 1000 * 1000;
 /** Size of the "block download window": how far ahead of our current height do we fetch?
  *  Larger windows tolerate larger download speed differences between peer, but increase the potential
  *  degree of disordering of blocks on disk (which make reindexing and in the future perhaps pruning
@@ -132,6 +142,12 @@ static const int64_t DEFAULT_MAX_TIP_AGE = 24 * 60 * 60;
 static const bool DEFAULT_PERMIT_BAREMULTISIG = true;
 static const bool DEFAULT_CHECKPOINTS_ENABLED = true;
 static const bool DEFAULT_TXINDEX = false;
+/** Default for -commentindex */
+static const bool DEFAULT_COMMENTINDEX = false;
+/** Default for -powcache */
+static const bool DEFAULT_POWCACHE = true;
+/** Most PoW hashes held in memory until the next block index flush decides which to keep */
+static const size_t MAX_POWCACHE_PENDING = 100000;
 static const unsigned int DEFAULT_BANSCORE_THRESHOLD = 100;
 
 static const bool DEFAULT_TESTSAFEMODE = false;
@@ -168,6 +184,10 @@ extern bool fImporting;
 extern bool fReindex;
 extern int nScriptCheckThreads;
 extern bool fTxIndex;
+/** Whether transaction comments are indexed by content and height (-commentindex) */
+extern bool fCommentIndex;
+/** Whether validated scrypt PoW hashes are kept in the block tree DB (-powcache) */
+extern bool fPoWCache;
 extern bool fIsBareMultisigStd;
 extern bool fRequireStandard;
 extern bool fCheckBlockIndex;
@@ -190,6 +210,8 @@ static const uint64_t nMinDiskSpace = 52428800;
 /** Pruning-related variables and constants */
 /** True if any block files have ever been pruned. */
 extern bool fHavePruned;
+/** True if the chain state was loaded from a UTXO snapshot, so there is no block data below the snapshot block. */
+extern bool fLoadedUTXOSnapshot;
 /** True if we're running in -prune mode. */
 extern bool fPruneMode;
 /** Number of MiB of block files that we're trying to stay below. */
@@ -244,6 +266,8 @@ bool InitBlockIndex(const CChainParams& chainparams);
 bool LoadBlockIndex();
 /** Unload database information */
 void UnloadBlockIndex();
+/** Load coinsStatsTip from the block tree database, or compute it from the coin database if it is missing or stale */
+bool LoadCoinsStats();
 /** Process protocol messages received from a given node */
 bool ProcessMessages(CNode* pfrom);
 /**
@@ -254,6 +278,10 @@ bool ProcessMessages(CNode* pfrom);
 bool SendMessages(CNode* pto);
 /** Run an instance of the script checking thread */
 void ThreadScriptCheck();
+/** Run an instance of the header proof-of-work check thread */
+void ThreadHeaderPoWCheck();
+/** Run an instance of the block import check thread, used by -reindex and -loadblock */
+void ThreadBlockImportCheck();
 /** Check whether we are doing an initial block download (synchronizing from disk or network) */
 bool IsInitialBlockDownload();
 /** Format a string that describes several potential problems detected by the core.
@@ -307,6 +335,19 @@ void PruneAndFlush();
 bool AcceptToMemoryPool(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
                         bool* pfMissingInputs, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
 
+/** (try to) add transaction to memory pool with a specified acceptance time **/
+bool AcceptToMemoryPoolWithTime(CTxMemPool& pool, CValidationState &state, const CTransaction &tx, bool fLimitFree,
+                                bool* pfMissingInputs, int64_t nAcceptTime, bool fOverrideMempoolLimit=false, const CAmount nAbsurdFee=0);
+
+/** Whether the mempool has been loaded from disk at startup (or that was skipped), so a dump will not lose transactions */
+extern std::atomic<bool> fMempoolLoaded;
+
+/** Load the mempool, with its fee and priority deltas, from mempool.dat in the data directory */
+bool LoadMempool();
+
+/** Dump the mempool, with its fee and priority deltas, to mempool.dat in the data directory */
+bool DumpMempool();
+
 /** Convert CValidationState to a human-readable message for logging */
 std::string FormatStateMessage(const CValidationState &state);
 
@@ -443,6 +484,15 @@ public:
 bool WriteBlockToDisk(const CBlock& block, CDiskBlockPos& pos, const CMessageHeader::MessageStartChars& messageStart);
 bool ReadBlockFromDisk(CBlock& block, const CDiskBlockPos& pos, const Consensus::Params& consensusParams);
 bool ReadBlockFromDisk(CBlock& block, const CBlockIndex* pindex, const Consensus::Params& consensusParams);
+/**
+ * Read a block's bytes as stored on disk, which is its network serialization
+ * including witness data, without deserializing it. The proof of work is not
+ * checked again; only that the header hashes to hashBlock.
+ */
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CDiskBlockPos& pos, const uint256& hashBlock, const CMessageHeader::MessageStartChars& messageStart);
+bool ReadRawBlockFromDisk(std::vector<unsigned char>& vchBlock, const CBlockIndex* pindex, const CMessageHeader::MessageStartChars& messageStart);
+/** Whether a block cannot carry witness data because segwit was not active for it, so its raw bytes are also its serialization without witnesses */
+bool IsBlockWitnessFree(const CBlockIndex* pindex, const Consensus::Params& params);
 
 /** Functions for validating blocks and updating the block tree */
 
@@ -458,15 +508,17 @@ bool ContextualCheckBlock(const CBlock& block, CValidationState& state, CBlockIn
 
 /** Apply the effects of this block (with given index) on the UTXO set represented by coins.
  *  Validity checks that depend on the UTXO set are also done; ConnectBlock()
- *  can fail if those validity checks fail (among other reasons). */
+ *  can fail if those validity checks fail (among other reasons).
+ *  If pstats is provided, it is moved along to the new block on success. */
 bool ConnectBlock(const CBlock& block, CValidationState& state, CBlockIndex* pindex, CCoinsViewCache& coins,
-                  const CChainParams& chainparams, bool fJustCheck = false);
+                  const CChainParams& chainparams, bool fJustCheck = false, CCoinsStats* pstats = NULL);
 
 /** Undo the effects of this block (with given index) on the UTXO set represented by coins.
  *  In case pfClean is provided, operation will try to be tolerant about errors, and *pfClean
  *  will be true if no problems were found. Otherwise, the return value will be false in case
- *  of problems. Note that in any case, coins may be modified. */
-bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL);
+ *  of problems. Note that in any case, coins may be modified.
+ *  If pstats is provided, it is moved back to the previous block on success. */
+bool DisconnectBlock(const CBlock& block, CValidationState& state, const CBlockIndex* pindex, CCoinsViewCache& coins, bool* pfClean = NULL, CCoinsStats* pstats = NULL);
 
 /** Check a block is completely valid from start to finish (only works on top of our current best block, with cs_main held) */
 bool TestBlockValidity(CValidationState& state, const CChainParams& chainparams, const CBlock& block, CBlockIndex* pindexPrev, bool fCheckPOW = true, bool fCheckMerkleRoot = true);
@@ -506,6 +558,13 @@ extern CChain chainActive;
 /** Global variable that points to the active CCoinsView (protected by cs_main) */
 extern CCoinsViewCache *pcoinsTip;
 
+/**
+ * Statistics of the UTXO set, updated as blocks are connected and
+ * disconnected. Only current while its hashBlock is pcoinsTip's best block.
+ * (protected by cs_main)
+ */
+extern CCoinsStats coinsStatsTip;
+
 /** Global variable that points to the active block tree (protected by cs_main) */
 extern CBlockTreeDB *pblocktree;
 
@@ -6,6 +6,7 @@
 #define BITCOIN_MEMUSAGE_H
 
 #include "indirectmap.h"
+#include "support/allocators/pool.h"
 
 #include <stdlib.h>
 
@@ -167,6 +168,21 @@ static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z>& m)
     return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
 }
 
+template<typename X, typename Y, typename Z, size_t MAX_BLOCK_SIZE_BYTES, size_t ALIGN_BYTES>
+static inline size_t DynamicUsage(const boost::unordered_map<X, Y, Z, std::equal_to<X>, PoolAllocator<std::pair<const X, Y>, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> >& m)
+{
+    // Nodes live in the pool's chunks, whether in use or on a free list. The
+    // bucket array comes from the pool too, from its chunks while small and
+    // from operator new once it outgrows the largest pooled block; the latter
+    // is usually the only unpooled allocation, so averaging over them is exact.
+    const PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>* pResource = m.get_allocator().resource();
+    if (pResource == NULL)
+        return MallocUsage(sizeof(boost_unordered_node<std::pair<const X, Y> >)) * m.size() + MallocUsage(sizeof(void*) * m.bucket_count());
+    size_t nUnpooled = pResource->NumUnpooledAllocations();
+    size_t nUnpooledUsage = nUnpooled == 0 ? 0 : MallocUsage(pResource->UnpooledBytes() / nUnpooled) * nUnpooled;
+    return MallocUsage(pResource->ChunkSizeBytes()) * pResource->NumAllocatedChunks() + nUnpooledUsage;
+}
+
 }
 
 #endif // BITCOIN_MEMUSAGE_H
@@ -131,7 +131,8 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
 
     if(!pblocktemplate.get())
         return NULL;
-    pblock = &pblocktemplate->block; // pointer for convenience
+    ptemplate = pblocktemplate.get();
+    pblock = &ptemplate->block; // pointer for convenience
 
     // Add dummy coinbase tx as first transaction
     pblock->vtx.push_back(CTransaction());
@@ -139,8 +140,9 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     pblocktemplate->vTxSigOpsCost.push_back(-1); // updated at end
 
     LOCK2(cs_main, mempool.cs);
-    CBlockIndex* pindexPrev = chainActive.Tip();
+    pindexPrev = chainActive.Tip();
     nHeight = pindexPrev->nHeight + 1;
+    scriptPubKey = scriptPubKeyIn;
 
     pblock->nVersion = ComputeBlockVersion(pindexPrev, chainparams.GetConsensus());
     // -regtest only: allow overriding block.nVersion with
@@ -170,17 +172,7 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     nLastBlockSize = nBlockSize;
     nLastBlockWeight = nBlockWeight;
 
-    // Create coinbase transaction.
-    CMutableTransaction coinbaseTx;
-    coinbaseTx.vin.resize(1);
-    coinbaseTx.vin[0].prevout.SetNull();
-    coinbaseTx.vout.resize(1);
-    coinbaseTx.vout[0].scriptPubKey = scriptPubKeyIn;
-    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
-    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
-    pblock->vtx[0] = coinbaseTx;
-    pblocktemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
-    pblocktemplate->vTxFees[0] = -nFees;
+    CreateCoinbase();
 
     uint64_t nSerializeSize = GetSerializeSize(*pblock, SER_NETWORK, PROTOCOL_VERSION);
     LogPrintf("CreateNewBlock(): total size: %u block weight: %u txs: %u fees: %ld sigops %d\n", nSerializeSize, GetBlockWeight(*pblock), nBlockTx, nFees, nBlockSigOpsCost);
@@ -190,7 +182,6 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     UpdateTime(pblock, chainparams.GetConsensus(), pindexPrev);
     pblock->nBits          = GetNextWorkRequired(pindexPrev, pblock, chainparams.GetConsensus());
     pblock->nNonce         = 0;
-    pblocktemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
 
     CValidationState state;
     if (!TestBlockValidity(state, chainparams, *pblock, pindexPrev, false, false)) {
@@ -200,6 +191,48 @@ CBlockTemplate* BlockAssembler::CreateNewBlock(const CScript& scriptPubKeyIn)
     return pblocktemplate.release();
 }
 
+void BlockAssembler::CreateCoinbase()
+{
+    CMutableTransaction coinbaseTx;
+    coinbaseTx.vin.resize(1);
+    coinbaseTx.vin[0].prevout.SetNull();
+    coinbaseTx.vout.resize(1);
+    coinbaseTx.vout[0].scriptPubKey = scriptPubKey;
+    coinbaseTx.vout[0].nValue = nFees + GetBlockSubsidy(nHeight, chainparams.GetConsensus());
+    coinbaseTx.vin[0].scriptSig = CScript() << nHeight << OP_0;
+    pblock->vtx[0] = coinbaseTx;
+    ptemplate->vchCoinbaseCommitment = GenerateCoinbaseCommitment(*pblock, pindexPrev, chainparams.GetConsensus());
+    ptemplate->vTxFees[0] = -nFees;
+    ptemplate->vTxSigOpsCost[0] = WITNESS_SCALE_FACTOR * GetLegacySigOpCount(pblock->vtx[0]);
+}
+
+bool BlockAssembler::AppendTransaction(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter)
+{
+    // With all of its parents in the block the transaction is a package on its own
+    if (inBlock.count(iter) || isStillDependent(iter))
+        return false;
+    if (iter->GetModifiedFee() < ::minRelayTxFee.GetFee(iter->GetTxSize()))
+        return false;
+    if (!TestPackage(iter->GetTxSize(), iter->GetSigOpCost()))
+        return false;
+    CTxMemPool::setEntries package;
+    package.insert(iter);
+    if (!TestPackageTransactions(package))
+        return false;
+
+    // It passed AcceptToMemoryPool on this same tip, so unlike CreateNewBlock
+    // there is no TestBlockValidity
+    ptemplate = &blocktemplate;
+    pblock = &blocktemplate.block;
+    AddToBlock(iter);
+    CreateCoinbase();
+
+    nLastBlockTx = nBlockTx;
+    nLastBlockSize = nBlockSize;
+    nLastBlockWeight = nBlockWeight;
+    return true;
+}
+
 bool BlockAssembler::isStillDependent(CTxMemPool::txiter iter)
 {
     BOOST_FOREACH(CTxMemPool::txiter parent, mempool.GetMemPoolParents(iter))
@@ -313,8 +346,8 @@ bool BlockAssembler::TestForBlock(CTxMemPool::txiter iter)
 void BlockAssembler::AddToBlock(CTxMemPool::txiter iter)
 {
     pblock->vtx.push_back(iter->GetTx());
-    pblocktemplate->vTxFees.push_back(iter->GetFee());
-    pblocktemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
+    ptemplate->vTxFees.push_back(iter->GetFee());
+    ptemplate->vTxSigOpsCost.push_back(iter->GetSigOpCost());
     if (fNeedSizeAccounting) {
         nBlockSize += ::GetSerializeSize(iter->GetTx(), SER_NETWORK, PROTOCOL_VERSION);
     }
@@ -590,6 +623,65 @@ void BlockAssembler::addPriorityTxs()
     fNeedSizeAccounting = fSizeAccounting;
 }
 
+CBlockTemplateCache blockTemplateCache;
+
+CBlockTemplate* CBlockTemplateCache::Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn, unsigned int& nTransactionsUpdatedRet)
+{
+    AssertLockHeld(cs_main);
+    if (pblocktemplate && (pindexPrev != chainActive.Tip() || scriptPubKey != scriptPubKeyIn ||
+                           mempool.GetTransactionsUpdated() != nTransactionsUpdated ||
+                           (fMissed && GetTime() - nTimeStart > BLOCK_TEMPLATE_REFRESH_INTERVAL)))
+        Clear();
+
+    if (!pblocktemplate) {
+        // Read the counter first, so changes made while assembling are not taken as included
+        nTransactionsUpdated = mempool.GetTransactionsUpdated();
+        nTimeStart = GetTime();
+        fMissed = false;
+        passembler.reset(new BlockAssembler(chainparams));
+        pblocktemplate.reset(passembler->CreateNewBlock(scriptPubKeyIn));
+        if (!pblocktemplate) {
+            passembler.reset();
+            return NULL;
+        }
+        pindexPrev = chainActive.Tip();
+        scriptPubKey = scriptPubKeyIn;
+    }
+    nTransactionsUpdatedRet = nTransactionsUpdated;
+    return pblocktemplate.get();
+}
+
+void CBlockTemplateCache::Clear()
+{
+    pblocktemplate.reset();
+    passembler.reset();
+    pindexPrev = NULL;
+}
+
+void CBlockTemplateCache::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock)
+{
+    // Only mempool acceptance comes without a block index; Get notices new tips
+    if (pindex != NULL || !pblocktemplate)
+        return;
+    AssertLockHeld(cs_main);
+    LOCK(mempool.cs);
+
+    // Unless this transaction entering is the only change since the template
+    // was last brought up to date, the assembler's view of the mempool is stale
+    if (pindexPrev != chainActive.Tip() || mempool.GetTransactionsUpdated() != nTransactionsUpdated + 1) {
+        Clear();
+        return;
+    }
+    CTxMemPool::txiter it = mempool.mapTx.find(tx.GetHash());
+    if (it == mempool.mapTx.end()) {
+        Clear();
+        return;
+    }
+    nTransactionsUpdated++;
+    if (!passembler->AppendTransaction(*pblocktemplate, it))
+        fMissed = true;
+}
+
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce)
 {
     // Update nExtraNonce
@@ -7,7 +7,9 @@
 #define BITCOIN_MINER_H
 
 #include "primitives/block.h"
+#include "script/script.h"
 #include "txmempool.h"
+#include "validationinterface.h"
 
 #include <stdint.h>
 #include <memory>
@@ -17,12 +19,13 @@
 class CBlockIndex;
 class CChainParams;
 class CReserveKey;
-class CScript;
 class CWallet;
 
 namespace Consensus { struct Params; };
 
 static const bool DEFAULT_PRINTPRIORITY = false;
+/** Seconds a cached block template may miss transactions it had no room for before it is assembled again */
+static const int64_t BLOCK_TEMPLATE_REFRESH_INTERVAL = 5;
 
 struct CBlockTemplate
 {
@@ -136,7 +139,10 @@ class BlockAssembler
 private:
     // The constructed block template
     std::unique_ptr<CBlockTemplate> pblocktemplate;
-    // A convenience pointer that always refers to the CBlock in pblocktemplate
+    // The template being filled: pblocktemplate in CreateNewBlock, or the
+    // caller's in AppendTransaction, which this does not own
+    CBlockTemplate* ptemplate;
+    // A convenience pointer that always refers to the CBlock in ptemplate
     CBlock* pblock;
 
     // Configuration parameters for the block size
@@ -153,9 +159,11 @@ private:
     CTxMemPool::setEntries inBlock;
 
     // Chain context for the block
+    CBlockIndex* pindexPrev;
     int nHeight;
     int64_t nLockTimeCutoff;
     const CChainParams& chainparams;
+    CScript scriptPubKey;
 
     // Variables used for addPriorityTxs
     int lastFewTxs;
@@ -165,6 +173,13 @@ public:
     BlockAssembler(const CChainParams& chainparams);
     /** Construct a new block template with coinbase to scriptPubKeyIn */
     CBlockTemplate* CreateNewBlock(const CScript& scriptPubKeyIn);
+    /**
+     * Append a transaction that entered the mempool after CreateNewBlock to
+     * the template it returned, if all of its unconfirmed parents are in the
+     * block already, it pays the relay fee and it fits. Nothing may have
+     * left the mempool in the meantime. Requires mempool.cs.
+     */
+    bool AppendTransaction(CBlockTemplate& blocktemplate, CTxMemPool::txiter iter);
 
 private:
     // utility functions
@@ -172,6 +187,8 @@ private:
     void resetBlock();
     /** Add a tx to the block */
     void AddToBlock(CTxMemPool::txiter iter);
+    /** (Re)create the coinbase paying the fees so far, and its witness commitment */
+    void CreateCoinbase();
 
     // Methods for how to add transactions to a block.
     /** Add transactions based on tx "priority" */
@@ -205,6 +222,49 @@ private:
     void UpdatePackagesForAdded(const CTxMemPool::setEntries& alreadyAdded, indexed_modified_transaction_set &mapModifiedTx);
 };
 
+/**
+ * The template getblocktemplate hands out, kept up to date as transactions
+ * enter the mempool instead of being assembled again on every call. A new
+ * transaction is appended when its unconfirmed parents are in the block
+ * already and it fits. A new tip or any other change to the mempool (a
+ * transaction leaving it, a fee delta) drops the template, so the next Get
+ * assembles a fresh one; so does a transaction that could not be appended,
+ * once the template is BLOCK_TEMPLATE_REFRESH_INTERVAL seconds old.
+ * Everything here requires cs_main.
+ */
+class CBlockTemplateCache : public CValidationInterface
+{
+private:
+    std::unique_ptr<BlockAssembler> passembler;
+    std::unique_ptr<CBlockTemplate> pblocktemplate;
+    CBlockIndex* pindexPrev;
+    CScript scriptPubKey;
+    //! the mempool's transactions-updated counter the template reflects
+    unsigned int nTransactionsUpdated;
+    int64_t nTimeStart;
+    //! whether a transaction was left out that a fresh template might include
+    bool fMissed;
+
+protected:
+    void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock);
+
+public:
+    CBlockTemplateCache() : pindexPrev(NULL), nTransactionsUpdated(0), nTimeStart(0), fMissed(false) {}
+
+    /**
+     * The template on the current tip with coinbase to scriptPubKeyIn,
+     * assembled anew only if needed. It remains owned by the cache and is
+     * only valid while cs_main stays held. nTransactionsUpdatedRet is set to
+     * the mempool's transactions-updated counter it reflects.
+     */
+    CBlockTemplate* Get(const CChainParams& chainparams, const CScript& scriptPubKeyIn, unsigned int& nTransactionsUpdatedRet);
+    /** Drop the template */
+    void Clear();
+};
+
+/** Template cache behind getblocktemplate */
+extern CBlockTemplateCache blockTemplateCache;
+
 /** Modify the extranonce in a block */
 void IncrementExtraNonce(CBlock* pblock, const CBlockIndex* pindexPrev, unsigned int& nExtraNonce);
 int64_t UpdateTime(CBlockHeader* pblock, const Consensus::Params& consensusParams, const CBlockIndex* pindexPrev);
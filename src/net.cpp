@@ -93,6 +93,8 @@ uint64_t nLocalHostNonce = 0;
 static std::vector<ListenSocket> vhListenSocket;
 CAddrMan addrman;
 int nMaxConnections = DEFAULT_MAX_PEER_CONNECTIONS;
+int nMessageHandlerThreads = DEFAULT_MSGHANDLER_THREADS;
+SocketEventsMode nSocketEventsMode = DEFAULT_SOCKETEVENTS;
 bool fAddressesInitialized = false;
 std::string strSubVersion;
 
@@ -110,7 +112,40 @@ NodeId nLastNodeId = 0;
 CCriticalSection cs_nLastNodeId;
 
 static CSemaphore *semOutbound = NULL;
-boost::condition_variable messageHandlerCondition;
+static CSocketPoller *pSocketPoller = NULL;
+
+/** Whether the socket handler can service hSocket with the configured -socketevents */
+static bool IsPollableSocket(SOCKET hSocket)
+{
+    return nSocketEventsMode != SOCKETEVENTS_SELECT || IsSelectableSocket(hSocket);
+}
+
+/** Wakes one message handler thread when one of its peers has work */
+struct MessageHandlerSignal
+{
+    boost::mutex mutex;
+    boost::condition_variable cond;
+    bool fWake;
+
+    MessageHandlerSignal() : fWake(false) {}
+};
+static MessageHandlerSignal vMessageHandlerSignals[MAX_MSGHANDLER_THREADS];
+
+/** Peers are sharded across message handler threads by node id */
+static int MessageHandlerForNode(NodeId id)
+{
+    return id % nMessageHandlerThreads;
+}
+
+static void WakeMessageHandler(NodeId id)
+{
+    MessageHandlerSignal& signal = vMessageHandlerSignals[MessageHandlerForNode(id)];
+    {
+        boost::lock_guard<boost::mutex> lock(signal.mutex);
+        signal.fWake = true;
+    }
+    signal.cond.notify_one();
+}
 
 // Signals for message handling
 static CNodeSignals g_signals;
@@ -408,7 +443,7 @@ CNode* ConnectNode(CAddress addrConnect, const char *pszDest, bool fCountFailure
     if (pszDest ? ConnectSocketByName(addrConnect, hSocket, pszDest, Params().GetDefaultPort(), nConnectTimeout, &proxyConnectionFailed) :
                   ConnectSocket(addrConnect, hSocket, nConnectTimeout, &proxyConnectionFailed))
     {
-        if (!IsSelectableSocket(hSocket)) {
+        if (!IsPollableSocket(hSocket)) {
             LogPrintf("Cannot create connection: non-selectable socket created (fd >= FD_SETSIZE ?)\n");
             CloseSocket(hSocket);
             return NULL;
@@ -484,6 +519,8 @@ void CNode::CloseSocketDisconnect()
     if (hSocket != INVALID_SOCKET)
     {
         LogPrint("net", "disconnecting peer=%d\n", id);
+        if (pSocketPoller)
+            pSocketPoller->Remove(hSocket, id);
         CloseSocket(hSocket);
     }
 
@@ -762,7 +799,7 @@ bool CNode::ReceiveMsgBytes(const char *pch, unsigned int nBytes)
             i->second += msg.hdr.nMessageSize + CMessageHeader::HEADER_SIZE;
 
             msg.nTime = GetTimeMicros();
-            messageHandlerCondition.notify_one();
+            WakeMessageHandler(id);
         }
     }
 
@@ -1043,7 +1080,7 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
         return;
     }
 
-    if (!IsSelectableSocket(hSocket))
+    if (!IsPollableSocket(hSocket))
     {
         LogPrintf("connection from %s dropped: non-selectable socket\n", addr.ToString());
         CloseSocket(hSocket);
@@ -1088,8 +1125,21 @@ static void AcceptConnection(const ListenSocket& hListenSocket) {
     }
 }
 
+bool InitSocketPoller()
+{
+    assert(pSocketPoller == NULL);
+    pSocketPoller = CSocketPoller::Create(nSocketEventsMode);
+    return pSocketPoller != NULL;
+}
+
 void ThreadSocketHandler()
 {
+    assert(pSocketPoller);
+    std::map<SOCKET, int> mapReady;
+
+    for (size_t i = 0; i < vhListenSocket.size(); i++)
+        pSocketPoller->Add(vhListenSocket[i].socket, CSocketPoller::EVENT_RECV, -1 - (int64_t)i);
+
     unsigned int nPrevNodeCount = 0;
     while (true)
     {
@@ -1111,8 +1161,11 @@ void ThreadSocketHandler()
                     // release outbound grant (if any)
                     pnode->grantOutbound.Release();
 
-                    // close socket and cleanup
+                    // close socket and cleanup; the socket may have been
+                    // closed by another thread after it was registered
                     pnode->CloseSocketDisconnect();
+                    if (pnode->hSocketPolled != INVALID_SOCKET)
+                        pSocketPoller->Remove(pnode->hSocketPolled, pnode->id);
 
                     // hold in disconnected pool until all refs are released
                     if (pnode->fNetworkNode || pnode->fInbound)
@@ -1159,43 +1212,26 @@ void ThreadSocketHandler()
         //
         // Find which sockets have data to receive
         //
-        struct timeval timeout;
-        timeout.tv_sec  = 0;
-        timeout.tv_usec = 50000; // frequency to poll pnode->vSend
-
-        fd_set fdsetRecv;
-        fd_set fdsetSend;
-        fd_set fdsetError;
-        FD_ZERO(&fdsetRecv);
-        FD_ZERO(&fdsetSend);
-        FD_ZERO(&fdsetError);
-        SOCKET hSocketMax = 0;
-        bool have_fds = false;
-
-        BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket) {
-            FD_SET(hListenSocket.socket, &fdsetRecv);
-            hSocketMax = std::max(hSocketMax, hListenSocket.socket);
-            have_fds = true;
-        }
+        const int64_t nTimeout = 50; // frequency to poll pnode->vSend, in milliseconds
+        bool have_fds = !vhListenSocket.empty();
 
         {
             LOCK(cs_vNodes);
             BOOST_FOREACH(CNode* pnode, vNodes)
             {
-                if (pnode->hSocket == INVALID_SOCKET)
+                SOCKET hSocket = pnode->hSocket;
+                if (hSocket == INVALID_SOCKET)
                     continue;
-                FD_SET(pnode->hSocket, &fdsetError);
-                hSocketMax = std::max(hSocketMax, pnode->hSocket);
                 have_fds = true;
 
                 // Implement the following logic:
-                // * If there is data to send, select() for sending data. As this only
+                // * If there is data to send, wait for sending data. As this only
                 //   happens when optimistic write failed, we choose to first drain the
                 //   write buffer in this case before receiving more. This avoids
                 //   needlessly queueing received data, if the remote peer is not themselves
                 //   receiving data. This means properly utilizing TCP flow control signalling.
                 // * Otherwise, if there is no (complete) message in the receive buffer,
-                //   or there is space left in the buffer, select() for receiving data.
+                //   or there is space left in the buffer, wait for receiving data.
                 // * (if neither of the above applies, there is certainly one message
                 //   in the receiver buffer ready to be processed).
                 // Together, that means that at least one of the following is always possible,
@@ -1203,39 +1239,46 @@ void ThreadSocketHandler()
                 // * We send some data.
                 // * We wait for data to be received (and disconnect after timeout).
                 // * We process a message in the buffer (message handler thread).
+                // Errors are waited for in any case.
+                int nEvents = 0;
                 {
                     TRY_LOCK(pnode->cs_vSend, lockSend);
-                    if (lockSend && !pnode->vSendMsg.empty()) {
-                        FD_SET(pnode->hSocket, &fdsetSend);
-                        continue;
-                    }
+                    if (lockSend && !pnode->vSendMsg.empty())
+                        nEvents = CSocketPoller::EVENT_SEND;
                 }
+                if (nEvents == 0)
                 {
                     TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                     if (lockRecv && (
                         pnode->vRecvMsg.empty() || !pnode->vRecvMsg.front().complete() ||
                         pnode->GetTotalRecvSize() <= ReceiveFloodSize()))
-                        FD_SET(pnode->hSocket, &fdsetRecv);
+                        nEvents = CSocketPoller::EVENT_RECV;
+                }
+                if (pnode->hSocketPolled != hSocket) {
+                    if (!pSocketPoller->Add(hSocket, nEvents, pnode->id)) {
+                        LogPrintf("socket %s registration failed for peer=%d: %s\n", GetSocketEventsModeName(nSocketEventsMode), pnode->id, NetworkErrorString(WSAGetLastError()));
+                        pnode->fDisconnect = true;
+                        continue;
+                    }
+                    pnode->hSocketPolled = hSocket;
+                } else if (pnode->nPollEvents != nEvents) {
+                    pSocketPoller->Modify(hSocket, nEvents);
                 }
+                pnode->nPollEvents = nEvents;
             }
         }
 
-        int nSelect = select(have_fds ? hSocketMax + 1 : 0,
-                             &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        bool fPollOk = pSocketPoller->Wait(nTimeout, mapReady);
         boost::this_thread::interruption_point();
 
-        if (nSelect == SOCKET_ERROR)
+        if (!fPollOk)
         {
             if (have_fds)
             {
                 int nErr = WSAGetLastError();
-                LogPrintf("socket select error %s\n", NetworkErrorString(nErr));
-                for (unsigned int i = 0; i <= hSocketMax; i++)
-                    FD_SET(i, &fdsetRecv);
+                LogPrintf("socket %s error %s\n", GetSocketEventsModeName(nSocketEventsMode), NetworkErrorString(nErr));
             }
-            FD_ZERO(&fdsetSend);
-            FD_ZERO(&fdsetError);
-            MilliSleep(timeout.tv_usec/1000);
+            MilliSleep(nTimeout);
         }
 
         //
@@ -1243,7 +1286,7 @@ void ThreadSocketHandler()
         //
         BOOST_FOREACH(const ListenSocket& hListenSocket, vhListenSocket)
         {
-            if (hListenSocket.socket != INVALID_SOCKET && FD_ISSET(hListenSocket.socket, &fdsetRecv))
+            if (hListenSocket.socket != INVALID_SOCKET && mapReady.count(hListenSocket.socket))
             {
                 AcceptConnection(hListenSocket);
             }
@@ -1268,7 +1311,16 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetRecv) || FD_ISSET(pnode->hSocket, &fdsetError))
+            std::map<SOCKET, int>::const_iterator itReady = mapReady.find(pnode->hSocket);
+            int nReady = itReady == mapReady.end() ? 0 : itReady->second;
+            // Only do what was waited for: an error on a socket held back from
+            // receiving is found by send(), or by recv() once it resumes
+            if (pnode->hSocketPolled != pnode->hSocket)
+                nReady = 0;
+            if (nReady & CSocketPoller::EVENT_ERR)
+                nReady |= pnode->nPollEvents;
+            nReady &= pnode->nPollEvents;
+            if (nReady & CSocketPoller::EVENT_RECV)
             {
                 TRY_LOCK(pnode->cs_vRecvMsg, lockRecv);
                 if (lockRecv)
@@ -1312,11 +1364,16 @@ void ThreadSocketHandler()
             //
             if (pnode->hSocket == INVALID_SOCKET)
                 continue;
-            if (FD_ISSET(pnode->hSocket, &fdsetSend))
+            if (nReady & CSocketPoller::EVENT_SEND)
             {
                 TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
+                if (lockSend) {
+                    bool fWasFull = pnode->nSendSize >= SendBufferSize();
                     SocketSendData(pnode);
+                    // The message handler stops serving getdata while the send buffer is full
+                    if (fWasFull && pnode->nSendSize < SendBufferSize())
+                        WakeMessageHandler(pnode->id);
+                }
             }
 
             //
@@ -1849,19 +1906,20 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 }
 
 
-void ThreadMessageHandler()
+void ThreadMessageHandler(int nWorker)
 {
-    boost::mutex condition_mutex;
-    boost::unique_lock<boost::mutex> lock(condition_mutex);
+    MessageHandlerSignal& signal = vMessageHandlerSignals[nWorker];
 
     while (true)
     {
         std::vector<CNode*> vNodesCopy;
         {
             LOCK(cs_vNodes);
-            vNodesCopy = vNodes;
-            BOOST_FOREACH(CNode* pnode, vNodesCopy) {
+            BOOST_FOREACH(CNode* pnode, vNodes) {
+                if (MessageHandlerForNode(pnode->id) != nWorker)
+                    continue;
                 pnode->AddRef();
+                vNodesCopy.push_back(pnode);
             }
         }
 
@@ -1891,12 +1949,10 @@ void ThreadMessageHandler()
             }
             boost::this_thread::interruption_point();
 
-            // Send messages
-            {
-                TRY_LOCK(pnode->cs_vSend, lockSend);
-                if (lockSend)
-                    GetNodeSignals().SendMessages(pnode);
-            }
+            // Send messages. Each push takes cs_vSend by itself; holding it
+            // here would invert the lock order of ProcessMessage on another
+            // handler thread pushing to this peer.
+            GetNodeSignals().SendMessages(pnode);
             boost::this_thread::interruption_point();
         }
 
@@ -1906,8 +1962,14 @@ void ThreadMessageHandler()
                 pnode->Release();
         }
 
-        if (fSleep)
-            messageHandlerCondition.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+        if (fSleep) {
+            // Woken as soon as one of our peers receives a message; the timeout
+            // keeps SendMessages' pings, address and inventory trickles running.
+            boost::unique_lock<boost::mutex> lock(signal.mutex);
+            if (!signal.fWake)
+                signal.cond.timed_wait(lock, boost::posix_time::microsec_clock::universal_time() + boost::posix_time::milliseconds(100));
+            signal.fWake = false;
+        }
     }
 }
 
@@ -1938,7 +2000,7 @@ bool BindListenPort(const CService &addrBind, std::string& strError, bool fWhite
         LogPrintf("%s\n", strError);
         return false;
     }
-    if (!IsSelectableSocket(hListenSocket))
+    if (!IsPollableSocket(hListenSocket))
     {
         strError = "Error: Couldn't create a listenable socket for incoming connections";
         LogPrintf("%s\n", strError);
@@ -2136,7 +2198,8 @@ void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler)
     threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "opencon", &ThreadOpenConnections));
 
     // Process messages
-    threadGroup.create_thread(boost::bind(&TraceThread<void (*)()>, "msghand", &ThreadMessageHandler));
+    for (int i = 0; i < nMessageHandlerThreads; i++)
+        threadGroup.create_thread(boost::bind(&TraceThread<boost::function<void()> >, "msghand", boost::function<void()>(boost::bind(&ThreadMessageHandler, i))));
 
     // Dump network addresses
     scheduler.scheduleEvery(&DumpData, DUMP_ADDRESSES_INTERVAL);
@@ -2185,6 +2248,8 @@ public:
         vhListenSocket.clear();
         delete semOutbound;
         semOutbound = NULL;
+        delete pSocketPoller;
+        pSocketPoller = NULL;
         delete pnodeLocalHost;
         pnodeLocalHost = NULL;
 
@@ -2471,6 +2536,8 @@ CNode::CNode(SOCKET hSocketIn, const CAddress& addrIn, const std::string& addrNa
     nServices = NODE_NONE;
     nServicesExpected = NODE_NONE;
     hSocket = hSocketIn;
+    hSocketPolled = INVALID_SOCKET;
+    nPollEvents = 0;
     nRecvVersion = INIT_PROTO_VERSION;
     nLastSend = 0;
     nLastRecv = 0;
@@ -11,6 +11,7 @@
 #include "compat.h"
 #include "limitedmap.h"
 #include "netbase.h"
+#include "netpoll.h"
 #include "protocol.h"
 #include "random.h"
 #include "streams.h"
@@ -69,6 +70,10 @@ static const unsigned int DEFAULT_MAX_PEER_CONNECTIONS = 125;
 static const uint64_t DEFAULT_MAX_UPLOAD_TARGET = 0;
 /** Default for blocks only*/
 static const bool DEFAULT_BLOCKSONLY = false;
+/** -msghandlerthreads default */
+static const int DEFAULT_MSGHANDLER_THREADS = 1;
+/** Maximum number of message handler threads */
+static const int MAX_MSGHANDLER_THREADS = 16;
 
 static const bool DEFAULT_FORCEDNSSEED = false;
 static const size_t DEFAULT_MAXRECEIVEBUFFER = 5 * 1000;
@@ -95,6 +100,8 @@ bool OpenNetworkConnection(const CAddress& addrConnect, bool fCountFailure, CSem
 void MapPort(bool fUseUPnP);
 unsigned short GetListenPort();
 bool BindListenPort(const CService &bindAddr, std::string& strError, bool fWhitelisted = false);
+/** Set up the socket handler's poller for nSocketEventsMode; fails if the mode cannot be used */
+bool InitSocketPoller();
 void StartNode(boost::thread_group& threadGroup, CScheduler& scheduler);
 bool StopNode();
 void SocketSendData(CNode *pnode);
@@ -165,6 +172,10 @@ extern CAddrMan addrman;
 
 /** Maximum number of connections to simultaneously allow (aka connection slots) */
 extern int nMaxConnections;
+/** Number of message handler threads; peers are sharded across them by node id */
+extern int nMessageHandlerThreads;
+/** How the socket handler waits for socket readiness (-socketevents) */
+extern SocketEventsMode nSocketEventsMode;
 
 extern std::vector<CNode*> vNodes;
 extern CCriticalSection cs_vNodes;
@@ -325,6 +336,9 @@ public:
     ServiceFlags nServices;
     ServiceFlags nServicesExpected;
     SOCKET hSocket;
+    //! Socket and events the socket handler registered with its poller
+    SOCKET hSocketPolled;
+    int nPollEvents;
     CDataStream ssSend;
     size_t nSendSize; // total size of all vSendMsg entries
     size_t nSendOffset; // offset inside the first vSendMsg already sent
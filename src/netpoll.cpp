@@ -0,0 +1,287 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "netpoll.h"
+
+#include "netbase.h"
+#include "sync.h"
+
+#include <algorithm>
+#include <vector>
+
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#endif
+
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& modeOut)
+{
+    if (strMode == "select") {
+        modeOut = SOCKETEVENTS_SELECT;
+        return true;
+    }
+#ifdef HAVE_SYS_EPOLL_H
+    if (strMode == "epoll") {
+        modeOut = SOCKETEVENTS_EPOLL;
+        return true;
+    }
+#endif
+    return false;
+}
+
+std::string GetSocketEventsModeName(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SOCKETEVENTS_SELECT: return "select";
+    case SOCKETEVENTS_EPOLL: return "epoll";
+    }
+    return "";
+}
+
+namespace {
+
+struct SocketRegistration
+{
+    int64_t nOwner;
+    int nEvents;
+};
+
+class CSelectSocketPoller : public CSocketPoller
+{
+private:
+    CCriticalSection cs;
+    std::map<SOCKET, SocketRegistration> mapRegistered;
+
+public:
+    bool Add(SOCKET hSocket, int nEvents, int64_t nOwner)
+    {
+        if (!IsSupported(hSocket))
+            return false;
+        LOCK(cs);
+        SocketRegistration& reg = mapRegistered[hSocket];
+        reg.nOwner = nOwner;
+        reg.nEvents = nEvents;
+        return true;
+    }
+
+    void Modify(SOCKET hSocket, int nEvents)
+    {
+        LOCK(cs);
+        std::map<SOCKET, SocketRegistration>::iterator it = mapRegistered.find(hSocket);
+        if (it != mapRegistered.end())
+            it->second.nEvents = nEvents;
+    }
+
+    void Remove(SOCKET hSocket, int64_t nOwner)
+    {
+        LOCK(cs);
+        std::map<SOCKET, SocketRegistration>::iterator it = mapRegistered.find(hSocket);
+        if (it != mapRegistered.end() && it->second.nOwner == nOwner)
+            mapRegistered.erase(it);
+    }
+
+    bool Wait(int64_t nTimeoutMs, std::map<SOCKET, int>& mapReady)
+    {
+        mapReady.clear();
+        fd_set fdsetRecv;
+        fd_set fdsetSend;
+        fd_set fdsetError;
+        FD_ZERO(&fdsetRecv);
+        FD_ZERO(&fdsetSend);
+        FD_ZERO(&fdsetError);
+        SOCKET hSocketMax = 0;
+        std::vector<SOCKET> vSockets;
+        {
+            LOCK(cs);
+            vSockets.reserve(mapRegistered.size());
+            for (std::map<SOCKET, SocketRegistration>::const_iterator it = mapRegistered.begin(); it != mapRegistered.end(); it++) {
+                if (it->second.nEvents == 0)
+                    continue;
+                FD_SET(it->first, &fdsetError);
+                if (it->second.nEvents & EVENT_RECV)
+                    FD_SET(it->first, &fdsetRecv);
+                if (it->second.nEvents & EVENT_SEND)
+                    FD_SET(it->first, &fdsetSend);
+                hSocketMax = std::max(hSocketMax, it->first);
+                vSockets.push_back(it->first);
+            }
+        }
+
+        struct timeval timeout = MillisToTimeval(nTimeoutMs);
+        int nSelect = select(vSockets.empty() ? 0 : hSocketMax + 1, &fdsetRecv, &fdsetSend, &fdsetError, &timeout);
+        bool fRet = nSelect != SOCKET_ERROR;
+        for (size_t i = 0; i < vSockets.size(); i++) {
+            SOCKET hSocket = vSockets[i];
+            int nReady = 0;
+            if (!fRet || FD_ISSET(hSocket, &fdsetRecv))
+                nReady |= EVENT_RECV;
+            if (fRet && FD_ISSET(hSocket, &fdsetSend))
+                nReady |= EVENT_SEND;
+            if (fRet && FD_ISSET(hSocket, &fdsetError))
+                nReady |= EVENT_ERR;
+            if (nReady)
+                mapReady[hSocket] = nReady;
+        }
+        return fRet;
+    }
+
+    bool IsSupported(SOCKET hSocket) const
+    {
+        return IsSelectableSocket(hSocket);
+    }
+};
+
+#ifdef HAVE_SYS_EPOLL_H
+class CEpollSocketPoller : public CSocketPoller
+{
+private:
+    int hEpoll;
+    CCriticalSection cs;
+    //! Every socket added; only those waiting for events are in the kernel's set
+    std::map<SOCKET, SocketRegistration> mapRegistered;
+    std::vector<struct epoll_event> vEvents;
+
+    static uint32_t ToEpollEvents(int nEvents)
+    {
+        uint32_t nEpollEvents = 0;
+        if (nEvents & EVENT_RECV)
+            nEpollEvents |= EPOLLIN;
+        if (nEvents & EVENT_SEND)
+            nEpollEvents |= EPOLLOUT;
+        return nEpollEvents;
+    }
+
+    bool Control(int nOp, SOCKET hSocket, int nEvents)
+    {
+        struct epoll_event event;
+        event.events = ToEpollEvents(nEvents);
+        event.data.fd = hSocket;
+        return epoll_ctl(hEpoll, nOp, hSocket, &event) == 0;
+    }
+
+    /** Move hSocket's kernel registration from nEventsOld to nEventsNew */
+    bool Update(SOCKET hSocket, int nEventsOld, int nEventsNew)
+    {
+        if (nEventsOld == nEventsNew)
+            return true;
+        if (nEventsNew == 0) {
+            Control(EPOLL_CTL_DEL, hSocket, 0);
+            return true;
+        }
+        if (nEventsOld == 0)
+            return Control(EPOLL_CTL_ADD, hSocket, nEventsNew) || (errno == EEXIST && Control(EPOLL_CTL_MOD, hSocket, nEventsNew));
+        return Control(EPOLL_CTL_MOD, hSocket, nEventsNew) || (errno == ENOENT && Control(EPOLL_CTL_ADD, hSocket, nEventsNew));
+    }
+
+public:
+    CEpollSocketPoller(int hEpollIn) : hEpoll(hEpollIn) {}
+
+    ~CEpollSocketPoller()
+    {
+        close(hEpoll);
+    }
+
+    bool Add(SOCKET hSocket, int nEvents, int64_t nOwner)
+    {
+        LOCK(cs);
+        std::map<SOCKET, SocketRegistration>::iterator it = mapRegistered.find(hSocket);
+        if (it != mapRegistered.end() && it->second.nOwner != nOwner) {
+            // The descriptor was closed and reused before its old owner
+            // removed it; the kernel dropped the old registration on close.
+            Control(EPOLL_CTL_DEL, hSocket, 0);
+            mapRegistered.erase(it);
+            it = mapRegistered.end();
+        }
+        if (!Update(hSocket, it == mapRegistered.end() ? 0 : it->second.nEvents, nEvents)) {
+            if (it != mapRegistered.end())
+                mapRegistered.erase(it);
+            return false;
+        }
+        SocketRegistration& reg = mapRegistered[hSocket];
+        reg.nOwner = nOwner;
+        reg.nEvents = nEvents;
+        return true;
+    }
+
+    void Modify(SOCKET hSocket, int nEvents)
+    {
+        LOCK(cs);
+        std::map<SOCKET, SocketRegistration>::iterator it = mapRegistered.find(hSocket);
+        if (it == mapRegistered.end())
+            return;
+        if (!Update(hSocket, it->second.nEvents, nEvents)) {
+            mapRegistered.erase(it);
+            return;
+        }
+        it->second.nEvents = nEvents;
+    }
+
+    void Remove(SOCKET hSocket, int64_t nOwner)
+    {
+        LOCK(cs);
+        std::map<SOCKET, SocketRegistration>::iterator it = mapRegistered.find(hSocket);
+        if (it == mapRegistered.end() || it->second.nOwner != nOwner)
+            return;
+        if (it->second.nEvents != 0)
+            Control(EPOLL_CTL_DEL, hSocket, 0);
+        mapRegistered.erase(it);
+    }
+
+    bool Wait(int64_t nTimeoutMs, std::map<SOCKET, int>& mapReady)
+    {
+        mapReady.clear();
+        {
+            LOCK(cs);
+            vEvents.resize(std::max(mapRegistered.size(), (size_t)1));
+        }
+        int nReady = epoll_wait(hEpoll, &vEvents[0], vEvents.size(), nTimeoutMs);
+        if (nReady < 0) {
+            if (errno == EINTR)
+                return true;
+            LOCK(cs);
+            for (std::map<SOCKET, SocketRegistration>::const_iterator it = mapRegistered.begin(); it != mapRegistered.end(); it++)
+                if (it->second.nEvents != 0)
+                    mapReady[it->first] = EVENT_RECV;
+            return false;
+        }
+        for (int i = 0; i < nReady; i++) {
+            int nEvents = 0;
+            if (vEvents[i].events & EPOLLIN)
+                nEvents |= EVENT_RECV;
+            if (vEvents[i].events & EPOLLOUT)
+                nEvents |= EVENT_SEND;
+            if (vEvents[i].events & (EPOLLERR | EPOLLHUP))
+                nEvents |= EVENT_ERR;
+            mapReady[vEvents[i].data.fd] = nEvents;
+        }
+        return true;
+    }
+
+    bool IsSupported(SOCKET hSocket) const
+    {
+        return true;
+    }
+};
+#endif // HAVE_SYS_EPOLL_H
+
+} // namespace
+
+CSocketPoller* CSocketPoller::Create(SocketEventsMode mode)
+{
+    switch (mode) {
+    case SOCKETEVENTS_SELECT:
+        return new CSelectSocketPoller();
+    case SOCKETEVENTS_EPOLL:
+#ifdef HAVE_SYS_EPOLL_H
+    {
+        int hEpoll = epoll_create1(EPOLL_CLOEXEC);
+        if (hEpoll < 0)
+            return NULL;
+        return new CEpollSocketPoller(hEpoll);
+    }
+#else
+        return NULL;
+#endif
+    }
+    return NULL;
+}
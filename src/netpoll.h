@@ -0,0 +1,93 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_NETPOLL_H
+#define BITCOIN_NETPOLL_H
+
+#if defined(HAVE_CONFIG_H)
+#include "config/bitcoin-config.h"
+#endif
+
+#include "compat.h"
+
+#include <map>
+#include <stdint.h>
+#include <string>
+
+enum SocketEventsMode
+{
+    SOCKETEVENTS_SELECT,
+    SOCKETEVENTS_EPOLL,
+};
+
+/** -socketevents default: epoll where the platform has it */
+#ifdef HAVE_SYS_EPOLL_H
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_EPOLL;
+#else
+static const SocketEventsMode DEFAULT_SOCKETEVENTS = SOCKETEVENTS_SELECT;
+#endif
+
+/** Parse a -socketevents value; fails for modes this build does not support */
+bool ParseSocketEventsMode(const std::string& strMode, SocketEventsMode& modeOut);
+std::string GetSocketEventsModeName(SocketEventsMode mode);
+
+/**
+ * Waits for readiness on a set of sockets.
+ *
+ * Sockets are registered once with Add(), have the events they are waited
+ * for changed with Modify() and are dropped with Remove() before they are
+ * closed. Errors and hangups are reported for sockets waiting for any event;
+ * a socket waiting for none is not watched at all, so that a peer whose
+ * receiving is held back cannot make every Wait() return at once.
+ *
+ * The select() backend rebuilds its fd_sets from the registrations every
+ * round, has the kernel scan all of them, and can only handle descriptors
+ * below FD_SETSIZE. The epoll backend keeps the registrations in the kernel
+ * and only calls epoll_ctl when they change, and has no limit on descriptor
+ * numbers.
+ *
+ * Remove() may be called from any thread; everything else belongs to the
+ * socket handler thread.
+ */
+class CSocketPoller
+{
+public:
+    enum {
+        EVENT_RECV = 1,
+        EVENT_SEND = 2,
+        EVENT_ERR = 4,
+    };
+
+    virtual ~CSocketPoller() {}
+
+    /**
+     * Start watching hSocket for nEvents. nOwner identifies what the socket
+     * belongs to, so that a descriptor number that was closed and reused for
+     * a new connection replaces the old registration instead of being
+     * mistaken for it. Returns false if the socket cannot be watched.
+     */
+    virtual bool Add(SOCKET hSocket, int nEvents, int64_t nOwner) = 0;
+
+    /** Change the events hSocket is watched for */
+    virtual void Modify(SOCKET hSocket, int nEvents) = 0;
+
+    /** Stop watching hSocket, if it is still registered to nOwner */
+    virtual void Remove(SOCKET hSocket, int64_t nOwner) = 0;
+
+    /**
+     * Wait up to nTimeoutMs for any of the registered sockets to become ready
+     * and return their events in mapReady. On failure returns false and
+     * reports every watched socket as readable, so that broken ones get found
+     * by recv().
+     */
+    virtual bool Wait(int64_t nTimeoutMs, std::map<SOCKET, int>& mapReady) = 0;
+
+    /** Whether hSocket can be handed to this poller at all */
+    virtual bool IsSupported(SOCKET hSocket) const = 0;
+
+    /** Create a poller for mode, or NULL if it is not available */
+    static CSocketPoller* Create(SocketEventsMode mode);
+};
+
+#endif // BITCOIN_NETPOLL_H
@@ -27,6 +27,10 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     if (pindexLast == NULL)
         return nProofOfWorkLimit;
 
+    // Regtest leaves the retarget intervals unset; its target never changes
+    if (params.fPowNoRetargeting)
+        return pindexLast->nBits;
+
     unsigned int nInterval;
     unsigned int nTargetTimespan;
     unsigned int nAveragingInterval;
@@ -93,11 +97,10 @@ unsigned int GetNextWorkRequired(const CBlockIndex* pindexLast, const CBlockHead
     if ((pindexLast->nHeight+1) != nAveragingInterval)
         blockstogoback = nAveragingInterval;
 
-    // Go back by what we want to be nAveragingInterval worth of blocks
-    const CBlockIndex* pindexFirst = pindexLast;
-    for (int i = 0; pindexFirst && i < blockstogoback; i++)
-        pindexFirst = pindexFirst->pprev;
-
+    // Go back by what we want to be nAveragingInterval worth of blocks.
+    // Florincoin retargets every block, so jump through the skiplist rather
+    // than walking pprev for every header we validate.
+    const CBlockIndex* pindexFirst = pindexLast->GetAncestor(pindexLast->nHeight - blockstogoback);
     assert(pindexFirst);
 
     return CalculateNextWorkRequired(pindexLast, pindexFirst->GetBlockTime(), params);
@@ -23,6 +23,17 @@ uint256 CBlockHeader::GetPoWHash() const
     return thash;
 }
 
+void GetPoWHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashesOut)
+{
+    // Pack the 80-byte headers back to back, the layout scrypt_1024_1_1_256_multi expects
+    std::vector<char> vInput(80 * headers.size());
+    for (size_t i = 0; i < headers.size(); i++)
+        memcpy(&vInput[80 * i], BEGIN(headers[i].nVersion), 80);
+    hashesOut.resize(headers.size());
+    if (!headers.empty())
+        scrypt_1024_1_1_256_multi(&vInput[0], BEGIN(hashesOut[0]), headers.size());
+}
+
 std::string CBlock::ToString() const
 {
     std::stringstream s;
@@ -156,6 +156,9 @@ struct CBlockLocator
     }
 };
 
+/** Compute GetPoWHash() for a batch of headers, interleaving them across SIMD lanes where possible. */
+void GetPoWHashes(const std::vector<CBlockHeader>& headers, std::vector<uint256>& hashesOut);
+
 /** Compute the consensus-critical block weight (see BIP 141). */
 int64_t GetBlockWeight(const CBlock& tx);
 
@@ -12,18 +12,29 @@
 #include "rpc/server.h"
 #include "streams.h"
 #include "sync.h"
+#include "txdb.h"
 #include "txmempool.h"
+#include "util.h"
 #include "utilstrencodings.h"
+#include "validationinterface.h"
 #include "version.h"
 
 #include <boost/algorithm/string.hpp>
 #include <boost/dynamic_bitset.hpp>
+#include <boost/thread/condition_variable.hpp>
+#include <boost/thread/mutex.hpp>
+
+#include <deque>
 
 #include <univalue.h>
 
 using namespace std;
 
 static const size_t MAX_GETUTXOS_OUTPOINTS = 15; //allow a max of 15 outpoints to be queried at once
+static const size_t MAX_REST_TXCOMMENTS = 1000; //max. comment index entries returned by one /rest/txcomments/ request
+static const size_t MAX_TXCOMMENT_FEED = 10000; //max. comments buffered for /rest/txcomments/stream readers
+static const int DEFAULT_TXCOMMENT_STREAM_SECONDS = 60;
+static const int MAX_TXCOMMENT_STREAM_SECONDS = 3600;
 
 enum RetFormat {
     RF_UNDEF,
@@ -60,10 +71,101 @@ struct CCoin {
 
 extern void TxToJSON(const CTransaction& tx, const uint256 hashBlock, UniValue& entry);
 extern UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false);
+extern bool ReadSerializedBlock(std::vector<unsigned char>& vchBlock, const CBlockIndex* pblockindex);
 extern UniValue mempoolInfoToJSON();
 extern UniValue mempoolToJSON(bool fVerbose = false);
 extern void ScriptPubKeyToJSON(const CScript& scriptPubKey, UniValue& out, bool fIncludeHex);
 extern UniValue blockheaderToJSON(const CBlockIndex* blockindex);
+extern UniValue commentIndexEntryToJSON(const CCommentIndexEntry& entry);
+extern UniValue commentIndexEntriesToJSON(const std::vector<CCommentIndexEntry>& vEntries);
+
+/**
+ * Comments of mempool-accepted and connected transactions, buffered for
+ * /rest/txcomments/stream. Entries carry an upcounting sequence number so
+ * every open stream can pick up where it left off; nothing is buffered
+ * while no stream is open.
+ */
+class CTxCommentFeed : public CValidationInterface
+{
+private:
+    boost::mutex cs;
+    boost::condition_variable cond;
+    std::deque<CCommentIndexEntry> entries;
+    uint64_t nNextSequence; //!< sequence number of the next entry to be added
+    int nStreams;
+    bool fInterrupted;
+
+public:
+    CTxCommentFeed() : nNextSequence(0), nStreams(0), fInterrupted(false) {}
+
+    void SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock)
+    {
+        // Only report mempool acceptance (no block) and block connection (with block)
+        if (tx.strTxComment.empty() || (pindex != NULL && pblock == NULL))
+            return;
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nStreams == 0)
+            return;
+        entries.push_back(CCommentIndexEntry(tx.GetHash(), pblock ? pindex->nHeight : -1, tx.strTxComment));
+        if (entries.size() > MAX_TXCOMMENT_FEED)
+            entries.pop_front();
+        nNextSequence++;
+        cond.notify_all();
+    }
+
+    /**
+     * Open a stream unless nMaxStreams are open already, setting nSequence
+     * to the sequence number of its first entry
+     */
+    bool Subscribe(int nMaxStreams, uint64_t& nSequence)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (nStreams >= nMaxStreams)
+            return false;
+        nStreams++;
+        nSequence = nNextSequence;
+        return true;
+    }
+
+    void Unsubscribe()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        if (--nStreams == 0)
+            entries.clear();
+    }
+
+    /**
+     * Wait for entries from nSequence on and append them to vEntries,
+     * advancing nSequence. Returns false once the deadline passed or the
+     * feed was interrupted without new entries.
+     */
+    bool Wait(uint64_t& nSequence, const boost::system_time& deadline, std::vector<CCommentIndexEntry>& vEntries)
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        while (!fInterrupted && nSequence == nNextSequence) {
+            if (!cond.timed_wait(lock, deadline))
+                break;
+        }
+        if (nSequence == nNextSequence)
+            return false;
+        // A reader that fell further behind than the buffer skips what was dropped
+        uint64_t nFirst = nNextSequence - entries.size();
+        if (nSequence < nFirst)
+            nSequence = nFirst;
+        vEntries.insert(vEntries.end(), entries.begin() + (nSequence - nFirst), entries.end());
+        nSequence = nNextSequence;
+        return true;
+    }
+
+    void Interrupt()
+    {
+        boost::unique_lock<boost::mutex> lock(cs);
+        fInterrupted = true;
+        cond.notify_all();
+    }
+};
+
+static CTxCommentFeed txCommentFeed;
 
 static bool RESTERR(HTTPRequest* req, enum HTTPStatusCode status, string message)
 {
@@ -214,6 +316,7 @@ static bool rest_block(HTTPRequest* req,
         return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hash: " + hashStr);
 
     CBlock block;
+    std::vector<unsigned char> vchBlock;
     CBlockIndex* pblockindex = NULL;
     {
         LOCK(cs_main);
@@ -224,23 +327,23 @@ static bool rest_block(HTTPRequest* req,
         if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not available (pruned data)");
 
-        if (!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        // Binary and hex are served from the serialized block without deserializing it
+        bool fRead = rf == RF_JSON ? ReadBlockFromDisk(block, pblockindex, Params().GetConsensus())
+                                   : ReadSerializedBlock(vchBlock, pblockindex);
+        if (!fRead)
             return RESTERR(req, HTTP_NOT_FOUND, hashStr + " not found");
     }
 
-    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-    ssBlock << block;
-
     switch (rf) {
     case RF_BINARY: {
-        string binaryBlock = ssBlock.str();
+        string binaryBlock(vchBlock.begin(), vchBlock.end());
         req->WriteHeader("Content-Type", "application/octet-stream");
         req->WriteReply(HTTP_OK, binaryBlock);
         return true;
     }
 
     case RF_HEX: {
-        string strHex = HexStr(ssBlock.begin(), ssBlock.end()) + "\n";
+        string strHex = HexStr(vchBlock.begin(), vchBlock.end()) + "\n";
         req->WriteHeader("Content-Type", "text/plain");
         req->WriteReply(HTTP_OK, strHex);
         return true;
@@ -301,6 +404,100 @@ static bool rest_chaininfo(HTTPRequest* req, const std::string& strURIPart)
     return true; // continue to process further HTTP reqs on this cxn
 }
 
+static bool rest_txcomments(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    if (!fCommentIndex)
+        return RESTERR(req, HTTP_NOT_FOUND, "Comment index not enabled (-commentindex)");
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+    vector<string> path;
+    boost::split(path, param, boost::is_any_of("/"));
+
+    std::vector<CCommentIndexEntry> vEntries;
+    bool fRead;
+    if (path.size() == 2 && path[0] == "prefix") {
+        if (!path[1].empty() && !IsHex(path[1]))
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid hex prefix: " + path[1]);
+        std::vector<unsigned char> vPrefix = ParseHex(path[1]);
+        fRead = pblocktree->FindCommentsByPrefix(std::string(vPrefix.begin(), vPrefix.end()), 0, MAX_REST_TXCOMMENTS, vEntries);
+    } else if (path.size() == 3 && path[0] == "range") {
+        int32_t nStartHeight, nEndHeight;
+        if (!ParseInt32(path[1], &nStartHeight) || !ParseInt32(path[2], &nEndHeight) || nStartHeight < 0 || nEndHeight < nStartHeight)
+            return RESTERR(req, HTTP_BAD_REQUEST, "Invalid height range: " + path[1] + "/" + path[2]);
+        fRead = pblocktree->FindCommentsByHeight(nStartHeight, nEndHeight, 0, MAX_REST_TXCOMMENTS, vEntries);
+    } else {
+        return RESTERR(req, HTTP_BAD_REQUEST, "Use /rest/txcomments/prefix/<hexprefix>.<ext> or /rest/txcomments/range/<startheight>/<endheight>.<ext>");
+    }
+    if (!fRead)
+        return RESTERR(req, HTTP_INTERNAL_SERVER_ERROR, "Failed to read comment index");
+
+    switch (rf) {
+    case RF_JSON: {
+        string strJSON = commentIndexEntriesToJSON(vEntries).write() + "\n";
+        req->WriteHeader("Content-Type", "application/json");
+        req->WriteReply(HTTP_OK, strJSON);
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
+static bool rest_txcomments_stream(HTTPRequest* req, const std::string& strURIPart)
+{
+    if (!CheckWarmup(req))
+        return false;
+    std::string param;
+    const RetFormat rf = ParseDataFormat(param, strURIPart);
+
+    int32_t nSeconds = DEFAULT_TXCOMMENT_STREAM_SECONDS;
+    if (!param.empty()) {
+        if (param[0] != '/' || !ParseInt32(param.substr(1), &nSeconds) || nSeconds < 1 || nSeconds > MAX_TXCOMMENT_STREAM_SECONDS)
+            return RESTERR(req, HTTP_BAD_REQUEST, strprintf("Invalid stream duration, use /rest/txcomments/stream/<1-%d>.<ext>", MAX_TXCOMMENT_STREAM_SECONDS));
+    }
+
+    switch (rf) {
+    case RF_JSON: {
+        // Each stream holds an HTTP worker until it ends, so always leave
+        // one of them to RPC and the other REST requests
+        int nMaxStreams = std::max((long)GetArg("-rpcthreads", DEFAULT_HTTP_THREADS), 1L) - 1;
+        uint64_t nSequence;
+        if (!txCommentFeed.Subscribe(nMaxStreams, nSequence))
+            return RESTERR(req, HTTP_SERVICE_UNAVAILABLE, strprintf("Too many open comment streams (at most %d, one less than -rpcthreads)", nMaxStreams));
+
+        // One JSON object per line, each sent as soon as the transaction is seen
+        boost::system_time deadline = boost::get_system_time() + boost::posix_time::seconds(nSeconds);
+        req->WriteHeader("Content-Type", "application/json");
+        req->StartChunkedReply(HTTP_OK);
+        std::vector<CCommentIndexEntry> vEntries;
+        while (txCommentFeed.Wait(nSequence, deadline, vEntries)) {
+            string strChunk;
+            BOOST_FOREACH(const CCommentIndexEntry& entry, vEntries)
+                strChunk += commentIndexEntryToJSON(entry).write() + "\n";
+            // Stop streaming to a client that is gone
+            if (!req->WriteReplyChunk(strChunk))
+                break;
+            vEntries.clear();
+        }
+        txCommentFeed.Unsubscribe();
+        req->EndChunkedReply();
+        return true;
+    }
+    default: {
+        return RESTERR(req, HTTP_NOT_FOUND, "output format not found (available: json)");
+    }
+    }
+
+    // not reached
+    return true; // continue to process further HTTP reqs on this cxn
+}
+
 static bool rest_mempool_info(HTTPRequest* req, const std::string& strURIPart)
 {
     if (!CheckWarmup(req))
@@ -611,21 +808,26 @@ static const struct {
       {"/rest/mempool/contents", rest_mempool_contents},
       {"/rest/headers/", rest_headers},
       {"/rest/getutxos", rest_getutxos},
+      {"/rest/txcomments/stream", rest_txcomments_stream},
+      {"/rest/txcomments/", rest_txcomments},
 };
 
 bool StartREST()
 {
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
         RegisterHTTPHandler(uri_prefixes[i].prefix, false, uri_prefixes[i].handler);
+    RegisterValidationInterface(&txCommentFeed);
     return true;
 }
 
 void InterruptREST()
 {
+    txCommentFeed.Interrupt();
 }
 
 void StopREST()
 {
+    UnregisterValidationInterface(&txCommentFeed);
     for (unsigned int i = 0; i < ARRAYLEN(uri_prefixes); i++)
         UnregisterHTTPHandler(uri_prefixes[i].prefix, false);
 }
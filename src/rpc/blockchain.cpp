@@ -8,22 +8,26 @@
 #include "chainparams.h"
 #include "checkpoints.h"
 #include "coins.h"
+#include "coinstats.h"
 #include "consensus/validation.h"
 #include "main.h"
 #include "policy/policy.h"
 #include "primitives/transaction.h"
 #include "rpc/server.h"
+#include "script/sigcache.h"
 #include "streams.h"
 #include "sync.h"
 #include "txmempool.h"
 #include "util.h"
 #include "utilstrencodings.h"
+#include "utxosnapshot.h"
 #include "hash.h"
 
 #include <stdint.h>
 
 #include <univalue.h>
 
+#include <boost/filesystem.hpp>
 #include <boost/thread/thread.hpp> // boost::thread::interrupt
 
 using namespace std;
@@ -90,6 +94,25 @@ UniValue blockheaderToJSON(const CBlockIndex* blockindex)
     return result;
 }
 
+/**
+ * Serialized block for the non-verbose RPC and REST formats. Copied straight
+ * from the block file unless witness data has to be stripped from it.
+ */
+bool ReadSerializedBlock(std::vector<unsigned char>& vchBlock, const CBlockIndex* pblockindex)
+{
+    const CChainParams& chainparams = Params();
+    if (!(RPCSerializationFlags() & SERIALIZE_TRANSACTION_NO_WITNESS) || IsBlockWitnessFree(pblockindex, chainparams.GetConsensus()))
+        return ReadRawBlockFromDisk(vchBlock, pblockindex, chainparams.MessageStart());
+
+    CBlock block;
+    if (!ReadBlockFromDisk(block, pblockindex, chainparams.GetConsensus()))
+        return false;
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
+    ssBlock << block;
+    vchBlock.assign(ssBlock.begin(), ssBlock.end());
+    return true;
+}
+
 UniValue blockToJSON(const CBlock& block, const CBlockIndex* blockindex, bool txDetails = false)
 {
     UniValue result(UniValue::VOBJ);
@@ -602,81 +625,29 @@ UniValue getblock(const UniValue& params, bool fHelp)
     if (fHavePruned && !(pblockindex->nStatus & BLOCK_HAVE_DATA) && pblockindex->nTx > 0)
         throw JSONRPCError(RPC_INTERNAL_ERROR, "Block not available (pruned data)");
 
-    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
-
     if (!fVerbose)
     {
-        CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION | RPCSerializationFlags());
-        ssBlock << block;
-        std::string strHex = HexStr(ssBlock.begin(), ssBlock.end());
-        return strHex;
+        std::vector<unsigned char> vchBlock;
+        if (!ReadSerializedBlock(vchBlock, pblockindex))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
+        return HexStr(vchBlock.begin(), vchBlock.end());
     }
 
-    return blockToJSON(block, pblockindex);
-}
-
-struct CCoinsStats
-{
-    int nHeight;
-    uint256 hashBlock;
-    uint64_t nTransactions;
-    uint64_t nTransactionOutputs;
-    uint64_t nSerializedSize;
-    uint256 hashSerialized;
-    CAmount nTotalAmount;
-
-    CCoinsStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nSerializedSize(0), nTotalAmount(0) {}
-};
-
-//! Calculate statistics about the unspent transaction output set
-static bool GetUTXOStats(CCoinsView *view, CCoinsStats &stats)
-{
-    boost::scoped_ptr<CCoinsViewCursor> pcursor(view->Cursor());
+    if(!ReadBlockFromDisk(block, pblockindex, Params().GetConsensus()))
+        throw JSONRPCError(RPC_INTERNAL_ERROR, "Can't read block from disk");
 
-    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
-    stats.hashBlock = pcursor->GetBestBlock();
-    {
-        LOCK(cs_main);
-        stats.nHeight = mapBlockIndex.find(stats.hashBlock)->second->nHeight;
-    }
-    ss << stats.hashBlock;
-    CAmount nTotalAmount = 0;
-    while (pcursor->Valid()) {
-        boost::this_thread::interruption_point();
-        uint256 key;
-        CCoins coins;
-        if (pcursor->GetKey(key) && pcursor->GetValue(coins)) {
-            stats.nTransactions++;
-            ss << key;
-            for (unsigned int i=0; i<coins.vout.size(); i++) {
-                const CTxOut &out = coins.vout[i];
-                if (!out.IsNull()) {
-                    stats.nTransactionOutputs++;
-                    ss << VARINT(i+1);
-                    ss << out;
-                    nTotalAmount += out.nValue;
-                }
-            }
-            stats.nSerializedSize += 32 + pcursor->GetValueSize();
-            ss << VARINT(0);
-        } else {
-            return error("%s: unable to read value", __func__);
-        }
-        pcursor->Next();
-    }
-    stats.hashSerialized = ss.GetHash();
-    stats.nTotalAmount = nTotalAmount;
-    return true;
+    return blockToJSON(block, pblockindex);
 }
 
 UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
 {
-    if (fHelp || params.size() != 0)
+    if (fHelp || params.size() > 1)
         throw runtime_error(
-            "gettxoutsetinfo\n"
+            "gettxoutsetinfo ( hash_serialized )\n"
             "\nReturns statistics about the unspent transaction output set.\n"
-            "Note this call may take some time.\n"
+            "They are kept up to date block by block, so this is fast unless hash_serialized is asked for.\n"
+            "\nArguments:\n"
+            "1. hash_serialized   (boolean, optional, default=false) Also compute hash_serialized, which takes a pass over the whole set\n"
             "\nResult:\n"
             "{\n"
             "  \"height\":n,     (numeric) The current block height (index)\n"
@@ -684,29 +655,90 @@ UniValue gettxoutsetinfo(const UniValue& params, bool fHelp)
             "  \"transactions\": n,      (numeric) The number of transactions\n"
             "  \"txouts\": n,            (numeric) The number of output transactions\n"
             "  \"bytes_serialized\": n,  (numeric) The serialized size\n"
-            "  \"hash_serialized\": \"hash\",   (string) The serialized hash\n"
+            "  \"muhash\": \"hash\",     (string) The rolling hash of the set of unspent outputs\n"
+            "  \"hash_serialized\": \"hash\",   (string) The serialized hash, as -utxosnapshothash expects it (only with hash_serialized set)\n"
             "  \"total_amount\": x.xxx          (numeric) The total amount\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("gettxoutsetinfo", "")
+            + HelpExampleCli("gettxoutsetinfo", "true")
             + HelpExampleRpc("gettxoutsetinfo", "")
         );
 
+    bool fHashSerialized = false;
+    if (params.size() > 0)
+        fHashSerialized = params[0].get_bool();
+
     UniValue ret(UniValue::VOBJ);
 
     CCoinsStats stats;
-    FlushStateToDisk();
-    if (GetUTXOStats(pcoinsTip, stats)) {
-        ret.push_back(Pair("height", (int64_t)stats.nHeight));
-        ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
-        ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
-        ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
-        ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
-        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
-        ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    if (fHashSerialized) {
+        FlushStateToDisk();
+        if (!GetUTXOStats(pcoinsTip, stats))
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
     } else {
-        throw JSONRPCError(RPC_INTERNAL_ERROR, "Unable to read UTXO set");
+        LOCK(cs_main);
+        if (coinsStatsTip.hashBlock != pcoinsTip->GetBestBlock())
+            throw JSONRPCError(RPC_INTERNAL_ERROR, "UTXO set statistics are not available yet");
+        stats = coinsStatsTip;
     }
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("bytes_serialized", (int64_t)stats.nSerializedSize));
+    ret.push_back(Pair("muhash", stats.GetMuHash().GetHex()));
+    if (fHashSerialized)
+        ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
+    return ret;
+}
+
+UniValue dumptxoutset(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 1)
+        throw runtime_error(
+            "dumptxoutset \"path\"\n"
+            "\nWrites the unspent transaction output set at the current tip to a snapshot file,\n"
+            "together with the headers of the chain leading up to it. A new node can start from\n"
+            "it with -loadutxosnapshot instead of downloading and replaying every block.\n"
+            "Note this call may take some time.\n"
+            "\nArguments:\n"
+            "1. \"path\"    (string, required) The file to write, relative to the data directory unless absolute\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"path\": \"path\",            (string) The file written\n"
+            "  \"height\":n,                (numeric) The height of the block the snapshot is at\n"
+            "  \"bestblock\": \"hex\",        (string) The hash of that block\n"
+            "  \"transactions\": n,         (numeric) The number of transactions\n"
+            "  \"txouts\": n,               (numeric) The number of output transactions\n"
+            "  \"hash_serialized\": \"hash\", (string) The serialized hash, as gettxoutsetinfo reports it at that block; pass it to -utxosnapshothash\n"
+            "  \"total_amount\": x.xxx      (numeric) The total amount\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("dumptxoutset", "\"utxo.dat\"")
+            + HelpExampleRpc("dumptxoutset", "\"utxo.dat\"")
+        );
+
+    boost::filesystem::path path(params[0].get_str());
+    if (!path.is_complete())
+        path = GetDataDir() / path;
+    if (boost::filesystem::exists(path))
+        throw JSONRPCError(RPC_INVALID_PARAMETER, path.string() + " already exists");
+
+    CUTXOSnapshotStats stats;
+    std::string strError;
+    if (!DumpUTXOSnapshot(path, stats, strError))
+        throw JSONRPCError(RPC_MISC_ERROR, strError);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("path", path.string()));
+    ret.push_back(Pair("height", (int64_t)stats.nHeight));
+    ret.push_back(Pair("bestblock", stats.hashBlock.GetHex()));
+    ret.push_back(Pair("transactions", (int64_t)stats.nTransactions));
+    ret.push_back(Pair("txouts", (int64_t)stats.nTransactionOutputs));
+    ret.push_back(Pair("hash_serialized", stats.hashSerialized.GetHex()));
+    ret.push_back(Pair("total_amount", ValueFromAmount(stats.nTotalAmount)));
     return ret;
 }
 
@@ -1079,6 +1111,7 @@ UniValue getchaintips(const UniValue& params, bool fHelp)
 UniValue mempoolInfoToJSON()
 {
     UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("loaded", (bool)fMempoolLoaded));
     ret.push_back(Pair("size", (int64_t) mempool.size()));
     ret.push_back(Pair("bytes", (int64_t) mempool.GetTotalTxSize()));
     ret.push_back(Pair("usage", (int64_t) mempool.DynamicMemoryUsage()));
@@ -1089,6 +1122,42 @@ UniValue mempoolInfoToJSON()
     return ret;
 }
 
+UniValue getsigcacheinfo(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "getsigcacheinfo\n"
+            "\nReturns details on the signature cache, which remembers valid signatures\n"
+            "from mempool acceptance so block connection can skip verifying them again.\n"
+            "\nResult:\n"
+            "{\n"
+            "  \"entries\": xxxxx,       (numeric) Signatures currently cached\n"
+            "  \"capacity\": xxxxx,      (numeric) Maximum number of cached signatures\n"
+            "  \"usage\": xxxxx,         (numeric) Memory allocated for the cache, in bytes (see -maxsigcachesize)\n"
+            "  \"hits\": xxxxx,          (numeric) Lookups that found a cached signature\n"
+            "  \"misses\": xxxxx,        (numeric) Lookups that required a full signature check\n"
+            "  \"inserts\": xxxxx,       (numeric) Signatures added to the cache\n"
+            "  \"evictions\": xxxxx      (numeric) Inserts that displaced another cached signature\n"
+            "}\n"
+            "\nExamples:\n"
+            + HelpExampleCli("getsigcacheinfo", "")
+            + HelpExampleRpc("getsigcacheinfo", "")
+        );
+
+    SignatureCacheStats stats;
+    GetSignatureCacheStats(stats);
+
+    UniValue ret(UniValue::VOBJ);
+    ret.push_back(Pair("entries", (uint64_t)stats.nEntries));
+    ret.push_back(Pair("capacity", (uint64_t)stats.nCapacity));
+    ret.push_back(Pair("usage", (uint64_t)stats.nUsage));
+    ret.push_back(Pair("hits", stats.nHits));
+    ret.push_back(Pair("misses", stats.nMisses));
+    ret.push_back(Pair("inserts", stats.nInserts));
+    ret.push_back(Pair("evictions", stats.nEvictions));
+    return ret;
+}
+
 UniValue getmempoolinfo(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 0)
@@ -1097,6 +1166,7 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
             "\nReturns details on the active state of the TX memory pool.\n"
             "\nResult:\n"
             "{\n"
+            "  \"loaded\": true|false,        (boolean) True if the mempool has been loaded from disk at startup\n"
             "  \"size\": xxxxx,               (numeric) Current tx count\n"
             "  \"bytes\": xxxxx,              (numeric) Sum of all tx sizes\n"
             "  \"usage\": xxxxx,              (numeric) Total memory usage for the mempool\n"
@@ -1111,6 +1181,27 @@ UniValue getmempoolinfo(const UniValue& params, bool fHelp)
     return mempoolInfoToJSON();
 }
 
+UniValue savemempool(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() != 0)
+        throw runtime_error(
+            "savemempool\n"
+            "\nDumps the mempool to disk, to be loaded again on the next start.\n"
+            "It fails until the mempool saved before has been loaded.\n"
+            "\nExamples:\n"
+            + HelpExampleCli("savemempool", "")
+            + HelpExampleRpc("savemempool", "")
+        );
+
+    if (!fMempoolLoaded)
+        throw JSONRPCError(RPC_MISC_ERROR, "The mempool was not loaded yet");
+
+    if (!DumpMempool())
+        throw JSONRPCError(RPC_MISC_ERROR, "Unable to dump mempool to disk");
+
+    return NullUniValue;
+}
+
 UniValue invalidateblock(const UniValue& params, bool fHelp)
 {
     if (fHelp || params.size() != 1)
@@ -1189,6 +1280,7 @@ UniValue reconsiderblock(const UniValue& params, bool fHelp)
 static const CRPCCommand commands[] =
 { //  category              name                      actor (function)         okSafeMode
   //  --------------------- ------------------------  -----------------------  ----------
+    { "blockchain",         "dumptxoutset",           &dumptxoutset,           true  },
     { "blockchain",         "getblockchaininfo",      &getblockchaininfo,      true  },
     { "blockchain",         "getbestblockhash",       &getbestblockhash,       true  },
     { "blockchain",         "getblockcount",          &getblockcount,          true  },
@@ -1202,8 +1294,10 @@ static const CRPCCommand commands[] =
     { "blockchain",         "getmempoolentry",        &getmempoolentry,        true  },
     { "blockchain",         "getmempoolinfo",         &getmempoolinfo,         true  },
     { "blockchain",         "getrawmempool",          &getrawmempool,          true  },
+    { "blockchain",         "getsigcacheinfo",        &getsigcacheinfo,        true  },
     { "blockchain",         "gettxout",               &gettxout,               true  },
     { "blockchain",         "gettxoutsetinfo",        &gettxoutsetinfo,        true  },
+    { "blockchain",         "savemempool",            &savemempool,            true  },
     { "blockchain",         "verifychain",            &verifychain,            true  },
 
     /* Not shown in help */
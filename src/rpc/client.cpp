@@ -60,6 +60,7 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "getblocktemplate", 0 },
     { "listsinceblock", 1 },
     { "listsinceblock", 2 },
+    { "listsinceblock", 3 },
     { "sendmany", 1 },
     { "sendmany", 2 },
     { "sendmany", 4 },
@@ -84,6 +85,13 @@ static const CRPCConvertParam vRPCConvertParams[] =
     { "gettxout", 1 },
     { "gettxout", 2 },
     { "gettxoutproof", 0 },
+    { "gettxoutsetinfo", 0 },
+    { "searchtxcomments", 1 },
+    { "searchtxcomments", 2 },
+    { "listtxcomments", 0 },
+    { "listtxcomments", 1 },
+    { "listtxcomments", 2 },
+    { "listtxcomments", 3 },
     { "lockunspent", 0 },
     { "lockunspent", 1 },
     { "importprivkey", 2 },
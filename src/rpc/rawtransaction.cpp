@@ -20,6 +20,7 @@
 #include "script/script_error.h"
 #include "script/sign.h"
 #include "script/standard.h"
+#include "txdb.h"
 #include "txmempool.h"
 #include "uint256.h"
 #include "utilstrencodings.h"
@@ -220,6 +221,121 @@ UniValue getrawtransaction(const UniValue& params, bool fHelp)
     return result;
 }
 
+UniValue commentIndexEntryToJSON(const CCommentIndexEntry& entry)
+{
+    UniValue obj(UniValue::VOBJ);
+    obj.push_back(Pair("txid", entry.txid.GetHex()));
+    obj.push_back(Pair("height", entry.nHeight));
+    obj.push_back(Pair("comment", entry.strComment));
+    return obj;
+}
+
+UniValue commentIndexEntriesToJSON(const std::vector<CCommentIndexEntry>& vEntries)
+{
+    UniValue result(UniValue::VARR);
+    BOOST_FOREACH(const CCommentIndexEntry& entry, vEntries)
+        result.push_back(commentIndexEntryToJSON(entry));
+    return result;
+}
+
+static size_t CommentIndexCountParam(const UniValue& params, size_t nIndex, size_t nDefault)
+{
+    if (params.size() <= nIndex)
+        return nDefault;
+    int n = params[nIndex].get_int();
+    if (n < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative count or skip");
+    return n;
+}
+
+UniValue searchtxcomments(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 3)
+        throw runtime_error(
+            "searchtxcomments \"prefix\" ( count skip )\n"
+            "\nReturns the confirmed transactions whose comment starts with \"prefix\",\n"
+            "ordered by comment and then by block height.\n"
+            "Requires the comment index (-commentindex).\n"
+            "\nArguments:\n"
+            "1. \"prefix\"      (string, required) The comment prefix to look for, \"\" matches every comment\n"
+            "2. count         (numeric, optional, default=100) The number of entries to return\n"
+            "3. skip          (numeric, optional, default=0) The number of matching entries to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"id\",        (string) The transaction id\n"
+            "    \"height\" : n,         (numeric) The height of the block containing the transaction\n"
+            "    \"comment\" : \"text\"   (string) The transaction comment\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("searchtxcomments", "\"text:\" 10")
+            + HelpExampleRpc("searchtxcomments", "\"text:\", 10")
+        );
+
+    if (!fCommentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Comment index not enabled, restart with -commentindex and -reindex-chainstate");
+
+    std::string strPrefix = params[0].get_str();
+    size_t nCount = CommentIndexCountParam(params, 1, 100);
+    size_t nSkip = CommentIndexCountParam(params, 2, 0);
+
+    std::vector<CCommentIndexEntry> vEntries;
+    if (!pblocktree->FindCommentsByPrefix(strPrefix, nSkip, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read comment index");
+    return commentIndexEntriesToJSON(vEntries);
+}
+
+UniValue listtxcomments(const UniValue& params, bool fHelp)
+{
+    if (fHelp || params.size() < 1 || params.size() > 4)
+        throw runtime_error(
+            "listtxcomments startheight ( endheight count skip )\n"
+            "\nReturns the commented transactions confirmed in blocks startheight to endheight (inclusive),\n"
+            "in block height order.\n"
+            "Requires the comment index (-commentindex).\n"
+            "\nArguments:\n"
+            "1. startheight   (numeric, required) The first block height to include\n"
+            "2. endheight     (numeric, optional, default=tip) The last block height to include\n"
+            "3. count         (numeric, optional, default=100) The number of entries to return\n"
+            "4. skip          (numeric, optional, default=0) The number of matching entries to skip\n"
+            "\nResult:\n"
+            "[\n"
+            "  {\n"
+            "    \"txid\" : \"id\",        (string) The transaction id\n"
+            "    \"height\" : n,         (numeric) The height of the block containing the transaction\n"
+            "    \"comment\" : \"text\"   (string) The transaction comment\n"
+            "  }\n"
+            "  ,...\n"
+            "]\n"
+            "\nExamples:\n"
+            + HelpExampleCli("listtxcomments", "1000000 1001000")
+            + HelpExampleRpc("listtxcomments", "1000000, 1001000")
+        );
+
+    if (!fCommentIndex)
+        throw JSONRPCError(RPC_MISC_ERROR, "Comment index not enabled, restart with -commentindex and -reindex-chainstate");
+
+    int nStartHeight = params[0].get_int();
+    int nEndHeight;
+    if (params.size() > 1) {
+        nEndHeight = params[1].get_int();
+    } else {
+        LOCK(cs_main);
+        nEndHeight = chainActive.Height();
+    }
+    if (nStartHeight < 0 || nEndHeight < nStartHeight)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid height range");
+    size_t nCount = CommentIndexCountParam(params, 2, 100);
+    size_t nSkip = CommentIndexCountParam(params, 3, 0);
+
+    std::vector<CCommentIndexEntry> vEntries;
+    if (!pblocktree->FindCommentsByHeight(nStartHeight, nEndHeight, nSkip, nCount, vEntries))
+        throw JSONRPCError(RPC_DATABASE_ERROR, "Failed to read comment index");
+    return commentIndexEntriesToJSON(vEntries);
+}
+
 UniValue gettxoutproof(const UniValue& params, bool fHelp)
 {
     if (fHelp || (params.size() != 1 && params.size() != 2))
@@ -927,6 +1043,8 @@ static const CRPCCommand commands[] =
 
     { "blockchain",         "gettxoutproof",          &gettxoutproof,          true  },
     { "blockchain",         "verifytxoutproof",       &verifytxoutproof,       true  },
+    { "blockchain",         "searchtxcomments",       &searchtxcomments,       true  },
+    { "blockchain",         "listtxcomments",         &listtxcomments,         true  },
 };
 
 void RegisterRawTransactionRPCCommands(CRPCTable &tableRPC)
@@ -5,28 +5,96 @@
 
 #include "sigcache.h"
 
-#include "memusage.h"
+#include "primitives/transaction.h"
 #include "pubkey.h"
 #include "random.h"
 #include "uint256.h"
 #include "util.h"
 
-#include <boost/thread.hpp>
-#include <boost/unordered_set.hpp>
+#include <vector>
 
-namespace {
+#include <boost/thread/locks.hpp>
 
-/**
- * We're hashing a nonce into the entries themselves, so we don't need extra
- * blinding in the set hash computation.
- */
-class CSignatureCacheHasher
+size_t GetSignatureCacheBytes()
 {
-public:
-    size_t operator()(const uint256& key) const {
-        return key.GetCheapHash();
+    return GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20) / 2;
+}
+
+CHashBucketCache::CHashBucketCache(size_t nBytes) : shards(SHARDS)
+{
+    nBuckets = nBytes / (sizeof(uint256) * WAYS * SHARDS);
+    for (size_t i = 0; i < shards.size(); i++)
+        shards[i].slots.resize(nBuckets * WAYS);
+}
+
+CHashBucketCache::Shard& CHashBucketCache::Locate(const uint256& entry, size_t& nSlot)
+{
+    // Entries are salted hashes, so uniformly distributed, no further blinding needed
+    uint64_t nHash = entry.GetCheapHash();
+    nSlot = ((nHash / SHARDS) % nBuckets) * WAYS;
+    return shards[nHash % SHARDS];
+}
+
+bool CHashBucketCache::Get(const uint256& entry, bool fErase)
+{
+    if (nBuckets == 0)
+        return false;
+    size_t nSlot;
+    Shard& shard = Locate(entry, nSlot);
+    boost::unique_lock<boost::mutex> lock(shard.cs);
+    for (size_t i = nSlot; i < nSlot + WAYS; i++) {
+        if (shard.slots[i] == entry) {
+            shard.nHits++;
+            if (fErase) {
+                shard.slots[i].SetNull();
+                shard.nEntries--;
+            }
+            return true;
+        }
     }
-};
+    shard.nMisses++;
+    return false;
+}
+
+void CHashBucketCache::Set(const uint256& entry)
+{
+    if (nBuckets == 0)
+        return;
+    size_t nSlot;
+    Shard& shard = Locate(entry, nSlot);
+    boost::unique_lock<boost::mutex> lock(shard.cs);
+    shard.nInserts++;
+    for (size_t i = nSlot; i < nSlot + WAYS; i++) {
+        if (shard.slots[i] == entry)
+            return;
+        if (shard.slots[i].IsNull()) {
+            shard.slots[i] = entry;
+            shard.nEntries++;
+            return;
+        }
+    }
+    // Bucket full: evict a way picked by bits of the entry that did not pick the bucket
+    shard.slots[nSlot + (entry.GetUint64(1) % WAYS)] = entry;
+    shard.nEvictions++;
+}
+
+void CHashBucketCache::GetStats(SignatureCacheStats& stats)
+{
+    stats = SignatureCacheStats();
+    for (size_t i = 0; i < shards.size(); i++) {
+        Shard& shard = shards[i];
+        boost::unique_lock<boost::mutex> lock(shard.cs);
+        stats.nEntries += shard.nEntries;
+        stats.nCapacity += shard.slots.size();
+        stats.nHits += shard.nHits;
+        stats.nMisses += shard.nMisses;
+        stats.nInserts += shard.nInserts;
+        stats.nEvictions += shard.nEvictions;
+    }
+    stats.nUsage = stats.nCapacity * sizeof(uint256);
+}
+
+namespace {
 
 /**
  * Valid signature cache, to avoid doing expensive ECDSA signature checking
@@ -38,13 +106,10 @@ class CSignatureCache
 private:
      //! Entries are SHA256(nonce || signature hash || public key || signature):
     uint256 nonce;
-    typedef boost::unordered_set<uint256, CSignatureCacheHasher> map_type;
-    map_type setValid;
-    boost::shared_mutex cs_sigcache;
-
+    CHashBucketCache cache;
 
 public:
-    CSignatureCache()
+    CSignatureCache() : cache(GetSignatureCacheBytes())
     {
         GetRandBytes(nonce.begin(), 32);
     }
@@ -55,53 +120,49 @@ public:
         CSHA256().Write(nonce.begin(), 32).Write(hash.begin(), 32).Write(&pubkey[0], pubkey.size()).Write(&vchSig[0], vchSig.size()).Finalize(entry.begin());
     }
 
-    bool
-    Get(const uint256& entry)
-    {
-        boost::shared_lock<boost::shared_mutex> lock(cs_sigcache);
-        return setValid.count(entry);
-    }
+    bool Get(const uint256& entry, bool fErase) { return cache.Get(entry, fErase); }
+    void Set(const uint256& entry) { cache.Set(entry); }
+    void GetStats(SignatureCacheStats& stats) { cache.GetStats(stats); }
+};
 
-    void Erase(const uint256& entry)
-    {
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        setValid.erase(entry);
-    }
+CSignatureCache& GetSignatureCache()
+{
+    static CSignatureCache signatureCache;
+    return signatureCache;
+}
 
-    void Set(const uint256& entry)
-    {
-        size_t nMaxCacheSize = GetArg("-maxsigcachesize", DEFAULT_MAX_SIG_CACHE_SIZE) * ((size_t) 1 << 20);
-        if (nMaxCacheSize <= 0) return;
-
-        boost::unique_lock<boost::shared_mutex> lock(cs_sigcache);
-        while (memusage::DynamicUsage(setValid) > nMaxCacheSize)
-        {
-            map_type::size_type s = GetRand(setValid.bucket_count());
-            map_type::local_iterator it = setValid.begin(s);
-            if (it != setValid.end(s)) {
-                setValid.erase(*it);
-            }
-        }
+}
 
-        setValid.insert(entry);
-    }
-};
+void GetSignatureCacheStats(SignatureCacheStats& stats)
+{
+    GetSignatureCache().GetStats(stats);
+}
+
+CScriptExecutionCache::CScriptExecutionCache(size_t nBytes) : cache(nBytes)
+{
+    GetRandBytes(nonce.begin(), 32);
+}
 
+void CScriptExecutionCache::ComputeEntry(uint256& entry, const CTransaction& tx, unsigned int flags) const
+{
+    CSHA256().Write(nonce.begin(), 32).Write(tx.GetWitnessHash().begin(), 32).Write((unsigned char*)&flags, sizeof(flags)).Finalize(entry.begin());
+}
+
+CScriptExecutionCache& GetScriptExecutionCache()
+{
+    static CScriptExecutionCache scriptExecutionCache(GetSignatureCacheBytes());
+    return scriptExecutionCache;
 }
 
 bool CachingTransactionSignatureChecker::VerifySignature(const std::vector<unsigned char>& vchSig, const CPubKey& pubkey, const uint256& sighash) const
 {
-    static CSignatureCache signatureCache;
+    CSignatureCache& signatureCache = GetSignatureCache();
 
     uint256 entry;
     signatureCache.ComputeEntry(entry, sighash, vchSig, pubkey);
 
-    if (signatureCache.Get(entry)) {
-        if (!store) {
-            signatureCache.Erase(entry);
-        }
+    if (signatureCache.Get(entry, !store))
         return true;
-    }
 
     if (!TransactionSignatureChecker::VerifySignature(vchSig, pubkey, sighash))
         return false;
@@ -7,14 +7,114 @@
 #define BITCOIN_SCRIPT_SIGCACHE_H
 
 #include "script/interpreter.h"
+#include "uint256.h"
 
+#include <stdint.h>
 #include <vector>
 
-// DoS prevention: limit cache size to less than 40MB (over 500000
-// entries on 64-bit systems).
-static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 40;
+#include <boost/thread/mutex.hpp>
+
+// DoS prevention: limit the signature cache and the script execution cache
+// to 80MB together, so the signature cache keeps the 40MB it had on its own
+// (over 1.3 million entries each, all allocated on first use).
+static const unsigned int DEFAULT_MAX_SIG_CACHE_SIZE = 80;
 
 class CPubKey;
+class CTransaction;
+
+/** Snapshot of the counters of a CHashBucketCache, summed over all shards */
+struct SignatureCacheStats
+{
+    size_t nEntries;    //!< valid signatures currently cached
+    size_t nCapacity;   //!< slots allocated for entries
+    size_t nUsage;      //!< memory used by the slots, in bytes
+    uint64_t nHits;
+    uint64_t nMisses;
+    uint64_t nInserts;
+    uint64_t nEvictions; //!< inserts that overwrote another entry
+
+    SignatureCacheStats() : nEntries(0), nCapacity(0), nUsage(0), nHits(0), nMisses(0), nInserts(0), nEvictions(0) {}
+};
+
+/** Bytes of -maxsigcachesize that go to each of the signature and script execution caches */
+size_t GetSignatureCacheBytes();
+
+/**
+ * A set of 256-bit entries with a fixed number of slots, all allocated up
+ * front. The slots are split into shards, each with its own lock, so
+ * concurrent script check threads rarely contend. Within a shard an entry
+ * can only be stored in the WAYS slots of one bucket, so a lookup compares
+ * at most that many entries. An insert into a full bucket evicts one of
+ * them. Entries must already be uniformly distributed, e.g. salted hashes.
+ */
+class CHashBucketCache
+{
+public:
+    enum {
+        //! Number of independently locked shards
+        SHARDS = 64,
+        //! Number of slots per bucket
+        WAYS = 4
+    };
+
+    /** Allocate as many buckets as fit in nBytes */
+    explicit CHashBucketCache(size_t nBytes);
+
+    /** Look up an entry, removing it on a hit if fErase is set */
+    bool Get(const uint256& entry, bool fErase);
+    void Set(const uint256& entry);
+    void GetStats(SignatureCacheStats& stats);
+
+private:
+    struct Shard {
+        boost::mutex cs;
+        //! Buckets of WAYS entries each; a null entry marks a free slot
+        std::vector<uint256> slots;
+        size_t nEntries;
+        uint64_t nHits;
+        uint64_t nMisses;
+        uint64_t nInserts;
+        uint64_t nEvictions;
+        //! Keep the locks of neighbouring shards on separate cache lines
+        char padding[64];
+
+        Shard() : nEntries(0), nHits(0), nMisses(0), nInserts(0), nEvictions(0) {}
+    };
+
+    std::vector<Shard> shards;
+    size_t nBuckets; //!< buckets per shard
+
+    /** Locate the shard and the first slot of the bucket for an entry */
+    Shard& Locate(const uint256& entry, size_t& nSlot);
+};
+
+void GetSignatureCacheStats(SignatureCacheStats& stats);
+
+/**
+ * Transactions whose scripts all passed under a given set of flags, so
+ * that a transaction validated on mempool acceptance does not have its
+ * scripts evaluated again when its block is connected. Entries are
+ * SHA256(nonce || wtxid || flags); the wtxid commits to the spent
+ * outputs, so nothing else affects the result.
+ */
+class CScriptExecutionCache
+{
+private:
+    uint256 nonce;
+    CHashBucketCache cache;
+
+public:
+    explicit CScriptExecutionCache(size_t nBytes);
+
+    void ComputeEntry(uint256& entry, const CTransaction& tx, unsigned int flags) const;
+    /** Look up an entry; like signatures, entries are only used once when fErase is set */
+    bool Contains(const uint256& entry, bool fErase) { return cache.Get(entry, fErase); }
+    void Insert(const uint256& entry) { cache.Set(entry); }
+    void GetStats(SignatureCacheStats& stats) { cache.GetStats(stats); }
+};
+
+/** The script execution cache shared by mempool acceptance and block connection */
+CScriptExecutionCache& GetScriptExecutionCache();
 
 class CachingTransactionSignatureChecker : public TransactionSignatureChecker
 {
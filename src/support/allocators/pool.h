@@ -0,0 +1,209 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+#define BITCOIN_SUPPORT_ALLOCATORS_POOL_H
+
+#include <cstddef>
+#include <new>
+#include <vector>
+
+/**
+ * Memory resource for node based containers that allocate many small,
+ * equally sized blocks.
+ *
+ * Blocks of up to MAX_BLOCK_SIZE_BYTES are carved out of chunks of
+ * nChunkSizeBytes and never returned to the system individually: a freed
+ * block goes onto a free list for its size (rounded up to ELEM_ALIGN_BYTES)
+ * and is handed out again by the next allocation of that size. All chunks are
+ * released together when the resource is destroyed. Larger or over-aligned
+ * requests go straight to operator new; they are counted so that memory
+ * accounting can include them.
+ *
+ * This avoids per-node malloc headers and rounding, makes the memory held by
+ * a container an exact multiple of the chunk size, and turns destroying a
+ * container of millions of nodes into freeing a handful of chunks.
+ *
+ * Not thread safe; the owner must serialize access like it does for the
+ * container itself.
+ */
+template <std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolResource
+{
+    static_assert(ALIGN_BYTES > 0 && (ALIGN_BYTES & (ALIGN_BYTES - 1)) == 0, "ALIGN_BYTES must be a power of two");
+
+    struct ListNode
+    {
+        ListNode* pNext;
+    };
+
+public:
+    //! Granularity of all pooled blocks: large enough to hold a free list link
+    static const std::size_t ELEM_ALIGN_BYTES = ALIGN_BYTES > alignof(ListNode) ? ALIGN_BYTES : alignof(ListNode);
+    static_assert(ELEM_ALIGN_BYTES <= alignof(std::max_align_t), "chunks from operator new are not aligned enough");
+    static_assert(MAX_BLOCK_SIZE_BYTES >= ELEM_ALIGN_BYTES, "MAX_BLOCK_SIZE_BYTES too small");
+    //! One free list per multiple of ELEM_ALIGN_BYTES up to MAX_BLOCK_SIZE_BYTES rounded up, plus the unused 0
+    static const std::size_t NUM_FREE_LISTS = (MAX_BLOCK_SIZE_BYTES + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES + 1;
+    //! Largest block carved from a chunk: MAX_BLOCK_SIZE_BYTES rounded up to ELEM_ALIGN_BYTES
+    static const std::size_t MAX_POOLED_BYTES = (NUM_FREE_LISTS - 1) * ELEM_ALIGN_BYTES;
+
+private:
+    const std::size_t nChunkSizeBytes;
+    std::vector<char*> vChunks;
+    //! Free lists indexed by block size in units of ELEM_ALIGN_BYTES
+    ListNode* vFreeLists[NUM_FREE_LISTS];
+    //! Not yet handed out part of the newest chunk
+    char* pAvailableBegin;
+    char* pAvailableEnd;
+    //! Live requests that went to operator new instead of the pool
+    std::size_t nUnpooledAllocations;
+    std::size_t nUnpooledBytes;
+
+    PoolResource(const PoolResource&);
+    PoolResource& operator=(const PoolResource&);
+
+    static std::size_t FreeListIndex(std::size_t nBytes)
+    {
+        return nBytes == 0 ? 1 : (nBytes + ELEM_ALIGN_BYTES - 1) / ELEM_ALIGN_BYTES;
+    }
+
+    static bool IsPooled(std::size_t nBytes, std::size_t nAlignment)
+    {
+        return nBytes <= MAX_BLOCK_SIZE_BYTES && nAlignment <= ELEM_ALIGN_BYTES;
+    }
+
+    void PushFree(void* p, std::size_t nIndex)
+    {
+        ListNode* pNode = static_cast<ListNode*>(p);
+        pNode->pNext = vFreeLists[nIndex];
+        vFreeLists[nIndex] = pNode;
+    }
+
+    void AllocateChunk()
+    {
+        // The rest of the current chunk is too small for this request but can
+        // still serve smaller ones. It is a multiple of ELEM_ALIGN_BYTES, as
+        // are all blocks carved from it.
+        std::size_t nRemaining = pAvailableEnd - pAvailableBegin;
+        if (nRemaining > 0)
+            PushFree(pAvailableBegin, nRemaining / ELEM_ALIGN_BYTES);
+
+        vChunks.reserve(vChunks.size() + 1);
+        pAvailableBegin = static_cast<char*>(::operator new(nChunkSizeBytes));
+        pAvailableEnd = pAvailableBegin + nChunkSizeBytes;
+        vChunks.push_back(pAvailableBegin);
+    }
+
+public:
+    /** nChunkSizeBytesIn is rounded down to a multiple of ELEM_ALIGN_BYTES, and up to at least MAX_POOLED_BYTES */
+    explicit PoolResource(std::size_t nChunkSizeBytesIn) :
+        nChunkSizeBytes(nChunkSizeBytesIn / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES < MAX_POOLED_BYTES ? (std::size_t)MAX_POOLED_BYTES : nChunkSizeBytesIn / ELEM_ALIGN_BYTES * ELEM_ALIGN_BYTES),
+        pAvailableBegin(NULL), pAvailableEnd(NULL), nUnpooledAllocations(0), nUnpooledBytes(0)
+    {
+        for (std::size_t i = 0; i < NUM_FREE_LISTS; i++)
+            vFreeLists[i] = NULL;
+    }
+
+    ~PoolResource()
+    {
+        for (std::size_t i = 0; i < vChunks.size(); i++)
+            ::operator delete(vChunks[i]);
+    }
+
+    void* Allocate(std::size_t nBytes, std::size_t nAlignment)
+    {
+        if (!IsPooled(nBytes, nAlignment)) {
+            void* p = ::operator new(nBytes);
+            nUnpooledAllocations++;
+            nUnpooledBytes += nBytes;
+            return p;
+        }
+
+        std::size_t nIndex = FreeListIndex(nBytes);
+        if (vFreeLists[nIndex] != NULL) {
+            ListNode* pNode = vFreeLists[nIndex];
+            vFreeLists[nIndex] = pNode->pNext;
+            return pNode;
+        }
+        std::size_t nRoundedBytes = nIndex * ELEM_ALIGN_BYTES;
+        if ((std::size_t)(pAvailableEnd - pAvailableBegin) < nRoundedBytes)
+            AllocateChunk();
+        void* p = pAvailableBegin;
+        pAvailableBegin += nRoundedBytes;
+        return p;
+    }
+
+    void Deallocate(void* p, std::size_t nBytes, std::size_t nAlignment)
+    {
+        if (IsPooled(nBytes, nAlignment)) {
+            PushFree(p, FreeListIndex(nBytes));
+        } else {
+            ::operator delete(p);
+            nUnpooledAllocations--;
+            nUnpooledBytes -= nBytes;
+        }
+    }
+
+    std::size_t NumAllocatedChunks() const { return vChunks.size(); }
+    std::size_t ChunkSizeBytes() const { return nChunkSizeBytes; }
+    std::size_t NumUnpooledAllocations() const { return nUnpooledAllocations; }
+    std::size_t UnpooledBytes() const { return nUnpooledBytes; }
+};
+
+/**
+ * Allocator drawing from a PoolResource. A default constructed allocator has
+ * no resource and falls back to operator new, so containers using it can still
+ * be created without one.
+ */
+template <typename T, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+class PoolAllocator
+{
+public:
+    typedef T value_type;
+    typedef PoolResource<MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> ResourceType;
+
+    template <typename U>
+    struct rebind {
+        typedef PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES> other;
+    };
+
+    PoolAllocator() : pResource(NULL) {}
+    PoolAllocator(ResourceType* pResourceIn) : pResource(pResourceIn) {}
+    template <typename U>
+    PoolAllocator(const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& other) : pResource(other.resource()) {}
+
+    T* allocate(std::size_t n)
+    {
+        if (pResource == NULL)
+            return static_cast<T*>(::operator new(n * sizeof(T)));
+        return static_cast<T*>(pResource->Allocate(n * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* p, std::size_t n)
+    {
+        if (pResource == NULL)
+            ::operator delete(p);
+        else
+            pResource->Deallocate(p, n * sizeof(T), alignof(T));
+    }
+
+    ResourceType* resource() const { return pResource; }
+
+private:
+    ResourceType* pResource;
+};
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator==(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return a.resource() == b.resource();
+}
+
+template <typename T, typename U, std::size_t MAX_BLOCK_SIZE_BYTES, std::size_t ALIGN_BYTES>
+bool operator!=(const PoolAllocator<T, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& a, const PoolAllocator<U, MAX_BLOCK_SIZE_BYTES, ALIGN_BYTES>& b)
+{
+    return !(a == b);
+}
+
+#endif // BITCOIN_SUPPORT_ALLOCATORS_POOL_H
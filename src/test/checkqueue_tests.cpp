@@ -0,0 +1,99 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "checkqueue.h"
+#include "test/test_bitcoin.h"
+
+#include <atomic>
+#include <vector>
+
+#include <boost/bind.hpp>
+#include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
+
+/** Counts how often each slot is checked; fails for slots marked bad */
+struct CountingCheck
+{
+    std::vector<std::atomic<int> >* pcounts;
+    size_t nSlot;
+    bool fBad;
+
+    CountingCheck() : pcounts(NULL), nSlot(0), fBad(false) {}
+    CountingCheck(std::vector<std::atomic<int> >* pcountsIn, size_t nSlotIn, bool fBadIn) : pcounts(pcountsIn), nSlot(nSlotIn), fBad(fBadIn) {}
+
+    bool operator()()
+    {
+        (*pcounts)[nSlot]++;
+        return !fBad;
+    }
+
+    void swap(CountingCheck& check)
+    {
+        std::swap(pcounts, check.pcounts);
+        std::swap(nSlot, check.nSlot);
+        std::swap(fBad, check.fBad);
+    }
+};
+
+BOOST_FIXTURE_TEST_SUITE(checkqueue_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(checkqueue_all_run_once)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 7; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+
+    // Batch sizes that cross the storage chunk size, over several rounds
+    const size_t sizes[] = {0, 1, 3, 1000, 1024, 1025, 5000};
+    for (size_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+        std::vector<std::atomic<int> > counts(sizes[s] * 3);
+        for (size_t i = 0; i < counts.size(); i++)
+            counts[i] = 0;
+        {
+            CCheckQueueControl<CountingCheck> control(&queue);
+            for (size_t nAdded = 0; nAdded < counts.size(); ) {
+                std::vector<CountingCheck> vChecks;
+                for (size_t i = 0; i < sizes[s] && nAdded < counts.size(); i++)
+                    vChecks.push_back(CountingCheck(&counts, nAdded++, false));
+                control.Add(vChecks);
+            }
+            BOOST_CHECK(control.Wait());
+        }
+        for (size_t i = 0; i < counts.size(); i++)
+            BOOST_CHECK_EQUAL(counts[i].load(), 1);
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_CASE(checkqueue_failure)
+{
+    CCheckQueue<CountingCheck> queue(16);
+    boost::thread_group threadGroup;
+    for (int i = 0; i < 3; i++)
+        threadGroup.create_thread(boost::bind(&CCheckQueue<CountingCheck>::Thread, boost::ref(queue)));
+
+    std::vector<std::atomic<int> > counts(2000);
+    for (size_t i = 0; i < counts.size(); i++)
+        counts[i] = 0;
+    for (int nRound = 0; nRound < 3; nRound++) {
+        // One failing check in the first two rounds, none in the last
+        CCheckQueueControl<CountingCheck> control(&queue);
+        std::vector<CountingCheck> vChecks;
+        for (size_t i = 0; i < counts.size(); i++)
+            vChecks.push_back(CountingCheck(&counts, i, nRound < 2 && i == 1500));
+        control.Add(vChecks);
+        BOOST_CHECK_EQUAL(control.Wait(), nRound == 2);
+        // The result is reset for the next round
+        BOOST_CHECK(queue.IsIdle());
+    }
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,114 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "coinstats.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(coinstats_tests, TestingSetup)
+
+static CCoins RandomCoins()
+{
+    CCoins coins;
+    coins.fCoinBase = insecure_rand() % 8 == 0;
+    coins.nHeight = insecure_rand() % 100000;
+    coins.nVersion = 1 + insecure_rand() % 2;
+    coins.vout.resize(1 + insecure_rand() % 6);
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        coins.vout[i].nValue = insecure_rand() % 100000000;
+        coins.vout[i].scriptPubKey = CScript() << std::vector<unsigned char>(insecure_rand() % 60, 0x51) << OP_DROP << OP_TRUE;
+    }
+    return coins;
+}
+
+static void CheckStatsMatch(const CCoinsStats& stats, const CCoinsStats& statsScan)
+{
+    BOOST_CHECK_EQUAL(stats.nTransactions, statsScan.nTransactions);
+    BOOST_CHECK_EQUAL(stats.nTransactionOutputs, statsScan.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(stats.nSerializedSize, statsScan.nSerializedSize);
+    BOOST_CHECK_EQUAL(stats.nTotalAmount, statsScan.nTotalAmount);
+    BOOST_CHECK(stats.GetMuHash() == statsScan.GetMuHash());
+}
+
+BOOST_AUTO_TEST_CASE(incremental_matches_scan)
+{
+    FlushStateToDisk();
+    CCoinsStats stats;
+    BOOST_REQUIRE(GetUTXOStats(pcoinsTip, stats));
+
+    // Create, spend from, spend all of and replace transactions at random,
+    // tracking each change; the totals have to match a walk of the database
+    std::vector<uint256> vTxids;
+    for (int nRound = 0; nRound < 4; nRound++) {
+        CCoinsViewCache view(pcoinsTip);
+        for (int i = 0; i < 100; i++) {
+            uint256 txid;
+            int nAction = vTxids.empty() ? 0 : insecure_rand() % 4;
+            if (nAction == 0) {
+                txid = GetRandHash();
+                vTxids.push_back(txid);
+            } else {
+                txid = vTxids[insecure_rand() % vTxids.size()];
+            }
+            const CCoins* pcoins = view.AccessCoins(txid);
+            CCoins coinsOld = pcoins ? *pcoins : CCoins();
+            {
+                CCoinsModifier modifier = view.ModifyCoins(txid);
+                if (nAction == 0 || nAction == 3) {
+                    *modifier = RandomCoins();
+                } else if (nAction == 1 && !modifier->vout.empty()) {
+                    modifier->Spend(insecure_rand() % modifier->vout.size());
+                } else {
+                    modifier->Clear();
+                }
+            }
+            pcoins = view.AccessCoins(txid);
+            stats.UpdateCoins(txid, coinsOld, pcoins ? *pcoins : CCoins());
+        }
+        BOOST_REQUIRE(view.Flush());
+        BOOST_REQUIRE(pcoinsTip->Flush());
+
+        CCoinsStats statsScan;
+        BOOST_REQUIRE(GetUTXOStats(pcoinsTip, statsScan));
+        BOOST_CHECK(statsScan.nTransactions > 0);
+        CheckStatsMatch(stats, statsScan);
+    }
+}
+
+BOOST_AUTO_TEST_CASE(load_coins_stats)
+{
+    // Connecting the genesis block in the fixture moved the statistics along
+    BOOST_CHECK(coinsStatsTip.hashBlock == chainActive.Tip()->GetBlockHash());
+
+    // Change the coins behind its back, and make the stored statistics stale
+    coinsStatsTip = CCoinsStats();
+    BOOST_REQUIRE(pblocktree->WriteCoinsStats(coinsStatsTip));
+    {
+        CCoinsModifier modifier = pcoinsTip->ModifyNewCoins(GetRandHash(), false);
+        *modifier = RandomCoins();
+    }
+    FlushStateToDisk();
+    CCoinsStats statsScan;
+    BOOST_REQUIRE(GetUTXOStats(pcoinsTip, statsScan));
+
+    // Stale statistics are recomputed and stored
+    BOOST_CHECK(LoadCoinsStats());
+    BOOST_CHECK(coinsStatsTip.hashBlock == chainActive.Tip()->GetBlockHash());
+    CheckStatsMatch(coinsStatsTip, statsScan);
+
+    coinsStatsTip = CCoinsStats();
+    CCoinsStats statsStored;
+    BOOST_REQUIRE(pblocktree->ReadCoinsStats(statsStored));
+    BOOST_CHECK(statsStored.hashBlock == chainActive.Tip()->GetBlockHash());
+    CheckStatsMatch(statsStored, statsScan);
+    BOOST_CHECK(LoadCoinsStats());
+    CheckStatsMatch(coinsStatsTip, statsScan);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
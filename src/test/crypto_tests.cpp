@@ -3,6 +3,8 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "crypto/aes.h"
+#include "crypto/common.h"
+#include "crypto/muhash.h"
 #include "crypto/ripemd160.h"
 #include "crypto/sha1.h"
 #include "crypto/sha256.h"
@@ -439,4 +441,91 @@ BOOST_AUTO_TEST_CASE(aes_cbc_testvectors) {
                   "b2eb05e2c39be9fcda6c19078c6a9d1b3f461796d6b0d6b2e0c2a72b4d80e644");
 }
 
+static bool IsNum3072(const Num3072& num, uint32_t nLow, uint32_t nRest)
+{
+    if (num.limbs[0] != nLow)
+        return false;
+    for (int i = 1; i < Num3072::LIMBS; i++) {
+        if (num.limbs[i] != nRest)
+            return false;
+    }
+    return true;
+}
+
+BOOST_AUTO_TEST_CASE(num3072_arithmetic) {
+    unsigned char data[Num3072::BYTE_SIZE];
+
+    // (p - 1)^2 = 1
+    memset(data, 0xff, sizeof(data));
+    WriteLE32(data, 0xffef289a);
+    Num3072 minus_one(data);
+    minus_one.Multiply(minus_one);
+    BOOST_CHECK(IsNum3072(minus_one, 1, 0));
+
+    // 2^3071 * 2 = 2^3072 = 1103717
+    memset(data, 0, sizeof(data));
+    data[Num3072::BYTE_SIZE - 1] = 0x80;
+    Num3072 half(data);
+    memset(data, 0, sizeof(data));
+    data[0] = 2;
+    half.Multiply(Num3072(data));
+    BOOST_CHECK(IsNum3072(half, 1103717, 0));
+
+    // The prime itself and anything above it are reduced on the way in
+    memset(data, 0xff, sizeof(data));
+    WriteLE32(data, 0xffef289b);
+    BOOST_CHECK(IsNum3072(Num3072(data), 0, 0));
+    memset(data, 0xff, sizeof(data));
+    BOOST_CHECK(IsNum3072(Num3072(data), 1103716, 0));
+
+    for (int i = 0; i < 3; i++) {
+        GetRandBytes(data, sizeof(data));
+        Num3072 x(data);
+        Num3072 inverse(x);
+        inverse.Invert();
+        x.Multiply(inverse);
+        BOOST_CHECK(IsNum3072(x, 1, 0));
+    }
+}
+
+BOOST_AUTO_TEST_CASE(muhash_set_operations) {
+    const unsigned char a[] = "a", b[] = "b", c[] = "c";
+    unsigned char hashEmpty[32], hash1[32], hash2[32];
+    MuHash3072().Finalize(hashEmpty);
+
+    // Order does not matter
+    MuHash3072().Insert(a, 1).Insert(b, 1).Insert(c, 1).Finalize(hash1);
+    MuHash3072().Insert(c, 1).Insert(a, 1).Insert(b, 1).Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+    BOOST_CHECK(memcmp(hash1, hashEmpty, 32) != 0);
+
+    // Removing undoes inserting, also before the insert
+    MuHash3072().Remove(b, 1).Insert(a, 1).Insert(b, 1).Finalize(hash1);
+    MuHash3072().Insert(a, 1).Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+    MuHash3072().Insert(b, 1).Finalize(hash1);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) != 0);
+
+    // Sets combine, and the state survives a round trip through bytes
+    MuHash3072 ab, c_only;
+    ab.Insert(a, 1).Insert(b, 1);
+    c_only.Insert(c, 1);
+    unsigned char state[MuHash3072::STATE_SIZE];
+    ab.ToBytes(state);
+    MuHash3072 combined;
+    combined.FromBytes(state);
+    combined *= c_only;
+    combined.Finalize(hash1);
+    MuHash3072().Insert(a, 1).Insert(b, 1).Insert(c, 1).Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+    combined /= ab;
+    combined.Finalize(hash1);
+    MuHash3072(c_only).Finalize(hash2);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+
+    // Finalize leaves a state that hashes the same again
+    combined.Finalize(hash1);
+    BOOST_CHECK(memcmp(hash1, hash2, 32) == 0);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,13 +2,21 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "arith_uint256.h"
+#include "blockencodings.h"
 #include "chainparams.h"
+#include "consensus/merkle.h"
+#include "consensus/validation.h"
+#include "crypto/common.h"
+#include "hash.h"
 #include "main.h"
+#include "pow.h"
 
 #include "test/test_bitcoin.h"
 
 #include <boost/signals2/signal.hpp>
 #include <boost/test/unit_test.hpp>
+#include <boost/thread.hpp>
 
 BOOST_FIXTURE_TEST_SUITE(main_tests, TestingSetup)
 
@@ -72,4 +80,233 @@ BOOST_AUTO_TEST_CASE(test_combiner_all)
     Test.disconnect(&ReturnTrue);
     BOOST_CHECK(Test());
 }
+
+static void ProcessMessagesThread(CNode* pnode)
+{
+    LOCK(pnode->cs_vRecvMsg);
+    ProcessMessages(pnode);
+}
+
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(message_handler_threads)
+{
+    // The peer needs a socket that takes the replies, or the first failed
+    // send disconnects it and SendMessages has nothing left to do
+    int fds[2];
+    BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+    CAddress addr(CService("10.0.0.1", Params().GetDefaultPort()), NODE_NONE);
+    CNode node(fds[0], addr, "", true);
+    node.nVersion = PROTOCOL_VERSION;
+    node.fSuccessfullyConnected = true;
+
+    CDataStream ssPayload(SER_NETWORK, PROTOCOL_VERSION);
+    ssPayload << (uint64_t)42;
+    CMessageHeader hdr(Params().MessageStart(), NetMsgType::PING, ssPayload.size());
+    uint256 hash = Hash(ssPayload.begin(), ssPayload.end());
+    hdr.nChecksum = ReadLE32(hash.begin());
+    CDataStream ssMsg(SER_NETWORK, PROTOCOL_VERSION);
+    ssMsg << hdr;
+    ssMsg.write(&ssPayload[0], ssPayload.size());
+    {
+        LOCK(node.cs_vRecvMsg);
+        BOOST_REQUIRE(node.ReceiveMsgBytes(&ssMsg[0], ssMsg.size()));
+    }
+
+    // One handler thread answers the ping, then another runs SendMessages for
+    // the same peer the way ThreadMessageHandler does, without cs_vSend. Both
+    // take cs_MessageHandling before cs_vSend, so a build with
+    // -DDEBUG_LOCKORDER would report an inversion here.
+    boost::thread threadProcess(ProcessMessagesThread, &node);
+    threadProcess.join();
+    BOOST_CHECK(SendMessages(&node));
+    CNodeStats stats;
+    node.copyStats(stats);
+    BOOST_CHECK(stats.mapSendBytesPerMsgCmd[NetMsgType::PONG] > 0);
+    BOOST_CHECK(stats.mapSendBytesPerMsgCmd[NetMsgType::PING] > 0);
+    BOOST_CHECK(!node.fDisconnect);
+    close(fds[1]);
+}
+#endif
+
+BOOST_AUTO_TEST_CASE(raw_block_read)
+{
+    const CChainParams& chainparams = Params();
+    const CBlockIndex* pindex = chainActive.Genesis();
+    BOOST_REQUIRE(pindex);
+
+    CBlock block;
+    BOOST_REQUIRE(ReadBlockFromDisk(block, pindex, chainparams.GetConsensus()));
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+
+    // The bytes on disk are the network serialization
+    std::vector<unsigned char> vchBlock;
+    BOOST_CHECK(ReadRawBlockFromDisk(vchBlock, pindex, chainparams.MessageStart()));
+    BOOST_CHECK(vchBlock == std::vector<unsigned char>(ssBlock.begin(), ssBlock.end()));
+    BOOST_CHECK(IsBlockWitnessFree(pindex, chainparams.GetConsensus()));
+
+    // Reading at a position with a different block fails
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex->GetBlockPos(), uint256S("0x01"), chainparams.MessageStart()));
+    CMessageHeader::MessageStartChars wrongStart = {0, 0, 0, 0};
+    BOOST_CHECK(!ReadRawBlockFromDisk(vchBlock, pindex, wrongStart));
+}
+
+BOOST_AUTO_TEST_CASE(pow_hash_cache)
+{
+    const Consensus::Params& consensusParams = Params().GetConsensus();
+    CValidationState state;
+    fPoWCache = true;
+
+    // A header that passes has its scrypt hash cached under its block hash,
+    // and stored in the block tree DB on the next flush as it is indexed
+    CBlockHeader header = chainActive.Genesis()->GetBlockHeader();
+    uint256 powHash;
+    BOOST_CHECK(CheckBlockHeader(header, state, consensusParams));
+    FlushStateToDisk();
+    BOOST_CHECK(pblocktree->ReadPoWHash(header.GetHash(), powHash));
+    BOOST_CHECK(powHash == header.GetPoWHash());
+
+    // A cached hash is used as is: this header misses its target, but the
+    // entry planted for it does not, so scrypt was not run again
+    CBlockHeader headerBad = header;
+    headerBad.nNonce++;
+    BOOST_CHECK(!CheckBlockHeader(headerBad, state, consensusParams));
+    BOOST_CHECK(!pblocktree->ReadPoWHash(headerBad.GetHash(), powHash));
+    BOOST_CHECK(pblocktree->WritePoWHashes(std::vector<std::pair<uint256, uint256> >(1, std::make_pair(headerBad.GetHash(), uint256()))));
+    BOOST_CHECK(CheckBlockHeader(headerBad, state, consensusParams));
+
+    // An entry that misses the target is stale: the hash is recomputed and
+    // the entry replaced instead of the block being rejected
+    uint256 hashStale = uint256S(std::string(64, 'f'));
+    BOOST_CHECK(pblocktree->WritePoWHashes(std::vector<std::pair<uint256, uint256> >(1, std::make_pair(header.GetHash(), hashStale))));
+    BOOST_CHECK(CheckBlockHeader(header, state, consensusParams));
+    BOOST_CHECK(pblocktree->ReadPoWHash(header.GetHash(), powHash));
+    BOOST_CHECK(powHash == hashStale);
+    FlushStateToDisk();
+    BOOST_CHECK(pblocktree->ReadPoWHash(header.GetHash(), powHash));
+    BOOST_CHECK(powHash == header.GetPoWHash());
+
+    // A header that never makes it into the block index is dropped on flush
+    // rather than stored; regtest's limit lets one pass in a few tries
+    const Consensus::Params& regtestParams = Params(CBaseChainParams::REGTEST).GetConsensus();
+    CBlockHeader headerUnindexed = header;
+    headerUnindexed.nBits = UintToArith256(regtestParams.powLimit).GetCompact();
+    do {
+        headerUnindexed.nNonce++;
+    } while (!CheckProofOfWork(headerUnindexed.GetPoWHash(), headerUnindexed.nBits, regtestParams));
+    BOOST_CHECK(CheckBlockHeader(headerUnindexed, state, regtestParams));
+    FlushStateToDisk();
+    BOOST_CHECK(!pblocktree->ReadPoWHash(headerUnindexed.GetHash(), powHash));
+
+    // Without -powcache the cache is not consulted
+    fPoWCache = false;
+    BOOST_CHECK(!CheckBlockHeader(headerBad, state, consensusParams));
+    fPoWCache = DEFAULT_POWCACHE;
+}
+
+static CBlock RecentBlockTestCase()
+{
+    CBlock block;
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vin[0].scriptSig.resize(10);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 42;
+    block.vtx.push_back(tx);
+    for (int i = 0; i < 3; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        block.vtx.push_back(tx);
+    }
+    block.hashPrevBlock = GetRandHash();
+    block.hashMerkleRoot = BlockMerkleRoot(block);
+    return block;
+}
+
+BOOST_AUTO_TEST_CASE(recent_block_cache)
+{
+    CRecentBlockCache cache(2);
+    CBlock block = RecentBlockTestCase();
+    uint256 hash = block.GetHash();
+    BOOST_CHECK(!cache.GetSerialized(hash, false, true));
+
+    cache.Add(std::make_shared<const CBlock>(block));
+    cache.Add(std::make_shared<const CBlock>(block));
+    BOOST_CHECK_EQUAL(cache.size(), 1U);
+    BOOST_CHECK(cache.GetBlock(hash)->GetHash() == hash);
+
+    CDataStream ssBlock(SER_NETWORK, PROTOCOL_VERSION);
+    ssBlock << block;
+    CRecentBlockCache::SerializedPtr pvchBlock = cache.GetSerialized(hash, false, true);
+    BOOST_REQUIRE(pvchBlock);
+    BOOST_CHECK(*pvchBlock == std::vector<unsigned char>(ssBlock.begin(), ssBlock.end()));
+    // Later requests share the first serialization
+    BOOST_CHECK(cache.GetSerialized(hash, false, true) == pvchBlock);
+
+    CRecentBlockCache::SerializedPtr pvchCompact = cache.GetSerialized(hash, true, false);
+    BOOST_REQUIRE(pvchCompact);
+    CDataStream ssCompact(*pvchCompact, SER_NETWORK, PROTOCOL_VERSION | SERIALIZE_TRANSACTION_NO_WITNESS);
+    CBlockHeaderAndShortTxIDs cmpctblock;
+    ssCompact >> cmpctblock;
+    BOOST_CHECK(cmpctblock.header.GetHash() == hash);
+    BOOST_CHECK_EQUAL(cmpctblock.BlockTxCount(), block.vtx.size());
+
+    // The oldest block is evicted first
+    cache.Add(std::make_shared<const CBlock>(RecentBlockTestCase()));
+    cache.Add(std::make_shared<const CBlock>(RecentBlockTestCase()));
+    BOOST_CHECK_EQUAL(cache.size(), 2U);
+    BOOST_CHECK(!cache.GetBlock(hash));
+    BOOST_CHECK(!cache.GetSerialized(hash, true, false));
+}
+
+static void WriteImportRecord(CDataStream& ss, const CChainParams& chainparams, const std::vector<char>& vchData, unsigned int nSize)
+{
+    ss << FLATDATA(chainparams.MessageStart()) << nSize;
+    ss.write(&vchData[0], vchData.size());
+}
+
+BOOST_AUTO_TEST_CASE(load_external_block_file)
+{
+    const CChainParams& chainparams = Params();
+    CBlock genesis;
+    BOOST_REQUIRE(ReadBlockFromDisk(genesis, chainActive.Genesis(), chainparams.GetConsensus()));
+    CDataStream ssGenesis(SER_DISK, CLIENT_VERSION);
+    ssGenesis << genesis;
+    std::vector<char> vchGenesis(ssGenesis.begin(), ssGenesis.end());
+
+    // A header claiming far more transactions than the record holds
+    std::vector<char> vchBad(120, 0);
+    vchBad[80] = (char)0xfd;
+    vchBad[81] = vchBad[82] = (char)0xff;
+
+    // Enough copies of the genesis block to span several read ahead batches,
+    // with records that need resyncing in between and a truncated one at the end
+    CDataStream ss(SER_DISK, CLIENT_VERSION);
+    ss << std::string("junk");
+    for (unsigned int i = 0; i < 3 * MAX_IMPORT_BATCH_BLOCKS; i++) {
+        if (i % 100 == 50) {
+            WriteImportRecord(ss, chainparams, vchBad, vchBad.size());
+        } else if (i % 100 == 70) {
+            std::vector<char> vchTrailing(vchGenesis);
+            vchTrailing.resize(vchGenesis.size() + 3, 'x');
+            WriteImportRecord(ss, chainparams, vchTrailing, vchTrailing.size());
+        } else {
+            WriteImportRecord(ss, chainparams, vchGenesis, vchGenesis.size());
+        }
+    }
+    WriteImportRecord(ss, chainparams, std::vector<char>(10, 0), 1000);
+
+    boost::filesystem::path path = pathTemp / "import.dat";
+    FILE* file = fopen(path.string().c_str(), "wb");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fwrite(&ss[0], 1, ss.size(), file), ss.size());
+    fclose(file);
+
+    // Nothing in there is new, and none of the broken records derail the scan
+    const CBlockIndex* pindexTip = chainActive.Tip();
+    file = fopen(path.string().c_str(), "rb");
+    BOOST_REQUIRE(file);
+    BOOST_CHECK(!LoadExternalBlockFile(chainparams, file));
+    BOOST_CHECK(chainActive.Tip() == pindexTip);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,7 +2,11 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "consensus/validation.h"
+#include "main.h"
 #include "policy/policy.h"
+#include "random.h"
+#include "script/standard.h"
 #include "txmempool.h"
 #include "util.h"
 
@@ -578,4 +582,100 @@ BOOST_AUTO_TEST_CASE(MempoolSizeLimitTest)
     SetMockTime(0);
 }
 
+BOOST_AUTO_TEST_CASE(MempoolPersistTest)
+{
+    // A P2SH output anyone can spend, so transactions pass AcceptToMemoryPool unsigned
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript scriptPubKey = GetScriptForDestination(CScriptID(redeemScript));
+    CScript scriptSig = CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+
+    uint256 hashFunding = GetRandHash();
+    {
+        LOCK(cs_main);
+        CCoinsModifier coins = pcoinsTip->ModifyNewCoins(hashFunding, false);
+        coins->vout.push_back(CTxOut(10 * COIN, scriptPubKey));
+    }
+
+    // A parent and its child, entered at different times
+    CMutableTransaction txParent;
+    txParent.nVersion = 1;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(hashFunding, 0);
+    txParent.vin[0].scriptSig = scriptSig;
+    txParent.vout.push_back(CTxOut(9 * COIN, scriptPubKey));
+    CMutableTransaction txChild;
+    txChild.nVersion = 1;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = scriptSig;
+    txChild.vout.push_back(CTxOut(8 * COIN, scriptPubKey));
+
+    int64_t nNow = GetTime();
+    {
+        LOCK(cs_main);
+        CValidationState state;
+        BOOST_REQUIRE(AcceptToMemoryPoolWithTime(mempool, state, txParent, true, NULL, nNow - 100));
+        BOOST_REQUIRE(AcceptToMemoryPoolWithTime(mempool, state, txChild, true, NULL, nNow - 50));
+    }
+    // Deltas both for a transaction in the pool and for one that is not
+    uint256 hashAbsent = GetRandHash();
+    mempool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 1.5, 1000);
+    mempool.PrioritiseTransaction(hashAbsent, hashAbsent.ToString(), 0, -2000);
+
+    BOOST_CHECK(DumpMempool());
+    BOOST_CHECK(boost::filesystem::exists(GetDataDir() / "mempool.dat"));
+    BOOST_CHECK(!boost::filesystem::exists(GetDataDir() / "mempool.dat.new"));
+
+    mempool.clear();
+    {
+        LOCK(mempool.cs);
+        mempool.mapDeltas.clear();
+    }
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 2U);
+    std::vector<TxMempoolInfo> vInfo = mempool.infoAll();
+    BOOST_REQUIRE_EQUAL(vInfo.size(), 2U);
+    BOOST_CHECK(vInfo[0].tx->GetHash() == txParent.GetHash());
+    BOOST_CHECK_EQUAL(vInfo[0].nTime, nNow - 100);
+    BOOST_CHECK(vInfo[1].tx->GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(vInfo[1].nTime, nNow - 50);
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas.size(), 2U);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[txChild.GetHash()].first, 1.5);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[txChild.GetHash()].second, 1000);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashAbsent].second, -2000);
+    }
+
+    // Transactions older than -mempoolexpiry are not loaded again, while
+    // the deltas are, and add to the ones already there
+    mempool.clear();
+    SetMockTime(nNow + DEFAULT_MEMPOOL_EXPIRY * 60 * 60 - 75);
+    BOOST_CHECK(LoadMempool());
+    BOOST_CHECK_EQUAL(mempool.size(), 0U);
+    SetMockTime(0);
+    {
+        LOCK(mempool.cs);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas.size(), 2U);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[txChild.GetHash()].first, 3.0);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[txChild.GetHash()].second, 2000);
+        BOOST_CHECK_EQUAL(mempool.mapDeltas[hashAbsent].second, -4000);
+        mempool.mapDeltas.clear();
+    }
+
+    // A file of another version is left alone
+    {
+        CAutoFile fileout(fopen((GetDataDir() / "mempool.dat").string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+        fileout << (uint64_t)2;
+    }
+    BOOST_CHECK(!LoadMempool());
+
+    // Leave the chainstate as the other tests expect it
+    {
+        LOCK(cs_main);
+        pcoinsTip->ModifyCoins(hashFunding)->Clear();
+    }
+    BOOST_CHECK(!pcoinsTip->HaveCoins(hashFunding));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
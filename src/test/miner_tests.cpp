@@ -10,6 +10,7 @@
 #include "main.h"
 #include "miner.h"
 #include "pubkey.h"
+#include "random.h"
 #include "script/standard.h"
 #include "txmempool.h"
 #include "uint256.h"
@@ -502,4 +503,82 @@ BOOST_AUTO_TEST_CASE(CreateNewBlock_validity)
     fCheckpointsEnabled = true;
 }
 
+BOOST_AUTO_TEST_CASE(BlockTemplateCache_updates)
+{
+    const CChainParams& chainparams = Params(CBaseChainParams::MAIN);
+    CScript scriptPubKey = CScript() << OP_TRUE;
+    CBlockTemplateCache cache;
+    RegisterValidationInterface(&cache);
+
+    // Fund a P2SH(OP_TRUE) output, so the transactions need no signatures
+    CScript redeemScript = CScript() << OP_TRUE;
+    CScript scriptP2SH = GetScriptForDestination(CScriptID(redeemScript));
+    CScript scriptSig = CScript() << std::vector<unsigned char>(redeemScript.begin(), redeemScript.end());
+    uint256 hashFunding = GetRandHash();
+    LOCK(cs_main);
+    {
+        CCoinsModifier coins = pcoinsTip->ModifyNewCoins(hashFunding, false);
+        coins->vout.push_back(CTxOut(10 * COIN, scriptP2SH));
+    }
+    CMutableTransaction txParent;
+    txParent.nVersion = 1;
+    txParent.vin.resize(1);
+    txParent.vin[0].prevout = COutPoint(hashFunding, 0);
+    txParent.vin[0].scriptSig = scriptSig;
+    txParent.vout.push_back(CTxOut(9 * COIN, scriptP2SH));
+    CMutableTransaction txChild;
+    txChild.nVersion = 1;
+    txChild.vin.resize(1);
+    txChild.vin[0].prevout = COutPoint(txParent.GetHash(), 0);
+    txChild.vin[0].scriptSig = scriptSig;
+    txChild.vout.push_back(CTxOut(8 * COIN, scriptP2SH));
+
+    unsigned int nTransactionsUpdated;
+    CBlockTemplate* pblocktemplate = cache.Get(chainparams, scriptPubKey, nTransactionsUpdated);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(nTransactionsUpdated, mempool.GetTransactionsUpdated());
+    CAmount nSubsidy = GetBlockSubsidy(chainActive.Height() + 1, chainparams.GetConsensus());
+
+    // Transactions entering the mempool are appended to the template in place
+    // (a rebuild would reset the nonce)
+    pblocktemplate->block.nNonce = 42;
+    CValidationState state;
+    BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, txParent, true, NULL));
+    BOOST_REQUIRE(AcceptToMemoryPool(mempool, state, txChild, true, NULL));
+    pblocktemplate = cache.Get(chainparams, scriptPubKey, nTransactionsUpdated);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.nNonce, 42U);
+    BOOST_CHECK_EQUAL(nTransactionsUpdated, mempool.GetTransactionsUpdated());
+    BOOST_REQUIRE_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+    BOOST_CHECK(pblocktemplate->block.vtx[1].GetHash() == txParent.GetHash());
+    BOOST_CHECK(pblocktemplate->block.vtx[2].GetHash() == txChild.GetHash());
+    BOOST_CHECK_EQUAL(pblocktemplate->vTxFees[0], -2 * COIN);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, nSubsidy + 2 * COIN);
+
+    // A fee delta makes for a fresh template
+    mempool.PrioritiseTransaction(txChild.GetHash(), txChild.GetHash().ToString(), 0, COIN);
+    pblocktemplate = cache.Get(chainparams, scriptPubKey, nTransactionsUpdated);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.nNonce, 0U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 3U);
+
+    // So do transactions leaving the mempool
+    std::list<CTransaction> removed;
+    mempool.removeRecursive(txParent, removed);
+    pblocktemplate = cache.Get(chainparams, scriptPubKey, nTransactionsUpdated);
+    BOOST_REQUIRE(pblocktemplate);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx.size(), 1U);
+    BOOST_CHECK_EQUAL(pblocktemplate->block.vtx[0].vout[0].nValue, nSubsidy);
+
+    UnregisterValidationInterface(&cache);
+    mempool.clear();
+    {
+        LOCK(mempool.cs);
+        mempool.mapDeltas.clear();
+    }
+    pcoinsTip->ModifyCoins(hashFunding)->Clear();
+    BOOST_CHECK(!pcoinsTip->HaveCoins(hashFunding));
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -164,4 +164,77 @@ BOOST_AUTO_TEST_CASE(cnode_simple_test)
     BOOST_CHECK(pnode2->fFeeler == false);
 }
 
+#ifndef WIN32
+BOOST_AUTO_TEST_CASE(socket_poller)
+{
+    std::vector<SocketEventsMode> vModes;
+    vModes.push_back(SOCKETEVENTS_SELECT);
+    SocketEventsMode modeEpoll;
+    if (ParseSocketEventsMode("epoll", modeEpoll))
+        vModes.push_back(modeEpoll);
+
+    BOOST_FOREACH(SocketEventsMode mode, vModes) {
+        std::unique_ptr<CSocketPoller> poller(CSocketPoller::Create(mode));
+        BOOST_REQUIRE(poller);
+        std::map<SOCKET, int> mapReady;
+
+        int fds[2];
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        BOOST_CHECK(poller->Add(fds[0], CSocketPoller::EVENT_RECV, 1));
+        BOOST_CHECK(poller->Wait(0, mapReady));
+        BOOST_CHECK(mapReady.empty());
+
+        // Registrations last across rounds
+        BOOST_CHECK_EQUAL(send(fds[1], "x", 1, 0), 1);
+        BOOST_CHECK(poller->Wait(1000, mapReady));
+        BOOST_CHECK_EQUAL(mapReady.size(), 1U);
+        BOOST_CHECK(mapReady[fds[0]] & CSocketPoller::EVENT_RECV);
+        BOOST_CHECK(poller->Wait(0, mapReady));
+        BOOST_CHECK(mapReady[fds[0]] & CSocketPoller::EVENT_RECV);
+
+        // Only what is asked for is reported
+        poller->Modify(fds[0], CSocketPoller::EVENT_SEND);
+        BOOST_CHECK(poller->Wait(1000, mapReady));
+        BOOST_CHECK_EQUAL(mapReady[fds[0]], CSocketPoller::EVENT_SEND);
+
+        // A socket waiting for nothing is not watched, not even for hangups
+        shutdown(fds[1], SHUT_WR);
+        poller->Modify(fds[0], 0);
+        BOOST_CHECK(poller->Wait(0, mapReady));
+        BOOST_CHECK(mapReady.empty());
+        poller->Modify(fds[0], CSocketPoller::EVENT_RECV);
+        BOOST_CHECK(poller->Wait(1000, mapReady));
+        BOOST_CHECK(mapReady[fds[0]] & CSocketPoller::EVENT_RECV);
+
+        // Removing only drops the registration of its owner
+        poller->Remove(fds[0], 2);
+        BOOST_CHECK(poller->Wait(0, mapReady));
+        BOOST_CHECK(!mapReady.empty());
+        poller->Remove(fds[0], 1);
+        BOOST_CHECK(poller->Wait(0, mapReady));
+        BOOST_CHECK(mapReady.empty());
+        close(fds[0]);
+        close(fds[1]);
+
+        // A descriptor number reused by a new socket replaces the old registration
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        BOOST_CHECK(poller->Add(fds[0], CSocketPoller::EVENT_RECV, 1));
+        SOCKET hOld = fds[0];
+        close(fds[0]);
+        close(fds[1]);
+        BOOST_REQUIRE(socketpair(AF_UNIX, SOCK_STREAM, 0, fds) == 0);
+        BOOST_CHECK_EQUAL(fds[0], hOld);
+        BOOST_CHECK_EQUAL(send(fds[1], "x", 1, 0), 1);
+        BOOST_CHECK(poller->Add(fds[0], CSocketPoller::EVENT_RECV, 2));
+        BOOST_CHECK(poller->Wait(1000, mapReady));
+        BOOST_CHECK(mapReady[fds[0]] & CSocketPoller::EVENT_RECV);
+        poller->Remove(fds[0], 1);
+        BOOST_CHECK(poller->Wait(0, mapReady));
+        BOOST_CHECK(mapReady[fds[0]] & CSocketPoller::EVENT_RECV);
+        close(fds[0]);
+        close(fds[1]);
+    }
+}
+#endif
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,131 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "coins.h"
+#include "memusage.h"
+#include "random.h"
+#include "support/allocators/pool.h"
+#include "test/test_bitcoin.h"
+
+#include <algorithm>
+#include <map>
+#include <vector>
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(pool_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(pool_resource_reuse)
+{
+    typedef PoolResource<64, 8> Resource;
+    Resource resource(1024);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 1024U);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 0U);
+
+    // Blocks are carved from one chunk until it runs out
+    std::vector<void*> vBlocks;
+    for (int i = 0; i < 1024 / 32; i++)
+        vBlocks.push_back(resource.Allocate(32, 8));
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    for (size_t i = 1; i < vBlocks.size(); i++)
+        BOOST_CHECK_EQUAL((char*)vBlocks[i] - (char*)vBlocks[i - 1], 32);
+
+    // Freed blocks are handed out again before a new chunk is needed
+    resource.Deallocate(vBlocks[5], 32, 8);
+    BOOST_CHECK(resource.Allocate(30, 8) == vBlocks[5]);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    resource.Allocate(32, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+
+    // Oversized and over-aligned requests bypass the pool, but are counted
+    void* pLarge = resource.Allocate(65, 8);
+    void* pAligned = resource.Allocate(16, 16);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    BOOST_CHECK_EQUAL(resource.NumUnpooledAllocations(), 2U);
+    BOOST_CHECK_EQUAL(resource.UnpooledBytes(), 81U);
+    resource.Deallocate(pLarge, 65, 8);
+    resource.Deallocate(pAligned, 16, 16);
+    BOOST_CHECK_EQUAL(resource.NumUnpooledAllocations(), 0U);
+    BOOST_CHECK_EQUAL(resource.UnpooledBytes(), 0U);
+
+    // Chunks are never smaller than the largest block
+    Resource tiny(1);
+    BOOST_CHECK_EQUAL(tiny.ChunkSizeBytes(), 64U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_unaligned_max)
+{
+    // A largest block that is not a multiple of the alignment is rounded up,
+    // for its free list as well as for the smallest chunk
+    PoolResource<20, 8> resource(20);
+    BOOST_CHECK_EQUAL(resource.ChunkSizeBytes(), 24U);
+    void* p = resource.Allocate(20, 8);
+    resource.Deallocate(p, 20, 8);
+    BOOST_CHECK(resource.Allocate(17, 8) == p);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    BOOST_CHECK_EQUAL(resource.NumUnpooledAllocations(), 0U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_resource_chunk_tail)
+{
+    // The tail of a chunk that is too small for a request serves smaller ones
+    PoolResource<64, 8> resource(100 * 8);
+    for (int i = 0; i < 12; i++)
+        resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 1U);
+    resource.Allocate(64, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+    resource.Allocate(32, 8);
+    BOOST_CHECK_EQUAL(resource.NumAllocatedChunks(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(pool_allocator_map)
+{
+    typedef PoolAllocator<std::pair<const int, int>, 128, 8> Allocator;
+    Allocator::ResourceType resource(4096);
+    Allocator allocator(&resource);
+    std::map<int, int, std::less<int>, Allocator> mapPooled(std::less<int>(), allocator);
+    std::map<int, int> mapPlain;
+    for (int i = 0; i < 1000; i++) {
+        int k = insecure_rand() % 300;
+        if (insecure_rand() % 3 == 0) {
+            mapPooled.erase(k);
+            mapPlain.erase(k);
+        } else {
+            mapPooled[k] = i;
+            mapPlain[k] = i;
+        }
+    }
+    BOOST_CHECK(std::equal(mapPlain.begin(), mapPlain.end(), mapPooled.begin()));
+    BOOST_CHECK(resource.NumAllocatedChunks() > 0);
+    // Freed nodes are reused, so the pool never exceeds what the peak size needs
+    BOOST_CHECK(resource.NumAllocatedChunks() * resource.ChunkSizeBytes() <= 4096 + 300 * 128);
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_pool_usage)
+{
+    CCoinsView viewDummy;
+    CCoinsViewCache cache(&viewDummy, 64 * 1024);
+    size_t nEmptyUsage = cache.DynamicMemoryUsage();
+
+    CMutableTransaction tx;
+    tx.vin.resize(1);
+    tx.vout.resize(1);
+    tx.vout[0].nValue = 1;
+    tx.vout[0].scriptPubKey = CScript() << OP_TRUE;
+    for (int i = 0; i < 2000; i++) {
+        tx.vin[0].prevout.hash = GetRandHash();
+        CTransaction txFinal(tx);
+        cache.ModifyNewCoins(txFinal.GetHash(), false)->FromTx(txFinal, 1);
+    }
+    size_t nUsage = cache.DynamicMemoryUsage();
+    BOOST_CHECK(nUsage > nEmptyUsage + 2000 * sizeof(CCoinsMap::value_type));
+
+    // Flushing hands the whole pool back
+    BOOST_CHECK(cache.Flush() == false);
+    BOOST_CHECK_EQUAL(cache.GetCacheSize(), 0U);
+    BOOST_CHECK_EQUAL(cache.DynamicMemoryUsage(), nEmptyUsage);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,7 @@
 
 #include "uint256.h"
 #include "util.h"
+#include "random.h"
 #include "utilstrencodings.h"
 #include "crypto/scrypt.h"
 
@@ -32,4 +33,37 @@ BOOST_AUTO_TEST_CASE(scrypt_hashtest)
     }
 }
 
+BOOST_AUTO_TEST_CASE(scrypt_multibuffer)
+{
+    // Every multi-buffer engine must agree with the generic implementation lane for lane
+    scrypt_detect_multibuffer();
+    std::vector<char> input(80 * SCRYPT_MULTI_MAX_LANES);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = (char)insecure_rand();
+
+    std::vector<uint256> expected(SCRYPT_MULTI_MAX_LANES);
+    char scratchpad[SCRYPT_SCRATCHPAD_SIZE];
+    for (int i = 0; i < SCRYPT_MULTI_MAX_LANES; i++)
+        scrypt_1024_1_1_256_sp_generic(&input[80 * i], BEGIN(expected[i]), scratchpad);
+
+    for (int nLanes = 4; nLanes <= SCRYPT_MULTI_MAX_LANES; nLanes *= 2) {
+        scrypt_multi_func func = scrypt_multi_impl(nLanes);
+        if (func == NULL)
+            continue;
+        std::vector<char> vScratch(scrypt_multi_scratchpad_size(nLanes));
+        std::vector<uint256> hashes(nLanes);
+        func(&input[0], BEGIN(hashes[0]), &vScratch[0]);
+        for (int i = 0; i < nLanes; i++)
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+    }
+
+    // Batches that do not fill a whole vector fall back to narrower engines
+    for (size_t nCount = 0; nCount <= (size_t)SCRYPT_MULTI_MAX_LANES; nCount += 3) {
+        std::vector<uint256> hashes(SCRYPT_MULTI_MAX_LANES);
+        scrypt_1024_1_1_256_multi(&input[0], BEGIN(hashes[0]), nCount);
+        for (size_t i = 0; i < nCount; i++)
+            BOOST_CHECK_EQUAL(hashes[i].ToString(), expected[i].ToString());
+    }
+}
+
 BOOST_AUTO_TEST_SUITE_END()
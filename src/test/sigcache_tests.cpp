@@ -0,0 +1,154 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "key.h"
+#include "primitives/transaction.h"
+#include "random.h"
+#include "script/sigcache.h"
+#include "test/test_bitcoin.h"
+#include "util.h"
+
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(sigcache_tests, BasicTestingSetup)
+
+BOOST_AUTO_TEST_CASE(sigcache_counters)
+{
+    CKey key;
+    key.MakeNewKey(true);
+    uint256 sighash = GetRandHash();
+    std::vector<unsigned char> vchSig;
+    BOOST_CHECK(key.Sign(sighash, vchSig));
+
+    CMutableTransaction txTo;
+    txTo.vin.resize(1);
+    CTransaction tx(txTo);
+    PrecomputedTransactionData txdata(tx);
+    CachingTransactionSignatureChecker checkerStore(&tx, 0, 0, true, txdata);
+    CachingTransactionSignatureChecker checkerNoStore(&tx, 0, 0, false, txdata);
+
+    SignatureCacheStats before, after;
+    GetSignatureCacheStats(before);
+    BOOST_CHECK(before.nCapacity > 0);
+    BOOST_CHECK_EQUAL(before.nUsage, before.nCapacity * 32);
+
+    // A miss, after which the valid signature is stored
+    BOOST_CHECK(checkerStore.VerifySignature(vchSig, key.GetPubKey(), sighash));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 1);
+    BOOST_CHECK_EQUAL(after.nInserts, before.nInserts + 1);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries + 1);
+
+    // A hit; without store the entry is removed again
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, key.GetPubKey(), sighash));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nHits, before.nHits + 1);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+
+    // Invalid signatures are neither accepted nor stored
+    BOOST_CHECK(!checkerStore.VerifySignature(vchSig, key.GetPubKey(), GetRandHash()));
+    BOOST_CHECK(checkerNoStore.VerifySignature(vchSig, key.GetPubKey(), sighash));
+    GetSignatureCacheStats(after);
+    BOOST_CHECK_EQUAL(after.nMisses, before.nMisses + 3);
+    BOOST_CHECK_EQUAL(after.nInserts, before.nInserts + 1);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries);
+}
+
+BOOST_AUTO_TEST_CASE(script_execution_cache)
+{
+    CScriptExecutionCache cache(1 << 20);
+    CMutableTransaction txTo;
+    txTo.vin.resize(1);
+    txTo.vin[0].prevout.hash = GetRandHash();
+    txTo.vout.resize(1);
+    CTransaction tx(txTo);
+
+    uint256 entry, entryOtherFlags;
+    cache.ComputeEntry(entry, tx, SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG);
+    cache.ComputeEntry(entryOtherFlags, tx, SCRIPT_VERIFY_P2SH);
+    BOOST_CHECK(entry != entryOtherFlags);
+
+    // A miss, then a hit once inserted; other flags still miss
+    BOOST_CHECK(!cache.Contains(entry, false));
+    cache.Insert(entry);
+    BOOST_CHECK(cache.Contains(entry, false));
+    BOOST_CHECK(!cache.Contains(entryOtherFlags, false));
+
+    // A different witness is a different transaction
+    txTo.wit.vtxinwit.resize(1);
+    txTo.wit.vtxinwit[0].scriptWitness.stack.push_back(std::vector<unsigned char>(1, 1));
+    uint256 entryWitness;
+    cache.ComputeEntry(entryWitness, CTransaction(txTo), SCRIPT_VERIFY_P2SH | SCRIPT_VERIFY_DERSIG);
+    BOOST_CHECK(entryWitness != entry);
+    BOOST_CHECK(!cache.Contains(entryWitness, false));
+
+    // Erasing lookups use the entry up
+    BOOST_CHECK(cache.Contains(entry, true));
+    BOOST_CHECK(!cache.Contains(entry, false));
+
+    SignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nHits, 2U);
+    BOOST_CHECK_EQUAL(stats.nMisses, 4U);
+    BOOST_CHECK_EQUAL(stats.nInserts, 1U);
+    BOOST_CHECK_EQUAL(stats.nEntries, 0U);
+}
+
+BOOST_AUTO_TEST_CASE(hash_bucket_cache_eviction)
+{
+    // One bucket per shard
+    CHashBucketCache cache(sizeof(uint256) * CHashBucketCache::WAYS * CHashBucketCache::SHARDS);
+    SignatureCacheStats stats;
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nCapacity, (size_t)CHashBucketCache::WAYS * CHashBucketCache::SHARDS);
+
+    // Every insert is found right after, but older ones get evicted once buckets are full
+    std::vector<uint256> vEntries;
+    for (size_t i = 0; i < 4 * stats.nCapacity; i++) {
+        vEntries.push_back(GetRandHash());
+        cache.Set(vEntries.back());
+        BOOST_CHECK(cache.Get(vEntries.back(), false));
+    }
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nInserts, vEntries.size());
+    BOOST_CHECK(stats.nEntries <= stats.nCapacity);
+    BOOST_CHECK_EQUAL(stats.nEntries + stats.nEvictions, vEntries.size());
+    size_t nFound = 0;
+    for (size_t i = 0; i < vEntries.size(); i++)
+        nFound += cache.Get(vEntries[i], false);
+    BOOST_CHECK_EQUAL(nFound, stats.nEntries);
+
+    // Inserting an entry that is already there changes nothing
+    cache.Set(vEntries.back());
+    SignatureCacheStats statsAfter;
+    cache.GetStats(statsAfter);
+    BOOST_CHECK_EQUAL(statsAfter.nEntries, stats.nEntries);
+    BOOST_CHECK_EQUAL(statsAfter.nEvictions, stats.nEvictions);
+}
+
+BOOST_AUTO_TEST_CASE(sigcache_sizing)
+{
+    // -maxsigcachesize is split evenly between the two caches
+    mapArgs["-maxsigcachesize"] = "2";
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), (size_t)1 << 20);
+    SignatureCacheStats stats;
+    CScriptExecutionCache(GetSignatureCacheBytes()).GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nUsage, (size_t)1 << 20);
+    BOOST_CHECK_EQUAL(stats.nCapacity, ((size_t)1 << 20) / 32);
+
+    // Zero disables caching altogether
+    mapArgs["-maxsigcachesize"] = "0";
+    CScriptExecutionCache cache(GetSignatureCacheBytes());
+    cache.GetStats(stats);
+    BOOST_CHECK_EQUAL(stats.nCapacity, 0U);
+    uint256 entry = GetRandHash();
+    cache.Insert(entry);
+    BOOST_CHECK(!cache.Contains(entry, false));
+    mapArgs.erase("-maxsigcachesize");
+
+    // By default the signature cache gets as much as it had on its own
+    BOOST_CHECK_EQUAL(GetSignatureCacheBytes(), (size_t)40 << 20);
+}
+
+BOOST_AUTO_TEST_SUITE_END()
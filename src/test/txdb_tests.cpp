@@ -0,0 +1,261 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/test/unit_test.hpp>
+
+/** In-memory coin database that can also write records in the legacy per-transaction layout */
+class CCoinsViewDBTest : public CCoinsViewDB
+{
+public:
+    CCoinsViewDBTest() : CCoinsViewDB(1 << 20, true) {}
+
+    bool WriteLegacyCoins(const uint256 &txid, const CCoins &coins)
+    {
+        return db.Write(std::make_pair('c', txid), coins);
+    }
+
+    bool WriteVersion(int nVersion)
+    {
+        return db.Write('V', nVersion);
+    }
+
+    bool EraseCoinHeader(const uint256 &txid)
+    {
+        return db.Erase(std::make_pair('h', txid));
+    }
+};
+
+static CCoins MakeCoins(unsigned int nOutputs, int nHeight)
+{
+    CMutableTransaction tx;
+    tx.nVersion = 2;
+    tx.vin.resize(1);
+    tx.vin[0].prevout.hash = GetRandHash();
+    for (unsigned int i = 0; i < nOutputs; i++)
+        tx.vout.push_back(CTxOut(i + 1, CScript() << (int64_t)i << OP_DROP << OP_TRUE));
+    return CCoins(tx, nHeight);
+}
+
+static bool WriteCoins(CCoinsViewDB &db, const uint256 &txid, const CCoins &coins, bool fFresh)
+{
+    CCoinsMap mapCoins;
+    CCoinsCacheEntry &entry = mapCoins[txid];
+    entry.coins = coins;
+    entry.flags = CCoinsCacheEntry::DIRTY | (fFresh ? CCoinsCacheEntry::FRESH : 0);
+    return db.BatchWrite(mapCoins, uint256());
+}
+
+BOOST_FIXTURE_TEST_SUITE(txdb_tests, TestingSetup)
+
+BOOST_AUTO_TEST_CASE(comment_index)
+{
+    std::vector<CCommentIndexEntry> vWrite;
+    vWrite.push_back(CCommentIndexEntry(GetRandHash(), 300, "text:hello"));
+    vWrite.push_back(CCommentIndexEntry(GetRandHash(), 20, "text:hello world"));
+    vWrite.push_back(CCommentIndexEntry(GetRandHash(), 100, "text:help"));
+    vWrite.push_back(CCommentIndexEntry(GetRandHash(), 100, std::string("text:\0hidden", 12)));
+    vWrite.push_back(CCommentIndexEntry(GetRandHash(), 70000, "json:{}"));
+    BOOST_CHECK(pblocktree->WriteCommentIndex(vWrite));
+
+    // Prefix search is ordered by comment bytes, then height
+    std::vector<CCommentIndexEntry> vFound;
+    BOOST_CHECK(pblocktree->FindCommentsByPrefix("text:hel", 0, 100, vFound));
+    BOOST_CHECK_EQUAL(vFound.size(), 3U);
+    BOOST_CHECK_EQUAL(vFound[0].strComment, "text:hello");
+    BOOST_CHECK(vFound[0].txid == vWrite[0].txid);
+    BOOST_CHECK_EQUAL(vFound[0].nHeight, 300);
+    BOOST_CHECK_EQUAL(vFound[1].strComment, "text:hello world");
+    BOOST_CHECK_EQUAL(vFound[2].strComment, "text:help");
+
+    // Embedded NUL bytes are part of the key, not a terminator
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByPrefix(std::string("text:\0", 6), 0, 100, vFound));
+    BOOST_CHECK_EQUAL(vFound.size(), 1U);
+    BOOST_CHECK(vFound[0].strComment == vWrite[3].strComment);
+
+    // Empty prefix matches everything; skip and count page through it
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByPrefix("", 0, 100, vFound));
+    BOOST_CHECK_EQUAL(vFound.size(), 5U);
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByPrefix("", 1, 2, vFound));
+    BOOST_CHECK_EQUAL(vFound.size(), 2U);
+    BOOST_CHECK(vFound[0].strComment == vWrite[3].strComment);
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByPrefix("nomatch", 0, 100, vFound));
+    BOOST_CHECK(vFound.empty());
+
+    // Height ranges are inclusive and ordered numerically
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByHeight(20, 300, 0, 100, vFound));
+    BOOST_CHECK_EQUAL(vFound.size(), 4U);
+    BOOST_CHECK_EQUAL(vFound[0].nHeight, 20);
+    BOOST_CHECK_EQUAL(vFound[1].nHeight, 100);
+    BOOST_CHECK_EQUAL(vFound[2].nHeight, 100);
+    BOOST_CHECK_EQUAL(vFound[3].nHeight, 300);
+    BOOST_CHECK_EQUAL(vFound[3].strComment, "text:hello");
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByHeight(301, 1000000, 0, 100, vFound));
+    BOOST_CHECK_EQUAL(vFound.size(), 1U);
+    BOOST_CHECK_EQUAL(vFound[0].nHeight, 70000);
+
+    // Erasing removes both keyspaces
+    BOOST_CHECK(pblocktree->EraseCommentIndex(vWrite));
+    vFound.clear();
+    BOOST_CHECK(pblocktree->FindCommentsByPrefix("", 0, 100, vFound));
+    BOOST_CHECK(vFound.empty());
+    BOOST_CHECK(pblocktree->FindCommentsByHeight(0, 1000000, 0, 100, vFound));
+    BOOST_CHECK(vFound.empty());
+}
+
+BOOST_AUTO_TEST_CASE(coins_per_output)
+{
+    CCoinsViewDBTest db;
+    uint256 txid1 = GetRandHash();
+    uint256 txid2 = GetRandHash();
+    CCoins coins1 = MakeCoins(200, 10);
+    CCoins coins2 = MakeCoins(2, 11);
+    BOOST_CHECK(WriteCoins(db, txid1, coins1, true));
+    BOOST_CHECK(WriteCoins(db, txid2, coins2, true));
+
+    CCoins coinsRead;
+    BOOST_CHECK(db.GetCoins(txid1, coinsRead));
+    BOOST_CHECK(coinsRead == coins1);
+    BOOST_CHECK(db.HaveCoins(txid2));
+    BOOST_CHECK(!db.HaveCoins(GetRandHash()));
+
+    // Spending a single output leaves the others untouched
+    coins1.Spend(150);
+    BOOST_CHECK(WriteCoins(db, txid1, coins1, false));
+    BOOST_CHECK(db.GetCoins(txid1, coinsRead));
+    BOOST_CHECK(coinsRead == coins1);
+    BOOST_CHECK(!coinsRead.IsAvailable(150));
+    BOOST_CHECK(coinsRead.IsAvailable(199));
+
+    // Trailing spent outputs are trimmed like CCoins::Cleanup does
+    coins1.Spend(199);
+    BOOST_CHECK(WriteCoins(db, txid1, coins1, false));
+    BOOST_CHECK(db.GetCoins(txid1, coinsRead));
+    BOOST_CHECK_EQUAL(coinsRead.vout.size(), 199U);
+    BOOST_CHECK(coinsRead == coins1);
+
+    // The cursor yields whole transactions
+    std::map<uint256, CCoins> mapSeen;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    for (; pcursor->Valid(); pcursor->Next()) {
+        uint256 key;
+        CCoins coins;
+        BOOST_CHECK(pcursor->GetKey(key));
+        BOOST_CHECK(pcursor->GetValue(coins));
+        BOOST_CHECK(pcursor->GetValueSize() > 0);
+        mapSeen[key] = coins;
+    }
+    BOOST_CHECK_EQUAL(mapSeen.size(), 2U);
+    BOOST_CHECK(mapSeen[txid1] == coins1);
+    BOOST_CHECK(mapSeen[txid2] == coins2);
+
+    // Spending everything removes the transaction
+    coins2.Spend(0);
+    coins2.Spend(1);
+    BOOST_CHECK(coins2.IsPruned());
+    BOOST_CHECK(WriteCoins(db, txid2, coins2, false));
+    BOOST_CHECK(!db.HaveCoins(txid2));
+    BOOST_CHECK(!db.GetCoins(txid2, coinsRead));
+}
+
+BOOST_AUTO_TEST_CASE(coins_cache_changes)
+{
+    CCoinsViewDBTest db;
+    uint256 txid = GetRandHash();
+    CCoins coins = MakeCoins(10, 10);
+    BOOST_CHECK(WriteCoins(db, txid, coins, true));
+
+    // Spends tracked by a cache, and by a cache on top of it, reach the disk
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Spend(3);
+        CCoinsViewCache child(&cache);
+        child.ModifyCoins(txid)->Spend(9);
+        BOOST_CHECK(child.Flush());
+        BOOST_CHECK(cache.Flush());
+    }
+    coins.Spend(3);
+    coins.Spend(9);
+    CCoins coinsRead;
+    BOOST_CHECK(db.GetCoins(txid, coinsRead));
+    BOOST_CHECK_EQUAL(coinsRead.vout.size(), 9U);
+    BOOST_CHECK(coinsRead == coins);
+
+    // An output restored after being spent is written again
+    {
+        CCoinsViewCache cache(&db);
+        cache.ModifyCoins(txid)->Spend(0);
+        BOOST_CHECK(cache.Flush());
+        cache.ModifyCoins(txid)->vout[0] = coins.vout[0];
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(db.GetCoins(txid, coinsRead));
+    BOOST_CHECK(coinsRead == coins);
+
+    // Spending the rest removes the transaction
+    {
+        CCoinsViewCache cache(&db);
+        {
+            CCoinsModifier modifier = cache.ModifyCoins(txid);
+            for (uint32_t n = 0; n < coins.vout.size(); n++)
+                modifier->Spend(n);
+        }
+        BOOST_CHECK(cache.Flush());
+    }
+    BOOST_CHECK(!db.HaveCoins(txid));
+    BOOST_CHECK(!db.GetCoins(txid, coinsRead));
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(db.Cursor());
+    BOOST_CHECK(!pcursor->Valid());
+}
+
+BOOST_AUTO_TEST_CASE(coins_upgrade)
+{
+    CCoinsViewDBTest db;
+    std::vector<std::pair<uint256, CCoins> > vLegacy;
+    for (int i = 0; i < 50; i++) {
+        CCoins coins = MakeCoins(1 + i % 7, 100 + i);
+        if (coins.vout.size() > 2)
+            coins.Spend(1);
+        vLegacy.push_back(std::make_pair(GetRandHash(), coins));
+        BOOST_CHECK(db.WriteLegacyCoins(vLegacy.back().first, coins));
+    }
+    BOOST_CHECK(!db.HaveCoins(vLegacy[0].first));
+
+    BOOST_CHECK(db.Upgrade());
+    for (unsigned int i = 0; i < vLegacy.size(); i++) {
+        CCoins coinsRead;
+        BOOST_CHECK(db.GetCoins(vLegacy[i].first, coinsRead));
+        BOOST_CHECK(coinsRead == vLegacy[i].second);
+    }
+
+    // Nothing legacy is left, so upgrading again is a no-op
+    BOOST_CHECK(db.Upgrade());
+    CCoins coinsRead;
+    BOOST_CHECK(db.GetCoins(vLegacy[1].first, coinsRead));
+    BOOST_CHECK(coinsRead == vLegacy[1].second);
+
+    // Format 1 had no per-transaction records; they are added on upgrade
+    BOOST_CHECK(db.EraseCoinHeader(vLegacy[2].first));
+    BOOST_CHECK(db.WriteVersion(1));
+    BOOST_CHECK(!db.HaveCoins(vLegacy[2].first));
+    BOOST_CHECK(db.Upgrade());
+    BOOST_CHECK(db.GetCoins(vLegacy[2].first, coinsRead));
+    BOOST_CHECK(coinsRead == vLegacy[2].second);
+
+    // A chainstate in a format newer than ours is refused
+    BOOST_CHECK(db.WriteVersion(CHAINSTATE_VERSION + 1));
+    BOOST_CHECK(!db.Upgrade());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
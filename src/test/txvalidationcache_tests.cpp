@@ -9,6 +9,7 @@
 #include "pubkey.h"
 #include "txmempool.h"
 #include "random.h"
+#include "script/sigcache.h"
 #include "script/standard.h"
 #include "test/test_bitcoin.h"
 #include "utiltime.h"
@@ -39,6 +40,8 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     spends.resize(2);
     for (int i = 0; i < 2; i++)
     {
+        // Version 2 is not standard before CSV activates
+        spends[i].nVersion = 1;
         spends[i].vin.resize(1);
         spends[i].vin[0].prevout.hash = coinbaseTxns[0].GetHash();
         spends[i].vin[0].prevout.n = 0;
@@ -83,4 +86,40 @@ BOOST_FIXTURE_TEST_CASE(tx_mempool_block_doublespend, TestChain100Setup)
     BOOST_CHECK_EQUAL(mempool.size(), 0);
 }
 
+BOOST_FIXTURE_TEST_CASE(tx_mempool_block_script_cache, TestChain100Setup)
+{
+    // A transaction accepted to the memory pool has its scripts skipped
+    // when the block containing it is connected, and the entry is used up.
+    CScript scriptPubKey = CScript() <<  ToByteVector(coinbaseKey.GetPubKey()) << OP_CHECKSIG;
+
+    CMutableTransaction spend;
+    spend.nVersion = 1;
+    spend.vin.resize(1);
+    spend.vin[0].prevout.hash = coinbaseTxns[0].GetHash();
+    spend.vin[0].prevout.n = 0;
+    spend.vout.resize(1);
+    spend.vout[0].nValue = 11*CENT;
+    spend.vout[0].scriptPubKey = scriptPubKey;
+
+    std::vector<unsigned char> vchSig;
+    uint256 hash = SignatureHash(scriptPubKey, spend, 0, SIGHASH_ALL, 0, SIGVERSION_BASE);
+    BOOST_CHECK(coinbaseKey.Sign(hash, vchSig));
+    vchSig.push_back((unsigned char)SIGHASH_ALL);
+    spend.vin[0].scriptSig << vchSig;
+
+    SignatureCacheStats before, after;
+    GetScriptExecutionCache().GetStats(before);
+    BOOST_CHECK(ToMemPool(spend));
+    GetScriptExecutionCache().GetStats(after);
+    BOOST_CHECK(after.nInserts > before.nInserts);
+
+    GetScriptExecutionCache().GetStats(before);
+    std::vector<CMutableTransaction> oneSpend(1, spend);
+    CBlock block = CreateAndProcessBlock(oneSpend, scriptPubKey);
+    BOOST_CHECK(chainActive.Tip()->GetBlockHash() == block.GetHash());
+    GetScriptExecutionCache().GetStats(after);
+    BOOST_CHECK(after.nHits > before.nHits);
+    BOOST_CHECK_EQUAL(after.nEntries, before.nEntries - 1);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -0,0 +1,108 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "chainparams.h"
+#include "main.h"
+#include "random.h"
+#include "txdb.h"
+#include "utxosnapshot.h"
+#include "test/test_bitcoin.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/test/unit_test.hpp>
+
+BOOST_FIXTURE_TEST_SUITE(utxosnapshot_tests, TestingSetup)
+
+static void AddRandomCoins(unsigned int nTransactions)
+{
+    for (unsigned int n = 0; n < nTransactions; n++) {
+        CMutableTransaction tx;
+        tx.vin.resize(1);
+        tx.vin[0].prevout.hash = GetRandHash();
+        for (unsigned int i = 0; i < 1 + n % 4; i++)
+            tx.vout.push_back(CTxOut(1000 * (i + 1), CScript() << OP_TRUE));
+        CCoins coins(tx, n);
+        // Leave a spent output in the middle now and then
+        if (coins.vout.size() > 2)
+            coins.Spend(1);
+        CCoinsModifier modifier = pcoinsTip->ModifyNewCoins(tx.GetHash(), false);
+        modifier->swap(coins);
+    }
+}
+
+static std::vector<std::pair<uint256, CCoins> > ReadAllCoins(CCoinsView& view)
+{
+    std::vector<std::pair<uint256, CCoins> > vCoins;
+    boost::scoped_ptr<CCoinsViewCursor> pcursor(view.Cursor());
+    while (pcursor->Valid()) {
+        uint256 txid;
+        CCoins coins;
+        BOOST_REQUIRE(pcursor->GetKey(txid) && pcursor->GetValue(coins));
+        vCoins.push_back(std::make_pair(txid, coins));
+        pcursor->Next();
+    }
+    return vCoins;
+}
+
+BOOST_AUTO_TEST_CASE(dump_and_load)
+{
+    const CChainParams& chainparams = Params();
+    AddRandomCoins(250);
+
+    boost::filesystem::path path = pathTemp / "utxo.dat";
+    CUTXOSnapshotStats stats;
+    std::string strError;
+    BOOST_REQUIRE_MESSAGE(DumpUTXOSnapshot(path, stats, strError), strError);
+    BOOST_CHECK_EQUAL(stats.nTransactions, 250U);
+    BOOST_CHECK(stats.hashBlock == chainActive.Tip()->GetBlockHash());
+    BOOST_CHECK_EQUAL(stats.nHeight, chainActive.Height());
+    BOOST_CHECK(!boost::filesystem::exists(path.string() + ".incomplete"));
+
+    // The commitment is the one gettxoutsetinfo computes over the database
+    std::vector<std::pair<uint256, CCoins> > vCoins = ReadAllCoins(*pcoinsTip);
+    CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+    ss << stats.hashBlock;
+    for (size_t i = 0; i < vCoins.size(); i++)
+        UpdateUTXOSetHash(ss, vCoins[i].first, vCoins[i].second);
+    BOOST_CHECK(ss.GetHash() == stats.hashSerialized);
+
+    // A different expected hash is refused before anything is written
+    CCoinsViewDB viewRefused(1 << 20, true);
+    CUTXOSnapshotStats statsLoad;
+    BOOST_CHECK(!LoadUTXOSnapshot(chainparams, path, GetRandHash(), &viewRefused, statsLoad, strError));
+    BOOST_CHECK(viewRefused.GetBestBlock().IsNull());
+    BOOST_CHECK(ReadAllCoins(viewRefused).empty());
+
+    CCoinsViewDB viewLoad(1 << 20, true);
+    BOOST_REQUIRE_MESSAGE(LoadUTXOSnapshot(chainparams, path, stats.hashSerialized, &viewLoad, statsLoad, strError), strError);
+    BOOST_CHECK(statsLoad.hashSerialized == stats.hashSerialized);
+    BOOST_CHECK_EQUAL(statsLoad.nTransactionOutputs, stats.nTransactionOutputs);
+    BOOST_CHECK_EQUAL(statsLoad.nTotalAmount, stats.nTotalAmount);
+    BOOST_CHECK(viewLoad.GetBestBlock() == stats.hashBlock);
+    std::vector<std::pair<uint256, CCoins> > vLoaded = ReadAllCoins(viewLoad);
+    BOOST_REQUIRE_EQUAL(vLoaded.size(), vCoins.size());
+    for (size_t i = 0; i < vCoins.size(); i++) {
+        BOOST_CHECK(vLoaded[i].first == vCoins[i].first);
+        BOOST_CHECK(vLoaded[i].second == vCoins[i].second);
+    }
+    bool fFlag = false;
+    BOOST_CHECK(pblocktree->ReadFlag("utxosnapshot", fFlag) && fFlag);
+    BOOST_CHECK(pblocktree->ReadFlag("prunedblockfiles", fFlag) && fFlag);
+
+    // Any damage to the coins is caught by the hash
+    std::vector<char> vchFile(boost::filesystem::file_size(path));
+    FILE* file = fopen(path.string().c_str(), "rb+");
+    BOOST_REQUIRE(file);
+    BOOST_REQUIRE_EQUAL(fread(&vchFile[0], 1, vchFile.size(), file), vchFile.size());
+    vchFile[vchFile.size() - 100] ^= 1;
+    BOOST_REQUIRE_EQUAL(fseek(file, 0, SEEK_SET), 0);
+    BOOST_REQUIRE_EQUAL(fwrite(&vchFile[0], 1, vchFile.size(), file), vchFile.size());
+    fclose(file);
+    CCoinsViewDB viewCorrupt(1 << 20, true);
+    BOOST_CHECK(!LoadUTXOSnapshot(chainparams, path, stats.hashSerialized, &viewCorrupt, statsLoad, strError));
+    BOOST_CHECK(viewCorrupt.GetBestBlock().IsNull());
+}
+
+BOOST_AUTO_TEST_SUITE_END()
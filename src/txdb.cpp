@@ -6,9 +6,14 @@
 #include "txdb.h"
 
 #include "chainparams.h"
+#include "coinstats.h"
+#include "crypto/common.h"
 #include "hash.h"
+#include "init.h"
 #include "pow.h"
+#include "ui_interface.h"
 #include "uint256.h"
+#include "util.h"
 
 #include <stdint.h>
 
@@ -17,26 +22,128 @@
 using namespace std;
 
 static const char DB_COINS = 'c';
+static const char DB_COIN = 'o';
+static const char DB_COIN_HEADER = 'h';
 static const char DB_BLOCK_FILES = 'f';
 static const char DB_TXINDEX = 't';
 static const char DB_BLOCK_INDEX = 'b';
+static const char DB_POW_HASH = 'p';
+static const char DB_TXCOMMENT = 'C';
+static const char DB_TXCOMMENT_HEIGHT = 'H';
 
 static const char DB_BEST_BLOCK = 'B';
 static const char DB_FLAG = 'F';
 static const char DB_REINDEX_FLAG = 'R';
 static const char DB_LAST_BLOCK = 'l';
+static const char DB_COINS_STATS = 'S';
+static const char DB_COINS_VERSION = 'V';
 
 
+namespace {
+
+/** Key of a single unspent output: DB_COIN, txid, output index. All outputs of a
+ *  transaction share the 33-byte (DB_COIN, txid) prefix and are adjacent on disk.
+ *  A transaction with unspent outputs also has a (DB_COIN_HEADER, txid) record,
+ *  so that lookups of missing transactions are point reads the bloom filter can
+ *  answer without seeking. */
+struct CoinEntry
+{
+    char key;
+    uint256 hash;
+    uint32_t n;
+
+    CoinEntry() : key(DB_COIN), n(0) {}
+    CoinEntry(const uint256 &hashIn, uint32_t nIn) : key(DB_COIN), hash(hashIn), n(nIn) {}
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersion) {
+        READWRITE(key);
+        READWRITE(hash);
+        READWRITE(VARINT(n));
+    }
+};
+
+/** Value of a single unspent output, carrying the transaction metadata of its CCoins */
+struct CoinRecord
+{
+    CTxOut txout;
+    bool fCoinBase;
+    unsigned int nHeight;
+    int nVersion;
+
+    CoinRecord() : txout(), fCoinBase(false), nHeight(0), nVersion(0) {}
+    CoinRecord(const CCoins &coins, uint32_t n) : txout(coins.vout[n]), fCoinBase(coins.fCoinBase), nHeight(coins.nHeight), nVersion(coins.nVersion) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return ::GetSerializeSize(VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion) +
+               ::GetSerializeSize(VARINT(this->nVersion), nType, nVersion) +
+               ::GetSerializeSize(CTxOutCompressor(REF(txout)), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        ::Serialize(s, VARINT(nHeight*2+(fCoinBase ? 1 : 0)), nType, nVersion);
+        ::Serialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Serialize(s, CTxOutCompressor(REF(txout)), nType, nVersion);
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        unsigned int nCode = 0;
+        ::Unserialize(s, VARINT(nCode), nType, nVersion);
+        nHeight = nCode / 2;
+        fCoinBase = nCode & 1;
+        ::Unserialize(s, VARINT(this->nVersion), nType, nVersion);
+        ::Unserialize(s, REF(CTxOutCompressor(REF(txout))), nType, nVersion);
+    }
+};
+
+/**
+ * Reassemble the CCoins of txid from the per-output records starting at the
+ * cursor position. Leaves the cursor on the first record past them and adds
+ * the size of the records read to nSize. Returns false if there were none.
+ */
+bool ReadCoinRecords(CDBIterator &cursor, const uint256 &txid, CCoins &coins, unsigned int &nSize)
+{
+    coins.Clear();
+    bool fFound = false;
+    CoinEntry entry;
+    while (cursor.Valid() && cursor.GetKey(entry) && entry.key == DB_COIN && entry.hash == txid) {
+        CoinRecord record;
+        if (!cursor.GetValue(record))
+            throw std::runtime_error("Database corrupted: unreadable UTXO record");
+        if (entry.n >= coins.vout.size())
+            coins.vout.resize(entry.n + 1);
+        coins.vout[entry.n] = record.txout;
+        coins.fCoinBase = record.fCoinBase;
+        coins.nHeight = record.nHeight;
+        coins.nVersion = record.nVersion;
+        nSize += cursor.GetValueSize();
+        fFound = true;
+        cursor.Next();
+    }
+    return fFound;
+}
+
+} // anonymous namespace
+
 CCoinsViewDB::CCoinsViewDB(size_t nCacheSize, bool fMemory, bool fWipe) : db(GetDataDir() / "chainstate", nCacheSize, fMemory, fWipe, true) 
 {
 }
 
 bool CCoinsViewDB::GetCoins(const uint256 &txid, CCoins &coins) const {
-    return db.Read(make_pair(DB_COINS, txid), coins);
+    if (!db.Exists(make_pair(DB_COIN_HEADER, txid)))
+        return false;
+    boost::scoped_ptr<CDBIterator> pcursor(const_cast<CDBWrapper*>(&db)->NewIterator());
+    pcursor->Seek(make_pair(DB_COIN, txid));
+    unsigned int nSize = 0;
+    return ReadCoinRecords(*pcursor, txid, coins, nSize);
 }
 
 bool CCoinsViewDB::HaveCoins(const uint256 &txid) const {
-    return db.Exists(make_pair(DB_COINS, txid));
+    return db.Exists(make_pair(DB_COIN_HEADER, txid));
 }
 
 uint256 CCoinsViewDB::GetBestBlock() const {
@@ -48,14 +155,65 @@ uint256 CCoinsViewDB::GetBestBlock() const {
 
 bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     CDBBatch batch(db);
+    boost::scoped_ptr<CDBIterator> pcursor;
     size_t count = 0;
     size_t changed = 0;
+    size_t written = 0;
+    size_t erased = 0;
     for (CCoinsMap::iterator it = mapCoins.begin(); it != mapCoins.end();) {
         if (it->second.flags & CCoinsCacheEntry::DIRTY) {
-            if (it->second.coins.IsPruned())
-                batch.Erase(make_pair(DB_COINS, it->first));
-            else
-                batch.Write(make_pair(DB_COINS, it->first), it->second.coins);
+            const CCoins &coins = it->second.coins;
+            if (it->second.flags & CCoinsCacheEntry::FRESH) {
+                // Nothing on disk yet
+                for (uint32_t n = 0; n < coins.vout.size(); n++) {
+                    if (coins.IsAvailable(n)) {
+                        batch.Write(CoinEntry(it->first, n), CoinRecord(coins, n));
+                        written++;
+                    }
+                }
+            } else if (it->second.fChangesKnown) {
+                // The cache tracked which outputs changed
+                const std::vector<bool> &vChanged = it->second.vChanged;
+                for (uint32_t n = 0; n < vChanged.size(); n++) {
+                    if (!vChanged[n])
+                        continue;
+                    if (coins.IsAvailable(n)) {
+                        batch.Write(CoinEntry(it->first, n), CoinRecord(coins, n));
+                        written++;
+                    } else {
+                        batch.Erase(CoinEntry(it->first, n));
+                        erased++;
+                    }
+                }
+            } else {
+                // Only entries built outside of CCoinsViewCache get here;
+                // compare against what is on disk.
+                if (!pcursor)
+                    pcursor.reset(db.NewIterator());
+                CCoins coinsOld;
+                unsigned int nSize = 0;
+                pcursor->Seek(make_pair(DB_COIN, it->first));
+                ReadCoinRecords(*pcursor, it->first, coinsOld, nSize);
+                bool fSameMeta = coinsOld.fCoinBase == coins.fCoinBase && coinsOld.nHeight == coins.nHeight && coinsOld.nVersion == coins.nVersion;
+                for (uint32_t n = 0; n < std::max(coins.vout.size(), coinsOld.vout.size()); n++) {
+                    bool fOld = coinsOld.IsAvailable(n);
+                    if (coins.IsAvailable(n)) {
+                        if (!fOld || !fSameMeta || !(coinsOld.vout[n] == coins.vout[n])) {
+                            batch.Write(CoinEntry(it->first, n), CoinRecord(coins, n));
+                            written++;
+                        }
+                    } else if (fOld) {
+                        batch.Erase(CoinEntry(it->first, n));
+                        erased++;
+                    }
+                }
+            }
+            if (coins.IsPruned()) {
+                if (!(it->second.flags & CCoinsCacheEntry::FRESH))
+                    batch.Erase(make_pair(DB_COIN_HEADER, it->first));
+            } else {
+                batch.Write(make_pair(DB_COIN_HEADER, it->first), '1');
+            }
             changed++;
         }
         count++;
@@ -65,10 +223,130 @@ bool CCoinsViewDB::BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock) {
     if (!hashBlock.IsNull())
         batch.Write(DB_BEST_BLOCK, hashBlock);
 
-    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database...\n", (unsigned int)changed, (unsigned int)count);
+    LogPrint("coindb", "Committing %u changed transactions (out of %u) to coin database: %u outputs written, %u erased...\n", (unsigned int)changed, (unsigned int)count, (unsigned int)written, (unsigned int)erased);
     return db.WriteBatch(batch);
 }
 
+unsigned int CCoinsViewDB::GetRecordSize(const CCoins &coins, uint32_t n) {
+    return ::GetSerializeSize(CoinRecord(coins, n), SER_DISK, CLIENT_VERSION);
+}
+
+bool CCoinsViewDB::Upgrade() {
+    int nVersion = 0;
+    if (db.Read(DB_COINS_VERSION, nVersion) && nVersion > CHAINSTATE_VERSION)
+        return error("%s: chainstate format %d is newer than the supported %d, it must be rebuilt with -reindex-chainstate", __func__, nVersion, CHAINSTATE_VERSION);
+
+    if (nVersion == 1)
+        return AddCoinHeaders();
+
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(make_pair(DB_COINS, uint256()));
+    std::pair<char, uint256> key;
+    if (!pcursor->Valid() || !pcursor->GetKey(key) || key.first != DB_COINS) {
+        if (nVersion < CHAINSTATE_VERSION)
+            return db.Write(DB_COINS_VERSION, CHAINSTATE_VERSION);
+        return true;
+    }
+
+    LogPrintf("Upgrading UTXO database to per-output records...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    int64_t nStart = GetTimeMillis();
+    size_t nTxs = 0;
+    size_t nOutputs = 0;
+    size_t nBatchOps = 0;
+    int nReportDone = 0;
+    CDBBatch batch(db);
+    while (pcursor->Valid()) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        if (!pcursor->GetKey(key) || key.first != DB_COINS)
+            break;
+        CCoins coins;
+        if (!pcursor->GetValue(coins))
+            return error("%s: unable to parse legacy coins record for %s", __func__, key.second.ToString());
+        for (uint32_t n = 0; n < coins.vout.size(); n++) {
+            if (coins.IsAvailable(n)) {
+                batch.Write(CoinEntry(key.second, n), CoinRecord(coins, n));
+                nOutputs++;
+                nBatchOps++;
+            }
+        }
+        if (!coins.IsPruned()) {
+            batch.Write(make_pair(DB_COIN_HEADER, key.second), '1');
+            nBatchOps++;
+        }
+        // The legacy record goes away in the same batch as its replacements, so
+        // an interrupted upgrade simply resumes with the next transaction.
+        batch.Erase(key);
+        nBatchOps++;
+        nTxs++;
+        if (nBatchOps >= UPGRADE_BATCH_OPS) {
+            if (!db.WriteBatch(batch))
+                return error("%s: failed to write upgraded coins", __func__);
+            batch.Clear();
+            nBatchOps = 0;
+            // Keys are ordered by txid, so its leading bytes track the progress
+            int nPercentageDone = (int)(((uint32_t)*key.second.begin() << 8 | *(key.second.begin() + 1)) * 100 / 65536);
+            if (nPercentageDone >= nReportDone + 10) {
+                nReportDone = nPercentageDone / 10 * 10;
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), nPercentageDone);
+                LogPrintf("[%d%%]...", nReportDone);
+            }
+        }
+        pcursor->Next();
+    }
+    if (!ShutdownRequested())
+        batch.Write(DB_COINS_VERSION, CHAINSTATE_VERSION);
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write upgraded coins", __func__);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("%s: %u transactions split into %u outputs in %dms\n", ShutdownRequested() ? "interrupted" : "done",
+        (unsigned int)nTxs, (unsigned int)nOutputs, (int)(GetTimeMillis() - nStart));
+    return !ShutdownRequested();
+}
+
+bool CCoinsViewDB::AddCoinHeaders() {
+    LogPrintf("Adding transaction records to the UTXO database...\n");
+    uiInterface.ShowProgress(_("Upgrading UTXO database"), 0);
+    int64_t nStart = GetTimeMillis();
+    size_t nTxs = 0;
+    size_t nBatchOps = 0;
+    CDBBatch batch(db);
+    boost::scoped_ptr<CDBIterator> pcursor(db.NewIterator());
+    pcursor->Seek(DB_COIN);
+    uint256 hashLast;
+    CoinEntry entry;
+    // Rewriting a header that is already there is harmless, so an interrupted
+    // pass simply starts over.
+    while (pcursor->Valid() && pcursor->GetKey(entry) && entry.key == DB_COIN) {
+        boost::this_thread::interruption_point();
+        if (ShutdownRequested())
+            break;
+        if (nTxs == 0 || entry.hash != hashLast) {
+            batch.Write(make_pair(DB_COIN_HEADER, entry.hash), '1');
+            hashLast = entry.hash;
+            nTxs++;
+            if (++nBatchOps >= UPGRADE_BATCH_OPS) {
+                if (!db.WriteBatch(batch))
+                    return error("%s: failed to write transaction records", __func__);
+                batch.Clear();
+                nBatchOps = 0;
+                uiInterface.ShowProgress(_("Upgrading UTXO database"), (int)(((uint32_t)*hashLast.begin() << 8 | *(hashLast.begin() + 1)) * 100 / 65536));
+            }
+        }
+        pcursor->Next();
+    }
+    if (!ShutdownRequested())
+        batch.Write(DB_COINS_VERSION, CHAINSTATE_VERSION);
+    if (!db.WriteBatch(batch))
+        return error("%s: failed to write transaction records", __func__);
+    uiInterface.ShowProgress("", 100);
+    LogPrintf("%s: %u transaction records added in %dms\n", ShutdownRequested() ? "interrupted" : "done",
+        (unsigned int)nTxs, (int)(GetTimeMillis() - nStart));
+    return !ShutdownRequested();
+}
+
 CBlockTreeDB::CBlockTreeDB(size_t nCacheSize, bool fMemory, bool fWipe) : CDBWrapper(GetDataDir() / "blocks" / "index", nCacheSize, fMemory, fWipe) {
 }
 
@@ -98,16 +376,16 @@ CCoinsViewCursor *CCoinsViewDB::Cursor() const
     /* It seems that there are no "const iterators" for LevelDB.  Since we
        only need read operations on it, use a const-cast to get around
        that restriction.  */
-    i->pcursor->Seek(DB_COINS);
-    // Cache key of first record
-    i->pcursor->GetKey(i->keyTmp);
+    i->pcursor->Seek(DB_COIN);
+    // Assemble the first transaction
+    i->Next();
     return i;
 }
 
 bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 {
     // Return cached key
-    if (keyTmp.first == DB_COINS) {
+    if (keyTmp.first == DB_COIN) {
         key = keyTmp.second;
         return true;
     }
@@ -116,24 +394,34 @@ bool CCoinsViewDBCursor::GetKey(uint256 &key) const
 
 bool CCoinsViewDBCursor::GetValue(CCoins &coins) const
 {
-    return pcursor->GetValue(coins);
+    if (keyTmp.first != DB_COIN)
+        return false;
+    coins = coinsTmp;
+    return true;
 }
 
 unsigned int CCoinsViewDBCursor::GetValueSize() const
 {
-    return pcursor->GetValueSize();
+    return nValueSizeTmp;
 }
 
 bool CCoinsViewDBCursor::Valid() const
 {
-    return keyTmp.first == DB_COINS;
+    return keyTmp.first == DB_COIN;
 }
 
 void CCoinsViewDBCursor::Next()
 {
-    pcursor->Next();
-    if (!pcursor->Valid() || !pcursor->GetKey(keyTmp))
+    // The underlying cursor already sits on the first output of the next
+    // transaction; gather all of its outputs into one CCoins.
+    CoinEntry entry;
+    nValueSizeTmp = 0;
+    if (!pcursor->Valid() || !pcursor->GetKey(entry) || entry.key != DB_COIN) {
         keyTmp.first = 0; // Invalidate cached key after last record so that Valid() and GetKey() return false
+        return;
+    }
+    keyTmp = make_pair(DB_COIN, entry.hash);
+    ReadCoinRecords(*pcursor, entry.hash, coinsTmp, nValueSizeTmp);
 }
 
 bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo) {
@@ -148,6 +436,14 @@ bool CBlockTreeDB::WriteBatchSync(const std::vector<std::pair<int, const CBlockF
     return WriteBatch(batch, true);
 }
 
+bool CBlockTreeDB::WriteDiskBlockIndex(const std::vector<CDiskBlockIndex>& vIndex) {
+    CDBBatch batch(*this);
+    for (std::vector<CDiskBlockIndex>::const_iterator it = vIndex.begin(); it != vIndex.end(); it++) {
+        batch.Write(make_pair(DB_BLOCK_INDEX, it->GetBlockHash()), *it);
+    }
+    return WriteBatch(batch, true);
+}
+
 bool CBlockTreeDB::ReadTxIndex(const uint256 &txid, CDiskTxPos &pos) {
     return Read(make_pair(DB_TXINDEX, txid), pos);
 }
@@ -159,6 +455,165 @@ bool CBlockTreeDB::WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos>
     return WriteBatch(batch);
 }
 
+bool CBlockTreeDB::ReadPoWHash(const uint256 &hash, uint256 &powHash) {
+    return Read(make_pair(DB_POW_HASH, hash), powHash);
+}
+
+bool CBlockTreeDB::WritePoWHashes(const std::vector<std::pair<uint256, uint256> >&vect) {
+    CDBBatch batch(*this);
+    for (std::vector<std::pair<uint256,uint256> >::const_iterator it=vect.begin(); it!=vect.end(); it++)
+        batch.Write(make_pair(DB_POW_HASH, it->first), it->second);
+    return WriteBatch(batch);
+}
+
+namespace {
+
+/**
+ * Key of the by-comment keyspace: DB_TXCOMMENT, the raw comment bytes, the
+ * big-endian height and the txid. The comment is written without a length
+ * prefix so that keys sort by comment bytes and a seek to a bare prefix lands
+ * on the first matching entry; on read its length follows from the key size.
+ */
+struct CommentKey
+{
+    std::string strComment;
+    int nHeight;
+    uint256 txid;
+    bool fPrefixOnly;
+
+    CommentKey() : nHeight(0), fPrefixOnly(false) {}
+    CommentKey(const CCommentIndexEntry &entry) : strComment(entry.strComment), nHeight(entry.nHeight), txid(entry.txid), fPrefixOnly(false) {}
+    explicit CommentKey(const std::string &strPrefix) : strComment(strPrefix), nHeight(0), fPrefixOnly(true) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 1 + strComment.size() + (fPrefixOnly ? 0 : 4 + 32);
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s << DB_TXCOMMENT;
+        if (!strComment.empty())
+            s.write(strComment.data(), strComment.size());
+        if (fPrefixOnly)
+            return;
+        unsigned char buf[4];
+        WriteBE32(buf, nHeight);
+        s.write((const char*)buf, sizeof(buf));
+        s << txid;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        char chType;
+        s >> chType;
+        if (chType != DB_TXCOMMENT || s.size() < 4 + 32)
+            throw std::ios_base::failure("not a comment index key");
+        strComment.resize(s.size() - 4 - 32);
+        if (!strComment.empty())
+            s.read(&strComment[0], strComment.size());
+        unsigned char buf[4];
+        s.read((char*)buf, sizeof(buf));
+        nHeight = ReadBE32(buf);
+        s >> txid;
+        fPrefixOnly = false;
+    }
+};
+
+/** Key of the by-height keyspace: DB_TXCOMMENT_HEIGHT, big-endian height, txid */
+struct CommentHeightKey
+{
+    int nHeight;
+    uint256 txid;
+
+    CommentHeightKey() : nHeight(0) {}
+    CommentHeightKey(int nHeightIn, const uint256 &txidIn) : nHeight(nHeightIn), txid(txidIn) {}
+
+    unsigned int GetSerializeSize(int nType, int nVersion) const {
+        return 1 + 4 + 32;
+    }
+
+    template<typename Stream>
+    void Serialize(Stream &s, int nType, int nVersion) const {
+        s << DB_TXCOMMENT_HEIGHT;
+        unsigned char buf[4];
+        WriteBE32(buf, nHeight);
+        s.write((const char*)buf, sizeof(buf));
+        s << txid;
+    }
+
+    template<typename Stream>
+    void Unserialize(Stream &s, int nType, int nVersion) {
+        char chType;
+        s >> chType;
+        if (chType != DB_TXCOMMENT_HEIGHT)
+            throw std::ios_base::failure("not a comment height key");
+        unsigned char buf[4];
+        s.read((char*)buf, sizeof(buf));
+        nHeight = ReadBE32(buf);
+        s >> txid;
+    }
+};
+
+}
+
+bool CBlockTreeDB::WriteCommentIndex(const std::vector<CCommentIndexEntry> &vEntries) {
+    CDBBatch batch(*this);
+    for (std::vector<CCommentIndexEntry>::const_iterator it = vEntries.begin(); it != vEntries.end(); it++) {
+        batch.Write(CommentKey(*it), '1');
+        batch.Write(CommentHeightKey(it->nHeight, it->txid), it->strComment);
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::EraseCommentIndex(const std::vector<CCommentIndexEntry> &vEntries) {
+    CDBBatch batch(*this);
+    for (std::vector<CCommentIndexEntry>::const_iterator it = vEntries.begin(); it != vEntries.end(); it++) {
+        batch.Erase(CommentKey(*it));
+        batch.Erase(CommentHeightKey(it->nHeight, it->txid));
+    }
+    return WriteBatch(batch);
+}
+
+bool CBlockTreeDB::FindCommentsByPrefix(const std::string &strPrefix, size_t nSkip, size_t nCount, std::vector<CCommentIndexEntry> &vEntries) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(CommentKey(strPrefix));
+    while (pcursor->Valid() && vEntries.size() < nCount) {
+        boost::this_thread::interruption_point();
+        CommentKey key;
+        if (!pcursor->GetKey(key) || key.strComment.compare(0, strPrefix.size(), strPrefix) != 0)
+            break;
+        if (nSkip > 0)
+            nSkip--;
+        else
+            vEntries.push_back(CCommentIndexEntry(key.txid, key.nHeight, key.strComment));
+        pcursor->Next();
+    }
+    return true;
+}
+
+bool CBlockTreeDB::FindCommentsByHeight(int nStartHeight, int nEndHeight, size_t nSkip, size_t nCount, std::vector<CCommentIndexEntry> &vEntries) {
+    boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
+
+    pcursor->Seek(CommentHeightKey(std::max(nStartHeight, 0), uint256()));
+    while (pcursor->Valid() && vEntries.size() < nCount) {
+        boost::this_thread::interruption_point();
+        CommentHeightKey key;
+        if (!pcursor->GetKey(key) || key.nHeight > nEndHeight)
+            break;
+        if (nSkip > 0) {
+            nSkip--;
+        } else {
+            std::string strComment;
+            if (!pcursor->GetValue(strComment))
+                return error("%s: failed to read comment of %s", __func__, key.txid.ToString());
+            vEntries.push_back(CCommentIndexEntry(key.txid, key.nHeight, strComment));
+        }
+        pcursor->Next();
+    }
+    return true;
+}
+
 bool CBlockTreeDB::WriteFlag(const std::string &name, bool fValue) {
     return Write(std::make_pair(DB_FLAG, name), fValue ? '1' : '0');
 }
@@ -171,6 +626,14 @@ bool CBlockTreeDB::ReadFlag(const std::string &name, bool &fValue) {
     return true;
 }
 
+bool CBlockTreeDB::WriteCoinsStats(const CCoinsStats &stats) {
+    return Write(DB_COINS_STATS, stats);
+}
+
+bool CBlockTreeDB::ReadCoinsStats(CCoinsStats &stats) {
+    return Read(DB_COINS_STATS, stats);
+}
+
 bool CBlockTreeDB::LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex)
 {
     boost::scoped_ptr<CDBIterator> pcursor(NewIterator());
@@ -18,6 +18,7 @@
 #include <boost/function.hpp>
 
 class CBlockIndex;
+class CCoinsStats;
 class CCoinsViewDBCursor;
 class uint256;
 
@@ -35,6 +36,12 @@ static const int64_t nMaxBlockDBCache = 2;
 static const int64_t nMaxBlockDBAndTxIndexCache = 1024;
 //! Max memory allocated to coin DB specific cache (MiB)
 static const int64_t nMaxCoinsDBCache = 8;
+//! Number of writes per batch when upgrading the coin database to per-output records
+static const size_t UPGRADE_BATCH_OPS = 100000;
+//! Chainstate record format written by this version: 1 = per-output records,
+//! 2 = plus a record per transaction with unspent outputs.
+//! Binaries from before per-output records do not check it, see the release notes.
+static const int CHAINSTATE_VERSION = 2;
 
 struct CDiskTxPos : public CDiskBlockPos
 {
@@ -61,11 +68,34 @@ struct CDiskTxPos : public CDiskBlockPos
     }
 };
 
-/** CCoinsView backed by the coin database (chainstate/) */
+/** One transaction comment as recorded by -commentindex */
+struct CCommentIndexEntry
+{
+    uint256 txid;
+    int nHeight;
+    std::string strComment;
+
+    CCommentIndexEntry() : nHeight(0) {}
+    CCommentIndexEntry(const uint256 &txidIn, int nHeightIn, const std::string &strCommentIn) :
+        txid(txidIn), nHeight(nHeightIn), strComment(strCommentIn) {}
+};
+
+/**
+ * CCoinsView backed by the coin database (chainstate/).
+ *
+ * Every unspent output is stored as its own record, keyed by txid and output
+ * index, so spending one output of a large transaction only erases that
+ * record. CCoins are reassembled from the records of a txid on read. A small
+ * record per transaction with unspent outputs answers HaveCoins, and lets
+ * GetCoins skip the seek for transactions that are not there.
+ */
 class CCoinsViewDB : public CCoinsView
 {
 protected:
     CDBWrapper db;
+
+    //! Add the per-transaction records to a chainstate of format version 1
+    bool AddCoinHeaders();
 public:
     CCoinsViewDB(size_t nCacheSize, bool fMemory = false, bool fWipe = false);
 
@@ -74,6 +104,13 @@ public:
     uint256 GetBestBlock() const;
     bool BatchWrite(CCoinsMap &mapCoins, const uint256 &hashBlock);
     CCoinsViewCursor *Cursor() const;
+
+    //! Convert legacy per-transaction records to per-output ones and mark the format version.
+    //! Returns false on error, on shutdown, or if the chainstate was written in a newer format.
+    bool Upgrade();
+
+    //! Size of the record stored for output n of coins, as the cursor's GetValueSize counts it
+    static unsigned int GetRecordSize(const CCoins &coins, uint32_t n);
 };
 
 /** Specialization of CCoinsViewCursor to iterate over a CCoinsViewDB */
@@ -91,9 +128,11 @@ public:
 
 private:
     CCoinsViewDBCursor(CDBIterator* pcursorIn, const uint256 &hashBlockIn):
-        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn) {}
+        CCoinsViewCursor(hashBlockIn), pcursor(pcursorIn), nValueSizeTmp(0) {}
     boost::scoped_ptr<CDBIterator> pcursor;
     std::pair<char, uint256> keyTmp;
+    CCoins coinsTmp;
+    unsigned int nValueSizeTmp;
 
     friend class CCoinsViewDB;
 };
@@ -108,14 +147,26 @@ private:
     void operator=(const CBlockTreeDB&);
 public:
     bool WriteBatchSync(const std::vector<std::pair<int, const CBlockFileInfo*> >& fileInfo, int nLastFile, const std::vector<const CBlockIndex*>& blockinfo);
+    /** Write block index entries of blocks that are not in mapBlockIndex, keyed by their hash */
+    bool WriteDiskBlockIndex(const std::vector<CDiskBlockIndex>& vIndex);
     bool ReadBlockFileInfo(int nFile, CBlockFileInfo &fileinfo);
     bool ReadLastBlockFile(int &nFile);
     bool WriteReindexing(bool fReindex);
     bool ReadReindexing(bool &fReindex);
     bool ReadTxIndex(const uint256 &txid, CDiskTxPos &pos);
     bool WriteTxIndex(const std::vector<std::pair<uint256, CDiskTxPos> > &list);
+    bool ReadPoWHash(const uint256 &hash, uint256 &powHash);
+    bool WritePoWHashes(const std::vector<std::pair<uint256, uint256> > &list);
+    bool WriteCommentIndex(const std::vector<CCommentIndexEntry> &vEntries);
+    bool EraseCommentIndex(const std::vector<CCommentIndexEntry> &vEntries);
+    /** Comments starting with strPrefix, in byte order of the comment, then by height */
+    bool FindCommentsByPrefix(const std::string &strPrefix, size_t nSkip, size_t nCount, std::vector<CCommentIndexEntry> &vEntries);
+    /** Comments in blocks nStartHeight..nEndHeight (inclusive), in height order */
+    bool FindCommentsByHeight(int nStartHeight, int nEndHeight, size_t nSkip, size_t nCount, std::vector<CCommentIndexEntry> &vEntries);
     bool WriteFlag(const std::string &name, bool fValue);
     bool ReadFlag(const std::string &name, bool &fValue);
+    bool WriteCoinsStats(const CCoinsStats &stats);
+    bool ReadCoinsStats(CCoinsStats &stats);
     bool LoadBlockIndexGuts(boost::function<CBlockIndex*(const uint256&)> insertBlockIndex);
 };
 
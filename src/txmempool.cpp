@@ -935,6 +935,8 @@ void CTxMemPool::PrioritiseTransaction(const uint256 hash, const string strHash,
                 mapTx.modify(ancestorIt, update_descendant_state(0, nFeeDelta, 0));
             }
         }
+        // Block templates depend on the deltas too
+        ++nTransactionsUpdated;
     }
     LogPrintf("PrioritiseTransaction: %s priority += %f, fee += %d\n", strHash, dPriorityDelta, FormatMoney(nFeeDelta));
 }
@@ -0,0 +1,289 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#include "utxosnapshot.h"
+
+#include "chain.h"
+#include "chainparams.h"
+#include "clientversion.h"
+#include "coins.h"
+#include "hash.h"
+#include "main.h"
+#include "streams.h"
+#include "sync.h"
+#include "txdb.h"
+#include "util.h"
+
+#include <boost/filesystem.hpp>
+#include <boost/scoped_ptr.hpp>
+#include <boost/thread.hpp>
+
+const unsigned char CUTXOSnapshotHeader::MAGIC[4] = {'u', 't', 'x', 'o'};
+
+CUTXOSnapshotHeader::CUTXOSnapshotHeader() : nVersion(UTXO_SNAPSHOT_VERSION), nHeight(0), nTransactions(0)
+{
+    memcpy(pchMagic, MAGIC, sizeof(pchMagic));
+    memset(pchMessageStart, 0, sizeof(pchMessageStart));
+}
+
+void UpdateUTXOSetHash(CHashWriter& ss, const uint256& txid, const CCoins& coins)
+{
+    ss << txid;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        const CTxOut &out = coins.vout[i];
+        if (!out.IsNull()) {
+            ss << VARINT(i+1);
+            ss << out;
+        }
+    }
+    ss << VARINT(0);
+}
+
+static void AddToStats(CUTXOSnapshotStats& stats, const CCoins& coins)
+{
+    stats.nTransactions++;
+    for (unsigned int i = 0; i < coins.vout.size(); i++) {
+        if (!coins.vout[i].IsNull()) {
+            stats.nTransactionOutputs++;
+            stats.nTotalAmount += coins.vout[i].nValue;
+        }
+    }
+}
+
+bool DumpUTXOSnapshot(const boost::filesystem::path& path, CUTXOSnapshotStats& stats, std::string& strError)
+{
+    boost::scoped_ptr<CCoinsViewCursor> pcursor;
+    const CBlockIndex* pindex;
+    {
+        LOCK(cs_main);
+        FlushStateToDisk();
+        pcursor.reset(pcoinsTip->Cursor());
+        BlockMap::const_iterator mi = mapBlockIndex.find(pcursor->GetBestBlock());
+        if (mi == mapBlockIndex.end()) {
+            strError = "Best block of the coin database is not known";
+            return false;
+        }
+        pindex = mi->second;
+    }
+
+    // Write next to the destination and only move it there once complete
+    boost::filesystem::path pathTmp(path.string() + ".incomplete");
+    CAutoFile fileout(fopen(pathTmp.string().c_str(), "wb"), SER_DISK, CLIENT_VERSION);
+    if (fileout.IsNull()) {
+        strError = "Cannot open " + pathTmp.string() + " for writing";
+        return false;
+    }
+
+    CUTXOSnapshotHeader header;
+    memcpy(header.pchMessageStart, Params().MessageStart(), sizeof(header.pchMessageStart));
+    header.hashBlock = pindex->GetBlockHash();
+    header.nHeight = pindex->nHeight;
+    stats = CUTXOSnapshotStats();
+    stats.hashBlock = header.hashBlock;
+    stats.nHeight = header.nHeight;
+    try {
+        fileout << header;
+
+        // Block index entries never change once the block is connected, so
+        // the ancestors of pindex can be walked without cs_main
+        for (int nHeight = 0; nHeight <= pindex->nHeight; nHeight++) {
+            boost::this_thread::interruption_point();
+            const CBlockIndex* pindexAncestor = pindex->GetAncestor(nHeight);
+            fileout << pindexAncestor->GetBlockHeader() << VARINT(pindexAncestor->nTx);
+        }
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header.hashBlock;
+        while (pcursor->Valid()) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CCoins coins;
+            if (!pcursor->GetKey(txid) || !pcursor->GetValue(coins))
+                throw std::runtime_error("unable to read the UTXO set");
+            fileout << txid << coins;
+            UpdateUTXOSetHash(ss, txid, coins);
+            AddToStats(stats, coins);
+            pcursor->Next();
+        }
+        stats.hashSerialized = ss.GetHash();
+        fileout << stats.hashSerialized;
+
+        // Now that the number of transactions is known, fill it in
+        header.nTransactions = stats.nTransactions;
+        if (fseek(fileout.Get(), 0, SEEK_SET) != 0)
+            throw std::runtime_error("seek failed");
+        fileout << header;
+        FileCommit(fileout.Get());
+    } catch (const std::exception& e) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        strError = strprintf("Error writing UTXO snapshot: %s", e.what());
+        return false;
+    } catch (const boost::thread_interrupted&) {
+        fileout.fclose();
+        boost::filesystem::remove(pathTmp);
+        throw;
+    }
+    fileout.fclose();
+
+    if (!RenameOver(pathTmp, path)) {
+        boost::filesystem::remove(pathTmp);
+        strError = "Cannot rename " + pathTmp.string() + " to " + path.string();
+        return false;
+    }
+    LogPrintf("Wrote UTXO snapshot at block %s (height %d, %u transactions) to %s\n",
+        stats.hashBlock.ToString(), stats.nHeight, stats.nTransactions, path.string());
+    return true;
+}
+
+/**
+ * Read a snapshot file front to back, checking the header chain and the
+ * hash of the coins. If pcoinsview is set, also write the block index and the
+ * coins out as they are read; that is only done after a checking pass.
+ */
+static bool ReadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, CCoinsView* pcoinsview, CUTXOSnapshotStats& stats, std::string& strError)
+{
+    CAutoFile filein(fopen(path.string().c_str(), "rb"), SER_DISK, CLIENT_VERSION);
+    if (filein.IsNull()) {
+        strError = "Cannot open UTXO snapshot " + path.string();
+        return false;
+    }
+
+    stats = CUTXOSnapshotStats();
+    try {
+        CUTXOSnapshotHeader header;
+        filein >> header;
+        if (memcmp(header.pchMagic, CUTXOSnapshotHeader::MAGIC, sizeof(header.pchMagic)) || header.nVersion != UTXO_SNAPSHOT_VERSION) {
+            strError = path.string() + " is not a UTXO snapshot of a supported version";
+            return false;
+        }
+        if (memcmp(header.pchMessageStart, chainparams.MessageStart(), sizeof(header.pchMessageStart)) || header.nHeight < 0) {
+            strError = "UTXO snapshot " + path.string() + " is for a different network";
+            return false;
+        }
+        stats.hashBlock = header.hashBlock;
+        stats.nHeight = header.nHeight;
+
+        // The headers have to link up from our genesis block; as the
+        // snapshot block's hash is covered by hash_serialized, that also
+        // commits to every one of them
+        std::vector<CDiskBlockIndex> vIndex;
+        uint256 hashPrev;
+        for (int nHeight = 0; nHeight <= header.nHeight; nHeight++) {
+            boost::this_thread::interruption_point();
+            CBlockHeader block;
+            unsigned int nTx = 0;
+            filein >> block >> VARINT(nTx);
+            if (block.hashPrevBlock != hashPrev || nTx == 0) {
+                strError = strprintf("UTXO snapshot headers do not form a chain at height %d", nHeight);
+                return false;
+            }
+            hashPrev = block.GetHash();
+            if (nHeight == 0 && hashPrev != chainparams.GetConsensus().hashGenesisBlock) {
+                strError = "UTXO snapshot starts from a different genesis block";
+                return false;
+            }
+            if (pcoinsview) {
+                vIndex.push_back(CDiskBlockIndex());
+                CDiskBlockIndex& index = vIndex.back();
+                index.nHeight = nHeight;
+                index.nStatus = BLOCK_VALID_SCRIPTS | BLOCK_OPT_WITNESS;
+                index.nTx = nTx;
+                index.nVersion = block.nVersion;
+                index.hashPrev = block.hashPrevBlock;
+                index.hashMerkleRoot = block.hashMerkleRoot;
+                index.nTime = block.nTime;
+                index.nBits = block.nBits;
+                index.nNonce = block.nNonce;
+                if (vIndex.size() >= UTXO_SNAPSHOT_LOAD_BATCH || nHeight == header.nHeight) {
+                    if (!pblocktree->WriteDiskBlockIndex(vIndex)) {
+                        strError = "Failed to write to the block index database";
+                        return false;
+                    }
+                    vIndex.clear();
+                }
+            }
+        }
+        if (hashPrev != header.hashBlock) {
+            strError = "UTXO snapshot headers do not lead to its block";
+            return false;
+        }
+
+        CHashWriter ss(SER_GETHASH, PROTOCOL_VERSION);
+        ss << header.hashBlock;
+        boost::scoped_ptr<CCoinsViewCache> pcache(pcoinsview ? new CCoinsViewCache(pcoinsview) : NULL);
+        uint256 txidLast;
+        for (uint64_t i = 0; i < header.nTransactions; i++) {
+            boost::this_thread::interruption_point();
+            uint256 txid;
+            CCoins coins;
+            filein >> txid >> coins;
+            if ((i > 0 && !(txidLast < txid)) || coins.IsPruned()) {
+                strError = strprintf("UTXO snapshot coins are malformed at transaction %s", txid.ToString());
+                return false;
+            }
+            txidLast = txid;
+            UpdateUTXOSetHash(ss, txid, coins);
+            AddToStats(stats, coins);
+            if (pcache) {
+                {
+                    CCoinsModifier modifier = pcache->ModifyNewCoins(txid, false);
+                    modifier->swap(coins);
+                }
+                if (pcache->GetCacheSize() >= UTXO_SNAPSHOT_LOAD_BATCH && !pcache->Flush()) {
+                    strError = "Failed to write to the coin database";
+                    return false;
+                }
+            }
+        }
+
+        uint256 hashSerialized;
+        filein >> hashSerialized;
+        stats.hashSerialized = ss.GetHash();
+        if (hashSerialized != stats.hashSerialized) {
+            strError = "UTXO snapshot is corrupted: its coins do not match the hash it was written with";
+            return false;
+        }
+        if (pcache) {
+            // Only now does the coin database claim to be at the snapshot block
+            pcache->SetBestBlock(header.hashBlock);
+            if (!pcache->Flush()) {
+                strError = "Failed to write to the coin database";
+                return false;
+            }
+        }
+    } catch (const std::exception& e) {
+        strError = strprintf("Error reading UTXO snapshot: %s", e.what());
+        return false;
+    }
+    return true;
+}
+
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, CCoinsView* pcoinsview, CUTXOSnapshotStats& stats, std::string& strError)
+{
+    LogPrintf("Checking UTXO snapshot %s...\n", path.string());
+    if (!ReadUTXOSnapshot(chainparams, path, NULL, stats, strError))
+        return false;
+    if (stats.hashSerialized != hashExpected) {
+        strError = strprintf("UTXO snapshot has hash_serialized %s, expected %s", stats.hashSerialized.ToString(), hashExpected.ToString());
+        return false;
+    }
+
+    LogPrintf("Loading UTXO snapshot at block %s (height %d, %u transactions)...\n",
+        stats.hashBlock.ToString(), stats.nHeight, stats.nTransactions);
+    // Mark the load as in progress, so an interrupted one is not taken for a chainstate
+    if (!pblocktree->WriteFlag("utxosnapshot", false)) {
+        strError = "Failed to write to the block index database";
+        return false;
+    }
+    if (!ReadUTXOSnapshot(chainparams, path, pcoinsview, stats, strError))
+        return false;
+    // None of the blocks below the snapshot have data; treat them like pruned ones
+    if (!pblocktree->WriteFlag("prunedblockfiles", true) || !pblocktree->WriteFlag("utxosnapshot", true)) {
+        strError = "Failed to write to the block index database";
+        return false;
+    }
+    LogPrintf("Loaded UTXO snapshot\n");
+    return true;
+}
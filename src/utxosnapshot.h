@@ -0,0 +1,97 @@
+// Copyright (c) 2017 The Florincoin Core developers
+// Distributed under the MIT software license, see the accompanying
+// file COPYING or http://www.opensource.org/licenses/mit-license.php.
+
+#ifndef BITCOIN_UTXOSNAPSHOT_H
+#define BITCOIN_UTXOSNAPSHOT_H
+
+#include "amount.h"
+#include "serialize.h"
+#include "uint256.h"
+
+#include <string>
+
+#include <boost/filesystem/path.hpp>
+
+class CChainParams;
+class CCoins;
+class CCoinsView;
+class CHashWriter;
+
+/** Format version of UTXO snapshot files */
+static const int UTXO_SNAPSHOT_VERSION = 1;
+/** Number of transactions written to the coin database at once when loading a snapshot */
+static const size_t UTXO_SNAPSHOT_LOAD_BATCH = 100000;
+
+/**
+ * Start of a UTXO snapshot file. It is followed by the header and
+ * transaction count of every block from the genesis block up to hashBlock,
+ * then nTransactions pairs of txid and CCoins in coin database order, and
+ * finally the hash_serialized that gettxoutsetinfo reports for that set.
+ */
+class CUTXOSnapshotHeader
+{
+public:
+    static const unsigned char MAGIC[4];
+
+    unsigned char pchMagic[4];
+    int nVersion;
+    unsigned char pchMessageStart[4];
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactions;
+
+    CUTXOSnapshotHeader();
+
+    ADD_SERIALIZE_METHODS;
+
+    template <typename Stream, typename Operation>
+    inline void SerializationOp(Stream& s, Operation ser_action, int nType, int nVersionIn) {
+        READWRITE(FLATDATA(pchMagic));
+        READWRITE(nVersion);
+        READWRITE(FLATDATA(pchMessageStart));
+        READWRITE(hashBlock);
+        READWRITE(nHeight);
+        READWRITE(nTransactions);
+    }
+};
+
+/** What a snapshot holds, as reported when writing or loading one */
+struct CUTXOSnapshotStats
+{
+    uint256 hashBlock;
+    int nHeight;
+    uint64_t nTransactions;
+    uint64_t nTransactionOutputs;
+    uint256 hashSerialized;
+    CAmount nTotalAmount;
+
+    CUTXOSnapshotStats() : nHeight(0), nTransactions(0), nTransactionOutputs(0), nTotalAmount(0) {}
+};
+
+/**
+ * Add the unspent outputs of txid to the hash_serialized commitment of
+ * gettxoutsetinfo. Transactions have to be added in coin database order,
+ * after the hash of the block the set is at.
+ */
+void UpdateUTXOSetHash(CHashWriter& ss, const uint256& txid, const CCoins& coins);
+
+/**
+ * Write the coin database at the current tip to a snapshot file at path,
+ * streaming it through a database cursor, so memory use does not depend on
+ * the size of the UTXO set. cs_main is only held to flush and take the cursor.
+ */
+bool DumpUTXOSnapshot(const boost::filesystem::path& path, CUTXOSnapshotStats& stats, std::string& strError);
+
+/**
+ * Bootstrap an empty block tree and coin database from a snapshot file.
+ *
+ * The file is read twice. The first pass checks that the headers link up
+ * from the genesis block to the snapshot block and that the coins hash to
+ * hashExpected, the hash_serialized of a trusted node at that block. Only
+ * then does the second pass write the block index, without block data, and
+ * the coins. The chain is marked as pruned below the snapshot block.
+ */
+bool LoadUTXOSnapshot(const CChainParams& chainparams, const boost::filesystem::path& path, const uint256& hashExpected, CCoinsView* pcoinsview, CUTXOSnapshotStats& stats, std::string& strError);
+
+#endif // BITCOIN_UTXOSNAPSHOT_H
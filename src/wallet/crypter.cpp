@@ -227,6 +227,19 @@ bool CCryptoKeyStore::AddKeyPubKey(const CKey& key, const CPubKey &pubkey)
     return true;
 }
 
+bool CCryptoKeyStore::EncryptKey(const CKey& key, const CPubKey &pubkey, std::vector<unsigned char> &vchCryptedSecret) const
+{
+    CKeyingMaterial vMasterKeyCopy;
+    {
+        LOCK(cs_KeyStore);
+        if (!IsCrypted() || IsLocked())
+            return false;
+        vMasterKeyCopy = vMasterKey;
+    }
+
+    CKeyingMaterial vchSecret(key.begin(), key.end());
+    return EncryptSecret(vMasterKeyCopy, vchSecret, pubkey.GetHash(), vchCryptedSecret);
+}
 
 bool CCryptoKeyStore::AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret)
 {
@@ -167,6 +167,8 @@ public:
 
     virtual bool AddCryptedKey(const CPubKey &vchPubKey, const std::vector<unsigned char> &vchCryptedSecret);
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
+    //! Encrypt a new key for AddCryptedKey, without holding cs_KeyStore while doing so; fails if locked
+    bool EncryptKey(const CKey& key, const CPubKey &pubkey, std::vector<unsigned char> &vchCryptedSecret) const;
     bool HaveKey(const CKeyID &address) const
     {
         {
@@ -240,7 +240,7 @@ void CDBEnv::CheckpointLSN(const std::string& strFile)
 }
 
 
-CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL)
+CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnCloseIn) : pdb(NULL), activeTxn(NULL), batchTxn(NULL)
 {
     int ret;
     fReadOnly = (!strchr(pszMode, '+') && !strchr(pszMode, 'w'));
@@ -297,6 +297,8 @@ CDB::CDB(const std::string& strFilename, const char* pszMode, bool fFlushOnClose
             bitdb.mapDb[strFile] = pdb;
         }
     }
+
+    activeTxn = batchTxn = CDBWriteBatch::GetTxn(strFile);
 }
 
 void CDB::Flush()
@@ -316,13 +318,15 @@ void CDB::Close()
 {
     if (!pdb)
         return;
-    if (activeTxn)
+    if (activeTxn && activeTxn != batchTxn)
         activeTxn->abort();
     activeTxn = NULL;
     pdb = NULL;
 
-    if (fFlushOnClose)
+    // A batch leaves checkpointing to the wallet flushing thread
+    if (fFlushOnClose && !batchTxn)
         Flush();
+    batchTxn = NULL;
 
     {
         LOCK(bitdb.cs_db);
@@ -330,6 +334,59 @@ void CDB::Close()
     }
 }
 
+static void NoBatchCleanup(CDBWriteBatch*)
+{
+}
+
+// Innermost write batch of each thread; the batches themselves live on the stack
+static boost::thread_specific_ptr<CDBWriteBatch> batchThread(NoBatchCleanup);
+
+CDBWriteBatch::CDBWriteBatch(const std::string& strFileIn, bool fSyncIn) : strFile(strFileIn), ptxn(NULL), fSync(fSyncIn), pprev(batchThread.get())
+{
+    CDBWriteBatch* pouter = pprev;
+    while (pouter && (pouter->strFile != strFile || !pouter->ptxn))
+        pouter = pouter->pprev;
+    if (pouter) {
+        pouter->fSync |= fSync;
+    } else if (!strFile.empty()) {
+        LOCK(bitdb.cs_db);
+        if (!bitdb.Open(GetDataDir()))
+            throw runtime_error("CDBWriteBatch: Failed to open database environment.");
+        ptxn = bitdb.TxnBegin();
+        // Keep the file from being closed for flushing under the transaction
+        if (ptxn)
+            ++bitdb.mapFileUseCount[strFile];
+    }
+    batchThread.reset(this);
+}
+
+CDBWriteBatch::~CDBWriteBatch()
+{
+    batchThread.reset(pprev);
+    if (!ptxn)
+        return;
+
+    int64_t nStart = GetTimeMillis();
+    int ret = ptxn->commit(fSync ? DB_TXN_SYNC : 0);
+    if (ret != 0)
+        LogPrintf("CDBWriteBatch: Error %d committing to %s: %s\n", ret, strFile, DbEnv::strerror(ret));
+    LogPrint("db", "CDBWriteBatch: Committed %s%s %dms\n", strFile, fSync ? " (sync)" : "", GetTimeMillis() - nStart);
+    {
+        LOCK(bitdb.cs_db);
+        --bitdb.mapFileUseCount[strFile];
+    }
+    // Count the commit itself, so the flushing thread syncs the log after it
+    nWalletDBUpdated++;
+}
+
+DbTxn* CDBWriteBatch::GetTxn(const std::string& strFile)
+{
+    for (CDBWriteBatch* pbatch = batchThread.get(); pbatch; pbatch = pbatch->pprev)
+        if (pbatch->strFile == strFile && pbatch->ptxn)
+            return pbatch->ptxn;
+    return NULL;
+}
+
 void CDBEnv::CloseDb(const string& strFile)
 {
     {
@@ -437,6 +494,15 @@ bool CDB::Rewrite(const string& strFile, const char* pszSkip)
 }
 
 
+void CDBEnv::FlushLog()
+{
+    if (!fDbEnvInit || fMockDb)
+        return;
+    int ret = dbenv->log_flush(NULL);
+    if (ret != 0)
+        LogPrintf("CDBEnv::FlushLog: Error %d flushing log: %s\n", ret, DbEnv::strerror(ret));
+}
+
 void CDBEnv::Flush(bool fShutdown)
 {
     int64_t nStart = GetTimeMillis();
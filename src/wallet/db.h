@@ -22,6 +22,7 @@
 
 static const unsigned int DEFAULT_WALLET_DBLOGSIZE = 100;
 static const bool DEFAULT_WALLET_PRIVDB = true;
+static const unsigned int DEFAULT_WALLET_FLUSH_INTERVAL = 500;
 
 extern unsigned int nWalletDBUpdated;
 
@@ -72,15 +73,16 @@ public:
     bool Open(const boost::filesystem::path& path);
     void Close();
     void Flush(bool fShutdown);
+    void FlushLog();
     void CheckpointLSN(const std::string& strFile);
 
     void CloseDb(const std::string& strFile);
     bool RemoveDb(const std::string& strFile);
 
-    DbTxn* TxnBegin(int flags = DB_TXN_WRITE_NOSYNC)
+    DbTxn* TxnBegin(DbTxn* pparent = NULL, int flags = DB_TXN_WRITE_NOSYNC)
     {
         DbTxn* ptxn = NULL;
-        int ret = dbenv->txn_begin(NULL, &ptxn, flags);
+        int ret = dbenv->txn_begin(pparent, &ptxn, flags);
         if (!ptxn || ret != 0)
             return NULL;
         return ptxn;
@@ -89,6 +91,40 @@ public:
 
 extern CDBEnv bitdb;
 
+/**
+ * Group the writes this thread makes to one database file into a single
+ * transaction, committed when the batch goes out of scope. Handles on the
+ * file opened while the batch is active read and write through it, and
+ * must be closed before it ends. Batches nest; only the outermost commits.
+ *
+ * A committed batch is atomic. It is durable once the log reaches disk:
+ * on commit if any of the nested batches asked for fSync, otherwise within
+ * -walletflushinterval milliseconds, when the wallet flushing thread syncs
+ * the log for every transaction committed since its last pass.
+ *
+ * Other threads' handles on the file wait for the records the batch has
+ * touched until it commits, so only create one while holding the lock that
+ * serializes writers to the file (cs_wallet for the wallet).
+ */
+class CDBWriteBatch
+{
+private:
+    std::string strFile;
+    DbTxn* ptxn;
+    bool fSync;
+    CDBWriteBatch* pprev;
+
+    CDBWriteBatch(const CDBWriteBatch&);
+    void operator=(const CDBWriteBatch&);
+
+public:
+    explicit CDBWriteBatch(const std::string& strFileIn, bool fSyncIn = false);
+    ~CDBWriteBatch();
+
+    /** The transaction of this thread's batch on strFile, or NULL */
+    static DbTxn* GetTxn(const std::string& strFile);
+};
+
 
 /** RAII class that provides access to a Berkeley database */
 class CDB
@@ -97,6 +133,7 @@ protected:
     Db* pdb;
     std::string strFile;
     DbTxn* activeTxn;
+    DbTxn* batchTxn;
     bool fReadOnly;
     bool fFlushOnClose;
 
@@ -222,7 +259,7 @@ protected:
         if (!pdb)
             return NULL;
         Dbc* pcursor = NULL;
-        int ret = pdb->cursor(NULL, &pcursor, 0);
+        int ret = pdb->cursor(activeTxn, &pcursor, 0);
         if (ret != 0)
             return NULL;
         return pcursor;
@@ -266,11 +303,12 @@ protected:
     }
 
 public:
+    // Inside a write batch these nest a child transaction under it
     bool TxnBegin()
     {
-        if (!pdb || activeTxn)
+        if (!pdb || activeTxn != batchTxn)
             return false;
-        DbTxn* ptxn = bitdb.TxnBegin();
+        DbTxn* ptxn = bitdb.TxnBegin(batchTxn);
         if (!ptxn)
             return false;
         activeTxn = ptxn;
@@ -279,19 +317,19 @@ public:
 
     bool TxnCommit()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || activeTxn == batchTxn)
             return false;
         int ret = activeTxn->commit(0);
-        activeTxn = NULL;
+        activeTxn = batchTxn;
         return (ret == 0);
     }
 
     bool TxnAbort()
     {
-        if (!pdb || !activeTxn)
+        if (!pdb || activeTxn == batchTxn)
             return false;
         int ret = activeTxn->abort();
-        activeTxn = NULL;
+        activeTxn = batchTxn;
         return (ret == 0);
     }
 
@@ -129,8 +129,10 @@ UniValue getnewaddress(const UniValue& params, bool fHelp)
     if (params.size() > 0)
         strAccount = AccountFromValue(params[0]);
 
+    // A top-up commits its keys in batches of its own, so start ours after it
     if (!pwalletMain->IsLocked())
         pwalletMain->TopUpKeyPool();
+    CDBWriteBatch batch(pwalletMain->strWalletFile);
 
     // Generate a new key that is added to wallet
     CPubKey newKey;
@@ -205,8 +207,10 @@ UniValue getrawchangeaddress(const UniValue& params, bool fHelp)
 
     LOCK2(cs_main, pwalletMain->cs_wallet);
 
+    // A top-up commits its keys in batches of its own, so start ours after it
     if (!pwalletMain->IsLocked())
         pwalletMain->TopUpKeyPool();
+    CDBWriteBatch batch(pwalletMain->strWalletFile);
 
     CReserveKey reservekey(pwalletMain);
     CPubKey vchPubKey;
@@ -1439,20 +1443,72 @@ void AcentryToJSON(const CAccountingEntry& acentry, const string& strAccount, Un
     }
 }
 
+/**
+ * Cursors for paging through listtransactions and listsinceblock. One
+ * names the index key of the transaction a page stopped in, and how many
+ * of the entries listed under that key were returned, as numbers
+ * separated by colons. Unlike a number of entries to skip, a cursor stays
+ * put as transactions come in, and the next page starts with a lookup
+ * instead of listing everything before it.
+ */
+static std::vector<int64_t> ParseListCursor(const string& strCursor, size_t nFields)
+{
+    std::vector<int64_t> vFields;
+    size_t nStart = 0;
+    while (vFields.size() < nFields) {
+        size_t nEnd = strCursor.find(':', nStart);
+        if ((nEnd == string::npos) != (vFields.size() + 1 == nFields))
+            break;
+        int64_t n;
+        if (!ParseInt64(strCursor.substr(nStart, nEnd - nStart), &n))
+            break;
+        vFields.push_back(n);
+        nStart = nEnd + 1;
+    }
+    if (vFields.size() != nFields || vFields.back() < 0)
+        throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+    return vFields;
+}
+
+/**
+ * Add the entries for the wallet transactions and accounting entries at
+ * the nOrderPos of it to vEntries, after skipping nSkip of them, until
+ * vEntries holds nCount. Leaves it past them, and nSkip at how many of
+ * them have been returned.
+ */
+static void ListOrderPosEntries(CWallet::TxItems::const_reverse_iterator& it, const CWallet::TxItems::const_reverse_iterator& end, const string& strAccount, const isminefilter& filter, int64_t& nSkip, int nCount, std::vector<UniValue>& vEntries)
+{
+    UniValue entries(UniValue::VARR);
+    for (int64_t nPos = it->first; it != end && it->first == nPos; ++it) {
+        CWalletTx *const pwtx = it->second.first;
+        if (pwtx != 0)
+            ListTransactions(*pwtx, strAccount, 0, true, entries, filter);
+        CAccountingEntry *const pacentry = it->second.second;
+        if (pacentry != 0)
+            AcentryToJSON(*pacentry, strAccount, entries);
+    }
+    for (; nSkip < (int64_t)entries.size() && (int)vEntries.size() < nCount; nSkip++)
+        vEntries.push_back(entries[nSkip]);
+}
+
 UniValue listtransactions(const UniValue& params, bool fHelp)
 {
     if (!EnsureWalletIsAvailable(fHelp))
         return NullUniValue;
 
-    if (fHelp || params.size() > 4)
+    if (fHelp || params.size() > 5)
         throw runtime_error(
-            "listtransactions ( \"account\" count from includeWatchonly)\n"
+            "listtransactions ( \"account\" count from includeWatchonly \"cursor\" )\n"
             "\nReturns up to 'count' most recent transactions skipping the first 'from' transactions for account 'account'.\n"
             "\nArguments:\n"
             "1. \"account\"    (string, optional) DEPRECATED. The account name. Should be \"*\".\n"
             "2. count          (numeric, optional, default=10) The number of transactions to return\n"
             "3. from           (numeric, optional, default=0) The number of transactions to skip\n"
             "4. includeWatchonly (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
+            "5. \"cursor\"       (string, optional) Page through the transactions instead of skipping 'from' of them: \"\" for the\n"
+            "                  most recent 'count' (1 or more), then the cursor of the page before for the 'count' before those.\n"
+            "                  The result is then an object with the transactions and the cursor for the next page,\n"
+            "                  which is left out once there are no older transactions\n"
             "\nResult:\n"
             "[\n"
             "  {\n"
@@ -1499,6 +1555,9 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
             + HelpExampleCli("listtransactions", "") +
             "\nList transactions 100 to 120\n"
             + HelpExampleCli("listtransactions", "\"*\" 20 100") +
+            "\nPage through all transactions, newest first\n"
+            + HelpExampleCli("listtransactions", "\"*\" 100 0 false \"\"")
+            + HelpExampleCli("listtransactions", "\"*\" 100 0 false \"cursor\"") +
             "\nAs a json rpc call\n"
             + HelpExampleRpc("listtransactions", "\"*\", 20, 100")
         );
@@ -1524,10 +1583,49 @@ UniValue listtransactions(const UniValue& params, bool fHelp)
     if (nFrom < 0)
         throw JSONRPCError(RPC_INVALID_PARAMETER, "Negative from");
 
-    UniValue ret(UniValue::VARR);
-
     const CWallet::TxItems & txOrdered = pwalletMain->wtxOrdered;
 
+    if (params.size() > 4)
+    {
+        if (nFrom != 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Cannot use from with a cursor");
+        if (nCount == 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Count must be positive with a cursor");
+
+        // Page backwards from where the cursor left off
+        string strCursor = params[4].get_str();
+        CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin();
+        int64_t nCursorPos = 0;
+        int64_t nCursorSkip = 0;
+        if (!strCursor.empty()) {
+            std::vector<int64_t> vCursor = ParseListCursor(strCursor, 2);
+            nCursorPos = vCursor[0];
+            nCursorSkip = vCursor[1];
+            it = CWallet::TxItems::const_reverse_iterator(txOrdered.upper_bound(nCursorPos));
+        }
+
+        std::vector<UniValue> vEntries;
+        while (it != txOrdered.rend() && (int)vEntries.size() < nCount) {
+            int64_t nPos = it->first;
+            int64_t nSkip = (!strCursor.empty() && nPos == nCursorPos) ? nCursorSkip : 0;
+            ListOrderPosEntries(it, txOrdered.rend(), strAccount, filter, nSkip, nCount, vEntries);
+            strCursor = strprintf("%d:%d", nPos, nSkip);
+            nCursorPos = nPos;
+            nCursorSkip = nSkip;
+        }
+        std::reverse(vEntries.begin(), vEntries.end()); // Return oldest to newest
+
+        UniValue transactions(UniValue::VARR);
+        transactions.push_backV(vEntries);
+        UniValue ret(UniValue::VOBJ);
+        ret.push_back(Pair("transactions", transactions));
+        if ((int)vEntries.size() == nCount)
+            ret.push_back(Pair("cursor", strCursor));
+        return ret;
+    }
+
+    UniValue ret(UniValue::VARR);
+
     // iterate backwards until we have nCount items to return:
     for (CWallet::TxItems::const_reverse_iterator it = txOrdered.rbegin(); it != txOrdered.rend(); ++it)
     {
@@ -1652,12 +1750,15 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
 
     if (fHelp)
         throw runtime_error(
-            "listsinceblock ( \"blockhash\" target-confirmations includeWatchonly)\n"
+            "listsinceblock ( \"blockhash\" target-confirmations includeWatchonly count \"cursor\" )\n"
             "\nGet all transactions in blocks since block [blockhash], or all transactions if omitted\n"
             "\nArguments:\n"
             "1. \"blockhash\"   (string, optional) The block hash to list transactions since\n"
             "2. target-confirmations:    (numeric, optional) The confirmations required, must be 1 or more\n"
-            "3. includeWatchonly:        (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')"
+            "3. includeWatchonly:        (bool, optional, default=false) Include transactions to watchonly addresses (see 'importaddress')\n"
+            "4. count                    (numeric, optional) Return at most this many transactions (1 or more), by block height and then\n"
+            "                            unconfirmed ones, with a cursor for the rest\n"
+            "5. \"cursor\"               (string, optional) The cursor of the page before, to get the next one\n"
             "\nResult:\n"
             "{\n"
             "  \"transactions\": [\n"
@@ -1680,6 +1781,8 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
             "    \"to\": \"...\",            (string) If a comment to is associated with the transaction.\n"
              "  ],\n"
             "  \"lastblock\": \"lastblockhash\"     (string) The hash of the last block\n"
+            "  \"cursor\": \"cursor\"           (string) With count, where the next page starts, if there may be one.\n"
+            "                                 Use the lastblock of the last page for the next listsinceblock\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("listsinceblock", "")
@@ -1715,17 +1818,51 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
         if(params[2].get_bool())
             filter = filter | ISMINE_WATCH_ONLY;
 
+    int nCount = std::numeric_limits<int>::max();
+    if (params.size() > 3)
+    {
+        nCount = params[3].get_int();
+        if (nCount <= 0)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Count must be positive");
+    }
+
     int depth = pindex ? (1 + chainActive.Height() - pindex->nHeight) : -1;
 
-    UniValue transactions(UniValue::VARR);
+    // Transactions in blocks up to pindex's height are deeper than it, unless
+    // they are in no active chain block, which wtxByHeight keeps at the end
+    const CWallet::TxHeightItems & txByHeight = pwalletMain->wtxByHeight;
+    std::pair<int, int64_t> key(pindex ? pindex->nHeight + 1 : 0, std::numeric_limits<int64_t>::min());
+    int64_t nCursorSkip = 0;
+    string strCursor;
+    if (params.size() > 4)
+        strCursor = params[4].get_str();
+    if (!strCursor.empty()) {
+        std::vector<int64_t> vCursor = ParseListCursor(strCursor, 3);
+        if (vCursor[0] < 0 || vCursor[0] > TX_HEIGHT_UNCONFIRMED)
+            throw JSONRPCError(RPC_INVALID_PARAMETER, "Invalid cursor");
+        key = std::max(key, std::make_pair((int)vCursor[0], vCursor[1]));
+        if (key == std::make_pair((int)vCursor[0], vCursor[1]))
+            nCursorSkip = vCursor[2];
+    }
 
-    for (map<uint256, CWalletTx>::iterator it = pwalletMain->mapWallet.begin(); it != pwalletMain->mapWallet.end(); it++)
+    std::vector<UniValue> vEntries;
+    for (CWallet::TxHeightItems::const_iterator it = txByHeight.lower_bound(key); it != txByHeight.end() && (int)vEntries.size() < nCount; )
     {
-        CWalletTx tx = (*it).second;
-
-        if (depth == -1 || tx.GetDepthInMainChain() < depth)
-            ListTransactions(tx, "*", 0, true, transactions, filter);
+        std::pair<int, int64_t> keyTx = it->first;
+        int64_t nSkip = keyTx == key ? nCursorSkip : 0;
+
+        UniValue entries(UniValue::VARR);
+        for (; it != txByHeight.end() && it->first == keyTx; ++it) {
+            const CWalletTx& tx = *it->second;
+            if (depth == -1 || tx.GetDepthInMainChain() < depth)
+                ListTransactions(tx, "*", 0, true, entries, filter);
+        }
+        for (; nSkip < (int64_t)entries.size() && (int)vEntries.size() < nCount; nSkip++)
+            vEntries.push_back(entries[nSkip]);
+        strCursor = strprintf("%d:%d:%d", keyTx.first, keyTx.second, nSkip);
     }
+    UniValue transactions(UniValue::VARR);
+    transactions.push_backV(vEntries);
 
     CBlockIndex *pblockLast = chainActive[chainActive.Height() + 1 - target_confirms];
     uint256 lastblock = pblockLast ? pblockLast->GetBlockHash() : uint256();
@@ -1733,6 +1870,8 @@ UniValue listsinceblock(const UniValue& params, bool fHelp)
     UniValue ret(UniValue::VOBJ);
     ret.push_back(Pair("transactions", transactions));
     ret.push_back(Pair("lastblock", lastblock.GetHex()));
+    if (params.size() > 3 && (int)vEntries.size() == nCount)
+        ret.push_back(Pair("cursor", strCursor));
 
     return ret;
 }
@@ -2310,6 +2449,11 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
             "  \"unlocked_until\": ttt,        (numeric) the timestamp in seconds since epoch (midnight Jan 1 1970 GMT) that the wallet is unlocked for transfers, or 0 if the wallet is locked\n"
             "  \"paytxfee\": x.xxxx,           (numeric) the transaction fee configuration, set in " + CURRENCY_UNIT + "/kB\n"
             "  \"hdmasterkeyid\": \"<hash160>\", (string) the Hash160 of the HD master pubkey\n"
+            "  \"scanning\":                    (json object) present while the wallet is being rescanned\n"
+            "  {\n"
+            "    \"duration\": xxxx,            (numeric) elapsed milliseconds since the rescan started\n"
+            "    \"progress\": x.xxx,           (numeric) the rescan progress, from 0 to 1\n"
+            "  }\n"
             "}\n"
             "\nExamples:\n"
             + HelpExampleCli("getwalletinfo", "")
@@ -2332,6 +2476,14 @@ UniValue getwalletinfo(const UniValue& params, bool fHelp)
     CKeyID masterKeyID = pwalletMain->GetHDChain().masterKeyID;
     if (!masterKeyID.IsNull())
          obj.push_back(Pair("hdmasterkeyid", masterKeyID.GetHex()));
+    int64_t nScanningDuration;
+    double dScanningProgress;
+    if (pwalletMain->GetScanningProgress(nScanningDuration, dScanningProgress)) {
+        UniValue scanning(UniValue::VOBJ);
+        scanning.push_back(Pair("duration", nScanningDuration));
+        scanning.push_back(Pair("progress", dScanningProgress));
+        obj.push_back(Pair("scanning", scanning));
+    }
     return obj;
 }
 
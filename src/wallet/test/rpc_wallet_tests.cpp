@@ -7,6 +7,8 @@
 
 #include "base58.h"
 #include "main.h"
+#include "random.h"
+#include "script/standard.h"
 #include "wallet/wallet.h"
 
 #include "wallet/test/wallet_test_fixture.h"
@@ -226,4 +228,84 @@ BOOST_AUTO_TEST_CASE(rpc_wallet)
     BOOST_CHECK_THROW(CallRPC("fundrawtransaction 01000000000180969800000000001976a91450ce0a4b0ee0ddeb633da85199728b940ac3fe9488ac00000000"), runtime_error);
 }
 
+/** Call actor with params and strCursor, add the page to vEntries and return its cursor */
+static UniValue ListPage(rpcfn_type actor, UniValue params, const std::string& strCursor, std::vector<UniValue>& vEntries, bool fPrepend)
+{
+    params.push_back(strCursor);
+    UniValue page = actor(params, false);
+    std::vector<UniValue> vPage = find_value(page, "transactions").getValues();
+    vEntries.insert(fPrepend ? vEntries.begin() : vEntries.end(), vPage.begin(), vPage.end());
+    return find_value(page, "cursor");
+}
+
+BOOST_AUTO_TEST_CASE(rpc_list_pages)
+{
+    rpcfn_type listtransactions = tableRPC["listtransactions"]->actor;
+    rpcfn_type listsinceblock = tableRPC["listsinceblock"]->actor;
+
+    // Receive seven times, every other one in the genesis block
+    {
+        LOCK2(cs_main, pwalletMain->cs_wallet);
+        CWalletDB walletdb(pwalletMain->strWalletFile);
+        CScript scriptPubKey = GetScriptForDestination(pwalletMain->GenerateNewKey().GetID());
+        for (int i = 0; i < 7; i++) {
+            CMutableTransaction tx;
+            tx.vin.resize(1);
+            tx.vin[0].prevout = COutPoint(GetRandHash(), 0);
+            tx.vout.push_back(CTxOut((i + 1) * COIN, scriptPubKey));
+            CWalletTx wtx(pwalletMain, tx);
+            if (i % 2 == 0) {
+                wtx.hashBlock = chainActive.Genesis()->GetBlockHash();
+                wtx.nIndex = 0;
+            }
+            BOOST_CHECK(pwalletMain->AddToWallet(wtx, false, &walletdb));
+        }
+    }
+
+    // Pages of listtransactions go from newest to oldest, and put together
+    // they are the whole list
+    UniValue params(UniValue::VARR);
+    params.push_back("*");
+    params.push_back(100);
+    UniValue all = listtransactions(params, false);
+    BOOST_CHECK_EQUAL(all.size(), 7U);
+
+    params = UniValue(UniValue::VARR);
+    params.push_back("*");
+    params.push_back(3);
+    params.push_back(0);
+    params.push_back(false);
+    std::vector<UniValue> vEntries;
+    UniValue cursor(UniValue::VSTR);
+    for (int nPages = 0; !cursor.isNull(); nPages++) {
+        BOOST_REQUIRE(nPages < 3);
+        cursor = ListPage(listtransactions, params, cursor.get_str(), vEntries, true);
+    }
+    BOOST_CHECK_EQUAL(vEntries.size(), 7U);
+    for (unsigned int i = 0; i < vEntries.size() && i < all.size(); i++)
+        BOOST_CHECK_EQUAL(find_value(vEntries[i], "txid").get_str(), find_value(all[i], "txid").get_str());
+
+    // listsinceblock pages go by height, unconfirmed last
+    params = UniValue(UniValue::VARR);
+    params.push_back("");
+    params.push_back(1);
+    params.push_back(false);
+    params.push_back(3);
+    vEntries.clear();
+    cursor = UniValue(UniValue::VSTR);
+    for (int nPages = 0; !cursor.isNull(); nPages++) {
+        BOOST_REQUIRE(nPages < 3);
+        cursor = ListPage(listsinceblock, params, cursor.get_str(), vEntries, false);
+    }
+    BOOST_CHECK_EQUAL(vEntries.size(), 7U);
+    for (unsigned int i = 0; i < vEntries.size(); i++)
+        BOOST_CHECK_EQUAL(find_value(vEntries[i], "confirmations").get_int(), i < 4 ? 1 : 0);
+    BOOST_CHECK_THROW(ListPage(listsinceblock, params, "0:1", vEntries, false), UniValue);
+
+    // Since the genesis block, only the unconfirmed ones are left
+    params = UniValue(UniValue::VARR);
+    params.push_back(chainActive.Genesis()->GetBlockHash().GetHex());
+    BOOST_CHECK_EQUAL(find_value(listsinceblock(params, false), "transactions").size(), 3U);
+}
+
 BOOST_AUTO_TEST_SUITE_END()
@@ -2,6 +2,10 @@
 // Distributed under the MIT software license, see the accompanying
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
+#include "chainparams.h"
+#include "main.h"
+#include "random.h"
+#include "script/standard.h"
 #include "wallet/wallet.h"
 
 #include <set>
@@ -12,6 +16,7 @@
 #include "wallet/test/wallet_test_fixture.h"
 
 #include <boost/foreach.hpp>
+#include <boost/thread.hpp>
 #include <boost/test/unit_test.hpp>
 
 // how many times to run all the tests to have a chance to catch errors that only show up with particular random shuffles
@@ -351,4 +356,171 @@ BOOST_AUTO_TEST_CASE(ApproximateBestSubset)
     BOOST_CHECK_EQUAL(setCoinsRet.size(), 2U);
 }
 
+BOOST_AUTO_TEST_CASE(wallet_utxo_index)
+{
+    LOCK2(cs_main, pwalletMain->cs_wallet);
+    CWalletDB walletdb(pwalletMain->strWalletFile);
+    CScript scriptPubKey = GetScriptForDestination(pwalletMain->GenerateNewKey().GetID());
+    uint256 hashGenesis = chainActive.Genesis()->GetBlockHash();
+    std::vector<COutput> vCoins;
+
+    // Two outputs to us, confirmed once
+    CMutableTransaction txFund;
+    txFund.vin.resize(1);
+    txFund.vin[0].prevout = COutPoint(GetRandHash(), 0);
+    txFund.vout.push_back(CTxOut(5 * COIN, scriptPubKey));
+    txFund.vout.push_back(CTxOut(3 * COIN, scriptPubKey));
+    CWalletTx wtxFund(pwalletMain, txFund);
+    wtxFund.hashBlock = hashGenesis;
+    wtxFund.nIndex = 0;
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxFund, false, &walletdb));
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 8 * COIN);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+
+    // A confirmed spend of the first one, paying 4 back to us
+    CMutableTransaction txSpend;
+    txSpend.vin.resize(1);
+    txSpend.vin[0].prevout = COutPoint(txFund.GetHash(), 0);
+    txSpend.vout.push_back(CTxOut(4 * COIN, scriptPubKey));
+    CWalletTx wtxSpend(pwalletMain, txSpend);
+    wtxSpend.hashBlock = hashGenesis;
+    wtxSpend.nIndex = 0;
+    BOOST_CHECK(pwalletMain->AddToWallet(wtxSpend, false, &walletdb));
+    pwalletMain->mapWallet[txFund.GetHash()].MarkDirty(); // as SyncTransaction does
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 7 * COIN);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+
+    // An unconfirmed spend of the second one that never made it to the
+    // mempool takes it away...
+    CMutableTransaction txPending;
+    txPending.vin.resize(1);
+    txPending.vin[0].prevout = COutPoint(txFund.GetHash(), 1);
+    txPending.vout.push_back(CTxOut(2 * COIN, scriptPubKey));
+    BOOST_CHECK(pwalletMain->AddToWallet(CWalletTx(pwalletMain, txPending), false, &walletdb));
+    pwalletMain->mapWallet[txFund.GetHash()].MarkDirty();
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 4 * COIN);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 1U);
+
+    // ... until it is abandoned
+    BOOST_CHECK(pwalletMain->AbandonTransaction(txPending.GetHash()));
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 7 * COIN);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+
+    // Indexing everything anew agrees
+    pwalletMain->MarkDirty();
+    BOOST_CHECK_EQUAL(pwalletMain->GetBalance(), 7 * COIN);
+    pwalletMain->AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+
+    // So does reloading the wallet, which reads the transactions before
+    // the keys that make their outputs ours
+    CWallet walletReloaded(pwalletMain->strWalletFile);
+    bool fFirstRun;
+    BOOST_CHECK(walletReloaded.LoadWallet(fFirstRun) == DB_LOAD_OK);
+    BOOST_CHECK_EQUAL(walletReloaded.GetBalance(), 7 * COIN);
+    walletReloaded.AvailableCoins(vCoins);
+    BOOST_CHECK_EQUAL(vCoins.size(), 2U);
+}
+
+BOOST_AUTO_TEST_CASE(rescan_watch_only)
+{
+    // Watch the genesis coinbase output; the rescan finds it on the wallet
+    // scan checks and leaves the wallet's best block at the tip
+    CBlock genesis;
+    BOOST_REQUIRE(ReadBlockFromDisk(genesis, chainActive.Genesis(), Params().GetConsensus()));
+    const CTransaction& txCoinbase = genesis.vtx[0];
+    BOOST_CHECK(pwalletMain->AddWatchOnly(txCoinbase.vout[0].scriptPubKey));
+
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), true), 1);
+    BOOST_CHECK(!pwalletMain->IsScanning());
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_CHECK(pwalletMain->mapWallet.count(txCoinbase.GetHash()));
+    }
+    CBlockLocator locator;
+    BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).ReadBestBlock(locator));
+    BOOST_CHECK(FindForkInGlobalIndex(chainActive, locator) == chainActive.Tip());
+
+    // Without fUpdate, what is already in the wallet is left alone
+    BOOST_CHECK_EQUAL(pwalletMain->ScanForWalletTransactions(chainActive.Genesis(), false), 0);
+}
+
+BOOST_AUTO_TEST_CASE(wallet_write_batch)
+{
+    const std::string& strFile = pwalletMain->strWalletFile;
+    CKeyPool keypool;
+    BOOST_CHECK(CDBWriteBatch::GetTxn(strFile) == NULL);
+    {
+        CDBWriteBatch batch(strFile);
+        BOOST_CHECK(CDBWriteBatch::GetTxn(strFile) != NULL);
+        {
+            // Nested batches join the outer one
+            CDBWriteBatch batchInner(strFile, true);
+            BOOST_CHECK(CDBWriteBatch::GetTxn(strFile) != NULL);
+            BOOST_CHECK(CWalletDB(strFile).WritePool(1000001, CKeyPool()));
+        }
+        // Other handles on this thread see the uncommitted writes
+        BOOST_CHECK(CWalletDB(strFile).ReadPool(1000001, keypool));
+
+        // A transaction begun inside the batch only rolls back its own writes
+        CWalletDB walletdb(strFile);
+        BOOST_CHECK(walletdb.TxnBegin());
+        BOOST_CHECK(!walletdb.TxnBegin());
+        BOOST_CHECK(walletdb.WritePool(1000002, CKeyPool()));
+        BOOST_CHECK(walletdb.TxnAbort());
+        BOOST_CHECK(!walletdb.TxnAbort());
+        BOOST_CHECK(!walletdb.ReadPool(1000002, keypool));
+        BOOST_CHECK(walletdb.ReadPool(1000001, keypool));
+    }
+    BOOST_CHECK(CDBWriteBatch::GetTxn(strFile) == NULL);
+    BOOST_CHECK(CWalletDB(strFile).ReadPool(1000001, keypool));
+    BOOST_CHECK(CWalletDB(strFile).ErasePool(1000001));
+}
+
+BOOST_AUTO_TEST_CASE(keypool_parallel_topup)
+{
+    // Generate on the wallet check threads, as with -par
+    int nScriptCheckThreadsOld = nScriptCheckThreads;
+    nScriptCheckThreads = 3;
+    boost::thread_group threadGroup;
+    for (int i = 0; i < nScriptCheckThreads - 1; i++)
+        threadGroup.create_thread(&ThreadWalletCheck);
+
+    {
+        LOCK(pwalletMain->cs_wallet);
+        BOOST_REQUIRE(pwalletMain->SetHDMasterKey(pwalletMain->GenerateNewHDMasterKey()));
+
+        // HD keys come out in keypath order whichever thread derived them
+        std::vector<CPubKey> vPubKeys;
+        pwalletMain->GenerateNewKeys(20, vPubKeys);
+        BOOST_CHECK_EQUAL(vPubKeys.size(), 20U);
+        BOOST_CHECK_EQUAL(pwalletMain->GetHDChain().nExternalChainCounter, 20U);
+        std::set<CKeyID> setKeyIDs;
+        for (unsigned int i = 0; i < vPubKeys.size(); i++) {
+            CKeyID keyID = vPubKeys[i].GetID();
+            CKey key;
+            BOOST_CHECK(pwalletMain->GetKey(keyID, key));
+            BOOST_CHECK(key.GetPubKey() == vPubKeys[i]);
+            BOOST_CHECK_EQUAL(pwalletMain->mapKeyMetadata[keyID].hdKeypath, "m/0'/0'/" + std::to_string(i) + "'");
+            setKeyIDs.insert(keyID);
+        }
+        BOOST_CHECK_EQUAL(setKeyIDs.size(), vPubKeys.size());
+    }
+
+    // A top-up bigger than a batch commits in several
+    BOOST_CHECK(pwalletMain->TopUpKeyPool(WALLET_KEYPOOL_BATCH_KEYS + 10));
+    BOOST_CHECK_EQUAL(pwalletMain->GetKeyPoolSize(), WALLET_KEYPOOL_BATCH_KEYS + 11);
+    CKeyPool keypool;
+    BOOST_CHECK(CWalletDB(pwalletMain->strWalletFile).ReadPool(WALLET_KEYPOOL_BATCH_KEYS + 11, keypool));
+    BOOST_CHECK(pwalletMain->HaveKey(keypool.vchPubKey.GetID()));
+
+    threadGroup.interrupt_all();
+    threadGroup.join_all();
+    nScriptCheckThreads = nScriptCheckThreadsOld;
+}
+
 BOOST_AUTO_TEST_SUITE_END()
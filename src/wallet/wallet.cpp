@@ -8,9 +8,11 @@
 #include "base58.h"
 #include "checkpoints.h"
 #include "chain.h"
+#include "checkqueue.h"
 #include "coincontrol.h"
 #include "consensus/consensus.h"
 #include "consensus/validation.h"
+#include "init.h"
 #include "key.h"
 #include "keystore.h"
 #include "main.h"
@@ -30,6 +32,7 @@
 
 #include <boost/algorithm/string/replace.hpp>
 #include <boost/filesystem.hpp>
+#include <boost/function.hpp>
 #include <boost/thread.hpp>
 
 using namespace std;
@@ -86,25 +89,118 @@ const CWalletTx* CWallet::GetWalletTx(const uint256& hash) const
     return &(it->second);
 }
 
+/** A new key for the wallet, filled in by a key generation check */
+struct CWalletNewKey
+{
+    //! HD child index to derive, unused for random keys
+    uint32_t nChild;
+    CKey secret;
+    CPubKey pubkey;
+    //! The encrypted secret, for an encrypted wallet
+    std::vector<unsigned char> vchCryptedSecret;
+
+    CWalletNewKey() : nChild(0) {}
+};
+
+/**
+ * Closure representing the expensive part of generating one key: making a
+ * random secret or deriving the HD child from the external chain key,
+ * computing and verifying its public key, and encrypting the secret when
+ * given the keystore to encrypt it for. Adding the key to the wallet is
+ * left for the caller under cs_wallet.
+ */
+class CWalletKeyGenCheck
+{
+private:
+    CWalletNewKey *pkey;
+    const CExtKey *pchainKey;
+    const CCryptoKeyStore *pkeystore;
+    bool fCompressed;
+
+public:
+    CWalletKeyGenCheck(): pkey(NULL), pchainKey(NULL), pkeystore(NULL), fCompressed(false) {}
+    CWalletKeyGenCheck(CWalletNewKey& keyIn, const CExtKey* pchainKeyIn, const CCryptoKeyStore* pkeystoreIn, bool fCompressedIn) :
+        pkey(&keyIn), pchainKey(pchainKeyIn), pkeystore(pkeystoreIn), fCompressed(fCompressedIn) { }
+
+    bool operator()() {
+        CWalletNewKey& key = *pkey;
+        if (pchainKey) {
+            // always derive hardened keys
+            // childIndex | BIP32_HARDENED_KEY_LIMIT = derive childIndex in hardened child-index-range
+            // example: 1 | BIP32_HARDENED_KEY_LIMIT == 0x80000001 == 2147483649
+            CExtKey childKey;
+            if (!pchainKey->Derive(childKey, key.nChild | BIP32_HARDENED_KEY_LIMIT))
+                return false;
+            key.secret = childKey.key;
+        } else {
+            key.secret.MakeNewKey(fCompressed);
+        }
+        key.pubkey = key.secret.GetPubKey();
+        if (!key.secret.VerifyPubKey(key.pubkey))
+            return false;
+        if (pkeystore && !pkeystore->EncryptKey(key.secret, key.pubkey, key.vchCryptedSecret))
+            return false;
+        return true;
+    }
+};
+
+/**
+ * Work for the wallet check threads, which key generation and rescans share:
+ * a CWalletKeyGenCheck or a CWalletScanCheck.
+ */
+class CWalletCheck
+{
+private:
+    boost::function<bool()> check;
+
+public:
+    CWalletCheck() {}
+    template <typename Check>
+    explicit CWalletCheck(const Check& checkIn) : check(checkIn) {}
+
+    bool operator()() { return check(); }
+
+    void swap(CWalletCheck &other) { check.swap(other.check); }
+};
+
+static CCheckQueue<CWalletCheck> walletcheckqueue(1);
+
+/**
+ * Held by whoever uses walletcheckqueue, which takes one master at a time.
+ * A rescan holds it throughout and takes cs_wallet while holding it, so key
+ * generation, which runs under cs_wallet, only tries it, and does without
+ * the check threads if it is taken or a rescan is running on its own thread.
+ */
+static CCriticalSection cs_walletcheckqueue;
+
+void ThreadWalletCheck() {
+    RenameThread("florincoin-walchk");
+    walletcheckqueue.Thread();
+}
+
 CPubKey CWallet::GenerateNewKey()
+{
+    std::vector<CPubKey> vPubKeys;
+    GenerateNewKeys(1, vPubKeys);
+    return vPubKeys[0];
+}
+
+void CWallet::GenerateNewKeys(unsigned int nKeys, std::vector<CPubKey>& vPubKeys)
 {
     AssertLockHeld(cs_wallet); // mapKeyMetadata
     bool fCompressed = CanSupportFeature(FEATURE_COMPRPUBKEY); // default to compressed public keys if we want 0.6.0 wallets
 
-    CKey secret;
-
     // Create new metadata
     int64_t nCreationTime = GetTime();
-    CKeyMetadata metadata(nCreationTime);
 
     // use HD key derivation if HD was enabled during wallet creation
-    if (!hdChain.masterKeyID.IsNull()) {
+    bool fHD = !hdChain.masterKeyID.IsNull();
+    CExtKey externalChainKey;      //key at m/0'/0'
+    if (fHD) {
         // for now we use a fixed keypath scheme of m/0'/0'/k
         CKey key;                      //master key seed (256bit)
         CExtKey masterKey;             //hd master key
         CExtKey accountKey;            //key at m/0'
-        CExtKey externalChainChildKey; //key at m/0'/0'
-        CExtKey childKey;              //key at m/0'/0'/<n>'
 
         // try to get the master key
         if (!GetKey(hdChain.masterKeyID, key))
@@ -117,43 +213,73 @@ CPubKey CWallet::GenerateNewKey()
         masterKey.Derive(accountKey, BIP32_HARDENED_KEY_LIMIT);
 
         // derive m/0'/0'
-        accountKey.Derive(externalChainChildKey, BIP32_HARDENED_KEY_LIMIT);
+        accountKey.Derive(externalChainKey, BIP32_HARDENED_KEY_LIMIT);
+    }
 
-        // derive child key at next index, skip keys already known to the wallet
-        do
+    CDBWriteBatch batch(fFileBacked ? strWalletFile : std::string());
+    vPubKeys.clear();
+    while (vPubKeys.size() < nKeys)
+    {
+        std::vector<CWalletNewKey> vKeys(nKeys - vPubKeys.size());
         {
-            // always derive hardened keys
-            // childIndex | BIP32_HARDENED_KEY_LIMIT = derive childIndex in hardened child-index-range
-            // example: 1 | BIP32_HARDENED_KEY_LIMIT == 0x80000001 == 2147483649
-            externalChainChildKey.Derive(childKey, hdChain.nExternalChainCounter | BIP32_HARDENED_KEY_LIMIT);
-            metadata.hdKeypath     = "m/0'/0'/"+std::to_string(hdChain.nExternalChainCounter)+"'";
-            metadata.hdMasterKeyID = hdChain.masterKeyID;
-            // increment childkey index
-            hdChain.nExternalChainCounter++;
-        } while(HaveKey(childKey.key.GetPubKey().GetID()));
-        secret = childKey.key;
-
-        // update the chain model in the database
-        if (!CWalletDB(strWalletFile).WriteHDChain(hdChain))
-            throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
-    } else {
-        secret.MakeNewKey(fCompressed);
+            TRY_LOCK(cs_walletcheckqueue, lockQueue);
+            bool fParallel = nScriptCheckThreads && vKeys.size() > 1 && lockQueue && !fScanningWallet;
+            CCheckQueueControl<CWalletCheck> control(fParallel ? &walletcheckqueue : NULL);
+            std::vector<CWalletCheck> vChecks;
+            vChecks.reserve(fParallel ? vKeys.size() : 0);
+            bool fOk = true;
+            BOOST_FOREACH(CWalletNewKey& key, vKeys) {
+                // derive child keys at the next indexes
+                if (fHD)
+                    key.nChild = hdChain.nExternalChainCounter++;
+                CWalletKeyGenCheck check(key, fHD ? &externalChainKey : NULL, IsCrypted() ? this : NULL, fCompressed);
+                if (!fParallel) {
+                    fOk = fOk && check();
+                    continue;
+                }
+                vChecks.push_back(CWalletCheck(check));
+            }
+            control.Add(vChecks);
+            if (!control.Wait() || !fOk)
+                throw std::runtime_error(std::string(__func__) + ": generating keys failed");
+        }
+
+        BOOST_FOREACH(const CWalletNewKey& key, vKeys) {
+            CKeyID keyID = key.pubkey.GetID();
+            // skip keys already known to the wallet
+            if (fHD && HaveKey(keyID))
+                continue;
+
+            CKeyMetadata metadata(nCreationTime);
+            if (fHD) {
+                metadata.hdKeypath     = "m/0'/0'/"+std::to_string(key.nChild)+"'";
+                metadata.hdMasterKeyID = hdChain.masterKeyID;
+            }
+            mapKeyMetadata[keyID] = metadata;
+
+            bool fAdded;
+            if (IsCrypted()) {
+                RemoveWatchOnlyKey(key.pubkey);
+                fAdded = AddCryptedKey(key.pubkey, key.vchCryptedSecret);
+            } else {
+                fAdded = AddKeyPubKey(key.secret, key.pubkey);
+            }
+            if (!fAdded)
+                throw std::runtime_error(std::string(__func__) + ": AddKey failed");
+            vPubKeys.push_back(key.pubkey);
+        }
     }
 
+    // update the chain model in the database
+    if (fHD && fFileBacked && !CWalletDB(strWalletFile).WriteHDChain(hdChain))
+        throw std::runtime_error(std::string(__func__) + ": Writing HD chain model failed");
+
     // Compressed public keys were introduced in version 0.6.0
     if (fCompressed)
         SetMinVersion(FEATURE_COMPRPUBKEY);
 
-    CPubKey pubkey = secret.GetPubKey();
-    assert(secret.VerifyPubKey(pubkey));
-
-    mapKeyMetadata[pubkey.GetID()] = metadata;
     if (!nTimeFirstKey || nCreationTime < nTimeFirstKey)
         nTimeFirstKey = nCreationTime;
-
-    if (!AddKeyPubKey(secret, pubkey))
-        throw std::runtime_error(std::string(__func__) + ": AddKey failed");
-    return pubkey;
 }
 
 bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
@@ -163,13 +289,7 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
         return false;
 
     // check if we need to remove from watch-only
-    CScript script;
-    script = GetScriptForDestination(pubkey.GetID());
-    if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
-    script = GetScriptForRawPubKey(pubkey);
-    if (HaveWatchOnly(script))
-        RemoveWatchOnly(script);
+    RemoveWatchOnlyKey(pubkey);
 
     if (!fFileBacked)
         return true;
@@ -181,6 +301,17 @@ bool CWallet::AddKeyPubKey(const CKey& secret, const CPubKey &pubkey)
     return true;
 }
 
+void CWallet::RemoveWatchOnlyKey(const CPubKey& pubkey)
+{
+    CScript script;
+    script = GetScriptForDestination(pubkey.GetID());
+    if (HaveWatchOnly(script))
+        RemoveWatchOnly(script);
+    script = GetScriptForRawPubKey(pubkey);
+    if (HaveWatchOnly(script))
+        RemoveWatchOnly(script);
+}
+
 bool CWallet::AddCryptedKey(const CPubKey &vchPubKey,
                             const vector<unsigned char> &vchCryptedSecret)
 {
@@ -340,6 +471,9 @@ bool CWallet::ChangeWalletPassphrase(const SecureString& strOldWalletPassphrase,
 
 void CWallet::SetBestChain(const CBlockLocator& loc)
 {
+    // A running rescan keeps the best block at its own progress
+    if (fScanningWallet)
+        return;
     CWalletDB walletdb(strWalletFile);
     walletdb.WriteBestBlock(loc);
 }
@@ -548,6 +682,106 @@ void CWallet::AddToSpends(const uint256& wtxid)
         AddToSpends(txin.prevout, wtxid);
 }
 
+void CWallet::UpdateWalletUTXO(const COutPoint& outpoint)
+{
+    AssertLockHeld(cs_wallet);
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.find(outpoint.hash);
+    bool fUnspent = mi != mapWallet.end() && outpoint.n < mi->second.vout.size() &&
+                    IsMine(mi->second.vout[outpoint.n]) != ISMINE_NO;
+
+    pair<TxSpends::const_iterator, TxSpends::const_iterator> range = mapTxSpends.equal_range(outpoint);
+    for (TxSpends::const_iterator it = range.first; fUnspent && it != range.second; ++it) {
+        std::map<uint256, CWalletTx>::const_iterator mit = mapWallet.find(it->second);
+        if (mit == mapWallet.end())
+            continue;
+        // Neither abandoned nor marked conflicted means a depth of at least
+        // zero, which IsSpent always counts as spent
+        const CWalletTx& wtxSpend = mit->second;
+        if (!wtxSpend.isAbandoned() && (wtxSpend.hashBlock.IsNull() || wtxSpend.nIndex != -1))
+            fUnspent = false;
+    }
+
+    if (fUnspent)
+        setWalletUTXO.insert(outpoint);
+    else
+        setWalletUTXO.erase(outpoint);
+}
+
+void CWallet::UpdateWalletUTXO(const CWalletTx& wtx)
+{
+    const uint256& hash = wtx.GetHash();
+    for (unsigned int i = 0; i < wtx.vout.size(); i++)
+        UpdateWalletUTXO(COutPoint(hash, i));
+    if (wtx.IsCoinBase())
+        return;
+    BOOST_FOREACH(const CTxIn& txin, wtx.vin)
+        UpdateWalletUTXO(txin.prevout);
+}
+
+void CWallet::UpdateTxHeightIndex(CWalletTx& wtx)
+{
+    AssertLockHeld(cs_main); // mapBlockIndex, chainActive
+    AssertLockHeld(cs_wallet);
+    int nHeight = TX_HEIGHT_UNCONFIRMED;
+    if (!wtx.hashUnset() && wtx.nIndex != -1) {
+        BlockMap::iterator mi = mapBlockIndex.find(wtx.hashBlock);
+        if (mi != mapBlockIndex.end() && chainActive.Contains(mi->second))
+            nHeight = mi->second->nHeight;
+    }
+    if (nHeight == wtx.nIndexedHeight)
+        return;
+
+    if (wtx.nIndexedHeight != -1) {
+        pair<TxHeightItems::iterator, TxHeightItems::iterator> range = wtxByHeight.equal_range(make_pair(wtx.nIndexedHeight, wtx.nOrderPos));
+        for (TxHeightItems::iterator it = range.first; it != range.second; ++it) {
+            if (it->second == &wtx) {
+                wtxByHeight.erase(it);
+                break;
+            }
+        }
+    }
+    wtxByHeight.insert(make_pair(make_pair(nHeight, wtx.nOrderPos), &wtx));
+    wtx.nIndexedHeight = nHeight;
+}
+
+void CWallet::UnindexTx(CWalletTx& wtx)
+{
+    AssertLockHeld(cs_wallet);
+    pair<TxItems::iterator, TxItems::iterator> range = wtxOrdered.equal_range(wtx.nOrderPos);
+    for (TxItems::iterator it = range.first; it != range.second; ++it) {
+        if (it->second.first == &wtx) {
+            wtxOrdered.erase(it);
+            break;
+        }
+    }
+    if (wtx.nIndexedHeight != -1) {
+        pair<TxHeightItems::iterator, TxHeightItems::iterator> rangeHeight = wtxByHeight.equal_range(make_pair(wtx.nIndexedHeight, wtx.nOrderPos));
+        for (TxHeightItems::iterator it = rangeHeight.first; it != rangeHeight.second; ++it) {
+            if (it->second == &wtx) {
+                wtxByHeight.erase(it);
+                break;
+            }
+        }
+        wtx.nIndexedHeight = -1;
+    }
+}
+
+std::vector<const CWalletTx*> CWallet::GetWalletUTXOTxs() const
+{
+    AssertLockHeld(cs_wallet);
+    std::vector<const CWalletTx*> vTxs;
+    std::map<uint256, CWalletTx>::const_iterator mi = mapWallet.end();
+    BOOST_FOREACH(const COutPoint& outpoint, setWalletUTXO) {
+        // The set is ordered by txid, so outputs of one transaction are adjacent
+        if (mi != mapWallet.end() && mi->first == outpoint.hash)
+            continue;
+        mi = mapWallet.find(outpoint.hash);
+        if (mi != mapWallet.end())
+            vTxs.push_back(&mi->second);
+    }
+    return vTxs;
+}
+
 bool CWallet::EncryptWallet(const SecureString& strWalletPassphrase)
 {
     if (IsCrypted())
@@ -736,8 +970,13 @@ void CWallet::MarkDirty()
 {
     {
         LOCK(cs_wallet);
-        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet)
+        // What is ours may have changed as well, so index the outputs anew
+        setWalletUTXO.clear();
+        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
             item.second.MarkDirty();
+            for (unsigned int i = 0; i < item.second.vout.size(); i++)
+                UpdateWalletUTXO(COutPoint(item.first, i));
+        }
     }
 }
 
@@ -859,6 +1098,8 @@ bool CWallet::AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletD
 
         // Break debit/credit balance caches:
         wtx.MarkDirty();
+        UpdateWalletUTXO(wtx);
+        UpdateTxHeightIndex(wtx);
 
         // Notify UI of new or updated transaction
         NotifyTransactionChanged(this, hash, fInsertedNew ? CT_NEW : CT_UPDATED);
@@ -954,6 +1195,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.setAbandoned();
             wtx.MarkDirty();
+            UpdateTxHeightIndex(wtx);
             walletdb.WriteTx(wtx);
             NotifyTransactionChanged(this, wtx.GetHash(), CT_UPDATED);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them abandoned too
@@ -970,6 +1212,7 @@ bool CWallet::AbandonTransaction(const uint256& hashTx)
             {
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
+                UpdateWalletUTXO(txin.prevout);
             }
         }
     }
@@ -1016,6 +1259,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             wtx.nIndex = -1;
             wtx.hashBlock = hashBlock;
             wtx.MarkDirty();
+            UpdateTxHeightIndex(wtx);
             walletdb.WriteTx(wtx);
             // Iterate over all its outputs, and mark transactions in the wallet that spend them conflicted too
             TxSpends::const_iterator iter = mapTxSpends.lower_bound(COutPoint(now, 0));
@@ -1031,6 +1275,7 @@ void CWallet::MarkConflicted(const uint256& hashBlock, const uint256& hashTx)
             {
                 if (mapWallet.count(txin.prevout.hash))
                     mapWallet[txin.prevout.hash].MarkDirty();
+                UpdateWalletUTXO(txin.prevout);
             }
         }
     }
@@ -1368,6 +1613,165 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
     }
 }
 
+/**
+ * The part of a wallet's keystore that IsMine looks at, copied for the
+ * wallet scan checks: the key ids, watch-only scripts with their public
+ * keys, and redeem scripts. It is filled before a rescan and only read
+ * while the checks run, so unlike the wallet it needs no lock. No private
+ * key or public key of a private key is copied; without the latter, IsMine
+ * may take an uncompressed witness key for ours, which only means the
+ * transaction gets checked against the wallet itself when committing.
+ */
+class CWalletScanKeys : public CKeyStore
+{
+private:
+    std::set<CKeyID> setKeys;
+    WatchKeyMap mapWatchKeys;
+    ScriptMap mapScripts;
+    WatchOnlySet setWatchOnly;
+
+public:
+    bool AddKeyPubKey(const CKey& key, const CPubKey& pubkey) { setKeys.insert(pubkey.GetID()); return true; }
+    void AddKeyID(const CKeyID& address) { setKeys.insert(address); }
+    bool HaveKey(const CKeyID& address) const { return setKeys.count(address) > 0; }
+    bool GetKey(const CKeyID& address, CKey& keyOut) const { return false; }
+    void GetKeys(std::set<CKeyID>& setAddress) const { setAddress = setKeys; }
+    bool GetPubKey(const CKeyID& address, CPubKey& vchPubKeyOut) const
+    {
+        WatchKeyMap::const_iterator it = mapWatchKeys.find(address);
+        if (it == mapWatchKeys.end())
+            return false;
+        vchPubKeyOut = it->second;
+        return true;
+    }
+
+    bool AddCScript(const CScript& redeemScript) { mapScripts[CScriptID(redeemScript)] = redeemScript; return true; }
+    bool HaveCScript(const CScriptID& hash) const { return mapScripts.count(hash) > 0; }
+    bool GetCScript(const CScriptID& hash, CScript& redeemScriptOut) const
+    {
+        ScriptMap::const_iterator it = mapScripts.find(hash);
+        if (it == mapScripts.end())
+            return false;
+        redeemScriptOut = it->second;
+        return true;
+    }
+
+    bool AddWatchOnly(const CScript& dest) { setWatchOnly.insert(dest); return true; }
+    void AddWatchPubKey(const CPubKey& pubkey) { mapWatchKeys[pubkey.GetID()] = pubkey; }
+    bool RemoveWatchOnly(const CScript& dest) { setWatchOnly.erase(dest); return true; }
+    bool HaveWatchOnly(const CScript& dest) const { return setWatchOnly.count(dest) > 0; }
+    bool HaveWatchOnly() const { return !setWatchOnly.empty(); }
+};
+
+void CWallet::GetScanKeys(CWalletScanKeys& keys) const
+{
+    std::set<CKeyID> setKeys;
+    GetKeys(setKeys);
+    BOOST_FOREACH(const CKeyID& keyid, setKeys)
+        keys.AddKeyID(keyid);
+
+    LOCK(cs_KeyStore);
+    BOOST_FOREACH(const PAIRTYPE(CKeyID, CPubKey)& item, mapWatchKeys)
+        keys.AddWatchPubKey(item.second);
+    BOOST_FOREACH(const PAIRTYPE(CScriptID, CScript)& item, mapScripts)
+        keys.AddCScript(item.second);
+    BOOST_FOREACH(const CScript& script, setWatchOnly)
+        keys.AddWatchOnly(script);
+}
+
+/** A block being rescanned, as read and matched by a wallet scan check */
+struct CWalletScanBlock
+{
+    CBlockIndex* pindex;
+    CDiskBlockPos pos;
+    uint256 hash;
+    //! Whether the block was read, and which of its transactions pay to the wallet
+    bool fRead;
+    CBlock block;
+    std::vector<bool> vfMatch;
+
+    CWalletScanBlock(CBlockIndex* pindexIn) : pindex(pindexIn), pos(pindexIn->GetBlockPos()), hash(pindexIn->GetBlockHash()), fRead(false) {}
+};
+
+/**
+ * Closure representing the part of rescanning one block that needs no
+ * lock: reading it from disk, which includes hashing the scrypt proof of
+ * work, and running the outputs through IsMine against a CWalletScanKeys.
+ * Transactions can also involve the wallet by spending from it, which is
+ * left for the commit under cs_wallet.
+ */
+class CWalletScanCheck
+{
+private:
+    CWalletScanBlock *pscan;
+    const CWalletScanKeys *pkeys;
+    const Consensus::Params *pparams;
+
+public:
+    CWalletScanCheck(): pscan(NULL), pkeys(NULL), pparams(NULL) {}
+    CWalletScanCheck(CWalletScanBlock& scanIn, const CWalletScanKeys& keysIn, const Consensus::Params& paramsIn) :
+        pscan(&scanIn), pkeys(&keysIn), pparams(&paramsIn) { }
+
+    bool operator()() {
+        CWalletScanBlock& scan = *pscan;
+        if (!ReadBlockFromDisk(scan.block, scan.pos, *pparams) || scan.block.GetHash() != scan.hash) {
+            scan.block.SetNull();
+            return true;
+        }
+        scan.fRead = true;
+        scan.vfMatch.assign(scan.block.vtx.size(), false);
+        for (unsigned int i = 0; i < scan.block.vtx.size(); i++) {
+            BOOST_FOREACH(const CTxOut& txout, scan.block.vtx[i].vout) {
+                if (::IsMine(*pkeys, txout.scriptPubKey) != ISMINE_NO) {
+                    scan.vfMatch[i] = true;
+                    break;
+                }
+            }
+        }
+        return true;
+    }
+};
+
+/**
+ * Collect the next batch of blocks to rescan into vBatch, from pindex along
+ * the active chain, and queue their checks on control, or run them right
+ * away without check threads.
+ */
+static void StartWalletScanChecks(CCheckQueueControl<CWalletCheck>& control, CBlockIndex* pindex, std::vector<CWalletScanBlock>& vBatch, const CWalletScanKeys& keys, const Consensus::Params& consensusParams)
+{
+    vBatch.clear();
+    {
+        LOCK(cs_main);
+        while (pindex && vBatch.size() < WALLET_SCAN_BATCH_BLOCKS) {
+            vBatch.push_back(CWalletScanBlock(pindex));
+            pindex = chainActive.Next(pindex);
+        }
+    }
+
+    std::vector<CWalletCheck> vChecks;
+    vChecks.reserve(vBatch.size());
+    BOOST_FOREACH(CWalletScanBlock& scan, vBatch) {
+        CWalletScanCheck check(scan, keys, consensusParams);
+        if (!nScriptCheckThreads) {
+            check();
+            continue;
+        }
+        vChecks.push_back(CWalletCheck(check));
+    }
+    control.Add(vChecks);
+}
+
+/** Clears the wallet's scanning flag when a rescan ends, also if it throws */
+class CWalletScanningGuard
+{
+private:
+    std::atomic<bool>& fScanning;
+
+public:
+    CWalletScanningGuard(std::atomic<bool>& fScanningIn) : fScanning(fScanningIn) {}
+    ~CWalletScanningGuard() { fScanning = false; }
+};
+
 /**
  * Scan the block chain (starting in pindexStart) for transactions
  * from or to us. If fUpdate is true, found transactions that already
@@ -1375,11 +1779,22 @@ void CWalletTx::GetAccountAmounts(const string& strAccount, CAmount& nReceived,
  */
 int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
 {
+    if (fScanningWallet.exchange(true)) {
+        LogPrintf("%s: a rescan is already running\n", __func__);
+        return -1;
+    }
+    CWalletScanningGuard scanning(fScanningWallet);
+    LOCK(cs_walletcheckqueue);
+    nScanningStartTime = GetTimeMillis();
+    dScanningProgress = 0;
+
     int ret = 0;
     int64_t nNow = GetTime();
     const CChainParams& chainParams = Params();
 
+    CWalletScanKeys keys;
     CBlockIndex* pindex = pindexStart;
+    double dProgressStart, dProgressTip;
     {
         LOCK2(cs_main, cs_wallet);
 
@@ -1388,32 +1803,117 @@ int CWallet::ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate)
         while (pindex && nTimeFirstKey && (pindex->GetBlockTime() < (nTimeFirstKey - 7200)))
             pindex = chainActive.Next(pindex);
 
-        ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
-        double dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
-        double dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
-        while (pindex)
+        GetScanKeys(keys);
+        dProgressStart = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false);
+        dProgressTip = Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), chainActive.Tip(), false);
+
+        // Until the rescan is done, the wallet is only known to be in sync
+        // up to where it starts, so a restart would pick it up from there
+        if (pindex && fFileBacked)
+            CWalletDB(strWalletFile).WriteBestBlock(chainActive.GetLocator(pindex));
+    }
+
+    ShowProgress(_("Rescanning..."), 0); // show rescan progress in GUI as dialog or on splashscreen, if -rescan on startup
+
+    // Blocks are checked a batch ahead of the one being committed
+    std::vector<CWalletScanBlock> vBatch, vBatchNext;
+    {
+        CCheckQueueControl<CWalletCheck> control(nScriptCheckThreads ? &walletcheckqueue : NULL);
+        StartWalletScanChecks(control, pindex, vBatch, keys, chainParams.GetConsensus());
+    }
+    if (vBatch.empty() && fFileBacked) {
+        LOCK(cs_main);
+        CWalletDB(strWalletFile).WriteBestBlock(chainActive.GetLocator());
+    }
+    while (!vBatch.empty())
+    {
+        if (ShutdownRequested()) {
+            LogPrintf("Rescan interrupted at block %d, it will resume on the next start\n", vBatch.front().pindex->nHeight);
+            if (fFileBacked) {
+                LOCK(cs_main);
+                CWalletDB(strWalletFile).WriteBestBlock(chainActive.GetLocator(vBatch.front().pindex));
+            }
+            break;
+        }
+
+        CCheckQueueControl<CWalletCheck> control(nScriptCheckThreads ? &walletcheckqueue : NULL);
+        {
+            LOCK(cs_main);
+            pindex = chainActive.Next(vBatch.back().pindex);
+        }
+        StartWalletScanChecks(control, pindex, vBatchNext, keys, chainParams.GetConsensus());
+
+        // If a reorg took a block of this batch off the active chain, the
+        // blocks checked ahead are no good either; carry on from the fork
+        bool fRestart = false;
         {
-            if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0)
-                ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)((Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart) * 100))));
+            LOCK2(cs_main, cs_wallet);
+            BOOST_FOREACH(CWalletScanBlock& scan, vBatch) {
+                pindex = scan.pindex;
+                if (!chainActive.Contains(pindex)) {
+                    pindex = chainActive.Next(chainActive.FindFork(pindex));
+                    fRestart = true;
+                    break;
+                }
 
-            CBlock block;
-            ReadBlockFromDisk(block, pindex, Params().GetConsensus());
-            BOOST_FOREACH(CTransaction& tx, block.vtx)
-            {
-                if (AddToWalletIfInvolvingMe(tx, &block, fUpdate))
-                    ret++;
+                if (pindex->nHeight % 100 == 0 && dProgressTip - dProgressStart > 0.0) {
+                    dScanningProgress = std::max(0.0, std::min(1.0, (Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex, false) - dProgressStart) / (dProgressTip - dProgressStart)));
+                    ShowProgress(_("Rescanning..."), std::max(1, std::min(99, (int)(dScanningProgress * 100))));
+                }
+
+                for (unsigned int i = 0; i < scan.block.vtx.size(); i++) {
+                    const CTransaction& tx = scan.block.vtx[i];
+                    // The checks only matched outputs; spending from the
+                    // wallet, or conflicting with its spends, counts too
+                    bool fCandidate = scan.vfMatch[i] || mapWallet.count(tx.GetHash());
+                    for (unsigned int j = 0; j < tx.vin.size() && !fCandidate; j++)
+                        fCandidate = mapWallet.count(tx.vin[j].prevout.hash) || mapTxSpends.count(tx.vin[j].prevout);
+                    if (fCandidate && AddToWalletIfInvolvingMe(tx, &scan.block, fUpdate))
+                        ret++;
+                }
+
+                if (GetTime() >= nNow + 60) {
+                    nNow = GetTime();
+                    LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+                    if (fFileBacked)
+                        CWalletDB(strWalletFile).WriteBestBlock(chainActive.GetLocator(pindex));
+                }
             }
-            pindex = chainActive.Next(pindex);
-            if (GetTime() >= nNow + 60) {
-                nNow = GetTime();
-                LogPrintf("Still rescanning. At block %d. Progress=%f\n", pindex->nHeight, Checkpoints::GuessVerificationProgress(chainParams.Checkpoints(), pindex));
+
+            // Blocks connected after the next batch was collected went through
+            // SyncTransaction before the wallet saw this one, so scan them as
+            // well. Only once the last block scanned is the tip, checked under
+            // the same locks, is the wallet in sync with it.
+            if (!fRestart && vBatchNext.empty()) {
+                pindex = chainActive.Next(vBatch.back().pindex);
+                if (pindex)
+                    fRestart = true;
+                else if (fFileBacked)
+                    CWalletDB(strWalletFile).WriteBestBlock(chainActive.GetLocator());
             }
         }
-        ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
+        control.Wait();
+
+        if (fRestart) {
+            CCheckQueueControl<CWalletCheck> controlReorg(nScriptCheckThreads ? &walletcheckqueue : NULL);
+            StartWalletScanChecks(controlReorg, pindex, vBatchNext, keys, chainParams.GetConsensus());
+        }
+        vBatch.swap(vBatchNext);
     }
+
+    ShowProgress(_("Rescanning..."), 100); // hide progress dialog in GUI
     return ret;
 }
 
+bool CWallet::GetScanningProgress(int64_t& nDurationRet, double& dProgressRet) const
+{
+    if (!fScanningWallet)
+        return false;
+    nDurationRet = GetTimeMillis() - nScanningStartTime;
+    dProgressRet = dScanningProgress;
+    return true;
+}
+
 void CWallet::ReacceptWalletTransactions()
 {
     // If transactions aren't being broadcasted, don't let them into local mempool either
@@ -1747,9 +2247,8 @@ CAmount CWallet::GetBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1763,9 +2262,8 @@ CAmount CWallet::GetUnconfirmedBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableCredit();
         }
@@ -1778,9 +2276,8 @@ CAmount CWallet::GetImmatureBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureCredit();
         }
     }
@@ -1792,9 +2289,8 @@ CAmount CWallet::GetWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (pcoin->IsTrusted())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1808,9 +2304,8 @@ CAmount CWallet::GetUnconfirmedWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             if (!pcoin->IsTrusted() && pcoin->GetDepthInMainChain() == 0 && pcoin->InMempool())
                 nTotal += pcoin->GetAvailableWatchOnlyCredit();
         }
@@ -1823,9 +2318,8 @@ CAmount CWallet::GetImmatureWatchOnlyBalance() const
     CAmount nTotal = 0;
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const CWalletTx* pcoin = &(*it).second;
             nTotal += pcoin->GetImmatureWatchOnlyCredit();
         }
     }
@@ -1838,10 +2332,9 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
 
     {
         LOCK2(cs_main, cs_wallet);
-        for (map<uint256, CWalletTx>::const_iterator it = mapWallet.begin(); it != mapWallet.end(); ++it)
+        BOOST_FOREACH(const CWalletTx* pcoin, GetWalletUTXOTxs())
         {
-            const uint256& wtxid = it->first;
-            const CWalletTx* pcoin = &(*it).second;
+            const uint256& wtxid = pcoin->GetHash();
 
             if (!CheckFinalTx(*pcoin))
                 continue;
@@ -1864,8 +2357,8 @@ void CWallet::AvailableCoins(vector<COutput>& vCoins, bool fOnlyConfirmed, const
             for (unsigned int i = 0; i < pcoin->vout.size(); i++) {
                 isminetype mine = IsMine(pcoin->vout[i]);
                 if (!(IsSpent(wtxid, i)) && mine != ISMINE_NO &&
-                    !IsLockedCoin((*it).first, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
-                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint((*it).first, i))))
+                    !IsLockedCoin(wtxid, i) && (pcoin->vout[i].nValue > 0 || fIncludeZeroValue) &&
+                    (!coinControl || !coinControl->HasSelected() || coinControl->fAllowOtherInputs || coinControl->IsSelected(COutPoint(wtxid, i))))
                         vCoins.push_back(COutput(pcoin, i, nDepth,
                                                  ((mine & ISMINE_SPENDABLE) != ISMINE_NO) ||
                                                   (coinControl && coinControl->fAllowWatchOnly && (mine & ISMINE_WATCH_SOLVABLE) != ISMINE_NO),
@@ -2484,6 +2977,10 @@ bool CWallet::CommitTransaction(CWalletTx& wtxNew, CReserveKey& reservekey)
         LOCK2(cs_main, cs_wallet);
         LogPrintf("CommitTransaction:\n%s", wtxNew.ToString());
         {
+            // The change key and the transaction go to disk in one batch,
+            // committed and synced before the transaction is broadcast
+            CDBWriteBatch batch(fFileBacked ? strWalletFile : std::string(), true);
+
             // This is only to keep the database open to defeat the auto-flush for the
             // duration of this scope.  This is the only place where this optimization
             // maybe makes sense; please don't do it anywhere else.
@@ -2589,6 +3086,20 @@ DBErrors CWallet::LoadWallet(bool& fFirstRunRet)
         return nLoadWalletRet;
     fFirstRunRet = !vchDefaultKey.IsValid();
 
+    {
+        LOCK2(cs_main, cs_wallet);
+        // Transactions are read before the keys that make their outputs
+        // ours, so setWalletUTXO can only be built once everything is in
+        wtxByHeight.clear();
+        setWalletUTXO.clear();
+        BOOST_FOREACH(PAIRTYPE(const uint256, CWalletTx)& item, mapWallet) {
+            item.second.nIndexedHeight = -1;
+            UpdateTxHeightIndex(item.second);
+            for (unsigned int i = 0; i < item.second.vout.size(); i++)
+                UpdateWalletUTXO(COutPoint(item.first, i));
+        }
+    }
+
     uiInterface.LoadWallet(this);
 
     return DB_LOAD_OK;
@@ -2598,7 +3109,22 @@ DBErrors CWallet::ZapSelectTx(vector<uint256>& vHashIn, vector<uint256>& vHashOu
 {
     if (!fFileBacked)
         return DB_LOAD_OK;
+    AssertLockHeld(cs_wallet); // mapWallet
+    // The indexes point into mapWallet, so take out what may be erased
+    // first, and put back what was not
+    BOOST_FOREACH(const uint256& hash, vHashIn) {
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end())
+            UnindexTx(mi->second);
+    }
     DBErrors nZapSelectTxRet = CWalletDB(strWalletFile,"cr+").ZapSelectTx(this, vHashIn, vHashOut);
+    BOOST_FOREACH(const uint256& hash, vHashIn) {
+        std::map<uint256, CWalletTx>::iterator mi = mapWallet.find(hash);
+        if (mi != mapWallet.end()) {
+            wtxOrdered.insert(make_pair(mi->second.nOrderPos, TxPair(&mi->second, (CAccountingEntry*)0)));
+            UpdateTxHeightIndex(mi->second);
+        }
+    }
     if (nZapSelectTxRet == DB_NEED_REWRITE)
     {
         if (CDB::Rewrite(strWalletFile, "\x04pool"))
@@ -2708,26 +3234,49 @@ bool CWallet::NewKeyPool()
 {
     {
         LOCK(cs_wallet);
-        CWalletDB walletdb(strWalletFile);
-        BOOST_FOREACH(int64_t nIndex, setKeyPool)
-            walletdb.ErasePool(nIndex);
+        {
+            CWalletDB walletdb(strWalletFile);
+            BOOST_FOREACH(int64_t nIndex, setKeyPool)
+                walletdb.ErasePool(nIndex);
+        }
         setKeyPool.clear();
 
         if (IsLocked())
             return false;
 
         int64_t nKeys = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t)0);
-        for (int i = 0; i < nKeys; i++)
-        {
-            int64_t nIndex = i+1;
-            walletdb.WritePool(nIndex, CKeyPool(GenerateNewKey()));
-            setKeyPool.insert(nIndex);
-        }
+        FillKeyPool(nKeys);
         LogPrintf("CWallet::NewKeyPool wrote %d new keys\n", nKeys);
     }
     return true;
 }
 
+void CWallet::FillKeyPool(unsigned int nSize)
+{
+    AssertLockHeld(cs_wallet); // setKeyPool
+    while (setKeyPool.size() < nSize)
+    {
+        // Keys in the pool get handed out, so they have to be on disk first.
+        // Nested in an outer batch, all keys would wait for its commit, in a
+        // single BDB transaction, so top up before opening one.
+        assert(!fFileBacked || CDBWriteBatch::GetTxn(strWalletFile) == NULL);
+        CDBWriteBatch batch(fFileBacked ? strWalletFile : std::string(), true);
+        CWalletDB walletdb(strWalletFile);
+
+        std::vector<CPubKey> vPubKeys;
+        GenerateNewKeys(std::min<size_t>(nSize - setKeyPool.size(), WALLET_KEYPOOL_BATCH_KEYS), vPubKeys);
+        int64_t nEnd = 1;
+        if (!setKeyPool.empty())
+            nEnd = *(--setKeyPool.end()) + 1;
+        BOOST_FOREACH(const CPubKey& pubkey, vPubKeys) {
+            if (fFileBacked && !walletdb.WritePool(nEnd, CKeyPool(pubkey)))
+                throw runtime_error(std::string(__func__) + ": writing generated key failed");
+            setKeyPool.insert(nEnd++);
+        }
+        LogPrintf("keypool added %u keys, size=%u\n", vPubKeys.size(), setKeyPool.size());
+    }
+}
+
 bool CWallet::TopUpKeyPool(unsigned int kpSize)
 {
     {
@@ -2736,8 +3285,6 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         if (IsLocked())
             return false;
 
-        CWalletDB walletdb(strWalletFile);
-
         // Top up key pool
         unsigned int nTargetSize;
         if (kpSize > 0)
@@ -2745,16 +3292,7 @@ bool CWallet::TopUpKeyPool(unsigned int kpSize)
         else
             nTargetSize = max(GetArg("-keypool", DEFAULT_KEYPOOL_SIZE), (int64_t) 0);
 
-        while (setKeyPool.size() < (nTargetSize + 1))
-        {
-            int64_t nEnd = 1;
-            if (!setKeyPool.empty())
-                nEnd = *(--setKeyPool.end()) + 1;
-            if (!walletdb.WritePool(nEnd, CKeyPool(GenerateNewKey())))
-                throw runtime_error(std::string(__func__) + ": writing generated key failed");
-            setKeyPool.insert(nEnd);
-            LogPrintf("keypool added key %d, size=%u\n", nEnd, setKeyPool.size());
-        }
+        FillKeyPool(nTargetSize + 1);
     }
     return true;
 }
@@ -3293,6 +3831,7 @@ std::string CWallet::GetWalletHelpString(bool showDebug)
         strUsage += HelpMessageOpt("-dblogsize=<n>", strprintf("Flush wallet database activity from memory to disk log every <n> megabytes (default: %u)", DEFAULT_WALLET_DBLOGSIZE));
         strUsage += HelpMessageOpt("-flushwallet", strprintf("Run a thread to flush wallet periodically (default: %u)", DEFAULT_FLUSHWALLET));
         strUsage += HelpMessageOpt("-privdb", strprintf("Sets the DB_PRIVATE flag in the wallet db environment (default: %u)", DEFAULT_WALLET_PRIVDB));
+        strUsage += HelpMessageOpt("-walletflushinterval=<n>", strprintf("Sync committed wallet database writes to disk every <n> milliseconds (default: %u)", DEFAULT_WALLET_FLUSH_INTERVAL));
         strUsage += HelpMessageOpt("-walletrejectlongchains", strprintf(_("Wallet will not create transactions that violate mempool chain limits (default: %u"), DEFAULT_WALLET_REJECT_LONG_CHAINS));
     }
 
@@ -3411,7 +3950,7 @@ bool CWallet::InitLoadWallet()
         //We can't rescan beyond non-pruned blocks, stop and throw an error
         //this might happen if a user uses a old wallet within a pruned node
         // or if he ran -disablewallet for a longer time, then decided to re-enable
-        if (fPruneMode)
+        if (fPruneMode || fHavePruned)
         {
             CBlockIndex *block = chainActive.Tip();
             while (block && block->pprev && (block->pprev->nStatus & BLOCK_HAVE_DATA) && block->pprev->nTx > 0 && pindexRescan != block)
@@ -3426,7 +3965,8 @@ bool CWallet::InitLoadWallet()
         nStart = GetTimeMillis();
         walletInstance->ScanForWalletTransactions(pindexRescan, true);
         LogPrintf(" rescan      %15dms\n", GetTimeMillis() - nStart);
-        walletInstance->SetBestChain(chainActive.GetLocator());
+        if (!ShutdownRequested())
+            walletInstance->SetBestChain(chainActive.GetLocator());
         nWalletDBUpdated++;
 
         // Restore wallet transaction metadata after -zapwallettxes=1
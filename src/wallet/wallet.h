@@ -18,6 +18,8 @@
 #include "wallet/rpcwallet.h"
 
 #include <algorithm>
+#include <atomic>
+#include <limits>
 #include <map>
 #include <set>
 #include <stdexcept>
@@ -61,15 +63,25 @@ static const bool DEFAULT_WALLETBROADCAST = true;
 
 //! if set, all keys will be derived by using BIP32
 static const bool DEFAULT_USE_HD_WALLET = true;
+//! Number of blocks a rescan reads ahead on the wallet check threads
+static const unsigned int WALLET_SCAN_BATCH_BLOCKS = 64;
+//! Number of keys a keypool top-up generates and commits at a time
+static const unsigned int WALLET_KEYPOOL_BATCH_KEYS = 1000;
+//! Where CWallet::wtxByHeight keeps transactions that are in no block of the active chain
+static const int TX_HEIGHT_UNCONFIRMED = std::numeric_limits<int>::max();
 
 extern const char * DEFAULT_WALLET_DAT;
 
+/** Run an instance of the wallet check thread, used by rescans and keypool top-ups */
+void ThreadWalletCheck();
+
 class CBlockIndex;
 class CCoinControl;
 class COutput;
 class CReserveKey;
 class CScript;
 class CTxMemPool;
+class CWalletScanKeys;
 class CWalletTx;
 
 /** (client) version numbers for particular wallet features */
@@ -241,6 +253,7 @@ public:
     int64_t nOrderPos; //!< position in ordered transaction list
 
     // memory only
+    int nIndexedHeight; //!< height CWallet::wtxByHeight has it under, -1 if none
     mutable bool fDebitCached;
     mutable bool fCreditCached;
     mutable bool fImmatureCreditCached;
@@ -309,6 +322,7 @@ public:
         nImmatureWatchCreditCached = 0;
         nChangeCached = 0;
         nOrderPos = -1;
+        nIndexedHeight = -1;
     }
 
     ADD_SERIALIZE_METHODS;
@@ -575,6 +589,26 @@ private:
     void AddToSpends(const COutPoint& outpoint, const uint256& wtxid);
     void AddToSpends(const uint256& wtxid);
 
+    /**
+     * Our outputs that no wallet transaction spends for sure, so the balances
+     * and AvailableCoins only look at these instead of the whole history. A
+     * spend by an abandoned transaction, or one marked conflicted, may or may
+     * not count depending on the chain, so outputs spent only by those stay
+     * in; readers still check IsSpent.
+     */
+    std::set<COutPoint> setWalletUTXO;
+    /** Add outpoint to or remove it from setWalletUTXO according to its current spends */
+    void UpdateWalletUTXO(const COutPoint& outpoint);
+    /** Update setWalletUTXO for the outputs of wtx and the outputs it spends */
+    void UpdateWalletUTXO(const CWalletTx& wtx);
+    /** The transactions with outputs in setWalletUTXO */
+    std::vector<const CWalletTx*> GetWalletUTXOTxs() const;
+
+    /** Move wtx to where it belongs in wtxByHeight, or add it there */
+    void UpdateTxHeightIndex(CWalletTx& wtx);
+    /** Take wtx out of wtxOrdered and wtxByHeight */
+    void UnindexTx(CWalletTx& wtx);
+
     /* Mark a transaction (and its in-wallet descendants) as conflicting with a particular block. */
     void MarkConflicted(const uint256& hashBlock, const uint256& hashTx);
 
@@ -583,6 +617,23 @@ private:
     /* the HD chain data model (external chain counters) */
     CHDChain hdChain;
 
+    /**
+     * Whether ScanForWalletTransactions is running, since when (in
+     * milliseconds) and how far along it is, from 0 to 1. Set without
+     * cs_wallet, which a rescan only holds while committing blocks.
+     */
+    std::atomic<bool> fScanningWallet;
+    std::atomic<int64_t> nScanningStartTime;
+    std::atomic<double> dScanningProgress;
+
+    /** Copy what IsMine needs of the keystore into keys, for the wallet scan checks */
+    void GetScanKeys(CWalletScanKeys& keys) const;
+
+    /** Stop watching the scripts of a key that is now in the keystore */
+    void RemoveWatchOnlyKey(const CPubKey& pubkey);
+    /** Add keys to the key pool until it holds nSize, in synced write batches of WALLET_KEYPOOL_BATCH_KEYS */
+    void FillKeyPool(unsigned int nSize);
+
 public:
     /*
      * Main wallet lock.
@@ -634,6 +685,9 @@ public:
         nLastResend = 0;
         nTimeFirstKey = 0;
         fBroadcastTransactions = false;
+        fScanningWallet = false;
+        nScanningStartTime = 0;
+        dScanningProgress = 0;
     }
 
     std::map<uint256, CWalletTx> mapWallet;
@@ -643,6 +697,17 @@ public:
     typedef std::multimap<int64_t, TxPair > TxItems;
     TxItems wtxOrdered;
 
+    /**
+     * Transactions by the height of the active chain block they are in,
+     * then by nOrderPos, so listsinceblock can start at a height. Those in
+     * no active chain block, conflicted and abandoned ones included, are
+     * under TX_HEIGHT_UNCONFIRMED. Built from the stored transactions on
+     * load, and kept up by AddToWallet as blocks are connected and
+     * disconnected.
+     */
+    typedef std::multimap<std::pair<int, int64_t>, CWalletTx*> TxHeightItems;
+    TxHeightItems wtxByHeight;
+
     int64_t nOrderPosNext;
     std::map<uint256, int> mapRequestCount;
 
@@ -685,6 +750,12 @@ public:
      * Generate a new key
      */
     CPubKey GenerateNewKey();
+    /**
+     * Generate nKeys new keys into vPubKeys. Making or deriving them, and
+     * encrypting them for an encrypted wallet, runs on the key generation
+     * check threads; they are then added to the wallet in one write batch.
+     */
+    void GenerateNewKeys(unsigned int nKeys, std::vector<CPubKey>& vPubKeys);
     //! Adds a key to the store, and saves it to disk.
     bool AddKeyPubKey(const CKey& key, const CPubKey &pubkey);
     //! Adds a key to the store, without saving it to disk (used by LoadWallet)
@@ -734,7 +805,19 @@ public:
     bool AddToWallet(const CWalletTx& wtxIn, bool fFromLoadWallet, CWalletDB* pwalletdb);
     void SyncTransaction(const CTransaction& tx, const CBlockIndex *pindex, const CBlock* pblock);
     bool AddToWalletIfInvolvingMe(const CTransaction& tx, const CBlock* pblock, bool fUpdate);
+    /**
+     * Scan the active chain from pindexStart for transactions involving the
+     * wallet. Blocks are read and matched against the wallet's keys on the
+     * wallet check threads; cs_main and cs_wallet are only taken to
+     * commit what they found, so callers should not hold them. Progress is
+     * saved as the wallet's best block, so a rescan cut short by shutdown
+     * picks up from there on the next start. Returns the number of
+     * transactions added or updated, or -1 if a rescan was already running.
+     */
     int ScanForWalletTransactions(CBlockIndex* pindexStart, bool fUpdate = false);
+    bool IsScanning() const { return fScanningWallet; }
+    /** If a rescan is running, get how long it has been running in milliseconds and its progress */
+    bool GetScanningProgress(int64_t& nDurationRet, double& dProgressRet) const;
     void ReacceptWalletTransactions();
     void ResendWalletTransactions(int64_t nBestBlockTime);
     std::vector<uint256> ResendWalletTransactionsBefore(int64_t nTime);
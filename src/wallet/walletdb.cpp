@@ -863,12 +863,22 @@ void ThreadFlushWalletDB(const string& strFile)
     if (!GetBoolArg("-flushwallet", DEFAULT_FLUSHWALLET))
         return;
 
+    int64_t nFlushInterval = std::max<int64_t>(GetArg("-walletflushinterval", DEFAULT_WALLET_FLUSH_INTERVAL), 1);
     unsigned int nLastSeen = nWalletDBUpdated;
     unsigned int nLastFlushed = nWalletDBUpdated;
+    unsigned int nLastSynced = nWalletDBUpdated;
     int64_t nLastWalletUpdate = GetTime();
     while (true)
     {
-        MilliSleep(500);
+        MilliSleep(nFlushInterval);
+
+        // Group commit: one log sync makes every transaction committed
+        // since the last pass durable
+        if (nLastSynced != nWalletDBUpdated)
+        {
+            nLastSynced = nWalletDBUpdated;
+            bitdb.FlushLog();
+        }
 
         if (nLastSeen != nWalletDBUpdated)
         {
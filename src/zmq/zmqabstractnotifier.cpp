@@ -20,3 +20,8 @@ bool CZMQAbstractNotifier::NotifyTransaction(const CTransaction &/*transaction*/
 {
     return true;
 }
+
+bool CZMQAbstractNotifier::NotifyTransactionComment(const CTransaction &/*transaction*/, int /*nHeight*/)
+{
+    return true;
+}
@@ -34,6 +34,8 @@ public:
 
     virtual bool NotifyBlock(const CBlockIndex *pindex);
     virtual bool NotifyTransaction(const CTransaction &transaction);
+    /** Called for commented transactions entering the mempool (nHeight -1) or a connected block */
+    virtual bool NotifyTransactionComment(const CTransaction &transaction, int nHeight);
 
 protected:
     void *psocket;
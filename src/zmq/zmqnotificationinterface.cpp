@@ -39,6 +39,7 @@ CZMQNotificationInterface* CZMQNotificationInterface::CreateWithArguments(const
     factories["pubhashtx"] = CZMQAbstractNotifier::Create<CZMQPublishHashTransactionNotifier>;
     factories["pubrawblock"] = CZMQAbstractNotifier::Create<CZMQPublishRawBlockNotifier>;
     factories["pubrawtx"] = CZMQAbstractNotifier::Create<CZMQPublishRawTransactionNotifier>;
+    factories["pubtxcomment"] = CZMQAbstractNotifier::Create<CZMQPublishTransactionCommentNotifier>;
 
     for (std::map<std::string, CZMQNotifierFactory>::const_iterator i=factories.begin(); i!=factories.end(); ++i)
     {
@@ -143,10 +144,14 @@ void CZMQNotificationInterface::UpdatedBlockTip(const CBlockIndex *pindex)
 
 void CZMQNotificationInterface::SyncTransaction(const CTransaction& tx, const CBlockIndex* pindex, const CBlock* pblock)
 {
+    // Comments are only published on mempool acceptance (no block) and block connection (with block)
+    bool fComment = !tx.strTxComment.empty() && (pindex == NULL || pblock != NULL);
+    int nHeight = pblock ? pindex->nHeight : -1;
+
     for (std::list<CZMQAbstractNotifier*>::iterator i = notifiers.begin(); i!=notifiers.end(); )
     {
         CZMQAbstractNotifier *notifier = *i;
-        if (notifier->NotifyTransaction(tx))
+        if (notifier->NotifyTransaction(tx) && (!fComment || notifier->NotifyTransactionComment(tx, nHeight)))
         {
             i++;
         }
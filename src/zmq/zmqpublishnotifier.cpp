@@ -3,6 +3,7 @@
 // file COPYING or http://www.opensource.org/licenses/mit-license.php.
 
 #include "chainparams.h"
+#include "crypto/common.h"
 #include "zmqpublishnotifier.h"
 #include "main.h"
 #include "util.h"
@@ -14,6 +15,7 @@ static const char *MSG_HASHBLOCK = "hashblock";
 static const char *MSG_HASHTX    = "hashtx";
 static const char *MSG_RAWBLOCK  = "rawblock";
 static const char *MSG_RAWTX     = "rawtx";
+static const char *MSG_TXCOMMENT = "txcomment";
 
 // Internal function to send multipart message
 static int zmq_send_multipart(void *sock, const void* data, size_t size, ...)
@@ -190,3 +192,16 @@ bool CZMQPublishRawTransactionNotifier::NotifyTransaction(const CTransaction &tr
     ss << transaction;
     return SendMessage(MSG_RAWTX, &(*ss.begin()), ss.size());
 }
+
+bool CZMQPublishTransactionCommentNotifier::NotifyTransactionComment(const CTransaction &transaction, int nHeight)
+{
+    uint256 hash = transaction.GetHash();
+    LogPrint("zmq", "zmq: Publish txcomment %s at height %d\n", hash.GetHex(), nHeight);
+    // 32-byte txid (in RPC byte order), 4-byte little endian height, then the raw comment
+    std::vector<unsigned char> data(32 + 4 + transaction.strTxComment.size());
+    for (unsigned int i = 0; i < 32; i++)
+        data[31 - i] = hash.begin()[i];
+    WriteLE32(&data[32], nHeight);
+    std::copy(transaction.strTxComment.begin(), transaction.strTxComment.end(), data.begin() + 36);
+    return SendMessage(MSG_TXCOMMENT, &data[0], data.size());
+}
@@ -52,4 +52,10 @@ public:
     bool NotifyTransaction(const CTransaction &transaction);
 };
 
+class CZMQPublishTransactionCommentNotifier : public CZMQAbstractPublishNotifier
+{
+public:
+    bool NotifyTransactionComment(const CTransaction &transaction, int nHeight);
+};
+
 #endif // BITCOIN_ZMQ_ZMQPUBLISHNOTIFIER_H